@@ -0,0 +1,27 @@
+##*****************************************************************************
+#  SYNOPSIS:
+#    AC_LIBCRYPTO
+#
+#  DESCRIPTION:
+#    Check for OpenSSL's libcrypto, which does the cryptography of the
+#    RMCP+ sessions of ipmi devices.  If found, define HAVE_LIBCRYPTO,
+#    substitute LIBCRYPTO with -lcrypto, and set WITH_LIBCRYPTO for
+#    automake.
+#
+#  WARNINGS:
+#    This macro must be placed after AC_PROG_CC or equivalent.
+##*****************************************************************************
+
+AC_DEFUN([AC_LIBCRYPTO],
+[
+  AC_CHECK_HEADER([openssl/evp.h], [
+    AC_CHECK_LIB([crypto], [EVP_CIPHER_CTX_new], [LIBCRYPTO=-lcrypto])
+  ])
+
+  if test -n "$LIBCRYPTO"; then
+    AC_DEFINE([HAVE_LIBCRYPTO], [1], [Define if you have OpenSSL libcrypto])
+  fi
+
+  AC_SUBST(LIBCRYPTO)
+  AM_CONDITIONAL(WITH_LIBCRYPTO, [test -n "$LIBCRYPTO"])
+])
@@ -0,0 +1,26 @@
+##*****************************************************************************
+#  SYNOPSIS:
+#    AC_CURL_MULTI
+#
+#  DESCRIPTION:
+#    Check for a libcurl with the multi socket interface and the URL API
+#    (7.62 or later), which powermand needs for http devices.  If found,
+#    define HAVE_LIBCURL_MULTI and substitute LIBCURL_MULTI with -lcurl.
+#
+#  WARNINGS:
+#    This macro must be placed after AC_PROG_CC or equivalent.
+##*****************************************************************************
+
+AC_DEFUN([AC_CURL_MULTI],
+[
+  AC_CHECK_HEADER([curl/curl.h], [
+    AC_CHECK_LIB([curl], [curl_url_set], [LIBCURL_MULTI=-lcurl])
+  ])
+
+  if test -n "$LIBCURL_MULTI"; then
+    AC_DEFINE([HAVE_LIBCURL_MULTI], [1],
+              [Define if libcurl can run http devices in powermand])
+  fi
+
+  AC_SUBST(LIBCURL_MULTI)
+])
@@ -41,9 +41,36 @@
 #include "error.h"
 #include "argv.h"
 
+/* Most requests in one multiget/multipost batch.
+ */
+#define MULTI_MAX_REQUESTS      32
+
+/* Most connections a batch opens to one server.  Embedded web servers
+ * often serve only a few clients at a time; requests beyond this wait for
+ * a connection to be free and reuse it.
+ */
+#define MULTI_MAX_HOST_CONNS    4
+
+/* A slot for one request of a batch.  Handles are kept between batches
+ * so their settings need not be rebuilt, and the connections they made
+ * stay in the multi handle's cache for the next batch to reuse.
+ */
+typedef struct {
+    CURL *h;
+    char *url;
+    char *body;                 /* response body */
+    int len;
+    int size;
+    bool done;
+    CURLcode result;
+    char errbuf[CURL_ERROR_SIZE];
+} Request;
+
 static char *url = NULL;
 static char *userpwd = NULL;
 static char errbuf[CURL_ERROR_SIZE];
+static CURLM *mh = NULL;
+static Request reqs[MULTI_MAX_REQUESTS];
 
 #define OPTIONS "u:"
 static struct option longopts[] = {
@@ -58,6 +85,8 @@ void help(void)
     printf("  seturl url\n");
     printf("  get [url]\n");
     printf("  post [url] key=val[&key=val]...\n");
+    printf("  multiget url [url]...\n");
+    printf("  multipost url key=val[&key=val]... [url key=val...]...\n");
 }
 
 char *
@@ -113,6 +142,199 @@ void get(CURL *h, char **av)
         xfree(myurl);
 }
 
+static size_t _write_body(char *ptr, size_t size, size_t nmemb, void *arg)
+{
+    Request *r = (Request *)arg;
+    int n = size * nmemb;
+
+    if (r->len + n > r->size) {
+        r->size = r->len + n + 1024;
+        r->body = r->body ? xrealloc(r->body, r->size) : xmalloc(r->size);
+    }
+    memcpy(r->body + r->len, ptr, n);
+    r->len += n;
+    return n;
+}
+
+/* Expand the first range in str, e.g. "[1-3,5]=ON", into one string per
+ * number.  A string without a range is returned as is.  Returns NULL if
+ * the range is malformed.
+ */
+static char **_expand(char *str)
+{
+    char **res = argv_create("", "");
+    char *open = strchr(str, '[');
+    char *close = open ? strchr(open, ']') : NULL;
+    char *p, *end, *tmp;
+    unsigned long lo, hi;
+    int count = 0;
+
+    if (open == NULL)
+        return argv_append(res, str);
+    if (close == NULL)
+        goto bad;
+    p = open + 1;
+    while (p < close) {
+        lo = hi = strtoul(p, &end, 10);
+        if (end == p)
+            goto bad;
+        if (*end == '-') {
+            p = end + 1;
+            hi = strtoul(p, &end, 10);
+            if (end == p || hi < lo)
+                goto bad;
+        }
+        if (end != close && *end != ',')
+            goto bad;
+        for (; lo <= hi; lo++) {
+            if (++count > MULTI_MAX_REQUESTS)
+                goto bad;
+            tmp = xmalloc(strlen(str) + 32);
+            sprintf(tmp, "%.*s%lu%s", (int)(open - str), str, lo, close + 1);
+            res = argv_append(res, tmp);
+            xfree(tmp);
+        }
+        p = end + 1;
+    }
+    if (count > 0)
+        return res;
+bad:
+    argv_destroy(res);
+    return NULL;
+}
+
+/* Set up the next free slot to GET or POST (if postdata is non-NULL)
+ * the URL with the suffix str.  Returns FALSE if the batch is full.
+ */
+static bool _add_request(int *n, char *str, char *postdata)
+{
+    Request *r;
+
+    if (*n == MULTI_MAX_REQUESTS)
+        return FALSE;
+    r = &reqs[(*n)++];
+    if (r->h == NULL) {
+        if ((r->h = curl_easy_init()) == NULL)
+            err_exit(FALSE, "curl_easy_init failed");
+        curl_easy_setopt(r->h, CURLOPT_TIMEOUT, 5);
+        curl_easy_setopt(r->h, CURLOPT_ERRORBUFFER, r->errbuf);
+        curl_easy_setopt(r->h, CURLOPT_FAILONERROR, 1);
+        curl_easy_setopt(r->h, CURLOPT_WRITEFUNCTION, _write_body);
+        curl_easy_setopt(r->h, CURLOPT_WRITEDATA, r);
+    }
+    if (userpwd) {
+        curl_easy_setopt(r->h, CURLOPT_USERPWD, userpwd);
+        curl_easy_setopt(r->h, CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
+    }
+    r->url = _make_url(str);
+    r->len = 0;
+    r->done = FALSE;
+    r->result = CURLE_OK;
+    r->errbuf[0] = '\0';
+    curl_easy_setopt(r->h, CURLOPT_URL, r->url);
+    if (postdata)
+        curl_easy_setopt(r->h, CURLOPT_COPYPOSTFIELDS, postdata);
+    else
+        curl_easy_setopt(r->h, CURLOPT_HTTPGET, 1L);
+    return TRUE;
+}
+
+/* Run requests 0 to n-1 concurrently and print their responses in order,
+ * each framed by "begin <i> <url>" and "end <i> OK" or "end <i> Error: ...".
+ */
+static void _run_requests(int n)
+{
+    CURLMcode mc = CURLM_OK;
+    CURLMsg *msg;
+    int running, left, i;
+
+    for (i = 0; i < n; i++)
+        curl_multi_add_handle(mh, reqs[i].h);
+    do {
+        mc = curl_multi_perform(mh, &running);
+        if (mc == CURLM_OK && running > 0)
+            mc = curl_multi_wait(mh, NULL, 0, 1000, NULL);
+    } while (mc == CURLM_OK && running > 0);
+    while ((msg = curl_multi_info_read(mh, &left))) {
+        if (msg->msg != CURLMSG_DONE)
+            continue;
+        for (i = 0; i < n; i++) {
+            if (reqs[i].h == msg->easy_handle) {
+                reqs[i].done = TRUE;
+                reqs[i].result = msg->data.result;
+            }
+        }
+    }
+    for (i = 0; i < n; i++) {
+        Request *r = &reqs[i];
+
+        curl_multi_remove_handle(mh, r->h);
+        printf("begin %d %s\n", i + 1, r->url);
+        if (r->len > 0) {
+            fwrite(r->body, 1, r->len, stdout);
+            if (r->body[r->len - 1] != '\n')
+                printf("\n");
+        }
+        if (!r->done)
+            printf("end %d Error: %s\n", i + 1, mc != CURLM_OK
+                   ? curl_multi_strerror(mc) : "not completed");
+        else if (r->result != CURLE_OK)
+            printf("end %d Error: %s\n", i + 1, r->errbuf[0] ? r->errbuf
+                   : curl_easy_strerror(r->result));
+        else
+            printf("end %d OK\n", i + 1);
+        xfree(r->url);
+        r->url = NULL;
+    }
+}
+
+/* multiget url [url]...
+ * multipost url data [url data]...
+ * A range in a url or data, e.g. "outlet [1-3]=ON", expands to one
+ * request per number, so ranged scripts can be written with %s.
+ */
+void multi(CURL *h, char **av, bool post)
+{
+    int per = post ? 2 : 1;
+    int ac = argv_length(av);
+    int n = 0;
+    int i, j;
+
+    if (ac == 0 || ac % per != 0) {
+        if (post)
+            printf("Usage: multipost url key=val[&key=val]... [...]\n");
+        else
+            printf("Usage: multiget url [url]...\n");
+        return;
+    }
+    for (i = 0; i < ac; i += per) {
+        char *data = post ? av[i + 1] : NULL;
+        bool inurl = (data == NULL || strchr(av[i], '[') != NULL);
+        char **ex = _expand(inurl ? av[i] : data);
+
+        if (ex == NULL) {
+            printf("Bad range: %s\n", inurl ? av[i] : data);
+            goto done;
+        }
+        for (j = 0; ex[j] != NULL; j++) {
+            if (!_add_request(&n, inurl ? ex[j] : av[i],
+                              inurl ? data : ex[j])) {
+                printf("Too many requests (max %d)\n", MULTI_MAX_REQUESTS);
+                argv_destroy(ex);
+                goto done;
+            }
+        }
+        argv_destroy(ex);
+    }
+    _run_requests(n);
+    return;
+done:
+    for (i = 0; i < n; i++) {
+        xfree(reqs[i].url);
+        reqs[i].url = NULL;
+    }
+}
+
 void seturl(CURL *h, char **av)
 {
     if (av[0] == NULL) {
@@ -154,6 +376,10 @@ int docmd(CURL *h, char **av)
             get(h, av + 1);
         else if (strcmp(av[0], "post") == 0)
             post(h, av + 1);
+        else if (strcmp(av[0], "multiget") == 0)
+            multi(h, av + 1, FALSE);
+        else if (strcmp(av[0], "multipost") == 0)
+            multi(h, av + 1, TRUE);
         else
             printf("type \"help\" for a list of commands\n");
     }
@@ -162,7 +388,7 @@ int docmd(CURL *h, char **av)
 
 void shell(CURL *h)
 {
-    char buf[128];
+    char buf[1024];
     char **av;
     int rc = 0;
 
@@ -215,8 +441,20 @@ main(int argc, char *argv[])
     curl_easy_setopt(h, CURLOPT_ERRORBUFFER, errbuf);
     curl_easy_setopt(h, CURLOPT_FAILONERROR, 1);
 
+    if ((mh = curl_multi_init()) == NULL)
+        err_exit(FALSE, "curl_multi_init failed");
+    curl_multi_setopt(mh, CURLMOPT_MAX_HOST_CONNECTIONS,
+                      (long)MULTI_MAX_HOST_CONNS);
+
     shell(h);
 
+    for (c = 0; c < MULTI_MAX_REQUESTS; c++) {
+        if (reqs[c].h)
+            curl_easy_cleanup(reqs[c].h);
+        if (reqs[c].body)
+            xfree(reqs[c].body);
+    }
+    curl_multi_cleanup(mh);
     curl_easy_cleanup(h);    	
     if (userpwd)
         xfree(userpwd);
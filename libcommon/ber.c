@@ -0,0 +1,518 @@
+/*****************************************************************************
+ *  Copyright (C) 2026 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  UCRL-CODE-2002-008.
+ *
+ *  This file is part of PowerMan, a remote power management program.
+ *  For details, see http://code.google.com/p/powerman/
+ *
+ *  PowerMan is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PowerMan is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PowerMan; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/*
+ * A minimal BER codec for SNMP messages.  Only definite lengths and
+ * single byte tags are supported, which is all SNMP needs.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "xmalloc.h"
+#include "ber.h"
+
+#define BER_CHUNK   256
+
+void ber_init(BerBuf *b)
+{
+    b->size = BER_CHUNK;
+    b->data = (unsigned char *)xmalloc(b->size);
+    b->len = 0;
+}
+
+void ber_free(BerBuf *b)
+{
+    xfree(b->data);
+    b->data = NULL;
+    b->len = b->size = 0;
+}
+
+static void _reserve(BerBuf *b, int n)
+{
+    if (b->len + n > b->size) {
+        while (b->len + n > b->size)
+            b->size += BER_CHUNK;
+        b->data = (unsigned char *)xrealloc((char *)b->data, b->size);
+    }
+}
+
+/* Encode a length into buf (at least 5 bytes), returning bytes used.
+ */
+static int _encode_len(unsigned char *buf, int len)
+{
+    int n = 0, i;
+
+    if (len < 0x80) {
+        buf[0] = len;
+        return 1;
+    }
+    for (i = len; i > 0; i >>= 8)
+        n++;
+    buf[0] = 0x80 | n;
+    for (i = n; i > 0; i--, len >>= 8)
+        buf[i] = len & 0xff;
+    return n + 1;
+}
+
+void ber_put_str(BerBuf *b, int tag, const void *str, int len)
+{
+    unsigned char hdr[6];
+    int n;
+
+    hdr[0] = tag;
+    n = _encode_len(hdr + 1, len) + 1;
+    _reserve(b, n + len);
+    memcpy(b->data + b->len, hdr, n);
+    memcpy(b->data + b->len + n, str, len);
+    b->len += n + len;
+}
+
+void ber_put_int(BerBuf *b, int tag, long val)
+{
+    unsigned char tmp[sizeof(long)];
+    unsigned char out[sizeof(long)];
+    int n = 0, i;
+
+    /* least significant byte first, stop when the rest is sign extension */
+    do {
+        tmp[n++] = val & 0xff;
+        val >>= 8;
+    } while (n < sizeof(long) && !((val == 0 && !(tmp[n - 1] & 0x80))
+                                || (val == -1 && (tmp[n - 1] & 0x80))));
+    for (i = 0; i < n; i++)
+        out[i] = tmp[n - 1 - i];
+    ber_put_str(b, tag, out, n);
+}
+
+void ber_put_uint(BerBuf *b, int tag, unsigned long val)
+{
+    unsigned char tmp[sizeof(long) + 1];
+    unsigned char out[sizeof(long) + 1];
+    int n = 0, i;
+
+    do {
+        tmp[n++] = val & 0xff;
+        val >>= 8;
+    } while (val != 0);
+    if (tmp[n - 1] & 0x80)
+        tmp[n++] = 0;               /* keep it positive */
+    for (i = 0; i < n; i++)
+        out[i] = tmp[n - 1 - i];
+    ber_put_str(b, tag, out, n);
+}
+
+/* Base-128 digits needed for the largest sub-identifier.
+ */
+#define BER_SUB_MAX     ((sizeof(unsigned long) * 8 + 6) / 7)
+
+int ber_put_oid(BerBuf *b, const char *oid)
+{
+    unsigned long sub[BER_MAX_STR / 2];
+    unsigned char out[BER_MAX_STR / 2 * BER_SUB_MAX];
+    const char *p = oid;
+    char *end;
+    int nsub = 0, n = 0, i, k;
+
+    if (*p == '.')
+        p++;
+    while (*p) {
+        if (!isdigit((unsigned char)*p) || nsub == BER_MAX_STR / 2)
+            return -1;
+        errno = 0;
+        sub[nsub++] = strtoul(p, &end, 10);
+        if (errno == ERANGE)
+            return -1;
+        p = end;
+        if (*p == '.' && isdigit((unsigned char)p[1]))
+            p++;
+        else if (*p != '\0')
+            return -1;
+    }
+    if (nsub < 2 || sub[0] > 2 || (sub[0] < 2 && sub[1] > 39)
+                 || sub[1] > ULONG_MAX - 80)
+        return -1;
+    sub[1] += sub[0] * 40;
+    for (i = 1; i < nsub; i++) {
+        unsigned char tmp[BER_SUB_MAX];
+        unsigned long v = sub[i];
+
+        k = 0;
+        do {
+            tmp[k++] = v & 0x7f;
+            v >>= 7;
+        } while (v != 0);
+        while (k > 1) {
+            k--;
+            out[n++] = tmp[k] | 0x80;
+        }
+        out[n++] = tmp[0];
+    }
+    ber_put_str(b, BER_OID, out, n);
+    return 0;
+}
+
+void ber_wrap(BerBuf *b, int tag, int start)
+{
+    unsigned char hdr[6];
+    int len = b->len - start;
+    int n;
+
+    hdr[0] = tag;
+    n = _encode_len(hdr + 1, len) + 1;
+    _reserve(b, n);
+    memmove(b->data + start + n, b->data + start, len);
+    memcpy(b->data + start, hdr, n);
+    b->len += n;
+}
+
+int ber_put_varbind(BerBuf *b, const char *oid, char type, const char *val)
+{
+    int start = b->len;
+    char *end;
+
+    if (ber_put_oid(b, oid) < 0)
+        goto bad;
+    switch (type) {
+    case 0:
+        ber_put_str(b, BER_NULL, "", 0);
+        break;
+    case 'i':
+        ber_put_int(b, BER_INTEGER, strtol(val, &end, 10));
+        if (*val == '\0' || *end != '\0')
+            goto bad;
+        break;
+    case 'u':
+    case 't':
+        ber_put_uint(b, type == 'u' ? BER_GAUGE32 : BER_TIMETICKS,
+                     strtoul(val, &end, 10));
+        if (*val == '\0' || *end != '\0')
+            goto bad;
+        break;
+    case 's':
+        ber_put_str(b, BER_OCTET_STRING, val, strlen(val));
+        break;
+    case 'a': {
+        unsigned int a[4];
+        unsigned char ip[4];
+        int i;
+
+        if (sscanf(val, "%u.%u.%u.%u", &a[0], &a[1], &a[2], &a[3]) != 4)
+            goto bad;
+        for (i = 0; i < 4; i++)
+            ip[i] = a[i];
+        ber_put_str(b, BER_IPADDRESS, ip, 4);
+        break;
+    }
+    case 'o':
+        if (ber_put_oid(b, val) < 0)
+            goto bad;
+        break;
+    default:
+        goto bad;
+    }
+    ber_wrap(b, BER_SEQUENCE, start);
+    return 0;
+bad:
+    b->len = start;
+    return -1;
+}
+
+int ber_get(const unsigned char **p, int *len, int *tag,
+            const unsigned char **val, int *vlen)
+{
+    const unsigned char *q = *p;
+    int left = *len;
+    int l, n;
+
+    if (left < 2 || (q[0] & 0x1f) == 0x1f)
+        return -1;
+    *tag = q[0];
+    l = q[1];
+    q += 2;
+    left -= 2;
+    if (l & 0x80) {
+        n = l & 0x7f;
+        if (n == 0 || n > 3 || n > left)
+            return -1;
+        for (l = 0; n > 0; n--, left--)
+            l = (l << 8) | *q++;
+    }
+    if (l > left)
+        return -1;
+    *val = q;
+    *vlen = l;
+    *p = q + l;
+    *len = left - l;
+    return 0;
+}
+
+long ber_int(const unsigned char *val, int vlen)
+{
+    long v = (vlen > 0 && (val[0] & 0x80)) ? -1 : 0;
+    int i;
+
+    for (i = 0; i < vlen; i++)
+        v = (v << 8) | val[i];
+    return v;
+}
+
+unsigned long ber_uint(const unsigned char *val, int vlen)
+{
+    unsigned long v = 0;
+    int i;
+
+    for (i = 0; i < vlen; i++)
+        v = (v << 8) | val[i];
+    return v;
+}
+
+int ber_oid_str(const unsigned char *val, int vlen, char *buf, int size)
+{
+    unsigned long v = 0;
+    int i, n = 0;
+    int first = 1;
+
+    if (vlen < 1)
+        return -1;
+    for (i = 0; i < vlen; i++) {
+        if (v > (ULONG_MAX >> 7))
+            return -1;              /* sub-identifier too big */
+        v = (v << 7) | (val[i] & 0x7f);
+        if (val[i] & 0x80)
+            continue;
+        if (first) {
+            int a = v < 40 ? 0 : v < 80 ? 1 : 2;
+
+            n += snprintf(buf + n, size > n ? size - n : 0, "%d.%lu",
+                          a, v - a * 40);
+            first = 0;
+        } else
+            n += snprintf(buf + n, size > n ? size - n : 0, ".%lu", v);
+        v = 0;
+    }
+    if ((val[vlen - 1] & 0x80) || n >= size)
+        return -1;
+    return 0;
+}
+
+int ber_value_str(int tag, const unsigned char *val, int vlen,
+                  char *buf, int size)
+{
+    int i, n;
+
+    switch (tag) {
+    case BER_INTEGER:
+        snprintf(buf, size, "%ld", ber_int(val, vlen));
+        break;
+    case BER_COUNTER32:
+    case BER_GAUGE32:
+    case BER_TIMETICKS:
+    case BER_COUNTER64:
+        snprintf(buf, size, "%lu", ber_uint(val, vlen));
+        break;
+    case BER_OCTET_STRING:
+        for (i = 0, n = 0; i < vlen && n < size - 1; i++)
+            buf[n++] = isprint(val[i]) ? val[i] : '.';
+        buf[n] = '\0';
+        break;
+    case BER_OID:
+        return ber_oid_str(val, vlen, buf, size);
+    case BER_IPADDRESS:
+        if (vlen != 4)
+            return -1;
+        snprintf(buf, size, "%d.%d.%d.%d", val[0], val[1], val[2], val[3]);
+        break;
+    case BER_NULL:
+        snprintf(buf, size, "NULL");
+        break;
+    case BER_NOSUCHOBJECT:
+        snprintf(buf, size, "noSuchObject");
+        break;
+    case BER_NOSUCHINSTANCE:
+        snprintf(buf, size, "noSuchInstance");
+        break;
+    case BER_ENDOFMIBVIEW:
+        snprintf(buf, size, "endOfMibView");
+        break;
+    default:
+        snprintf(buf, size, "type 0x%x", tag);
+        break;
+    }
+    return 0;
+}
+
+void snmp_encode(BerBuf *msg, int version, const char *community, int type,
+                 long reqid, long err, long idx, BerBuf *vbl)
+{
+    int start = msg->len;
+    int pdu;
+
+    ber_put_int(msg, BER_INTEGER, version);
+    ber_put_str(msg, BER_OCTET_STRING, community, strlen(community));
+    pdu = msg->len;
+    ber_put_int(msg, BER_INTEGER, reqid);
+    ber_put_int(msg, BER_INTEGER, err);
+    ber_put_int(msg, BER_INTEGER, idx);
+    ber_put_str(msg, BER_SEQUENCE, vbl->data, vbl->len);
+    ber_wrap(msg, type, pdu);
+    ber_wrap(msg, BER_SEQUENCE, start);
+}
+
+int snmp_decode(const unsigned char *buf, int len, int *version,
+                char *community, int csize, int *type, long *reqid,
+                long *err, long *idx, const unsigned char **vbl, int *vblen)
+{
+    const unsigned char *val;
+    int vlen, tag;
+
+    if (ber_get(&buf, &len, &tag, &val, &vlen) < 0 || tag != BER_SEQUENCE)
+        return -1;
+    buf = val;
+    len = vlen;
+    if (ber_get(&buf, &len, &tag, &val, &vlen) < 0 || tag != BER_INTEGER)
+        return -1;
+    *version = ber_int(val, vlen);
+    if (ber_get(&buf, &len, &tag, &val, &vlen) < 0
+            || tag != BER_OCTET_STRING || vlen >= csize)
+        return -1;
+    memcpy(community, val, vlen);
+    community[vlen] = '\0';
+    if (ber_get(&buf, &len, type, &val, &vlen) < 0)
+        return -1;
+    buf = val;
+    len = vlen;
+    if (ber_get(&buf, &len, &tag, &val, &vlen) < 0 || tag != BER_INTEGER)
+        return -1;
+    *reqid = ber_int(val, vlen);
+    if (ber_get(&buf, &len, &tag, &val, &vlen) < 0 || tag != BER_INTEGER)
+        return -1;
+    *err = ber_int(val, vlen);
+    if (ber_get(&buf, &len, &tag, &val, &vlen) < 0 || tag != BER_INTEGER)
+        return -1;
+    *idx = ber_int(val, vlen);
+    if (ber_get(&buf, &len, &tag, vbl, vblen) < 0 || tag != BER_SEQUENCE)
+        return -1;
+    return 0;
+}
+
+int snmp_decode_trap1(const unsigned char *buf, int len, char *community,
+                      int csize, char *trapoid, unsigned long *uptime,
+                      const unsigned char **vbl, int *vblen)
+{
+    char enterprise[BER_MAX_STR];
+    const unsigned char *val;
+    int vlen, tag;
+    long generic, specific;
+
+    if (ber_get(&buf, &len, &tag, &val, &vlen) < 0 || tag != BER_SEQUENCE)
+        return -1;
+    buf = val;
+    len = vlen;
+    if (ber_get(&buf, &len, &tag, &val, &vlen) < 0 || tag != BER_INTEGER
+            || ber_int(val, vlen) != SNMP_V1)
+        return -1;
+    if (ber_get(&buf, &len, &tag, &val, &vlen) < 0
+            || tag != BER_OCTET_STRING || vlen >= csize)
+        return -1;
+    memcpy(community, val, vlen);
+    community[vlen] = '\0';
+    if (ber_get(&buf, &len, &tag, &val, &vlen) < 0 || tag != SNMP_TRAP)
+        return -1;
+    buf = val;
+    len = vlen;
+    if (ber_get(&buf, &len, &tag, &val, &vlen) < 0 || tag != BER_OID
+            || ber_oid_str(val, vlen, enterprise, sizeof(enterprise)) < 0)
+        return -1;
+    if (ber_get(&buf, &len, &tag, &val, &vlen) < 0 || tag != BER_IPADDRESS)
+        return -1;                                  /* agent-addr */
+    if (ber_get(&buf, &len, &tag, &val, &vlen) < 0 || tag != BER_INTEGER)
+        return -1;
+    generic = ber_int(val, vlen);
+    if (ber_get(&buf, &len, &tag, &val, &vlen) < 0 || tag != BER_INTEGER)
+        return -1;
+    specific = ber_int(val, vlen);
+    if (ber_get(&buf, &len, &tag, &val, &vlen) < 0 || tag != BER_TIMETICKS)
+        return -1;
+    *uptime = ber_uint(val, vlen);
+    if (ber_get(&buf, &len, &tag, vbl, vblen) < 0 || tag != BER_SEQUENCE)
+        return -1;
+
+    /* enterpriseSpecific traps are enterprise.0.specific; the generic
+     * ones (coldStart etc.) live under snmpTraps.
+     */
+    if (generic == 6) {
+        if (strlen(enterprise) + 24 > BER_MAX_STR)
+            return -1;
+        sprintf(trapoid, "%s.0.%ld", enterprise, specific);
+    } else if (generic >= 0 && generic < 6)
+        sprintf(trapoid, "1.3.6.1.6.3.1.1.5.%ld", generic + 1);
+    else
+        return -1;
+    return 0;
+}
+
+int snmp_next_varbind(const unsigned char **vbl, int *vblen, char *oid,
+                      int *tag, char *val)
+{
+    const unsigned char *p, *v;
+    int len, vlen, t;
+
+    if (*vblen == 0)
+        return 0;
+    if (ber_get(vbl, vblen, &t, &p, &len) < 0 || t != BER_SEQUENCE)
+        return -1;
+    if (ber_get(&p, &len, &t, &v, &vlen) < 0 || t != BER_OID
+            || ber_oid_str(v, vlen, oid, BER_MAX_STR) < 0)
+        return -1;
+    if (ber_get(&p, &len, tag, &v, &vlen) < 0
+            || ber_value_str(*tag, v, vlen, val, BER_MAX_STR) < 0)
+        return -1;
+    return 1;
+}
+
+const char *snmp_strerror(long err)
+{
+    static const char *names[] = {
+        "noError", "tooBig", "noSuchName", "badValue", "readOnly",
+        "genErr", "noAccess", "wrongType", "wrongLength", "wrongEncoding",
+        "wrongValue", "noCreation", "inconsistentValue",
+        "resourceUnavailable", "commitFailed", "undoFailed",
+        "authorizationError", "notWritable", "inconsistentName",
+    };
+
+    if (err < 0 || err >= sizeof(names) / sizeof(names[0]))
+        return "unknown error";
+    return names[err];
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,114 @@
+#ifndef PM_BER_H
+#define PM_BER_H
+
+/*
+ * Basic Encoding Rules for the subset of SNMP (RFC 1157, RFC 3416) that
+ * powerman uses: community based messages carrying varbind lists.
+ */
+
+/* universal and SNMP application tags */
+#define BER_INTEGER         0x02
+#define BER_OCTET_STRING    0x04
+#define BER_NULL            0x05
+#define BER_OID             0x06
+#define BER_SEQUENCE        0x30
+#define BER_IPADDRESS       0x40
+#define BER_COUNTER32       0x41
+#define BER_GAUGE32         0x42
+#define BER_TIMETICKS       0x43
+#define BER_COUNTER64       0x46
+#define BER_NOSUCHOBJECT    0x80
+#define BER_NOSUCHINSTANCE  0x81
+#define BER_ENDOFMIBVIEW    0x82
+
+/* PDU types */
+#define SNMP_GET            0xa0
+#define SNMP_GETNEXT        0xa1
+#define SNMP_RESPONSE       0xa2
+#define SNMP_SET            0xa3
+#define SNMP_GETBULK        0xa5
+#define SNMP_TRAP           0xa4    /* SNMPv1 Trap-PDU */
+#define SNMP_INFORM         0xa6
+#define SNMP_TRAP2          0xa7    /* SNMPv2-Trap-PDU */
+
+#define SNMP_V1             0
+#define SNMP_V2C            1
+
+/* longest OID or value string produced by the decoders */
+#define BER_MAX_STR         256
+
+/* An encoding in progress. */
+typedef struct {
+    unsigned char *data;
+    int len;
+    int size;
+} BerBuf;
+
+void ber_init(BerBuf *b);
+void ber_free(BerBuf *b);
+
+/* Append an element.  ber_put_oid() takes dotted decimal, e.g. "1.3.6.1",
+ * and returns -1 if the OID is malformed.  ber_wrap() turns everything
+ * appended since offset start into the contents of a constructed element.
+ */
+void ber_put_int(BerBuf *b, int tag, long val);
+void ber_put_uint(BerBuf *b, int tag, unsigned long val);
+void ber_put_str(BerBuf *b, int tag, const void *str, int len);
+int ber_put_oid(BerBuf *b, const char *oid);
+void ber_wrap(BerBuf *b, int tag, int start);
+
+/* Append a varbind to a varbind list.  type is a net-snmp style type
+ * letter ('i', 'u', 's', 't', 'a', 'o'), or 0 for a NULL value.
+ * Returns -1 if the OID or value is malformed.
+ */
+int ber_put_varbind(BerBuf *b, const char *oid, char type, const char *val);
+
+/* Get the next element from *p, which has *len bytes left, and advance
+ * past it.  Returns -1 if the encoding is malformed or truncated.
+ */
+int ber_get(const unsigned char **p, int *len, int *tag,
+            const unsigned char **val, int *vlen);
+long ber_int(const unsigned char *val, int vlen);
+unsigned long ber_uint(const unsigned char *val, int vlen);
+
+/* Format an OID or a value as text.  Return -1 if malformed.
+ */
+int ber_oid_str(const unsigned char *val, int vlen, char *buf, int size);
+int ber_value_str(int tag, const unsigned char *val, int vlen,
+                  char *buf, int size);
+
+/* Encode an SNMP message with varbind list contents vbl.  For GETBULK,
+ * err and idx are non-repeaters and max-repetitions.
+ */
+void snmp_encode(BerBuf *msg, int version, const char *community, int type,
+                 long reqid, long err, long idx, BerBuf *vbl);
+
+/* Decode an SNMP message, leaving *vbl pointing at the contents of its
+ * varbind list.  Returns -1 if it is malformed.
+ */
+int snmp_decode(const unsigned char *buf, int len, int *version,
+                char *community, int csize, int *type, long *reqid,
+                long *err, long *idx, const unsigned char **vbl, int *vblen);
+
+/* Decode an SNMPv1 trap message.  The enterprise, generic and specific
+ * trap fields are folded into a trap OID as in RFC 3584 (section 3.1),
+ * e.g. "1.3.6.1.4.1.318.0.268", and *uptime is its time-stamp.  Returns -1
+ * if it is malformed or not a v1 trap.
+ */
+int snmp_decode_trap1(const unsigned char *buf, int len, char *community,
+                      int csize, char *trapoid, unsigned long *uptime,
+                      const unsigned char **vbl, int *vblen);
+
+/* Get the next varbind from a varbind list, as text.  Returns 0 at the
+ * end of the list, 1 if a varbind was read, -1 if it is malformed.
+ */
+int snmp_next_varbind(const unsigned char **vbl, int *vblen, char *oid,
+                      int *tag, char *val);
+
+const char *snmp_strerror(long err);
+
+#endif /* PM_BER_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
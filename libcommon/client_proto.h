@@ -9,9 +9,21 @@
  * 4. client sends command
  * 5. server sends response (see note under Responses below)
  * If not quit, goto 3
+ *
+ * A request line ending in CP_CONTINUE is joined with the next line
+ * (minus the CP_CONTINUE character and line break) before it is processed,
+ * so a request with a large hostlist may span several lines.  No prompt is
+ * sent between continuation lines.
+ *
+ * After CP_WATCH, the server may send CP_INFO_WATCH lines at any time
+ * (between responses) reporting the current state of watched nodes whose
+ * power state has changed.  Changes are coalesced per node while the
+ * client is slow to read them, so only the latest state is reported.
  */
 
 #define CP_LINEMAX  8192                /* max request/response line length */
+#define CP_REQMAX   (1024*1024)         /* max request length w/continuation */
+#define CP_CONTINUE '\\'                /* request continuation character */
 #define CP_EOL      "\r\n"              /* line terminator */
 #define CP_PROMPT   "powerman> "        /* prompt */
 #define CP_VERSION  "001 %s" CP_EOL
@@ -38,6 +50,10 @@
 #define CP_BEACON_OFF "unflash %s"
 #define CP_TELEMETRY  "telemetry"
 #define CP_EXPRANGE   "exprange"
+#define CP_BINARY     "binary"
+#define CP_WATCH      "watch %s"
+#define CP_WATCH_ALL  "watch"
+#define CP_UNWATCH    "unwatch"
 
 /*
  * Responses -
@@ -57,6 +73,8 @@
 #define CP_RSP_QRY_COMPLETE "103 Query complete"                    CP_EOL
 #define CP_RSP_TELEMETRY    "104 Telemetry %s"                      CP_EOL
 #define CP_RSP_EXPRANGE     "105 Hostrange expansion %s"            CP_EOL
+#define CP_RSP_BINARY       "106 Binary protocol enabled"           CP_EOL
+#define CP_RSP_WATCH        "107 Watch %s"                          CP_EOL
 
 /* failure 2xx */
 #define CP_ERR_UNKNOWN      "201 Unknown command"                   CP_EOL
@@ -85,6 +103,9 @@
  "301 unflash <nodes>    - set beacon to OFF (if available)"        CP_EOL \
  "301 telemetry          - toggle telemetry display"                CP_EOL \
  "301 exprange           - toggle host range expansion"             CP_EOL \
+ "301 binary             - switch to binary protocol"               CP_EOL \
+ "301 watch [<nodes>]    - report power state changes"              CP_EOL \
+ "301 unwatch            - stop reporting power state changes"      CP_EOL \
  "301 help               - display help"                            CP_EOL \
  "301 quit               - logout"                                  CP_EOL
 #define CP_INFO_STATUS \
@@ -98,6 +119,83 @@
 #define CP_INFO_NODES       "306 %s"                                CP_EOL
 #define CP_INFO_XNODES      "307 %s"                                CP_EOL
 #define CP_INFO_ACTERROR    "308 %s"                                CP_EOL
+#define CP_INFO_WATCH       "309 %s: %s"                            CP_EOL
+
+/*
+ * Binary protocol -
+ * A client may switch a connection to binary framing by sending CP_BINARY.
+ * The server responds with CP_RSP_BINARY and a prompt, and from then
+ * on requests and responses are frames consisting of a CPB_HDRLEN byte
+ * header and a payload:
+ *   bytes 0-3  payload length
+ *   byte  4    opcode
+ *   byte  5    target type (requests only, else 0)
+ *   bytes 6-7  response code, same as the text protocol (responses only)
+ * Integers are unsigned, in network byte order.  Frames are limited to
+ * CPB_FRAMEMAX bytes including the header.
+ *
+ * A request is one frame.  Its target is either all nodes (no payload),
+ * a hostlist string (not NUL terminated), or an array of 32-bit node IDs.
+ * Node IDs are positions in the node list returned by CPB_OP_NODES.
+ * Requests are executed in order; a client may send a request before the
+ * previous one has completed.
+ *
+ * The response to a request is zero or more data/info frames followed by
+ * one CPB_RSP_DONE frame carrying the 1xx/2xx code.  The payload of a
+ * CPB_RSP_DONE or CPB_RSP_INFO frame is the message text of the equivalent
+ * text protocol response (without code or CP_EOL).  Data frame payloads:
+ *   CPB_RSP_NODES   NUL terminated node names, in node ID order
+ *   CPB_RSP_STATES  5 bytes per node: node ID, state (CPB_STATE_*)
+ *   CPB_RSP_VALUES  per node: node ID, NUL terminated value string
+ *
+ * CPB_OP_WATCH and CPB_OP_UNWATCH are the binary equivalents of CP_WATCH
+ * and CP_UNWATCH.  While watching, the server may send CPB_RSP_CHANGED
+ * frames at any time (between responses) in place of CP_INFO_WATCH lines.
+ * Their payload is the same as CPB_RSP_STATES, in node ID order.
+ */
+#define CPB_HDRLEN          8
+#define CPB_FRAMEMAX        CP_REQMAX
+
+/* request opcodes */
+#define CPB_OP_QUIT         1
+#define CPB_OP_NODES        2
+#define CPB_OP_STATUS       3
+#define CPB_OP_ON           4
+#define CPB_OP_OFF          5
+#define CPB_OP_CYCLE        6
+#define CPB_OP_RESET        7
+#define CPB_OP_BEACON       8
+#define CPB_OP_FLASH        9
+#define CPB_OP_UNFLASH      10
+#define CPB_OP_TEMP         11
+#define CPB_OP_WATCH        12
+#define CPB_OP_UNWATCH      13
+
+/* request target types */
+#define CPB_TARG_ALL        0
+#define CPB_TARG_HOSTLIST   1
+#define CPB_TARG_NODEID     2
+
+/* response opcodes */
+#define CPB_RSP_DONE        128
+#define CPB_RSP_INFO        129
+#define CPB_RSP_NODES       130
+#define CPB_RSP_STATES      131
+#define CPB_RSP_VALUES      132
+#define CPB_RSP_CHANGED     133
+
+/* CPB_RSP_STATES and CPB_RSP_CHANGED values */
+#define CPB_STATE_UNKNOWN   0
+#define CPB_STATE_OFF       1
+#define CPB_STATE_ON        2
+
+#define CPB_GET16(p)        (((p)[0] << 8) | (p)[1])
+#define CPB_GET32(p)        (((unsigned long)(p)[0] << 24) | ((p)[1] << 16) \
+                             | ((p)[2] << 8) | (p)[3])
+#define CPB_PUT16(p, v)     ((p)[0] = ((v) >> 8) & 0xff, (p)[1] = (v) & 0xff)
+#define CPB_PUT32(p, v)     ((p)[0] = ((v) >> 24) & 0xff, \
+                             (p)[1] = ((v) >> 16) & 0xff, \
+                             (p)[2] = ((v) >> 8) & 0xff, (p)[3] = (v) & 0xff)
 
 #endif  /* PM_CLIENT_PROTO_H */
 
@@ -4,6 +4,7 @@
 #define DAEMON_NAME         "powermand"
 #define DFLT_PORT           "10101"
 #define DFLT_HOSTNAME       "127.0.0.1"
+#define UNIX_PREFIX         "unix:"     /* unix domain socket address */
 
 #endif /* PM_POWERMAN_H */
 
@@ -0,0 +1,373 @@
+/*****************************************************************************
+ *  Copyright (C) 2026 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  UCRL-CODE-2002-008.
+ *
+ *  This file is part of PowerMan, a remote power management program.
+ *  For details, see http://code.google.com/p/powerman/
+ *
+ *  PowerMan is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PowerMan is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PowerMan; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/*
+ * RMCP+ packet codec (IPMI v2.0 section 13).  A session packet is
+ *
+ *   RMCP header      version 6, sequence 0xff (no ack), class IPMI
+ *   session header   auth type 6, payload type, session ID, sequence,
+ *                    payload length
+ *   payload          with AES-CBC-128: IV, then the encrypted payload
+ *                    followed by its confidentiality trailer
+ *   session trailer  with HMAC-SHA1-96 only: integrity pad, pad length,
+ *                    next header, AuthCode over everything from the
+ *                    session header on
+ *
+ * Multi-byte fields are little endian.
+ *
+ * The cryptography (HMAC-SHA1, AES-128-CBC and random numbers) is done
+ * by OpenSSL's libcrypto.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+#include "xtypes.h"
+#include "error.h"
+#include "rmcp.h"
+
+#define RMCP_HDR_LEN        4
+#define RMCP_SESSION_LEN    12      /* session header, after RMCP header */
+#define RMCP_AUTH_RMCPPLUS  0x06
+#define RMCP_ENCRYPTED      0x80
+#define RMCP_AUTHENTICATED  0x40
+#define RMCP_NEXT_HEADER    0x07
+
+void rmcp_put32(unsigned char *p, unsigned long val)
+{
+    p[0] = val & 0xff;
+    p[1] = (val >> 8) & 0xff;
+    p[2] = (val >> 16) & 0xff;
+    p[3] = (val >> 24) & 0xff;
+}
+
+unsigned long rmcp_get32(const unsigned char *p)
+{
+    return (unsigned long)p[0] | ((unsigned long)p[1] << 8)
+         | ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+/* Challenges and IVs must not be guessable, so there is no falling back
+ * to a weaker generator.
+ */
+void rmcp_random(unsigned char *buf, int len)
+{
+    if (RAND_bytes(buf, len) != 1)
+        err_exit(FALSE, "rmcp_random: no random numbers available");
+}
+
+int rmcp_equal(const unsigned char *a, const unsigned char *b, int len)
+{
+    return CRYPTO_memcmp(a, b, len) == 0;
+}
+
+/* Compute HMAC-SHA1 of data with key into digest (SHA1_LEN bytes).
+ */
+static void _hmac_sha1(const void *key, int keylen, const void *data,
+                       int len, unsigned char *digest)
+{
+    unsigned int n = SHA1_LEN;
+
+    if (!HMAC(EVP_sha1(), key, keylen, data, len, digest, &n))
+        err_exit(FALSE, "HMAC-SHA1 failed");
+}
+
+/* Encrypt (enc = 1) or decrypt (enc = 0) len bytes, a multiple of
+ * AES_BLOCK_LEN, with AES-128 in CBC mode.
+ */
+static void _aes_cbc(const unsigned char *key, const unsigned char *iv,
+                     const unsigned char *in, unsigned char *out, int len,
+                     int enc)
+{
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    int n = 0, m = 0;
+
+    if (!ctx || !EVP_CipherInit_ex(ctx, EVP_aes_128_cbc(), NULL, key, iv, enc)
+             || !EVP_CIPHER_CTX_set_padding(ctx, 0)
+             || !EVP_CipherUpdate(ctx, out, &n, in, len)
+             || !EVP_CipherFinal_ex(ctx, out + n, &m) || n + m != len)
+        err_exit(FALSE, "AES-CBC-128 failed");
+    EVP_CIPHER_CTX_free(ctx);
+}
+
+/* Append the user name fields shared by the RAKP authentication codes.
+ */
+static int _put_role_user(unsigned char *p, const RmcpAuth *a)
+{
+    int ulen = strlen(a->user);
+
+    p[0] = a->rolem;
+    p[1] = ulen;
+    memcpy(p + 2, a->user, ulen);
+    return 2 + ulen;
+}
+
+/* HMAC(Kuid, SIDm, SIDc, Rm, Rc, GUIDc, ROLEm, ULENGTHm, UNAMEm) */
+void rmcp_rakp2_hmac(const RmcpAuth *a, unsigned char *hmac)
+{
+    unsigned char buf[128];
+    int n = 0;
+
+    rmcp_put32(buf, a->sidm);
+    rmcp_put32(buf + 4, a->sidc);
+    n = 8;
+    memcpy(buf + n, a->rm, RMCP_RAND_LEN);
+    n += RMCP_RAND_LEN;
+    memcpy(buf + n, a->rc, RMCP_RAND_LEN);
+    n += RMCP_RAND_LEN;
+    memcpy(buf + n, a->guidc, RMCP_GUID_LEN);
+    n += RMCP_GUID_LEN;
+    n += _put_role_user(buf + n, a);
+    _hmac_sha1(a->passwd, strlen(a->passwd), buf, n, hmac);
+}
+
+/* HMAC(Kuid, Rc, SIDm, ROLEm, ULENGTHm, UNAMEm) */
+void rmcp_rakp3_hmac(const RmcpAuth *a, unsigned char *hmac)
+{
+    unsigned char buf[128];
+    int n = 0;
+
+    memcpy(buf, a->rc, RMCP_RAND_LEN);
+    n = RMCP_RAND_LEN;
+    rmcp_put32(buf + n, a->sidm);
+    n += 4;
+    n += _put_role_user(buf + n, a);
+    _hmac_sha1(a->passwd, strlen(a->passwd), buf, n, hmac);
+}
+
+/* SIK = HMAC(Kg, Rm, Rc, ROLEm, ULENGTHm, UNAMEm), with Kg = Kuid as no
+ * BMC key is configured; K1 and K2 are HMAC(SIK, const 1 or 2).
+ */
+void rmcp_keys(const RmcpAuth *a, int integrity, int confidentiality,
+               RmcpKeys *k)
+{
+    unsigned char buf[128], k2[SHA1_LEN];
+    int n;
+
+    memcpy(buf, a->rm, RMCP_RAND_LEN);
+    memcpy(buf + RMCP_RAND_LEN, a->rc, RMCP_RAND_LEN);
+    n = 2 * RMCP_RAND_LEN;
+    n += _put_role_user(buf + n, a);
+    _hmac_sha1(a->passwd, strlen(a->passwd), buf, n, k->sik);
+
+    memset(buf, 0x01, SHA1_LEN);
+    _hmac_sha1(k->sik, SHA1_LEN, buf, SHA1_LEN, k->k1);
+    memset(buf, 0x02, SHA1_LEN);
+    _hmac_sha1(k->sik, SHA1_LEN, buf, SHA1_LEN, k2);
+    memcpy(k->k2, k2, AES_KEY_LEN);
+
+    k->integrity = integrity;
+    k->confidentiality = confidentiality;
+}
+
+/* HMAC(SIK, Rm, SIDc, GUIDc), truncated */
+void rmcp_rakp4_icv(const RmcpAuth *a, const RmcpKeys *k,
+                    unsigned char *icv)
+{
+    unsigned char buf[64], hmac[SHA1_LEN];
+
+    memcpy(buf, a->rm, RMCP_RAND_LEN);
+    rmcp_put32(buf + RMCP_RAND_LEN, a->sidc);
+    memcpy(buf + RMCP_RAND_LEN + 4, a->guidc, RMCP_GUID_LEN);
+    _hmac_sha1(k->sik, SHA1_LEN, buf, RMCP_RAND_LEN + 4 + RMCP_GUID_LEN,
+               hmac);
+    memcpy(icv, hmac, RMCP_AUTHCODE_LEN);
+}
+
+int rmcp_encode(unsigned char *buf, int type, unsigned long sid,
+                unsigned long seq, const unsigned char *payload, int len,
+                const RmcpKeys *keys)
+{
+    unsigned char *p = buf + RMCP_HDR_LEN + RMCP_SESSION_LEN;
+    int plen = len;
+
+    if (len > RMCP_MAX_PAYLOAD)
+        return -1;
+
+    buf[0] = 0x06;
+    buf[1] = 0x00;
+    buf[2] = 0xff;
+    buf[3] = 0x07;
+    buf[4] = RMCP_AUTH_RMCPPLUS;
+    buf[5] = type;
+    rmcp_put32(buf + 6, sid);
+    rmcp_put32(buf + 10, seq);
+
+    if (keys && keys->confidentiality == RMCP_CONF_AES_CBC_128) {
+        unsigned char tmp[RMCP_MAX_PAYLOAD + AES_BLOCK_LEN];
+        int pad = AES_BLOCK_LEN - (len + 1) % AES_BLOCK_LEN;
+        int i;
+
+        if (pad == AES_BLOCK_LEN)
+            pad = 0;
+        memcpy(tmp, payload, len);
+        for (i = 0; i < pad; i++)
+            tmp[len + i] = i + 1;
+        tmp[len + pad] = pad;
+        plen = len + pad + 1;
+
+        rmcp_random(p, AES_BLOCK_LEN);
+        _aes_cbc(keys->k2, p, tmp, p + AES_BLOCK_LEN, plen, 1);
+        plen += AES_BLOCK_LEN;
+        buf[5] |= RMCP_ENCRYPTED;
+    } else
+        memcpy(p, payload, len);
+    buf[14] = plen & 0xff;
+    buf[15] = (plen >> 8) & 0xff;
+    p += plen;
+
+    if (keys && keys->integrity == RMCP_INTEG_HMAC_SHA1_96) {
+        unsigned char hmac[SHA1_LEN];
+        int pad = (4 - (p - buf - RMCP_HDR_LEN + 2) % 4) % 4;
+
+        buf[5] |= RMCP_AUTHENTICATED;
+        memset(p, 0xff, pad);
+        p += pad;
+        *p++ = pad;
+        *p++ = RMCP_NEXT_HEADER;
+        _hmac_sha1(keys->k1, SHA1_LEN, buf + RMCP_HDR_LEN,
+                   p - buf - RMCP_HDR_LEN, hmac);
+        memcpy(p, hmac, RMCP_AUTHCODE_LEN);
+        p += RMCP_AUTHCODE_LEN;
+    }
+    return p - buf;
+}
+
+int rmcp_header(const unsigned char *buf, int len, int *type,
+                unsigned long *sid)
+{
+    if (len < RMCP_HDR_LEN + RMCP_SESSION_LEN || buf[0] != 0x06
+            || buf[3] != 0x07 || (buf[4] & 0x0f) != RMCP_AUTH_RMCPPLUS)
+        return -1;
+    *type = buf[5] & 0x3f;
+    *sid = rmcp_get32(buf + 6);
+    return 0;
+}
+
+int rmcp_decode(const unsigned char *buf, int len, const RmcpKeys *keys,
+                unsigned long *seq, unsigned char *payload, int size)
+{
+    const unsigned char *p = buf + RMCP_HDR_LEN + RMCP_SESSION_LEN;
+    int authenticated = (buf[5] & RMCP_AUTHENTICATED) != 0;
+    int encrypted = (buf[5] & RMCP_ENCRYPTED) != 0;
+    int plen;
+
+    if (len < RMCP_HDR_LEN + RMCP_SESSION_LEN)
+        return -1;
+    plen = buf[14] | (buf[15] << 8);
+    if (plen > len - RMCP_HDR_LEN - RMCP_SESSION_LEN)
+        return -1;
+    *seq = rmcp_get32(buf + 10);
+
+    /* protection must be exactly what the session negotiated */
+    if (authenticated != (keys && keys->integrity != RMCP_INTEG_NONE))
+        return -1;
+    if (encrypted != (keys && keys->confidentiality != RMCP_CONF_NONE))
+        return -1;
+
+    if (authenticated) {
+        unsigned char hmac[SHA1_LEN];
+        int n = len - RMCP_AUTHCODE_LEN;    /* end of the signed part */
+        int pad = n - 2 - (p + plen - buf);
+
+        if (pad < 0 || pad > 3 || buf[n - 2] != pad
+                || buf[n - 1] != RMCP_NEXT_HEADER)
+            return -1;
+        _hmac_sha1(keys->k1, SHA1_LEN, buf + RMCP_HDR_LEN, n - RMCP_HDR_LEN,
+                   hmac);
+        if (!rmcp_equal(hmac, buf + n, RMCP_AUTHCODE_LEN))
+            return -1;
+    }
+
+    if (encrypted) {
+        unsigned char tmp[RMCP_MAX_MSG];
+        int pad;
+
+        plen -= AES_BLOCK_LEN;
+        if (plen <= 0 || plen % AES_BLOCK_LEN != 0 || plen > RMCP_MAX_MSG)
+            return -1;
+        _aes_cbc(keys->k2, p, p + AES_BLOCK_LEN, tmp, plen, 0);
+        pad = tmp[plen - 1];
+        if (pad + 1 > plen)
+            return -1;
+        plen -= pad + 1;
+        if (plen > size)
+            return -1;
+        memcpy(payload, tmp, plen);
+    } else {
+        if (plen > size)
+            return -1;
+        memcpy(payload, p, plen);
+    }
+    return plen;
+}
+
+int ipmi_encode(unsigned char *buf, int to, int netfn, int from, int seq,
+                int cmd, const unsigned char *data, int len)
+{
+    unsigned char sum = 0;
+    int i;
+
+    buf[0] = to;
+    buf[1] = netfn << 2;
+    buf[2] = -(buf[0] + buf[1]);
+    buf[3] = from;
+    buf[4] = (seq & 0x3f) << 2;
+    buf[5] = cmd;
+    memcpy(buf + 6, data, len);
+    for (i = 3; i < 6 + len; i++)
+        sum += buf[i];
+    buf[6 + len] = -sum;
+    return 7 + len;
+}
+
+int ipmi_decode(const unsigned char *buf, int len, int *netfn, int *seq,
+                int *cmd, const unsigned char **data, int *dlen)
+{
+    unsigned char sum = 0;
+    int i;
+
+    if (len < 7 || ((buf[0] + buf[1] + buf[2]) & 0xff) != 0)
+        return -1;
+    for (i = 3; i < len; i++)
+        sum += buf[i];
+    if (sum != 0)
+        return -1;
+    *netfn = buf[1] >> 2;
+    *seq = buf[4] >> 2;
+    *cmd = buf[5];
+    *data = buf + 6;
+    *dlen = len - 7;
+    return 0;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
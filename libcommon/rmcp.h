@@ -0,0 +1,151 @@
+#ifndef PM_RMCP_H
+#define PM_RMCP_H
+
+/*
+ * RMCP+ (IPMI v2.0 over LAN) session packets and the IPMI messages they
+ * carry.  Cipher suites 1-3 are supported: RAKP-HMAC-SHA1 authentication,
+ * optionally with HMAC-SHA1-96 integrity and AES-CBC-128 confidentiality.
+ */
+
+#define RMCP_PORT               "623"
+
+/* HMAC-SHA1 digest, AES-128 block and key sizes */
+#define SHA1_LEN                20
+#define AES_BLOCK_LEN           16
+#define AES_KEY_LEN             16
+
+/* payload types */
+#define RMCP_PAYLOAD_IPMI       0x00
+#define RMCP_PAYLOAD_OPEN_REQ   0x10
+#define RMCP_PAYLOAD_OPEN_RSP   0x11
+#define RMCP_PAYLOAD_RAKP1      0x12
+#define RMCP_PAYLOAD_RAKP2      0x13
+#define RMCP_PAYLOAD_RAKP3      0x14
+#define RMCP_PAYLOAD_RAKP4      0x15
+
+/* algorithms proposed in the Open Session Request */
+#define RMCP_AUTH_HMAC_SHA1     0x01
+#define RMCP_INTEG_NONE         0x00
+#define RMCP_INTEG_HMAC_SHA1_96 0x01
+#define RMCP_CONF_NONE          0x00
+#define RMCP_CONF_AES_CBC_128   0x01
+
+/* privilege levels (RAKP 1 may add the name-only lookup bit) */
+#define IPMI_PRIV_USER          0x02
+#define IPMI_PRIV_OPERATOR      0x03
+#define IPMI_PRIV_ADMIN         0x04
+#define IPMI_NAME_ONLY_LOOKUP   0x10
+
+/* network functions and commands */
+#define IPMI_NETFN_CHASSIS      0x00
+#define IPMI_NETFN_APP          0x06
+#define IPMI_GET_CHASSIS_STATUS 0x01
+#define IPMI_CHASSIS_CONTROL    0x02
+#define IPMI_CHASSIS_IDENTIFY   0x04
+#define IPMI_SET_SESSION_PRIV   0x3b
+#define IPMI_CLOSE_SESSION      0x3c
+
+/* Chassis Control request data */
+#define IPMI_CHASSIS_DOWN       0x00
+#define IPMI_CHASSIS_UP         0x01
+#define IPMI_CHASSIS_CYCLE      0x02
+#define IPMI_CHASSIS_RESET      0x03
+
+/* IPMB addresses of the BMC and of remote console software */
+#define IPMI_BMC_ADDR           0x20
+#define IPMI_REMOTE_ADDR        0x81
+
+#define RMCP_MAX_PAYLOAD        256
+#define RMCP_MAX_MSG            512
+#define RMCP_MAX_USER           16
+#define RMCP_MAX_PASSWD         20
+#define RMCP_RAND_LEN           16
+#define RMCP_GUID_LEN           16
+#define RMCP_AUTHCODE_LEN       12      /* HMAC-SHA1-96 */
+
+/* What both ends learn during the RAKP exchange, named as in the IPMI v2.0
+ * spec: m is the remote console and c is the managed system (the BMC).
+ */
+typedef struct {
+    unsigned long sidm;
+    unsigned long sidc;
+    unsigned char rm[RMCP_RAND_LEN];
+    unsigned char rc[RMCP_RAND_LEN];
+    unsigned char guidc[RMCP_GUID_LEN];
+    int rolem;                          /* requested role byte of RAKP 1 */
+    char user[RMCP_MAX_USER + 1];
+    char passwd[RMCP_MAX_PASSWD + 1];   /* Kuid (and Kg) */
+} RmcpAuth;
+
+/* The keys of an established session.
+ */
+typedef struct {
+    int integrity;                      /* RMCP_INTEG_* */
+    int confidentiality;                /* RMCP_CONF_* */
+    unsigned char sik[SHA1_LEN];
+    unsigned char k1[SHA1_LEN];
+    unsigned char k2[AES_KEY_LEN];      /* first bytes of K2 */
+} RmcpKeys;
+
+/* Key exchange authentication codes (SHA1_LEN bytes), session keys, and
+ * the RAKP 4 integrity check value (RMCP_AUTHCODE_LEN bytes).
+ */
+void rmcp_rakp2_hmac(const RmcpAuth *a, unsigned char *hmac);
+void rmcp_rakp3_hmac(const RmcpAuth *a, unsigned char *hmac);
+void rmcp_keys(const RmcpAuth *a, int integrity, int confidentiality,
+               RmcpKeys *k);
+void rmcp_rakp4_icv(const RmcpAuth *a, const RmcpKeys *k,
+                    unsigned char *icv);
+
+/* Fill buf with len random bytes.  Exits if there are none to be had.
+ */
+void rmcp_random(unsigned char *buf, int len);
+
+/* Compare authentication codes in constant time.  Returns nonzero if
+ * the len bytes at a and b are equal.
+ */
+int rmcp_equal(const unsigned char *a, const unsigned char *b, int len);
+
+/* Little endian integers, as in RMCP+ headers and payloads.
+ */
+void rmcp_put32(unsigned char *p, unsigned long val);
+unsigned long rmcp_get32(const unsigned char *p);
+
+/* Encode a session packet into buf (RMCP_MAX_MSG bytes) and return its
+ * length.  keys is NULL outside a session, otherwise the payload is
+ * protected as the session's algorithms require.
+ */
+int rmcp_encode(unsigned char *buf, int type, unsigned long sid,
+                unsigned long seq, const unsigned char *payload, int len,
+                const RmcpKeys *keys);
+
+/* Get the payload type and session ID of a received packet, so the keys
+ * to decode it with can be found.  Returns -1 if it is not RMCP+.
+ */
+int rmcp_header(const unsigned char *buf, int len, int *type,
+                unsigned long *sid);
+
+/* Check and decrypt a received packet, copying its payload to payload
+ * (size bytes).  Returns the payload length, or -1 if the packet is
+ * malformed or not protected as keys require.
+ */
+int rmcp_decode(const unsigned char *buf, int len, const RmcpKeys *keys,
+                unsigned long *seq, unsigned char *payload, int size);
+
+/* Encode an IPMI message from IPMB address from to address to; requests
+ * go from IPMI_REMOTE_ADDR to IPMI_BMC_ADDR, responses the other way with
+ * netfn + 1.  Returns the message length.
+ */
+int ipmi_encode(unsigned char *buf, int to, int netfn, int from, int seq,
+                int cmd, const unsigned char *data, int len);
+
+/* Decode an IPMI message.  Returns -1 if it is malformed.
+ */
+int ipmi_decode(const unsigned char *buf, int len, int *netfn, int *seq,
+                int *cmd, const unsigned char **data, int *dlen);
+
+#endif /* PM_RMCP_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
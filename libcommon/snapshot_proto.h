@@ -0,0 +1,59 @@
+#ifndef PM_SNAPSHOT_PROTO_H
+#define PM_SNAPSHOT_PROTO_H
+
+#include <stdint.h>
+
+/*
+ * Layout of the POSIX shared memory segment in which powermand publishes
+ * its last known plug state for each node (see 'snapshot' in
+ * powerman.conf).  Local readers map it read-only and never talk to the
+ * daemon.
+ *
+ * The segment consists of a header, an array of 'count' node entries in
+ * hostlist sort order (node index == binary protocol node ID), and a table
+ * of NUL terminated node names.  Names are written once when the segment
+ * is created; only states and timestamps change afterwards.
+ *
+ * Updates are protected by a sequence lock: the writer increments 'seq'
+ * before and after each update, so it is odd while an update is in
+ * progress.  A reader copies what it needs, then retries if 'seq' was odd
+ * or changed in the meantime.
+ */
+
+#define PM_SNAP_MAGIC       0x706d736e      /* "pmsn" */
+#define PM_SNAP_VERSION     1
+#define PM_SNAP_MODE        0644            /* segment permissions */
+
+struct pm_snap_hdr {
+    uint32_t magic;             /* PM_SNAP_MAGIC */
+    uint32_t version;           /* PM_SNAP_VERSION */
+    uint32_t size;              /* total segment size in bytes */
+    uint32_t count;             /* number of node entries */
+    uint32_t names;             /* offset of node name table */
+    volatile uint32_t seq;      /* sequence lock (odd while updating) */
+    volatile int32_t pid;       /* pid of writer (0 after it exits) */
+    uint32_t pad;
+    volatile int64_t updated;   /* time of last update */
+};
+
+struct pm_snap_node {
+    int32_t state;              /* PM_SNAP_UNKNOWN, PM_SNAP_OFF, PM_SNAP_ON */
+    uint32_t name;              /* offset of node name in segment */
+    int64_t changed;            /* time of last state change (0 = never) */
+};
+
+#define PM_SNAP_UNKNOWN     0
+#define PM_SNAP_OFF         1
+#define PM_SNAP_ON          2
+
+#define PM_SNAP_NODES(hdr) \
+    ((struct pm_snap_node *)((char *)(hdr) + sizeof(struct pm_snap_hdr)))
+
+/* full memory barrier for the sequence lock */
+#define PM_SNAP_BARRIER()   __sync_synchronize()
+
+#endif /* PM_SNAPSHOT_PROTO_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
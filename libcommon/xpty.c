@@ -25,6 +25,7 @@
 #if HAVE_CONFIG_H
 #include "config.h"
 #endif
+#define _GNU_SOURCE             /* POSIX_SPAWN_SETSID */
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -46,8 +47,22 @@
 #include <sys/syscall.h>
 #endif
 #endif
+#include <sys/socket.h>
 #include <stdio.h>
+#include <errno.h>
 #include <assert.h>
+#if HAVE_SPAWN_H
+#include <spawn.h>
+#endif
+
+/* Start coprocesses with posix_spawn(3), which does not copy the parent's
+ * address space, so the cost does not grow with the size of the daemon.
+ */
+#if HAVE_SPAWN_H && HAVE_POSIX_SPAWN && HAVE_POSIX_OPENPT \
+                 && defined(POSIX_SPAWN_SETSID)
+#define XPTY_SPAWN 1
+extern char **environ;
+#endif
 
 #include "xtypes.h"
 #include "xpty.h"
@@ -219,6 +234,205 @@ pid_t xforkpty(int *amaster, char *name, int len)
     return pid;
 }
 
+/* Like xforkpty() but the child's stdin, stdout, and stderr are connected
+ * to one end of a socketpair, for programs that don't need a terminal.
+ * If bufsize is nonzero, the socket buffers are set to that size.
+ */
+pid_t xforksocketpair(int *afd, int bufsize)
+{
+    int sv[2];
+    int i;
+    pid_t pid;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+        return -1;
+    for (i = 0; i < 2 && bufsize > 0; i++) {
+        (void)setsockopt(sv[i], SOL_SOCKET, SO_SNDBUF, &bufsize,
+                         sizeof(bufsize));
+        (void)setsockopt(sv[i], SOL_SOCKET, SO_RCVBUF, &bufsize,
+                         sizeof(bufsize));
+    }
+    pid = fork();
+    switch (pid) {
+        case -1: /* Error */
+            close(sv[0]);
+            close(sv[1]);
+            return -1;
+        case 0: /* Child */
+            close(sv[0]);
+            dup2(sv[1], STDIN_FILENO);
+            dup2(sv[1], STDOUT_FILENO);
+            dup2(sv[1], STDERR_FILENO);
+            if (sv[1] > STDERR_FILENO)
+                close(sv[1]);
+            return 0;
+        default: /* Parent */
+            close(sv[1]);
+            if (afd)
+                *afd = sv[0];
+            break;
+    }
+    return pid;
+}
+
+#if XPTY_SPAWN
+/* Spawn argv with file actions fa in a new session.
+ */
+static pid_t _spawn(char *const argv[], posix_spawn_file_actions_t *fa)
+{
+    posix_spawnattr_t attr;
+    pid_t pid;
+    int rc;
+
+    if ((rc = posix_spawnattr_init(&attr)) != 0) {
+        errno = rc;
+        return -1;
+    }
+    rc = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID);
+    if (rc == 0)
+        rc = posix_spawn(&pid, argv[0], fa, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+    if (rc != 0) {
+        errno = rc;
+        return -1;
+    }
+    return pid;
+}
+
+static void _set_cloexec(int fd)
+{
+    if (fcntl(fd, F_SETFD, FD_CLOEXEC) < 0)
+        err_exit(TRUE, "fcntl F_SETFD");
+}
+#endif
+
+/* Run argv as a coprocess on a raw pty.  Return its pid and put the pty
+ * master in *amaster and its name in name, or return -1 on error.  If the
+ * program cannot be executed, either -1 is returned or the child exits.
+ */
+pid_t xspawnpty(char *const argv[], int *amaster, char *name, int len)
+{
+    pid_t pid;
+#if XPTY_SPAWN
+    posix_spawn_file_actions_t fa;
+    int master, slave, rc, saved_errno;
+    char *slave_name;
+
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0)
+        return -1;
+    if (grantpt(master) < 0 || unlockpt(master) < 0
+                            || !(slave_name = ptsname(master))) {
+        close(master);
+        return -1;
+    }
+    /* the slave becomes the controlling tty when the child opens it */
+    slave = open(slave_name, O_RDWR | O_NOCTTY);
+    if (slave < 0) {
+        close(master);
+        return -1;
+    }
+    xcfmakeraw(slave);
+    _set_cloexec(master);
+    _set_cloexec(slave);
+
+    if ((rc = posix_spawn_file_actions_init(&fa)) != 0) {
+        close(slave);
+        close(master);
+        errno = rc;
+        return -1;
+    }
+    rc = posix_spawn_file_actions_addopen(&fa, STDIN_FILENO, slave_name,
+                                          O_RDWR, 0);
+    if (rc == 0)
+        rc = posix_spawn_file_actions_adddup2(&fa, STDIN_FILENO,
+                                              STDOUT_FILENO);
+    if (rc == 0)
+        rc = posix_spawn_file_actions_adddup2(&fa, STDIN_FILENO,
+                                              STDERR_FILENO);
+    if (rc == 0) {
+        if (name)
+            snprintf(name, len, "%s", slave_name);
+        pid = _spawn(argv, &fa);
+    } else {
+        errno = rc;
+        pid = -1;
+    }
+    saved_errno = errno;
+    posix_spawn_file_actions_destroy(&fa);
+    close(slave);
+    if (pid < 0)
+        close(master);
+    else if (amaster)
+        *amaster = master;
+    errno = saved_errno;
+#else
+    pid = xforkpty(amaster, name, len);
+    if (pid == 0) {
+        xcfmakeraw(STDIN_FILENO);
+        execv(argv[0], argv);
+        err_exit(TRUE, "exec %s", argv[0]);
+    }
+#endif
+    return pid;
+}
+
+/* Run argv as a coprocess on a socketpair (see xforksocketpair()).
+ */
+pid_t xspawnsocketpair(char *const argv[], int *afd, int bufsize)
+{
+    pid_t pid;
+#if XPTY_SPAWN
+    posix_spawn_file_actions_t fa;
+    int sv[2];
+    int i, rc, saved_errno;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+        return -1;
+    for (i = 0; i < 2 && bufsize > 0; i++) {
+        (void)setsockopt(sv[i], SOL_SOCKET, SO_SNDBUF, &bufsize,
+                         sizeof(bufsize));
+        (void)setsockopt(sv[i], SOL_SOCKET, SO_RCVBUF, &bufsize,
+                         sizeof(bufsize));
+    }
+    _set_cloexec(sv[0]);
+    _set_cloexec(sv[1]); /* dup2'd copies don't inherit FD_CLOEXEC */
+
+    if ((rc = posix_spawn_file_actions_init(&fa)) != 0) {
+        close(sv[0]);
+        close(sv[1]);
+        errno = rc;
+        return -1;
+    }
+    rc = posix_spawn_file_actions_adddup2(&fa, sv[1], STDIN_FILENO);
+    if (rc == 0)
+        rc = posix_spawn_file_actions_adddup2(&fa, sv[1], STDOUT_FILENO);
+    if (rc == 0)
+        rc = posix_spawn_file_actions_adddup2(&fa, sv[1], STDERR_FILENO);
+    if (rc == 0)
+        pid = _spawn(argv, &fa);
+    else {
+        errno = rc;
+        pid = -1;
+    }
+    saved_errno = errno;
+    posix_spawn_file_actions_destroy(&fa);
+    close(sv[1]);
+    if (pid < 0)
+        close(sv[0]);
+    else if (afd)
+        *afd = sv[0];
+    errno = saved_errno;
+#else
+    pid = xforksocketpair(afd, bufsize);
+    if (pid == 0) {
+        execv(argv[0], argv);
+        err_exit(TRUE, "exec %s", argv[0]);
+    }
+#endif
+    return pid;
+}
+
 
 /*
  * vi:tabstop=4 shiftwidth=4 expandtab
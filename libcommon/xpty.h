@@ -7,6 +7,10 @@ void nonblock_set(int fd);
 void nonblock_clr(int fd);
 
 pid_t xforkpty(int *amaster, char *name, int len);
+pid_t xforksocketpair(int *afd, int bufsize);
+
+pid_t xspawnpty(char *const argv[], int *amaster, char *name, int len);
+pid_t xspawnsocketpair(char *const argv[], int *afd, int bufsize);
 
 #endif /* PM_XPTY_H */
 
@@ -31,7 +31,13 @@
 #endif
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <netdb.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -39,6 +45,8 @@
 #include <errno.h>
 
 #include "client_proto.h"
+#include "powerman.h"
+#include "snapshot_proto.h"
 #include "libpowerman.h"
 
 #ifndef MAXHOSTNAMELEN
@@ -53,6 +61,7 @@
 struct pm_handle_struct {
     int         pmh_magic;
     int         pmh_fd;
+    int         pmh_binary;     /* using binary protocol */
 };
 
 
@@ -70,6 +79,20 @@ struct pm_node_iterator_struct {
     struct list_struct *pmi_pos;
 };
 
+struct snap_name {
+    char *              name;
+    int                 id;
+};
+
+#define PMS_MAGIC 0x736e6170
+#define PMS_RETRIES 1000        /* give up if writer stays busy this long */
+struct pm_snapshot_struct {
+    int                 pms_magic;
+    struct pm_snap_hdr *pms_hdr;    /* mapped segment */
+    size_t              pms_size;   /* size of mapping */
+    struct snap_name *  pms_names;  /* node names sorted by strcmp */
+};
+
 static pm_err_t _list_add(struct list_struct **head, char *s,
                                 list_free_t freefun);
 static void     _list_free(struct list_struct **head);
@@ -87,6 +110,13 @@ static pm_err_t _server_recv_response(pm_handle_t pmh,
 static pm_err_t _server_send_command(pm_handle_t pmh, char *cmd, char *arg);
 static pm_err_t _server_command(pm_handle_t pmh, char *cmd, char *arg,
                                 struct list_struct **respp);
+static pm_err_t _server_send_frame(pm_handle_t pmh, int op, int targ,
+                                const void *data, int len);
+static pm_err_t _server_recv_frames(pm_handle_t pmh,
+                                unsigned char **datap, int *lenp);
+static pm_err_t _server_frame_command(pm_handle_t pmh, int op, int targ,
+                                const void *data, int len,
+                                unsigned char **datap, int *lenp);
 
 
 /* Add [s] to the list referenced by [head], registering [freefun] to
@@ -206,6 +236,41 @@ _connect_to_server_tcp(pm_handle_t pmh, char *server, int family)
     return err;
 }
 
+/* Return the unix domain socket path in [server], or NULL if it is not
+ * of the form /path or unix:/path.
+ */
+static char *
+_unix_path(char *server)
+{
+    if (server == NULL)
+        return NULL;
+    if (!strncmp(server, UNIX_PREFIX, strlen(UNIX_PREFIX)))
+        return server + strlen(UNIX_PREFIX);
+    if (server[0] == '/')
+        return server;
+    return NULL;
+}
+
+/* Establish connection to powermand on unix domain socket [path].
+ */
+static pm_err_t
+_connect_to_server_unix(pm_handle_t pmh, char *path)
+{
+    struct sockaddr_un saddr;
+
+    if (strlen(path) >= sizeof(saddr.sun_path))
+        return PM_EBADARG;
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sun_family = AF_UNIX;
+    strcpy(saddr.sun_path, path);
+
+    if ((pmh->pmh_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return PM_ERRNOVALID;
+    if (connect(pmh->pmh_fd, (struct sockaddr *)&saddr, sizeof(saddr)) < 0)
+        return PM_ECONNECT;
+    return PM_ESUCCESS;
+}
+
 /* Parse a server response stored in [buf] of length [len] into
  * an array of lines stored in [respp] which caller must free.
  */
@@ -254,6 +319,7 @@ _server_retcode(struct list_struct *resp)
                 case 103:   /* query complete */
                 case 104:   /* telemetry on|off */
                 case 105:   /* hostrange expansion on|off */
+                case 106:   /* binary protocol enabled */
                     err = PM_ESUCCESS;
                     break;
                 case PM_EUNKNOWN:
@@ -324,29 +390,65 @@ _server_recv_response(pm_handle_t pmh, struct list_struct **respp)
     return err;
 }
 
+/* Write [len] bytes of [buf] to server handle [pmh].
+ */
+static pm_err_t
+_server_write(pm_handle_t pmh, const char *buf, int len)
+{
+    int count, n;
+
+    count = 0;
+    while (count < len) {
+        n = write(pmh->pmh_fd, buf + count, len - count);
+        if (n < 0)
+            return PM_ERRNOVALID;
+        count += n;
+    }
+    return PM_ESUCCESS;
+}
+
 /* Send command [cmd] with argument [arg] to server handle [pmh].
  * [cmd] is treated as a printf format string with [arg] as the
- * first printf argument (can be NULL).
+ * first printf argument (can be NULL).  A command too long for one
+ * line is broken after a comma (outside of brackets) and sent on
+ * continuation lines.
  */
 static pm_err_t
 _server_send_command(pm_handle_t pmh, char *cmd, char *arg)
 {
-    char buf[CP_LINEMAX];
-    int count, len, n;
+    char cont[4];
+    char *buf, *p, *brk;
+    int i, len, depth;
     pm_err_t err = PM_ESUCCESS;
 
-    snprintf(buf, sizeof(buf), cmd, arg);
-    snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf), CP_EOL);
-    count = 0;
-    len = strlen(buf);
-    while (count < len) {
-        n = write(pmh->pmh_fd, buf + count, len - count);
-        if (n < 0) {
-            err = PM_ERRNOVALID;
-            break;
+    len = strlen(cmd) + (arg ? strlen(arg) : 0) + 1;
+    if (!(buf = malloc(len)))
+        return PM_ENOMEM;
+    snprintf(buf, len, cmd, arg);
+    snprintf(cont, sizeof(cont), "%c%s", CP_CONTINUE, CP_EOL);
+
+    p = buf;
+    while (err == PM_ESUCCESS && strlen(p) >= CP_LINEMAX) {
+        brk = NULL;
+        for (i = 0, depth = 0; i < CP_LINEMAX - 1; i++) {
+            if (p[i] == '[')
+                depth++;
+            else if (p[i] == ']')
+                depth--;
+            else if (p[i] == ',' && depth == 0)
+                brk = &p[i];
         }
-        count += n;
+        if (brk == NULL)
+            break;          /* can't break it - server will reject */
+        if ((err = _server_write(pmh, p, brk - p + 1)) == PM_ESUCCESS)
+            err = _server_write(pmh, cont, strlen(cont));
+        p = brk + 1;
     }
+    if (err == PM_ESUCCESS)
+        err = _server_write(pmh, p, strlen(p));
+    if (err == PM_ESUCCESS)
+        err = _server_write(pmh, CP_EOL, strlen(CP_EOL));
+    free(buf);
     return err;
 }
 
@@ -366,6 +468,135 @@ _server_command(pm_handle_t pmh, char *cmd, char *arg, struct list_struct **resp
     return PM_ESUCCESS;
 }
 
+/* Read [len] bytes from server handle [pmh] into [buf].
+ */
+static pm_err_t
+_server_read(pm_handle_t pmh, void *buf, int len)
+{
+    int count, n;
+
+    count = 0;
+    while (count < len) {
+        n = read(pmh->pmh_fd, (char *)buf + count, len - count);
+        if (n == 0)
+            return PM_ESERVEREOF;
+        if (n < 0)
+            return PM_ERRNOVALID;
+        count += n;
+    }
+    return PM_ESUCCESS;
+}
+
+/* Send binary request frame [op] with target type [targ] and payload
+ * [data] of length [len] to server handle [pmh].
+ */
+static pm_err_t
+_server_send_frame(pm_handle_t pmh, int op, int targ, const void *data,
+                   int len)
+{
+    unsigned char hdr[CPB_HDRLEN];
+    pm_err_t err;
+
+    if (len > CPB_FRAMEMAX - CPB_HDRLEN)
+        return PM_EBADARG;
+    CPB_PUT32(hdr, len);
+    hdr[4] = op;
+    hdr[5] = targ;
+    CPB_PUT16(&hdr[6], 0);
+    if ((err = _server_write(pmh, (char *)hdr, CPB_HDRLEN)) != PM_ESUCCESS)
+        return err;
+    if (len > 0)
+        err = _server_write(pmh, data, len);
+    return err;
+}
+
+/* Read binary response frames from server handle [pmh] up to and
+ * including the final CPB_RSP_DONE frame, and return its code.
+ * If [datap] is non-NULL, return the (concatenated) payload of any data
+ * frames in [datap] and its length in [lenp].  Caller must free [datap].
+ */
+static pm_err_t
+_server_recv_frames(pm_handle_t pmh, unsigned char **datap, int *lenp)
+{
+    unsigned char hdr[CPB_HDRLEN];
+    unsigned char *data = NULL, *buf, *cpy;
+    unsigned long len;
+    int code, datalen = 0;
+    pm_err_t err;
+
+    for (;;) {
+        if ((err = _server_read(pmh, hdr, CPB_HDRLEN)) != PM_ESUCCESS)
+            break;
+        len = CPB_GET32(hdr);
+        code = CPB_GET16(&hdr[6]);
+        if (len > CPB_FRAMEMAX) {
+            err = PM_ESERVERPARSE;
+            break;
+        }
+        if (!(buf = malloc(len + 1))) {
+            err = PM_ENOMEM;
+            break;
+        }
+        if ((err = _server_read(pmh, buf, len)) != PM_ESUCCESS) {
+            free(buf);
+            break;
+        }
+        if (hdr[4] == CPB_RSP_DONE) {
+            free(buf);
+            if (CP_IS_SUCCESS(code))
+                err = PM_ESUCCESS;
+            else if (CP_IS_FAILURE(code))
+                err = code;
+            else
+                err = PM_ESERVERPARSE;
+            break;
+        }
+        if (hdr[4] != CPB_RSP_INFO && len > 0) {
+            if (!(cpy = realloc(data, datalen + len))) {
+                free(buf);
+                err = PM_ENOMEM;
+                break;
+            }
+            data = cpy;
+            memcpy(data + datalen, buf, len);
+            datalen += len;
+        }
+        free(buf);
+    }
+    if (err == PM_ESUCCESS && datap != NULL) {
+        *datap = data;
+        *lenp = datalen;
+    } else if (data != NULL)
+        free(data);
+    return err;
+}
+
+/* Send binary request frame to server handle [pmh] and read the response.
+ * See _server_send_frame() and _server_recv_frames().
+ */
+static pm_err_t
+_server_frame_command(pm_handle_t pmh, int op, int targ, const void *data,
+                      int len, unsigned char **datap, int *lenp)
+{
+    pm_err_t err;
+
+    if ((err = _server_send_frame(pmh, op, targ, data, len)) != PM_ESUCCESS)
+        return err;
+    return _server_recv_frames(pmh, datap, lenp);
+}
+
+/* Send binary request [op] targetting hostlist [node] to server handle
+ * [pmh], or in text mode, the equivalent command [cmd].
+ */
+static pm_err_t
+_server_node_command(pm_handle_t pmh, int op, char *cmd, char *node)
+{
+    if (pmh->pmh_binary)
+        return _server_frame_command(pmh, op, CPB_TARG_HOSTLIST, node,
+                                     strlen(node), NULL, NULL);
+    return _server_command(pmh, cmd, node, NULL);
+}
+
 pm_err_t
 pm_connect(char *server, void *arg, pm_handle_t *pmhp, int flags)
 {
@@ -377,10 +608,18 @@ pm_connect(char *server, void *arg, pm_handle_t *pmhp, int flags)
     if ((pmh = (pm_handle_t)malloc(sizeof(struct pm_handle_struct))) == NULL)
         return PM_ENOMEM;
     pmh->pmh_magic = PMH_MAGIC;
+    pmh->pmh_binary = 0;
 
-    if ((err = _connect_to_server_tcp(pmh, server, (flags & PM_CONN_INET6)
-                                ? PF_INET6 : PF_UNSPEC)) != PM_ESUCCESS) {
-        (void)close(pmh->pmh_fd);
+    pmh->pmh_fd = -1;
+
+    if (_unix_path(server))
+        err = _connect_to_server_unix(pmh, _unix_path(server));
+    else
+        err = _connect_to_server_tcp(pmh, server, (flags & PM_CONN_INET6)
+                                     ? PF_INET6 : PF_UNSPEC);
+    if (err != PM_ESUCCESS) {
+        if (pmh->pmh_fd >= 0)
+            (void)close(pmh->pmh_fd);
         free(pmh);
         return err;
     }
@@ -389,11 +628,17 @@ pm_connect(char *server, void *arg, pm_handle_t *pmhp, int flags)
         free(pmh);
         return err;
     }
-    if ((err = _server_command(pmh, CP_EXPRANGE, NULL, NULL)) != PM_ESUCCESS) {
+    if ((flags & PM_CONN_BINARY))
+        err = _server_command(pmh, CP_BINARY, NULL, NULL);
+    else
+        err = _server_command(pmh, CP_EXPRANGE, NULL, NULL);
+    if (err != PM_ESUCCESS) {
         (void)close(pmh->pmh_fd);
         free(pmh);
         return err;
     }
+    if ((flags & PM_CONN_BINARY))
+        pmh->pmh_binary = 1;
     if (err == PM_ESUCCESS)
         *pmhp = pmh;
     else
@@ -423,6 +668,47 @@ pm_node_iterator_destroy(pm_node_iterator_t pmi)
     free(pmi);
 }
 
+/* Helper for pm_node_iterator_create().
+ * Fill iterator [pmi] with the node list from binary server handle [pmh],
+ * in node ID order.
+ */
+static pm_err_t
+_node_iterator_fill_binary(pm_handle_t pmh, pm_node_iterator_t pmi)
+{
+    unsigned char *data = NULL;
+    char **names = NULL;
+    char *p, *cpy;
+    int i, count, len = 0;
+    pm_err_t err;
+
+    err = _server_frame_command(pmh, CPB_OP_NODES, CPB_TARG_ALL, NULL, 0,
+                                &data, &len);
+    if (err != PM_ESUCCESS)
+        return err;
+    for (count = 0, i = 0; i < len; i++)
+        if (data[i] == '\0')
+            count++;
+    if (count > 0 && !(names = malloc(sizeof(char *) * count)))
+        err = PM_ENOMEM;
+    for (i = 0, p = (char *)data; err == PM_ESUCCESS && i < count; i++) {
+        names[i] = p;
+        p += strlen(p) + 1;
+    }
+    /* _list_add() prepends, so add in reverse */
+    for (i = count - 1; err == PM_ESUCCESS && i >= 0; i--) {
+        if (!(cpy = strdup(names[i]))) {
+            err = PM_ENOMEM;
+            break;
+        }
+        err = _list_add(&pmi->pmi_nodes, cpy, (list_free_t)free);
+    }
+    if (names)
+        free(names);
+    if (data)
+        free(data);
+    return err;
+}
+
 pm_err_t
 pm_node_iterator_create(pm_handle_t pmh, pm_node_iterator_t *pmip)
 {
@@ -435,6 +721,15 @@ pm_node_iterator_create(pm_handle_t pmh, pm_node_iterator_t *pmip)
         return PM_EBADHAND;
     if ((err = _node_iterator_create(&pmi)) != PM_ESUCCESS)
         return err;
+    if (pmh->pmh_binary) {
+        if ((err = _node_iterator_fill_binary(pmh, pmi)) == PM_ESUCCESS
+                                                        && pmip != NULL) {
+            pm_node_iterator_reset(pmi);
+            *pmip = pmi;
+        } else
+            pm_node_iterator_destroy(pmi);
+        return err;
+    }
     if ((err = _server_command(pmh, CP_NODES, NULL, &resp)) != PM_ESUCCESS) {
         pm_node_iterator_destroy(pmi);
         return err;
@@ -485,12 +780,103 @@ void
 pm_disconnect(pm_handle_t pmh)
 {
     if (pmh != NULL && pmh->pmh_magic == PMH_MAGIC) {
-        (void)_server_command(pmh, CP_QUIT, NULL, NULL); /* PM_ESERVEREOF */
+        if (pmh->pmh_binary)
+            (void)_server_frame_command(pmh, CPB_OP_QUIT, CPB_TARG_ALL,
+                                        NULL, 0, NULL, NULL);
+        else
+            (void)_server_command(pmh, CP_QUIT, NULL, NULL); /* EOF */
         (void)close(pmh->pmh_fd);
         free(pmh);
     }
 }
 
+/* Convert binary protocol state to pm_node_state_t.
+ */
+static pm_node_state_t
+_node_state(int state)
+{
+    switch (state) {
+        case CPB_STATE_ON:
+            return PM_ON;
+        case CPB_STATE_OFF:
+            return PM_OFF;
+        default:
+            return PM_UNKNOWN;
+    }
+}
+
+/* Helper for pm_node_status() on a binary server handle.
+ */
+static pm_err_t
+_node_status_binary(pm_handle_t pmh, char *node, pm_node_state_t *statep)
+{
+    unsigned char *data = NULL;
+    int len = 0;
+    pm_err_t err;
+
+    err = _server_frame_command(pmh, CPB_OP_STATUS, CPB_TARG_HOSTLIST,
+                                node, strlen(node), &data, &len);
+    if (err != PM_ESUCCESS)
+        return err;
+    if (statep)
+        *statep = len >= 5 ? _node_state(data[4]) : PM_UNKNOWN;
+    if (data)
+        free(data);
+    return PM_ESUCCESS;
+}
+
+/* Query server [pmh] for the power status of [count] nodes by node ID
+ * [ids] (binary protocol only), and store them in [states].
+ */
+pm_err_t
+pm_node_status_ids(pm_handle_t pmh, const int *ids, int count,
+                   pm_node_state_t *states)
+{
+    unsigned char *req, *data = NULL, *st;
+    int i, len = 0, maxid = 0;
+    unsigned long id;
+    pm_err_t err;
+
+    if (pmh == NULL || pmh->pmh_magic != PMH_MAGIC)
+        return PM_EBADHAND;
+    if (!pmh->pmh_binary || ids == NULL || states == NULL || count <= 0)
+        return PM_EBADARG;
+    if (!(req = malloc(count * 4)))
+        return PM_ENOMEM;
+    for (i = 0; i < count; i++) {
+        if (ids[i] < 0) {
+            free(req);
+            return PM_EBADARG;
+        }
+        if (ids[i] > maxid)
+            maxid = ids[i];
+        CPB_PUT32(&req[i * 4], ids[i]);
+    }
+    err = _server_frame_command(pmh, CPB_OP_STATUS, CPB_TARG_NODEID,
+                                req, count * 4, &data, &len);
+    free(req);
+    if (err != PM_ESUCCESS)
+        return err;
+
+    /* response is in server order - index it by node ID */
+    if (!(st = calloc(maxid + 1, 1))) {
+        if (data)
+            free(data);
+        return PM_ENOMEM;
+    }
+    for (i = 0; i + 5 <= len; i += 5) {
+        id = CPB_GET32(&data[i]);
+        if (id <= (unsigned long)maxid)
+            st[id] = data[i + 4];
+    }
+    for (i = 0; i < count; i++)
+        states[i] = _node_state(st[ids[i]]);
+    free(st);
+    if (data)
+        free(data);
+    return PM_ESUCCESS;
+}
+
 /* Query server [pmh] for the power status of [node], and store it
  * in [statep].
  */
@@ -504,6 +890,8 @@ pm_node_status(pm_handle_t pmh, char *node, pm_node_state_t *statep)
 
     if (pmh == NULL || pmh->pmh_magic != PMH_MAGIC)
         return PM_EBADHAND;
+    if (pmh->pmh_binary)
+        return _node_status_binary(pmh, node, statep);
     if ((err = _server_command(pmh, CP_STATUS, node, &resp)) != PM_ESUCCESS)
         return err;
 
@@ -529,7 +917,7 @@ pm_node_on(pm_handle_t pmh, char *node)
 {
     if (pmh == NULL || pmh->pmh_magic != PMH_MAGIC)
         return PM_EBADHAND;
-    return _server_command(pmh, CP_ON, node, NULL);
+    return _server_node_command(pmh, CPB_OP_ON, CP_ON, node);
 }
 
 /* Tell server [pmh] to turn [node] off.
@@ -539,7 +927,7 @@ pm_node_off(pm_handle_t pmh, char *node)
 {
     if (pmh == NULL || pmh->pmh_magic != PMH_MAGIC)
         return PM_EBADHAND;
-    return _server_command(pmh, CP_OFF, node, NULL);
+    return _server_node_command(pmh, CPB_OP_OFF, CP_OFF, node);
 }
 
 /* Tell server [pmh] to cycle [node].
@@ -549,7 +937,190 @@ pm_node_cycle(pm_handle_t pmh, char *node)
 {
     if (pmh == NULL || pmh->pmh_magic != PMH_MAGIC)
         return PM_EBADHAND;
-    return _server_command(pmh, CP_CYCLE, node, NULL);
+    return _server_node_command(pmh, CPB_OP_CYCLE, CP_CYCLE, node);
+}
+
+/* helper for pm_snapshot_open and pm_snapshot_status */
+static int
+_snap_name_cmp(const void *a, const void *b)
+{
+    return strcmp(((struct snap_name *)a)->name, ((struct snap_name *)b)->name);
+}
+
+/* Map the powermand plug state snapshot 'name' (see 'snapshot' in
+ * powerman.conf).  No connection to the server is made.
+ */
+pm_err_t
+pm_snapshot_open(char *name, pm_snapshot_t *snapp)
+{
+    pm_snapshot_t snap;
+    struct pm_snap_hdr *hdr;
+    struct pm_snap_node *nodes;
+    struct stat sb;
+    pm_err_t err = PM_ESNAPSHOT;
+    int fd, i;
+
+    if (name == NULL || snapp == NULL)
+        return PM_EBADARG;
+    if ((fd = shm_open(name, O_RDONLY, 0)) < 0)
+        return PM_ERRNOVALID;
+    if (fstat(fd, &sb) < 0) {
+        (void)close(fd);
+        return PM_ERRNOVALID;
+    }
+    if (sb.st_size < sizeof(struct pm_snap_hdr)) {
+        (void)close(fd);
+        return PM_ESNAPSHOT;
+    }
+    hdr = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    (void)close(fd);
+    if (hdr == MAP_FAILED)
+        return PM_ERRNOVALID;
+
+    /* validate the layout, and that the writer is still around */
+    if (hdr->magic != PM_SNAP_MAGIC || hdr->version != PM_SNAP_VERSION
+            || hdr->size != sb.st_size || hdr->names > hdr->size
+            || hdr->names < sizeof(struct pm_snap_hdr)
+                          + hdr->count * sizeof(struct pm_snap_node))
+        goto error;
+    if (hdr->pid == 0 || (kill(hdr->pid, 0) < 0 && errno == ESRCH))
+        goto error;
+
+    err = PM_ENOMEM;
+    if (!(snap = malloc(sizeof(struct pm_snapshot_struct))))
+        goto error;
+    snap->pms_magic = PMS_MAGIC;
+    snap->pms_hdr = hdr;
+    snap->pms_size = sb.st_size;
+    if (!(snap->pms_names = malloc((hdr->count + 1)
+                                   * sizeof(struct snap_name)))) {
+        free(snap);
+        goto error;
+    }
+    nodes = PM_SNAP_NODES(hdr);
+    for (i = 0; i < hdr->count; i++) {
+        if (nodes[i].name < hdr->names || nodes[i].name >= hdr->size) {
+            pm_snapshot_close(snap);
+            return PM_ESNAPSHOT;
+        }
+        snap->pms_names[i].name = (char *)hdr + nodes[i].name;
+        snap->pms_names[i].id = i;
+    }
+    qsort(snap->pms_names, hdr->count, sizeof(struct snap_name),
+          _snap_name_cmp);
+    *snapp = snap;
+    return PM_ESUCCESS;
+error:
+    (void)munmap(hdr, sb.st_size);
+    return err;
+}
+
+/* Unmap the snapshot and free its handle.
+ */
+void
+pm_snapshot_close(pm_snapshot_t snap)
+{
+    if (snap == NULL || snap->pms_magic != PMS_MAGIC)
+        return;
+    snap->pms_magic = 0;
+    (void)munmap(snap->pms_hdr, snap->pms_size);
+    free(snap->pms_names);
+    free(snap);
+}
+
+/* Return the number of nodes in the snapshot.  Node ID's range from 0 to
+ * one less than this, in the same order as the binary protocol.
+ */
+int
+pm_snapshot_count(pm_snapshot_t snap)
+{
+    if (snap == NULL || snap->pms_magic != PMS_MAGIC)
+        return 0;
+    return snap->pms_hdr->count;
+}
+
+/* Return the name of node 'id', or NULL if out of range.
+ */
+char *
+pm_snapshot_node(pm_snapshot_t snap, int id)
+{
+    if (snap == NULL || snap->pms_magic != PMS_MAGIC)
+        return NULL;
+    if (id < 0 || id >= snap->pms_hdr->count)
+        return NULL;
+    return (char *)snap->pms_hdr + PM_SNAP_NODES(snap->pms_hdr)[id].name;
+}
+
+/* Copy states of 'count' nodes starting at 'first' out of the snapshot
+ * under its sequence lock.  'changed' and 'updatedp' may be NULL.
+ */
+static pm_err_t
+_snapshot_copy(pm_snapshot_t snap, int first, int count,
+               pm_node_state_t *states, time_t *changed, time_t *updatedp)
+{
+    struct pm_snap_hdr *hdr = snap->pms_hdr;
+    struct pm_snap_node *nodes = PM_SNAP_NODES(hdr) + first;
+    uint32_t seq;
+    int i, tries;
+
+    for (tries = 0; tries < PMS_RETRIES; tries++) {
+        if (hdr->pid == 0)
+            break;
+        seq = hdr->seq;
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+        PM_SNAP_BARRIER();
+        for (i = 0; i < count; i++) {
+            states[i] = nodes[i].state == PM_SNAP_ON ? PM_ON
+                      : nodes[i].state == PM_SNAP_OFF ? PM_OFF : PM_UNKNOWN;
+            if (changed)
+                changed[i] = nodes[i].changed;
+        }
+        if (updatedp)
+            *updatedp = hdr->updated;
+        PM_SNAP_BARRIER();
+        if (hdr->seq == seq)
+            return PM_ESUCCESS;
+    }
+    return PM_ESNAPSHOT;
+}
+
+/* Look up the state of 'node' in the snapshot, and the time it last
+ * changed (0 if never).  'changedp' may be NULL.
+ */
+pm_err_t
+pm_snapshot_status(pm_snapshot_t snap, char *node, pm_node_state_t *statep,
+                   time_t *changedp)
+{
+    struct snap_name key, *found;
+
+    if (snap == NULL || snap->pms_magic != PMS_MAGIC)
+        return PM_EBADHAND;
+    if (node == NULL || statep == NULL)
+        return PM_EBADARG;
+    key.name = node;
+    if (!(found = bsearch(&key, snap->pms_names, snap->pms_hdr->count,
+                          sizeof(struct snap_name), _snap_name_cmp)))
+        return PM_ENOSUCHNODES;
+    return _snapshot_copy(snap, found->id, 1, statep, changedp, NULL);
+}
+
+/* Copy the state of every node into 'states', indexed by node ID, and
+ * optionally the time each changed and the time of the last update.
+ * Arrays must have room for pm_snapshot_count() entries.
+ */
+pm_err_t
+pm_snapshot_read(pm_snapshot_t snap, pm_node_state_t *states,
+                 time_t *changed, time_t *updatedp)
+{
+    if (snap == NULL || snap->pms_magic != PMS_MAGIC)
+        return PM_EBADHAND;
+    if (states == NULL)
+        return PM_EBADARG;
+    return _snapshot_copy(snap, 0, snap->pms_hdr->count, states, changed,
+                          updatedp);
 }
 
 /* Convert error code to human readable string.
@@ -585,6 +1156,9 @@ pm_strerror(pm_err_t err, char *str, int len)
         case PM_ESERVERPARSE:
             strncpy(str, "unexpected response from server", len);
             break;
+        case PM_ESNAPSHOT:
+            strncpy(str, "snapshot is invalid or no longer updated", len);
+            break;
         case PM_EUNKNOWN:
             strncpy(str, "server: unknown command", len);
             break;
@@ -25,12 +25,15 @@
 #ifndef LIBPOWERMAN_H
 #define LIBPOWERMAN_H
 
+#include <time.h>
+
 #ifdef __cplusplus
   extern "C" {
 #endif
 
 typedef struct pm_handle_struct         *pm_handle_t;
 typedef struct pm_node_iterator_struct  *pm_node_iterator_t;
+typedef struct pm_snapshot_struct       *pm_snapshot_t;
 
 typedef enum {
     PM_UNKNOWN      = 0,
@@ -48,6 +51,7 @@ typedef enum {
     PM_EBADARG      = 6,    /* bad argument */
     PM_ESERVEREOF   = 7,    /* received unexpected EOF from server */
     PM_ESERVERPARSE = 8,    /* unexpected response from server */
+    PM_ESNAPSHOT    = 9,    /* snapshot is invalid or no longer updated */
     PM_EUNKNOWN     = 201,  /* server: unknown command (201) */
     PM_EPARSE       = 202,  /* server: parse error (202) */
     PM_ETOOLONG     = 203,  /* server: command too long (203) */
@@ -63,6 +67,7 @@ typedef enum {
 /* flags for pm_connect() */
 #define PM_CONN_INET6   1   /* connect using IPv6 only */
 #define PM_CONN_COPROC  2   /* unimplemented */
+#define PM_CONN_BINARY  4   /* use binary protocol */
 
 pm_err_t pm_connect(char *server, void *arg, pm_handle_t *pmhp, int flags);
 void     pm_disconnect(pm_handle_t pmh);
@@ -71,12 +76,23 @@ pm_err_t pm_node_status(pm_handle_t pmh, char *node, pm_node_state_t *statep);
 pm_err_t pm_node_on(pm_handle_t pmh, char *node);
 pm_err_t pm_node_off(pm_handle_t pmh, char *node);
 pm_err_t pm_node_cycle(pm_handle_t pmh, char *node);
+pm_err_t pm_node_status_ids(pm_handle_t pmh, const int *ids, int count,
+                            pm_node_state_t *states);
 
 pm_err_t pm_node_iterator_create(pm_handle_t pmh, pm_node_iterator_t *pmip);
 char *   pm_node_next(pm_node_iterator_t pmi);
 void     pm_node_iterator_reset(pm_node_iterator_t pmi);
 void     pm_node_iterator_destroy(pm_node_iterator_t pmi);
 
+pm_err_t pm_snapshot_open(char *name, pm_snapshot_t *snapp);
+void     pm_snapshot_close(pm_snapshot_t snap);
+int      pm_snapshot_count(pm_snapshot_t snap);
+char *   pm_snapshot_node(pm_snapshot_t snap, int id);
+pm_err_t pm_snapshot_status(pm_snapshot_t snap, char *node,
+                            pm_node_state_t *statep, time_t *changedp);
+pm_err_t pm_snapshot_read(pm_snapshot_t snap, pm_node_state_t *states,
+                          time_t *changed, time_t *updatedp);
+
 char *   pm_strerror(pm_err_t err, char *str, int len);
 
 #define PM_DFLT_PORT           "10101"
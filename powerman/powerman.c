@@ -41,6 +41,7 @@
 #include <limits.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netdb.h>
 #include <stdarg.h>
 
@@ -59,6 +60,10 @@
 #include "list.h"
 
 #define CMD_MAGIC 0x5565aafd
+
+#define CHUNK_HOSTS     64      /* hosts per chunk of a large hostlist */
+#define CHUNK_MAXLEN    1024    /* max single-line hostlist (cf. hostlist.c) */
+
 typedef struct {
     int magic;
     char *fmt;
@@ -70,6 +75,7 @@ typedef struct {
 static void _push_genders_hosts(hostlist_t targets, char *s);
 #endif
 static int  _connect_to_server_tcp(char *host, char *port);
+static int  _connect_to_server_unix(char *path);
 static int  _connect_to_server_pipe(char *server_path, char *config_path,
                                     bool short_circuit_delays);
 static void _usage(void);
@@ -83,6 +89,7 @@ static void _cmd_create(List cl, char *fmt, char *arg, bool prepend);
 static void _cmd_destroy(cmd_t *cp);
 static void _cmd_append(cmd_t *cp, char *arg);
 static void _cmd_prepare(cmd_t *cp, bool genders);
+static char *_chunked_ranged_string(hostlist_t hl, int prefixlen);
 static int  _cmd_execute(cmd_t *cp, int fd);
 static void _cmd_print(cmd_t *cp);
 
@@ -198,8 +205,10 @@ int main(int argc, char **argv)
         case 'Y':              /* --short-circuit-delays */
             short_circuit_delays = TRUE;
             break;
-        case 'h':              /* --server-host host[:port] */
-            if ((p = strchr(optarg, ':'))) {
+        case 'h':              /* --server-host host[:port] or /path */
+            if (!strncmp(optarg, UNIX_PREFIX, strlen(UNIX_PREFIX)))
+                optarg += strlen(UNIX_PREFIX);
+            if (optarg[0] != '/' && (p = strchr(optarg, ':'))) {
                 *p++ = '\0';
                 port = p;
             }
@@ -289,6 +298,8 @@ int main(int argc, char **argv)
     if (server_path)
         server_fd = _connect_to_server_pipe(server_path, config_path,
                                             short_circuit_delays);
+    else if (host[0] == '/')
+        server_fd = _connect_to_server_unix(host);
     else
         server_fd = _connect_to_server_tcp(host, port);
     _process_version(server_fd);
@@ -432,6 +443,7 @@ static void _cmd_append(cmd_t *cp, char *arg)
 static void _cmd_prepare(cmd_t *cp, bool genders)
 {
     char tmpstr[CP_LINEMAX];
+    char *hosts = NULL;
     hostlist_t hl;
     int i;
 
@@ -451,11 +463,67 @@ static void _cmd_prepare(cmd_t *cp, bool genders)
                     err_exit(FALSE, "hostlist error");
             }
         }
-        if (hostlist_ranged_string(hl, sizeof(tmpstr), tmpstr) == -1)
-            err_exit(FALSE, "hostlist error");
+        if (hostlist_ranged_string(hl, CHUNK_MAXLEN, tmpstr) == -1)
+            hosts = _chunked_ranged_string(hl, strlen(cp->fmt));
         hostlist_destroy(hl);
     }
-    cp->sendstr = hsprintf(cp->fmt, tmpstr);
+    cp->sendstr = hsprintf(cp->fmt, hosts ? hosts : tmpstr);
+    if (hosts)
+        xfree(hosts);
+}
+
+/* Convert a hostlist that is too large to send as one ranged string into
+ * ranged strings of CHUNK_HOSTS hosts each, joined with commas and broken
+ * into continuation lines shorter than CP_LINEMAX.  The server rejoins the
+ * lines and treats the result as a single hostlist.  (Chunks also keep each
+ * bracketed range below the server's hostlist token limit, CHUNK_MAXLEN).
+ * Result must be freed with xfree().
+ */
+static char *_chunked_ranged_string(hostlist_t hl, int prefixlen)
+{
+    char tmpstr[CP_LINEMAX];
+    hostlist_iterator_t itr;
+    hostlist_t chunk;
+    char *str, *host;
+    int size = CP_LINEMAX, len = 0, linelen = prefixlen;
+    int n;
+
+    if ((itr = hostlist_iterator_create(hl)) == NULL)
+        err_exit(FALSE, "hostlist error");
+    str = xmalloc(size);
+    host = hostlist_next(itr);
+    while (host != NULL) {
+        if ((chunk = hostlist_create(NULL)) == NULL)
+            err_exit(FALSE, "hostlist error");
+        for (n = 0; n < CHUNK_HOSTS && host != NULL; n++) {
+            if (hostlist_push_host(chunk, host) == 0)
+                err_exit(FALSE, "hostlist error");
+            free(host); /* hostlist_next strdups returned string */
+            host = hostlist_next(itr);
+        }
+        if (hostlist_ranged_string(chunk, sizeof(tmpstr), tmpstr) == -1)
+            err_exit(FALSE, "hostlist error");
+        hostlist_destroy(chunk);
+
+        n = strlen(tmpstr);
+        if (len + n + 8 > size) {
+            size = (len + n + 8) * 2;
+            str = xrealloc(str, size);
+        }
+        if (len > 0) {
+            str[len++] = ',';
+            linelen++;
+            if (linelen + n >= CP_LINEMAX - 1) {
+                len += sprintf(str + len, "%c%s", CP_CONTINUE, CP_EOL);
+                linelen = 0;
+            }
+        }
+        strcpy(str + len, tmpstr);
+        len += n;
+        linelen += n;
+    }
+    hostlist_iterator_destroy(itr);
+    return str;
 }
 
 static int _cmd_execute(cmd_t *cp, int fd)
@@ -546,6 +614,24 @@ static int _connect_to_server_tcp(char *host, char *port)
     return fd;
 }
 
+static int _connect_to_server_unix(char *path)
+{
+    struct sockaddr_un saddr;
+    int fd;
+
+    if (strlen(path) >= sizeof(saddr.sun_path))
+        err_exit(FALSE, "server socket path too long: %s", path);
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sun_family = AF_UNIX;
+    strcpy(saddr.sun_path, path);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        err_exit(TRUE, "socket");
+    if (connect(fd, (struct sockaddr *)&saddr, sizeof(saddr)) < 0)
+        err_exit(TRUE, "could not connect to %s", path);
+    return fd;
+}
+
 /* Return true if response should be suppressed.
  */
 static bool _supress(int num)
@@ -29,6 +29,7 @@
 #if HAVE_CONFIG_H
 #include "config.h"
 #endif
+#define _GNU_SOURCE             /* struct ucred */
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
@@ -40,6 +41,8 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
 #include <netdb.h>
 #if HAVE_TCP_WRAPPERS
 #include <tcpd.h>
@@ -64,6 +67,7 @@
 #include "arglist.h"
 #include "device_private.h"
 #include "xpty.h"
+#include "resolve.h"
 #include "powerman.h"
 
 #ifndef HAVE_SOCKLEN_T
@@ -98,6 +102,13 @@ typedef struct {
     bool telemetry;             /* client wants telemetry debugging info */
     bool exprange;              /* client wants host ranges expanded */
     bool client_quit;           /* set true after client quit command */
+    bool binary;                /* client switched to binary framing */
+    bool authorizing;           /* input held until client is authorized */
+    char *req;                  /* request accumulated over continuations */
+    int reqlen;                 /* length of above (-1 if too long) */
+    unsigned char *watch;       /* bitmap of watched node IDs (or NULL) */
+    unsigned char *watch_pending; /* bitmap of watched nodes with changes */
+    int watch_npending;         /* count of bits set in above */
 } Client;
 
 /* prototypes for internal functions */
@@ -110,13 +121,30 @@ static void _client_query_nodes_reply(Client * c);
 static void _client_query_device_reply(Client * c, char *arg);
 static void _client_query_status_reply(Client * c, bool error);
 static void _client_query_status_reply_nointerp(Client * c, bool error);
+static void _client_query_status_reply_binary(Client * c, bool error, int op);
+static void _client_write(Client * c, void *data, int len);
+static void _client_write_frame(Client * c, int op, int code, void *data,
+                                int len);
 static void _handle_read(Client * c);
 static void _handle_write(Client * c);
 static void _handle_input(Client *c);
 static char *_strip_whitespace(char *str);
-static void _parse_input(Client * c, char *input);
+static bool _append_input(Client * c, char *input);
+static void _parse_input(Client * c, char *str);
+static void _handle_frames(Client * c);
+static void _parse_frame(Client * c, int op, int targ, unsigned char *buf,
+                         int len);
+static void _start_command(Client * c, Command * cmd);
+static void _client_watch(Client * c, char *str);
+static void _client_unwatch(Client * c);
+static void _client_watch_flush(Client * c);
+static void _plugstate_changed(char *node, InterpState state);
 static void _destroy_client(Client * c);
 static void _create_client_socket(int fd);
+#if HAVE_TCP_WRAPPERS
+static void _client_authorize(void *arg, char *name);
+#endif
+static void _unlink_unix_listeners(void);
 static void _create_client_stdio(void);
 static void _act_finish(int client_id, ActError acterr, const char *fmt, ...);
 static void _telemetry_printf(int client_id, const char *fmt, ...);
@@ -134,6 +162,10 @@ static List cli_clients = NULL; /* list of clients */
 static bool one_client = FALSE; /* terminate after first client */
 static bool server_done = FALSE;/* true when stdio client exits */
 
+static char **node_ids = NULL; /* binary protocol node ID -> name map */
+static int node_ids_len = 0;    /* count of above names */
+static int *node_ids_byname = NULL; /* IDs in strcmp order of their names */
+
 static int cli_id_seq = 1;      /* range 1...INT_MAX */
 #define _next_cli_id() \
     (cli_id_seq < INT_MAX ? cli_id_seq++ : (cli_id_seq = 1, INT_MAX))
@@ -161,30 +193,141 @@ static char *_xhostlist_ranged_string(hostlist_t hl)
     return str;
 }
 
+/*
+ * Write data to the output cbuf.
+ */
+static void _client_write(Client *c, void *data, int len)
+{
+    int written, dropped;
+
+    written = cbuf_write(c->to, data, len, &dropped);
+    if (written < 0)
+        err(TRUE, "_client_write: cbuf_write returned %d", written);
+    else if (dropped > 0)
+        err(FALSE, "_client_write: cbuf_write dropped %d chars", dropped);
+}
+
+/*
+ * Write a binary protocol response frame to the output cbuf.
+ */
+static void _client_write_frame(Client *c, int op, int code, void *data,
+                                int len)
+{
+    unsigned char hdr[CPB_HDRLEN];
+
+    CPB_PUT32(hdr, len);
+    hdr[4] = op;
+    hdr[5] = 0;
+    CPB_PUT16(&hdr[6], code);
+    _client_write(c, hdr, CPB_HDRLEN);
+    if (len > 0)
+        _client_write(c, data, len);
+}
+
 /*
  * printf-like function which writes to the output cbuf.
+ * A binary client gets each response line as a CPB_RSP_DONE or CPB_RSP_INFO
+ * frame instead.  Lines without a response code (the prompt) are dropped.
  */
 static void _client_printf(Client *c, const char *fmt, ...)
 {
     char *str = NULL;
-    int written, dropped;
+    char *msg;
+    int code, len;
     va_list ap;
 
     va_start(ap, fmt);
     str = hvsprintf(fmt, ap);
     va_end(ap);
 
-    /* Write to the client buffer */
-    written = cbuf_write(c->to, str, strlen(str), &dropped);
-    if (written < 0)
-        err(TRUE, "_client_printf: cbuf_write returned %d", written);
-    else if (dropped > 0)
-        err(FALSE, "_client_printf: cbuf_write dropped %d chars", dropped);
+    if (!c->binary)
+        _client_write(c, str, strlen(str));
+    else {
+        code = strtol(str, &msg, 10);
+        if (msg != str) {
+            if (*msg == ' ')
+                msg++;
+            len = strlen(msg);
+            while (len > 0 && (msg[len - 1] == '\r' || msg[len - 1] == '\n'))
+                len--;
+            _client_write_frame(c, CP_IS_ALLDONE(code) ? CPB_RSP_DONE
+                                : CPB_RSP_INFO, code, msg, len);
+        }
+    }
 
     /* Free the tmp string */
     xfree(str);
 }
 
+static int _cmp_node_id(const void *a, const void *b)
+{
+    return strcmp(node_ids[*(const int *)a], node_ids[*(const int *)b]);
+}
+
+static int _cmp_node_name(const void *key, const void *id)
+{
+    return strcmp((const char *)key, node_ids[*(const int *)id]);
+}
+
+/*
+ * Map between node names and binary protocol node IDs.  IDs are positions
+ * in the sorted node list (as sent in response to CPB_OP_NODES), which
+ * doesn't change once the configuration is loaded.  The configuration's
+ * own node list is left in the order it was given.
+ */
+static void _init_node_ids(void)
+{
+    hostlist_t nodes;
+    hostlist_iterator_t itr;
+    char *node;
+    int i = 0;
+
+    if (node_ids != NULL)
+        return;
+    nodes = hostlist_copy(conf_getnodes());
+    hostlist_sort(nodes);
+    node_ids_len = hostlist_count(nodes);
+    node_ids = (char **)xmalloc(sizeof(char *) * (node_ids_len + 1));
+    if ((itr = hostlist_iterator_create(nodes)) == NULL)
+        err_exit(FALSE, "hostlist_iterator_create failed");
+    while ((node = hostlist_next(itr)) && i < node_ids_len) {
+        node_ids[i++] = xstrdup(node);
+        free(node); /* hostlist_next strdups returned string */
+    }
+    hostlist_iterator_destroy(itr);
+    hostlist_destroy(nodes);
+    node_ids_len = i;
+
+    node_ids_byname = (int *)xmalloc(sizeof(int) * (node_ids_len + 1));
+    for (i = 0; i < node_ids_len; i++)
+        node_ids_byname[i] = i;
+    qsort(node_ids_byname, node_ids_len, sizeof(int), _cmp_node_id);
+}
+
+/* Return the binary protocol ID of node, or -1 if it is unknown.
+ */
+static int _node_id(char *node)
+{
+    int *id;
+
+    _init_node_ids();
+    id = bsearch(node, node_ids_byname, node_ids_len, sizeof(int),
+                 _cmp_node_name);
+    return id ? *id : -1;
+}
+
+/* Bitmaps of node IDs, e.g. the nodes a client is watching.
+ */
+#define NODE_BIT_SET(map, id)   ((map)[(id) / 8] |= 1 << ((id) % 8))
+#define NODE_BIT_CLR(map, id)   ((map)[(id) / 8] &= ~(1 << ((id) % 8)))
+#define NODE_BIT_ISSET(map, id) ((map)[(id) / 8] & (1 << ((id) % 8)))
+
+static unsigned char *_node_bitmap_create(void)
+{
+    _init_node_ids();
+    return (unsigned char *)xmalloc(node_ids_len / 8 + 1); /* zeroed */
+}
+
 /*
  * Initialize module.
  */
@@ -192,6 +335,9 @@ void cli_init(void)
 {
     /* create cli_clients list */
     cli_clients = list_create((ListDelF) _destroy_client);
+
+    /* get notified of plug state changes for watching clients */
+    dev_set_plugstate_cb(_plugstate_changed);
 }
 
 /*
@@ -201,6 +347,19 @@ void cli_fini(void)
 {
     /* destroy clients */
     list_destroy(cli_clients);
+
+    _unlink_unix_listeners();
+
+    if (node_ids != NULL) {
+        int i;
+
+        for (i = 0; i < node_ids_len; i++)
+            xfree(node_ids[i]);
+        xfree(node_ids);
+        node_ids = NULL;
+        xfree(node_ids_byname);
+        node_ids_byname = NULL;
+    }
 }
 
 /*
@@ -225,6 +384,7 @@ static hostlist_t _hostlist_create_validated(Client * c, char *str)
         return NULL;
     }
     conf_exp_aliases(hl);
+    hostlist_uniq(hl);  /* aliases may expand to duplicate nodes */
     if ((badhl = hostlist_create(NULL)) == NULL) {
         /* Note: other hostlist failures not user-induced so OK to be vague */
         _internal_error_response(c);
@@ -481,6 +641,105 @@ static void _client_query_status_reply_nointerp(Client * c, bool error)
     hostlist_destroy(hl);
 }
 
+/*
+ * Reply to binary client request for plug/beacon status (op=CPB_RSP_STATES)
+ * or temperature (op=CPB_RSP_VALUES).
+ */
+static void _client_query_status_reply_binary(Client * c, bool error, int op)
+{
+    Arg *arg;
+    ArgListIterator itr;
+    unsigned char *buf = NULL;
+    int len = 0, size = 0, need;
+
+    assert(c->cmd != NULL);
+
+    itr = arglist_iterator_create(c->cmd->arglist);
+    while ((arg = arglist_next(itr))) {
+        need = 5 + (op == CPB_RSP_VALUES && arg->val ? strlen(arg->val) : 0);
+        if (len + need > size) {
+            size = (len + need) * 2;
+            buf = buf ? (unsigned char *)xrealloc((char *)buf, size)
+                      : (unsigned char *)xmalloc(size);
+        }
+        CPB_PUT32(&buf[len], _node_id(arg->node));
+        len += 4;
+        if (op == CPB_RSP_STATES) {
+            buf[len++] = arg->state == ST_ON ? CPB_STATE_ON
+                       : arg->state == ST_OFF ? CPB_STATE_OFF
+                       : CPB_STATE_UNKNOWN;
+        } else {
+            if (arg->val) {
+                strcpy((char *)&buf[len], arg->val);
+                len += strlen(arg->val);
+            }
+            buf[len++] = '\0';
+        }
+    }
+    arglist_iterator_destroy(itr);
+
+    _client_write_frame(c, op, 0, buf, len);
+    if (buf)
+        xfree(buf);
+
+    if (error)
+        _client_printf(c, CP_ERR_QRY_COMPLETE);
+    else
+        _client_printf(c, CP_RSP_QRY_COMPLETE);
+}
+
+/*
+ * Reply to binary client request for the node list.
+ */
+static void _client_query_nodes_reply_binary(Client * c)
+{
+    char *buf;
+    int i, len = 0;
+
+    _init_node_ids();
+    for (i = 0; i < node_ids_len; i++)
+        len += strlen(node_ids[i]) + 1;
+    buf = xmalloc(len + 1);
+    for (i = 0, len = 0; i < node_ids_len; i++) {
+        strcpy(buf + len, node_ids[i]);
+        len += strlen(node_ids[i]) + 1;
+    }
+    _client_write_frame(c, CPB_RSP_NODES, 0, buf, len);
+    xfree(buf);
+
+    _client_printf(c, CP_RSP_QRY_COMPLETE);
+}
+
+/*
+ * Helper for _parse_frame.
+ * Convert an array of node IDs to a hostlist string which caller must
+ * xfree().  If any IDs are invalid, issue error response and return NULL.
+ */
+static char *_node_ids_to_hosts(Client * c, unsigned char *buf, int len)
+{
+    hostlist_t hl = hostlist_create(NULL);
+    unsigned long id;
+    char *str = NULL;
+    int i;
+
+    _init_node_ids();
+    for (i = 0; i + 4 <= len; i += 4) {
+        id = CPB_GET32(&buf[i]);
+        if (id >= (unsigned long)node_ids_len) {
+            char tmpstr[32];
+
+            snprintf(tmpstr, sizeof(tmpstr), "node ID %lu", id);
+            _client_printf(c, CP_ERR_NOSUCHNODES, tmpstr);
+            hostlist_destroy(hl);
+            return NULL;
+        }
+        hostlist_push_host(hl, node_ids[id]);
+    }
+    str = _xhostlist_ranged_string(hl);
+    hostlist_destroy(hl);
+    return str;
+}
+
 /*
  * Create Command.
  * On error, return an error to the client and NULL to the caller.
@@ -553,23 +812,59 @@ static char *_strip_whitespace(char *str)
 }
 
 /*
- * Parse a line of input and create a Command (and enqueue device actions)
- * if needed.
+ * Append a line of input to the client's pending request.  A line ending
+ * in CP_CONTINUE is joined to the next one (backslash and line break
+ * removed), so a request such as a large hostlist may exceed CP_LINEMAX.
+ * Each line is still limited to CP_LINEMAX and the whole request to
+ * CP_REQMAX.  Return TRUE if more lines are expected.
  */
-static void _parse_input(Client * c, char *input)
+static bool _append_input(Client * c, char *input)
 {
     char *str = _strip_whitespace(input);
-    char arg1[CP_LINEMAX];
-    Command *cmd = NULL;
+    int len = strlen(str);
+    bool more = FALSE;
 
-    memset(arg1, 0, CP_LINEMAX);
+    if (len > 0 && str[len - 1] == CP_CONTINUE) {
+        str[--len] = '\0';
+        more = TRUE;
+    }
+    if (c->reqlen < 0)                          /* already too long */
+        return more;
+    if (len >= CP_LINEMAX || c->reqlen + len >= CP_REQMAX) {
+        if (c->req)
+            xfree(c->req);
+        c->req = NULL;
+        c->reqlen = -1;
+        return more;
+    }
+    if (c->req == NULL)
+        c->req = xmalloc(len + 1);
+    else
+        c->req = xrealloc(c->req, c->reqlen + len + 1);
+    memcpy(c->req + c->reqlen, str, len + 1);
+    c->reqlen += len;
+    return more;
+}
 
-    /* NOTE: sscanf is safe because 'str' is guaranteed to be < CP_LINEMAX */
+/*
+ * Parse a complete request and create a Command (and enqueue device actions)
+ * if needed.  A NULL request indicates that it exceeded the length limits.
+ */
+static void _parse_input(Client * c, char *str)
+{
+    char *arg1 = NULL;
+    Command *cmd = NULL;
+    bool binary = FALSE;
 
-    if (strlen(str) >= CP_LINEMAX) {
+    /* NOTE: sscanf is safe because 'arg1' is as large as 'str' */
+    if (str != NULL)
+        arg1 = xmalloc(strlen(str) + 1);
+
+    if (str == NULL) {
         _client_printf(c, CP_ERR_TOOLONG);              /* error: too long */
     } else if (c->cmd != NULL) {
         _client_printf(c, CP_ERR_CLIBUSY);              /* error: busy */
+        xfree(arg1);
         return;                                         /* no prompt */
     } else if (!strncasecmp(str, CP_HELP, strlen(CP_HELP))) {
         _client_printf(c, CP_INFO_HELP);                /* help */
@@ -582,6 +877,16 @@ static void _parse_input(Client * c, char *input)
     } else if (!strncasecmp(str, CP_EXPRANGE, strlen(CP_EXPRANGE))) {
         c->exprange = !c->exprange;                     /* exprange */
         _client_printf(c, CP_RSP_EXPRANGE, c->exprange ? "ON" : "OFF");
+    } else if (!strncasecmp(str, CP_BINARY, strlen(CP_BINARY))) {
+        _client_printf(c, CP_RSP_BINARY);               /* binary */
+        binary = TRUE;
+    } else if (sscanf(str, CP_WATCH, arg1) == 1) {      /* watch hostlist */
+        _client_watch(c, arg1);
+    } else if (!strncasecmp(str, CP_WATCH_ALL, strlen(CP_WATCH_ALL))) {
+        _client_watch(c, NULL);
+    } else if (!strncasecmp(str, CP_UNWATCH, strlen(CP_UNWATCH))) {
+        _client_unwatch(c);                             /* unwatch */
+        _client_printf(c, CP_RSP_WATCH, "OFF");
     } else if (!strncasecmp(str, CP_QUIT, strlen(CP_QUIT))) {
         c->client_quit = TRUE;
         _client_printf(c, CP_RSP_QUIT);                 /* quit */
@@ -617,26 +922,315 @@ static void _parse_input(Client * c, char *input)
     } else {                                            /* error: unknown */
         _client_printf(c, CP_ERR_UNKNOWN);
     }
+    if (arg1)
+        xfree(arg1);
 
-    /* enqueue device actions and tie up the client if necessary */
-    if (cmd) {
-        assert(cmd->hl != NULL);
-        dbg(DBG_CLIENT, "_parse_input: enqueuing actions");
-        cmd->pending = dev_enqueue_actions(cmd->com, cmd->hl, _act_finish,
-                c->telemetry ? _telemetry_printf : NULL,
-                c->client_id, cmd->arglist);
-        if (cmd->pending == 0) {
-            _client_printf(c, CP_ERR_UNIMPL);
-            _destroy_command(cmd);
-            cmd = NULL;
-        }
-        assert(c->cmd == NULL);
-        c->cmd = cmd;
-    }
+    if (cmd)
+        _start_command(c, cmd);
 
     /* reissue prompt if we didn't queue up any device actions */
-    if (cmd == NULL && !c->client_quit)
+    if (c->cmd == NULL && !c->client_quit)
         _client_printf(c, CP_PROMPT);
+
+    /* switch protocols after the last text response */
+    if (binary)
+        c->binary = TRUE;
+}
+
+/*
+ * Subscribe client to state changes on nodes in 'str' (all nodes if NULL),
+ * replacing any previous subscription.  The current state of each watched
+ * node is reported first so the client has a baseline.  The subscription
+ * is kept as a bitmap of node IDs so a state change costs O(1) per client.
+ */
+static void _client_watch(Client * c, char *str)
+{
+    hostlist_t hl;
+    hostlist_iterator_t itr;
+    char *node;
+    int id;
+
+    if (str != NULL) {
+        if (!(hl = _hostlist_create_validated(c, str)))
+            return;
+    } else
+        hl = hostlist_copy(conf_getnodes());
+
+    _client_unwatch(c);
+    c->watch = _node_bitmap_create();
+    c->watch_pending = _node_bitmap_create();
+
+    if ((itr = hostlist_iterator_create(hl)) == NULL)
+        err_exit(FALSE, "hostlist_iterator_create failed");
+    while ((node = hostlist_next(itr))) {
+        if ((id = _node_id(node)) >= 0 && !NODE_BIT_ISSET(c->watch, id)) {
+            NODE_BIT_SET(c->watch, id);
+            NODE_BIT_SET(c->watch_pending, id);
+            c->watch_npending++;
+        }
+        free(node);
+    }
+    hostlist_iterator_destroy(itr);
+    hostlist_destroy(hl);
+
+    _client_printf(c, CP_RSP_WATCH, "ON");
+}
+
+/*
+ * Cancel client's subscription to state changes, if any.
+ */
+static void _client_unwatch(Client * c)
+{
+    if (c->watch) {
+        xfree(c->watch);
+        c->watch = NULL;
+    }
+    if (c->watch_pending) {
+        xfree(c->watch_pending);
+        c->watch_pending = NULL;
+    }
+    c->watch_npending = 0;
+}
+
+/*
+ * Mark node as changed for each client watching it.  Repeated changes
+ * to the same node collapse into one pending bit, so a client that
+ * is slow to read costs nothing more than its bitmaps.
+ */
+static void _plugstate_changed(char *node, InterpState state)
+{
+    ListIterator itr;
+    Client *c;
+    int id = _node_id(node);
+
+    if (id < 0)
+        return;
+    itr = list_iterator_create(cli_clients);
+    while ((c = list_next(itr))) {
+        if (c->watch == NULL || !NODE_BIT_ISSET(c->watch, id))
+            continue;
+        if (!NODE_BIT_ISSET(c->watch_pending, id)) {
+            NODE_BIT_SET(c->watch_pending, id);
+            c->watch_npending++;
+        }
+    }
+    list_iterator_destroy(itr);
+}
+
+/*
+ * Send pending state changes to a watching binary client as one
+ * CPB_RSP_CHANGED frame, in node ID order.
+ */
+static void _client_watch_flush_binary(Client * c)
+{
+    unsigned char *buf;
+    int id, len = 0;
+
+    buf = (unsigned char *)xmalloc(c->watch_npending * 5);
+    for (id = 0; id < node_ids_len && c->watch_npending > 0; id++) {
+        if (NODE_BIT_ISSET(c->watch_pending, id)) {
+            NODE_BIT_CLR(c->watch_pending, id);
+            c->watch_npending--;
+            CPB_PUT32(&buf[len], id);
+            len += 4;
+            switch (dev_get_plugstate(node_ids[id])) {
+                case ST_ON:
+                    buf[len++] = CPB_STATE_ON;
+                    break;
+                case ST_OFF:
+                    buf[len++] = CPB_STATE_OFF;
+                    break;
+                default:
+                    buf[len++] = CPB_STATE_UNKNOWN;
+                    break;
+            }
+        }
+    }
+    _client_write_frame(c, CPB_RSP_CHANGED, 0, buf, len);
+    xfree(buf);
+}
+
+/*
+ * Send pending state changes to a watching client, grouped by current
+ * state.  Nothing is sent until the client's output buffer is empty,
+ * so changes keep coalescing while the client is slow to read.
+ */
+static void _client_watch_flush(Client * c)
+{
+    hostlist_t hls[3];          /* indexed by InterpState */
+    InterpState order[] = { ST_ON, ST_OFF, ST_UNKNOWN };
+    hostlist_iterator_t itr;
+    char *str;
+    int i, id;
+
+    if (c->watch_pending == NULL || c->watch_npending == 0)
+        return;
+    if (!cbuf_is_empty(c->to))
+        return;
+    if (c->binary) {
+        _client_watch_flush_binary(c);
+        return;
+    }
+
+    for (i = 0; i < 3; i++)
+        hls[i] = hostlist_create(NULL);
+    for (id = 0; id < node_ids_len && c->watch_npending > 0; id++) {
+        if (NODE_BIT_ISSET(c->watch_pending, id)) {
+            NODE_BIT_CLR(c->watch_pending, id);
+            c->watch_npending--;
+            hostlist_push_host(hls[dev_get_plugstate(node_ids[id])],
+                               node_ids[id]);
+        }
+    }
+
+    for (i = 0; i < 3; i++) {
+        hostlist_t hl = hls[order[i]];
+        const char *state = order[i] == ST_ON ? "on"
+                          : order[i] == ST_OFF ? "off" : "unknown";
+
+        if (hostlist_is_empty(hl))
+            continue;
+        hostlist_sort(hl);
+        if (c->exprange) {
+            if ((itr = hostlist_iterator_create(hl)) == NULL)
+                err_exit(FALSE, "hostlist_iterator_create failed");
+            while ((str = hostlist_next(itr))) {
+                _client_printf(c, CP_INFO_WATCH, str, state);
+                free(str);
+            }
+            hostlist_iterator_destroy(itr);
+        } else {
+            str = _xhostlist_ranged_string(hl);
+            _client_printf(c, CP_INFO_WATCH, str, state);
+            xfree(str);
+        }
+    }
+    for (i = 0; i < 3; i++)
+        hostlist_destroy(hls[i]);
+}
+
+/*
+ * Enqueue device actions for a Command and tie up the client until they
+ * complete.  If no actions could be queued, issue error response.
+ */
+static void _start_command(Client * c, Command * cmd)
+{
+    assert(cmd->hl != NULL);
+    assert(c->cmd == NULL);
+    dbg(DBG_CLIENT, "_start_command: enqueuing actions");
+    cmd->pending = dev_enqueue_actions(cmd->com, cmd->hl, _act_finish,
+            c->telemetry ? _telemetry_printf : NULL,
+            c->client_id, cmd->arglist);
+    if (cmd->pending == 0) {
+        _client_printf(c, CP_ERR_UNIMPL);
+        _destroy_command(cmd);
+        return;
+    }
+    c->cmd = cmd;
+}
+
+/*
+ * Parse a binary request frame and create a Command (and enqueue device
+ * actions) if needed.
+ */
+static void _parse_frame(Client * c, int op, int targ, unsigned char *buf,
+                         int len)
+{
+    Command *cmd = NULL;
+    char *hosts = NULL;
+    bool watch = FALSE;
+    int com;
+
+    switch (op) {
+        case CPB_OP_QUIT:
+            c->client_quit = TRUE;
+            _client_printf(c, CP_RSP_QUIT);
+            _handle_write(c);
+            return;
+        case CPB_OP_NODES:
+            _client_query_nodes_reply_binary(c);
+            return;
+        case CPB_OP_UNWATCH:
+            _client_unwatch(c);
+            _client_printf(c, CP_RSP_WATCH, "OFF");
+            return;
+        case CPB_OP_WATCH:          /* takes the same targets as status */
+            watch = TRUE;
+            com = PM_STATUS_PLUGS;
+            break;
+        case CPB_OP_STATUS:
+            com = PM_STATUS_PLUGS;
+            break;
+        case CPB_OP_BEACON:
+            com = PM_STATUS_BEACON;
+            break;
+        case CPB_OP_TEMP:
+            com = PM_STATUS_TEMP;
+            break;
+        case CPB_OP_ON:
+            com = PM_POWER_ON;
+            break;
+        case CPB_OP_OFF:
+            com = PM_POWER_OFF;
+            break;
+        case CPB_OP_CYCLE:
+            com = PM_POWER_CYCLE;
+            break;
+        case CPB_OP_RESET:
+            com = PM_RESET;
+            break;
+        case CPB_OP_FLASH:
+            com = PM_BEACON_ON;
+            break;
+        case CPB_OP_UNFLASH:
+            com = PM_BEACON_OFF;
+            break;
+        default:
+            _client_printf(c, CP_ERR_UNKNOWN);
+            return;
+    }
+
+    switch (targ) {
+        case CPB_TARG_ALL:          /* queries only, like the text protocol */
+            if (len > 0 || (com != PM_STATUS_PLUGS && com != PM_STATUS_BEACON
+                                && com != PM_STATUS_TEMP)) {
+                _client_printf(c, CP_ERR_PARSE);
+                return;
+            }
+            break;
+        case CPB_TARG_HOSTLIST:
+            if (len == 0) {
+                _client_printf(c, CP_ERR_PARSE);
+                return;
+            }
+            hosts = xmalloc(len + 1);
+            memcpy(hosts, buf, len);
+            break;
+        case CPB_TARG_NODEID:
+            if (len == 0 || len % 4 != 0) {
+                _client_printf(c, CP_ERR_PARSE);
+                return;
+            }
+            if (!(hosts = _node_ids_to_hosts(c, buf, len)))
+                return;
+            break;
+        default:
+            _client_printf(c, CP_ERR_PARSE);
+            return;
+    }
+
+    if (watch) {
+        _client_watch(c, hosts);
+        if (hosts)
+            xfree(hosts);
+        return;
+    }
+
+    cmd = _create_command(c, com, hosts);
+    if (hosts)
+        xfree(hosts);
+    if (cmd)
+        _start_command(c, cmd);
 }
 
 /*
@@ -688,10 +1282,18 @@ static void _act_finish(int client_id, ActError acterr, const char *fmt, ...)
         switch (c->cmd->com) {
         case PM_STATUS_PLUGS:      /* status */
         case PM_STATUS_BEACON:     /* beacon */
-            _client_query_status_reply(c, c->cmd->error);
+            if (c->binary)
+                _client_query_status_reply_binary(c, c->cmd->error,
+                                                  CPB_RSP_STATES);
+            else
+                _client_query_status_reply(c, c->cmd->error);
             break;
         case PM_STATUS_TEMP:       /* temp */
-            _client_query_status_reply_nointerp(c, c->cmd->error);
+            if (c->binary)
+                _client_query_status_reply_binary(c, c->cmd->error,
+                                                  CPB_RSP_VALUES);
+            else
+                _client_query_status_reply_nointerp(c, c->cmd->error);
             break;
         case PM_POWER_ON:          /* on */
         case PM_POWER_OFF:         /* off */
@@ -746,6 +1348,9 @@ static void _destroy_client(Client *c)
         xfree(c->ip);
     if (c->host)
         xfree(c->host);
+    if (c->req)
+        xfree(c->req);
+    _client_unwatch(c);
     xfree(c);
     if (one_client)
         server_done = TRUE;
@@ -765,6 +1370,111 @@ static Client *_find_client(int seq)
     return list_find_first(cli_clients, (ListFindF) _match_client, &seq);
 }
 
+/*
+ * Create a unix domain listen socket at 'path'.  Authorization is by peer
+ * credentials (see conf_unix_peer_allowed()), so anyone may connect.
+ * On failure, return NO_FD with errno set and 'what' pointing at the
+ * failing call.
+ */
+static int _listen_unix(char *path, char **what)
+{
+    struct sockaddr_un saddr;
+    struct stat sb;
+    int fd, saved_errno;
+
+    if (strlen(path) >= sizeof(saddr.sun_path))
+        err_exit(FALSE, "unix socket path too long: %s", path);
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sun_family = AF_UNIX;
+    strcpy(saddr.sun_path, path);
+
+    /* remove a stale socket left by a previous instance, but not one that
+     * a running instance is still listening on
+     */
+    if (lstat(path, &sb) == 0 && S_ISSOCK(sb.st_mode)) {
+        if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+            *what = "socket";
+            return NO_FD;
+        }
+        if (connect(fd, (struct sockaddr *)&saddr, sizeof(saddr)) == 0)
+            err_exit(FALSE, "%s: socket is in use by another process", path);
+        saved_errno = errno;
+        close(fd);
+        if (saved_errno == ECONNREFUSED)
+            (void)unlink(path);
+        else if (saved_errno != ENOENT) {
+            errno = saved_errno;
+            *what = "connect";
+            return NO_FD;
+        }
+    }
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        *what = "socket";
+        return NO_FD;
+    }
+    nonblock_set(fd);
+    if (bind(fd, (struct sockaddr *)&saddr, sizeof(saddr)) < 0) {
+        *what = "bind";
+        goto error;
+    }
+    if (chmod(path, 0666) < 0) {
+        *what = "chmod";
+        goto error;
+    }
+    if (listen(fd, LISTEN_BACKLOG) < 0) {
+        *what = "listen";
+        goto error;
+    }
+    return fd;
+error:
+    saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return NO_FD;
+}
+
+/*
+ * Remove unix domain sockets created by _listen_unix().
+ */
+static void _unlink_unix_listeners(void)
+{
+    ListIterator itr;
+    char *addr;
+    int plen = strlen(UNIX_PREFIX);
+
+    if (listen_fds == NULL)
+        return;
+    itr = list_iterator_create(conf_get_listen());
+    while ((addr = list_next(itr))) {
+        if (!strncmp(addr, UNIX_PREFIX, plen))
+            (void)unlink(addr + plen);
+    }
+    list_iterator_destroy(itr);
+}
+
+/*
+ * Get the credentials of the process on the other end of unix domain
+ * socket 'fd'.
+ */
+static bool _unix_peer_cred(int fd, uid_t *uidp, gid_t *gidp)
+{
+#if defined(SO_PEERCRED)
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+        return FALSE;
+    *uidp = cred.uid;
+    *gidp = cred.gid;
+    return TRUE;
+#elif HAVE_GETPEEREID
+    return (getpeereid(fd, uidp, gidp) == 0);
+#else
+    return FALSE;
+#endif
+}
+
 /*
  * Begin listening for clients on configured listen addresses.
  * This function leaves listen_fds[] (of size listen_fds_len) initialized
@@ -787,6 +1497,20 @@ static void _listen_client(void)
     addrs = conf_get_listen();
     itr = list_iterator_create(addrs);
     while ((addr = list_next(itr))) {
+        if (!strncmp(addr, UNIX_PREFIX, strlen(UNIX_PREFIX))) {
+            listen_fds_len++;
+            if (listen_fds == NULL)
+                listen_fds = (int *)xmalloc(sizeof(int) * listen_fds_len);
+            else
+                listen_fds = (int *)xrealloc((char *)listen_fds,
+                                             sizeof(int) * listen_fds_len);
+            listen_fds[i] = _listen_unix(addr + strlen(UNIX_PREFIX), &what);
+            if (listen_fds[i++] != NO_FD)
+                count++;
+            else
+                saved_errno = errno;
+            continue;
+        }
         host = addr;
         if (!(port = strchr(addr, ':')))
             err_exit(FALSE, "error parsing listen address: %s", addr);
@@ -883,6 +1607,16 @@ static void _create_client_socket(int fd)
     c->exprange = FALSE;
     c->ofd = NO_FD;
     c->client_quit = FALSE;
+    c->binary = FALSE;
+    c->authorizing = FALSE;
+    c->req = NULL;
+    c->reqlen = 0;
+    c->watch = NULL;
+    c->watch_pending = NULL;
+    c->watch_npending = 0;
+    c->ip = NULL;
+    c->host = NULL;
+    c->port = 0;
 
     c->fd = accept(fd, (struct sockaddr *)&addr, &addr_size);
     if (c->fd < 0){
@@ -898,6 +1632,27 @@ static void _create_client_socket(int fd)
         err_exit(TRUE, "accept");
     }
 
+    /* local client: authorize by peer credentials, skip name lookups */
+    if (addr.ss_family == AF_UNIX) {
+        uid_t uid;
+        gid_t gid;
+
+        if (!_unix_peer_cred(c->fd, &uid, &gid)) {
+            err(TRUE, "_create_client: could not get peer credentials");
+            _destroy_client(c);
+            return;
+        }
+        if (!conf_unix_peer_allowed(uid, gid)) {
+            err(FALSE, "_create_client: uid %d gid %d not allowed",
+                (int)uid, (int)gid);
+            _destroy_client(c);
+            return;
+        }
+        c->ip = hsprintf("uid=%d", (int)uid);
+        c->host = xstrdup("localhost");
+        goto accepted;
+    }
+
     if ((error = getnameinfo((struct sockaddr *)&addr, addr_size,
                              hbuf, sizeof(hbuf), pbuf, sizeof(pbuf),
                              NI_NUMERICHOST | NI_NUMERICSERV))) {
@@ -908,26 +1663,21 @@ static void _create_client_socket(int fd)
     c->ip   = xstrdup(hbuf);
     c->port = strtoul(pbuf, NULL, 10);
 
-    if ((error = getnameinfo((struct sockaddr *)&addr, addr_size,
-                             hbuf, sizeof(hbuf), NULL, 0, NI_NAMEREQD)))
-        err(FALSE, "_create_client: getnameinfo: %s", gai_strerror(error));
-    else
-        c->host = xstrdup(hbuf);
-
 #if HAVE_TCP_WRAPPERS
-    /* get authorization from tcp wrappers */
+    /* tcp wrappers rules may need the host name, which is looked up
+     * without blocking the poll loop.  Input is held until then.
+     */
     if (conf_get_use_tcp_wrappers()) {
-        if (!hosts_ctl(DAEMON_NAME,
-                       c->host ? c->host : STRING_UNKNOWN,
-                       c->ip, STRING_UNKNOWN)) {
-            err(FALSE, "_create_client: tcp wrappers denies %s:%d",
-                c->host ? c->host : c->ip, c->port);
-            _destroy_client(c);
-            return;
-        }
+        int *idp = (int *)xmalloc(sizeof(int));
+
+        *idp = c->client_id;
+        c->authorizing = TRUE;
+        resolve_name((struct sockaddr *)&addr, addr_size,
+                     _client_authorize, idp);
     }
 #endif
 
+accepted:
     /* create I/O buffers */
     c->to = cbuf_create(MIN_CLIENT_BUF, MAX_CLIENT_BUF);
     c->from = cbuf_create(MIN_CLIENT_BUF, MAX_CLIENT_BUF);
@@ -942,9 +1692,39 @@ static void _create_client_socket(int fd)
         c->port, c->fd);
 
     /* prompt the client */
+    if (!c->authorizing) {
+        _client_printf(c, CP_VERSION, PACKAGE_VERSION);
+        _client_printf(c, CP_PROMPT);
+    }
+}
+
+#if HAVE_TCP_WRAPPERS
+/*
+ * Get authorization from tcp wrappers once the client's host name lookup
+ * completes ('name' is NULL if it has none).
+ */
+static void _client_authorize(void *arg, char *name)
+{
+    int client_id = *(int *)arg;
+    Client *c;
+
+    xfree(arg);
+    if (!(c = _find_client(client_id)))
+        return;                                 /* client went away */
+    if (name)
+        c->host = xstrdup(name);
+    if (!hosts_ctl(DAEMON_NAME, c->host ? c->host : STRING_UNKNOWN,
+                   c->ip, STRING_UNKNOWN)) {
+        err(FALSE, "_create_client: tcp wrappers denies %s:%d",
+            c->host ? c->host : c->ip, c->port);
+        list_delete_all(cli_clients, (ListFindF) _match_client, &client_id);
+        return;
+    }
+    c->authorizing = FALSE;
     _client_printf(c, CP_VERSION, PACKAGE_VERSION);
     _client_printf(c, CP_PROMPT);
 }
+#endif
 
 static void _create_client_stdio(void)
 {
@@ -958,6 +1738,13 @@ static void _create_client_stdio(void)
     c->telemetry = FALSE;
     c->exprange = FALSE;
     c->client_quit = FALSE;
+    c->binary = FALSE;
+    c->authorizing = FALSE;
+    c->req = NULL;
+    c->reqlen = 0;
+    c->watch = NULL;
+    c->watch_pending = NULL;
+    c->watch_npending = 0;
     c->fd = STDIN_FILENO;
     c->ofd = STDOUT_FILENO;
     c->host = xstrdup("localhost");
@@ -1022,12 +1809,54 @@ static void _handle_write(Client * c)
 static void _handle_input(Client *c)
 {
     char buf[MAX_CLIENT_BUF];
-    int len;
+    int len = 0;
 
-    while ((len = cbuf_read_line(c->from, buf, sizeof(buf), 1)) > 0)
-        _parse_input(c, buf);
+    if (c->authorizing)
+        return;
+    while (!c->binary
+            && (len = cbuf_read_line(c->from, buf, sizeof(buf), 1)) > 0) {
+        if (_append_input(c, buf))
+            continue;                           /* continuation line */
+        _parse_input(c, c->reqlen < 0 ? NULL : c->req ? c->req : "");
+        if (c->req)
+            xfree(c->req);
+        c->req = NULL;
+        c->reqlen = 0;
+    }
     if (len < 0)
         err(TRUE, "client cbuf_read_line returned %d", len);
+    if (c->binary)
+        _handle_frames(c);
+}
+
+/*
+ * Parse binary request frames from the input cbuf.  As with the text
+ * protocol, one command runs at a time, but frames that arrive while it
+ * is running are left in the buffer until it completes, not refused.
+ */
+static void _handle_frames(Client *c)
+{
+    unsigned char hdr[CPB_HDRLEN];
+    unsigned char *buf;
+    unsigned long len;
+
+    while (c->cmd == NULL && !c->client_quit
+            && cbuf_peek(c->from, hdr, CPB_HDRLEN) == CPB_HDRLEN) {
+        len = CPB_GET32(hdr);
+        if (len > CPB_FRAMEMAX - CPB_HDRLEN) {
+            err(FALSE, "client sent oversized frame (%lu bytes)", len);
+            c->client_quit = TRUE;
+            break;
+        }
+        if ((unsigned long)cbuf_used(c->from) < CPB_HDRLEN + len)
+            break;
+        cbuf_drop(c->from, CPB_HDRLEN);
+        buf = (unsigned char *)xmalloc(len + 1);
+        if (len > 0)
+            cbuf_read(c->from, buf, len);
+        _parse_frame(c, hdr[4], hdr[5], buf, len);
+        xfree(buf);
+    }
 }
 
 /*
@@ -1055,6 +1884,9 @@ void cli_pre_poll(xpollfd_t pfd)
          */
         xpollfd_set(pfd, client->fd, XPOLLIN);
 
+        /* report state changes once earlier output has drained */
+        _client_watch_flush(client);
+
         /* need to be in the write set if we are sending anything */
         if (!cbuf_is_empty(client->to)) {
             if (client->ofd != NO_FD)
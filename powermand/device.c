@@ -30,7 +30,11 @@
  *
  * parser - at config file parse time, each device is instantiated by
  * the dev_create() function, which puts the device on the local 'dev_devices'
- * list.
+ * list.  A device that accepts concurrent sessions gets additional Devices,
+ * one per extra connection, that share its plugs and are added with
+ * dev_add_session().  Client actions are spread across the sessions.
+ * A device may also get a spare Device, added with dev_add_spare(), that
+ * stays connected and logged in so the device can reconnect on it at once.
  *
  * client - calls dev_enqueue_actions() to cause one type of script to
  * run across possibly multiple devices.  This function returns an "action
@@ -57,6 +61,9 @@
 
 #include <errno.h>
 #include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
 #include <time.h>
 #include <fcntl.h>
 #include <ctype.h>
@@ -65,6 +72,7 @@
 #include <assert.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "list.h"
 #include "hostlist.h"
@@ -78,6 +86,9 @@
 #include "device.h"
 #include "arglist.h"
 #include "device_private.h"
+#include "device_pipe.h"
+#include "device_http.h"
+#include "snapshot.h"
 #include "error.h"
 #include "debug.h"
 #include "client_proto.h"
@@ -90,6 +101,7 @@
  */
 typedef struct {
     List plugs;                 /* name(s) used for send "%s" (NULL=all) */
+    char *arg;                  /* send "%s" if no plugs (select script) */
     List block;                 /* List of stmts */
     ListIterator stmtitr;       /* next stmt in block */
     Stmt *cur;                  /* current stmt */
@@ -114,6 +126,7 @@ typedef struct {
     struct timeval time_stamp;  /* time stamp for timeouts */
     struct timeval delay_start; /* time stamp for delay completion */
     ArgList arglist;            /* argument for query actions (list of Arg's) */
+    int tries;                  /* times action has been retried */
 } Action;
 
 
@@ -124,6 +137,8 @@ static bool _process_foreach(Device *dev, Action *act, ExecCtx *e);
 static bool _process_setplugstate(Device * dev, Action *act, ExecCtx *e);
 static bool _process_expect(Device * dev, Action *act, ExecCtx *e);
 static bool _process_send(Device * dev, Action *act, ExecCtx *e);
+static bool _process_request(Device * dev, Action *act, ExecCtx *e,
+        struct timeval *timeout);
 static bool _process_delay(Device * dev, Action *act, ExecCtx *e,
         struct timeval *timeout);
 static int _match_name(Device * dev, void *key);
@@ -147,14 +162,51 @@ static int _enqueue_targetted_actions(Device * dev, int com, hostlist_t hl,
 static char *_getregex_buf(cbuf_t b, xregex_t re, xregex_match_t xm);
 static bool _command_needs_device(Device * dev, hostlist_t hl);
 static void _enqueue_ping(Device * dev, struct timeval *timeout);
+static void _dispatch_action(Device *dev, Action *act);
 static void _enqueue_login(Device *dev);
+static void _connected(Device *dev);
+static void _connect_failed(Device *dev);
+static struct timeval *_connect_timeout(Device *dev);
 static void _disconnect(Device * dev);
+static void _set_plugstate(char *node, InterpState state);
+static void _set_plugstate_all(Device * dev, List plugs, InterpState state);
+static const char *_state_str(InterpState state);
 static bool _connect(Device * dev);
 static bool _reconnect(Device * dev, struct timeval *timeout);
 static bool _time_to_reconnect(Device * dev, struct timeval *timeout);
+static bool _connect_slot(Device *dev, struct timeval *timeout);
+
+/* A device is considered down after dev_down_failures connects in a row
+ * have failed (zero: never).  Actions for it then fail at once with
+ * ACT_EDEVDOWN instead of waiting for the connect timeout, while
+ * reconnects continue in the background with the usual backoff.
+ */
+#define _device_down(dev) ((dev)->connect_state != DEV_CONNECTED \
+                           && dev_down_failures > 0 \
+                           && (dev)->connect_failures >= dev_down_failures)
+
+/* How often a device waiting for a connection budget slot, a connect
+ * slot, its turn on a shared connection, or other sessions to finish
+ * with some plugs checks again.
+ */
+#define DEV_WAIT_MS         100
 
 static List dev_devices = NULL;
+static List dev_sessions = NULL;        /* dev_devices + their extra sessions */
 static bool short_circuit_delay = FALSE;
+static bool dev_lazy = FALSE;           /* connect only when there is work */
+static int dev_max_open = 0;            /* connection budget (0 = none) */
+static struct timeval dev_idle;         /* idle disconnect time (0 = none) */
+static int dev_nopen = 0;               /* devices connecting or connected */
+static int dev_nclosing = 0;            /* devices logging out to close */
+static struct timeval dev_connect_gap;  /* mean gap between connects (0=none) */
+static struct timeval dev_next_connect; /* earliest time of next connect */
+static int dev_max_starting = 0;        /* concurrent connects (0 = no limit) */
+static int dev_nstarting = 0;           /* devices connecting or logging in */
+static int dev_nurgent = 0;             /* waiting devices with actions */
+static int dev_down_failures = 3;       /* failed connects till down */
+static ArgList dev_plugstate = NULL;    /* last known state of each node */
+static PlugStateCB plugstate_fun = NULL;/* called when plug state changes */
 
 static void _dbg_actions(Device * dev)
 {
@@ -235,6 +287,7 @@ static ExecCtx *_create_exec_ctx(Device *dev, List block, List plugs)
     new->plugs = plugs;
     new->plugitr = NULL;
     new->processing = FALSE;
+    new->arg = NULL;
 
     return new;
 }
@@ -267,9 +320,36 @@ static void _rewind_action(Action *act)
     if (e) {
         list_iterator_reset(e->stmtitr);
         e->cur = list_next(e->stmtitr);
+        e->processing = FALSE;
     }
 }
 
+/*
+ * An action failed or was aborted because the device is about to be
+ * reconnected.  If it may be retried, rewind it so it starts over after
+ * the reconnect and login, and return TRUE.  Actions that had not started
+ * yet are simply left queued.  Internal actions (login, ping) are dropped.
+ */
+static bool _retry_action(Device *dev, Action *act)
+{
+    if (act->complete_fun == NULL || act->com == PM_LOG_IN)
+        return FALSE;
+    if (timerisset(&act->time_stamp)) {
+        if (act->tries >= dev->retries)
+            return FALSE;
+        act->tries++;
+        _rewind_action(act);
+        timerclear(&act->time_stamp);
+        if (act->vpf_fun)
+            act->vpf_fun(act->client_id, "retry(%s): %d of %d", dev->name,
+                    act->tries, dev->retries);
+        dbg(DBG_ACTION, "%s: retrying action %d (%d of %d)", dev->name,
+                act->com, act->tries, dev->retries);
+    }
+    act->errnum = ACT_ESUCCESS;
+    return TRUE;
+}
+
 static Action *_create_action(Device * dev, int com, List plugs,
                               ActionCB complete_fun, VerbosePrintf vpf_fun,
                               int client_id, ArgList arglist)
@@ -291,6 +371,7 @@ static Action *_create_action(Device * dev, int com, List plugs,
 
     act->errnum = ACT_ESUCCESS;
     act->arglist = arglist ? arglist_link(arglist) : NULL;
+    act->tries = 0;
     timerclear(&act->time_stamp);
     return act;
 }
@@ -313,19 +394,110 @@ static void _destroy_action(Action * act)
 void dev_init(bool Sopt)
 {
     dev_devices = list_create((ListDelF) dev_destroy);
+    dev_sessions = list_create((ListDelF) NULL);
     short_circuit_delay = Sopt;
 }
 
 /* tear down this module */
 void dev_fini(void)
 {
+    list_destroy(dev_sessions);
     list_destroy(dev_devices);
+    http_fini();
+    if (dev_plugstate)
+        arglist_unlink(dev_plugstate);
 }
 
 /* add a device to the device list (called from config file parser) */
 void dev_add(Device * dev)
 {
     list_append(dev_devices, dev);
+    list_append(dev_sessions, dev);
+}
+
+/* add an extra session to a device (called from config file parser) */
+void dev_add_session(Device *dev, Device *session)
+{
+    assert(dev->pool == NULL);
+    session->pool = dev;
+    session->plugs = dev->plugs;
+    if (dev->sessions == NULL)
+        dev->sessions = list_create((ListDelF) dev_destroy);
+    list_append(dev->sessions, session);
+    list_append(dev_sessions, session);
+}
+
+/* add a spare connection to a device (called from config file parser) */
+void dev_add_spare(Device *dev, Device *spare)
+{
+    assert(dev->spare == NULL);
+    spare->standby = TRUE;
+    spare->plugs = dev->plugs;
+    dev->spare = spare;
+    list_append(dev_sessions, spare);
+}
+
+/*
+ * Client registers a callback to learn about plug state changes ("watch").
+ */
+void dev_set_plugstate_cb(PlugStateCB fun)
+{
+    plugstate_fun = fun;
+}
+
+/*
+ * Return the last known state of a node's plug.  This is updated by
+ * status queries, successful power control actions, and device disconnects.
+ */
+InterpState dev_get_plugstate(char *node)
+{
+    Arg *arg = NULL;
+
+    if (dev_plugstate)
+        arg = arglist_find(dev_plugstate, node);
+    return arg ? arg->state : ST_UNKNOWN;
+}
+
+/*
+ * Record the state of a node's plug, and if it changed, tell the client.
+ */
+static void _set_plugstate(char *node, InterpState state)
+{
+    Arg *arg;
+
+    if (dev_plugstate == NULL)
+        dev_plugstate = arglist_create(conf_getnodes());
+    if ((arg = arglist_find(dev_plugstate, node)) && arg->state != state) {
+        arg->state = state;
+        snap_set_state(arg->node, state);
+        if (plugstate_fun)
+            plugstate_fun(arg->node, state);
+    }
+}
+
+/*
+ * Record the state of a list of plugs, or if plugs is NULL, all the plugs
+ * on the device.
+ */
+static void _set_plugstate_all(Device * dev, List plugs, InterpState state)
+{
+    Plug *plug;
+
+    if (plugs) {
+        ListIterator itr = list_iterator_create(plugs);
+
+        while ((plug = list_next(itr)))
+            if (plug->node)
+                _set_plugstate(plug->node, state);
+        list_iterator_destroy(itr);
+    } else if (dev->plugs) {
+        PlugListIterator itr = pluglist_iterator_create(dev->plugs);
+
+        while ((plug = pluglist_next(itr)))
+            if (plug->node)
+                _set_plugstate(plug->node, state);
+        pluglist_iterator_destroy(itr);
+    }
 }
 
 /*
@@ -412,13 +584,62 @@ static bool _connect(Device * dev)
     dev->retry_count++;
 
     connected = dev->connect(dev);
+    if (dev->connect_state != DEV_NOT_CONNECTED) {
+        dev_nopen++;
+        dev_nstarting++;
+    }
 
     if (connected)
-        _enqueue_login(dev);
+        _connected(dev);
+    else if (dev->connect_state == DEV_NOT_CONNECTED)
+        _connect_failed(dev);
 
     return connected;
 }
 
+/* TRUE if dev has a spare connection that is logged in and idle */
+static bool _spare_ready(Device *dev)
+{
+    Device *spare = dev->spare;
+
+    return (spare != NULL && spare->connect_state == DEV_CONNECTED
+            && spare->logged_in && !spare->closing
+            && list_is_empty(spare->acts));
+}
+
+/*
+ * Helper for _reconnect().
+ * Move the connection of dev's spare, which is logged in already, over to
+ * dev.  The spare gets dev's old connection data and connects again in
+ * the background (or after a failure, e.g. its coprocess exiting).
+ */
+static bool _take_spare(Device *dev)
+{
+    Device *spare = dev->spare;
+    void *data = dev->data;
+    cbuf_t to = dev->to;
+    cbuf_t from = dev->from;
+
+    assert(dev->connect_state == DEV_NOT_CONNECTED);
+    dev->data = spare->data;
+    spare->data = data;
+    dev->to = spare->to;
+    spare->to = to;
+    dev->from = spare->from;
+    spare->from = from;
+    dev->fd = spare->fd;
+    spare->fd = NO_FD;
+    dev->connect_state = DEV_CONNECTED;
+    spare->connect_state = DEV_NOT_CONNECTED;
+    dev->logged_in = TRUE;
+    spare->logged_in = FALSE;
+    spare->retry_count = 0;
+    dev->stat_successful_connects++;
+    err(FALSE, "%s: reconnected on spare connection", dev->name);
+    _connected(dev);
+    return TRUE;
+}
+
 static bool _reconnect(Device *dev, struct timeval *timeout)
 {
     bool connected = FALSE;
@@ -426,12 +647,75 @@ static bool _reconnect(Device *dev, struct timeval *timeout)
     if (dev->connect_state != DEV_NOT_CONNECTED)
         _disconnect(dev);
 
-    if (_time_to_reconnect(dev, timeout))
+    if (_spare_ready(dev))
+        connected = _take_spare(dev);
+    else if (_time_to_reconnect(dev, timeout) && _connect_slot(dev, timeout))
         connected = _connect(dev);
 
     return connected;
 }
 
+/*
+ * Helper for dev_post_poll().
+ * A device is "starting" from the time a connect is initiated until its
+ * login script has completed.  It is "urgent" if it is waiting to be
+ * connected and there are actions queued for it.
+ */
+static bool _starting(Device *dev)
+{
+    return (dev->connect_state == DEV_CONNECTING
+            || (dev->connect_state == DEV_CONNECTED && !dev->logged_in));
+}
+
+static bool _urgent(Device *dev)
+{
+    return (dev->connect_state == DEV_NOT_CONNECTED
+            && !list_is_empty(dev->acts) && _time_to_reconnect(dev, NULL));
+}
+
+/*
+ * Helper for _reconnect() and dev_initial_connect().
+ * Return TRUE if the connect scheduler lets dev connect now.  Connects are
+ * spaced out by the configured rate, with some random jitter so devices
+ * that went down together don't come back in lockstep, and limited to a
+ * number of devices starting at once.  Devices that have client actions
+ * waiting go first.  If FALSE, update timeout to try again.
+ */
+static bool _connect_slot(Device *dev, struct timeval *timeout)
+{
+    struct timeval now, wait, gap;
+    long usec;
+
+    if (!timerisset(&dev_connect_gap) && dev_max_starting == 0)
+        return TRUE;
+    if (!_urgent(dev) && dev_nurgent > 0)
+        return FALSE;       /* an urgent device will update timeout */
+    if (dev_max_starting > 0 && dev_nstarting >= dev_max_starting) {
+        timerclear(&wait);
+        wait.tv_usec = DEV_WAIT_MS * 1000;
+        _update_timeout(timeout, &wait);
+        return FALSE;
+    }
+    if (timerisset(&dev_connect_gap)) {
+        if (gettimeofday(&now, NULL) < 0)
+            err_exit(TRUE, "gettimeofday");
+        if (timercmp(&now, &dev_next_connect, <)) {
+            timersub(&dev_next_connect, &now, &wait);
+            _update_timeout(timeout, &wait);
+            return FALSE;
+        }
+        /* next gap is 50-150% of the mean */
+        usec = dev_connect_gap.tv_sec * 1000000L + dev_connect_gap.tv_usec;
+        usec = usec / 2 + (long)(random() % (usec + 1));
+        gap.tv_sec = usec / 1000000L;
+        gap.tv_usec = usec % 1000000L;
+        timeradd(&now, &gap, &dev_next_connect);
+    }
+    if (_urgent(dev))
+        dev_nurgent--;
+    return TRUE;
+}
+
 /* helper for dev_check_actions/dev_enqueue_actions */
 static bool _command_needs_device(Device * dev, hostlist_t hl)
 {
@@ -499,9 +783,7 @@ int dev_enqueue_actions(int com, hostlist_t hl, ActionCB complete_fun,
             continue;                               /* uninvolved device */
         count = _enqueue_actions(dev, com, hl, complete_fun, vpf_fun,
                 client_id, arglist);
-        if (count > 0 && dev->connect_state != DEV_CONNECTED)
-            dev->retry_count = 0;   /* expedite retries on this device since */
-        total += count;             /*   the user is beating on us... */
+        total += count;
     }
     list_iterator_destroy(itr);
 
@@ -711,7 +993,7 @@ static int _enqueue_targetted_actions(Device * dev, int com, hostlist_t hl,
         if (ncom != -1) {
             act = _create_action(dev, ncom, NULL, complete_fun,
                                  vpf_fun, client_id, arglist);
-            list_append(dev->acts, act);
+            _dispatch_action(dev, act);
             count++;
         }
     }
@@ -724,7 +1006,7 @@ static int _enqueue_targetted_actions(Device * dev, int com, hostlist_t hl,
         if (ncom != -1) {
             act = _create_action(dev, ncom, ranged_plugs, complete_fun,
                                  vpf_fun, client_id, arglist);
-            list_append(dev->acts, act);
+            _dispatch_action(dev, act);
             used_ranged_plugs++;
             count++;
         }
@@ -734,7 +1016,7 @@ static int _enqueue_targetted_actions(Device * dev, int com, hostlist_t hl,
      */
     if (count == 0) {
         while ((act = list_pop(new_acts))) {
-            list_append(dev->acts, act);
+            _dispatch_action(dev, act);
             count++;
         }
     }
@@ -746,16 +1028,270 @@ cleanup:
     return count;
 }
 
-/* Called upon success of connect or finish_connect device methods.
+static int _same_plug(Plug *plug, Plug *key)
+{
+    return (plug == key);
+}
+
+/* plugs targetted by an action (NULL = all) */
+static List _action_plugs(Action *act)
+{
+    ExecCtx *e, *outer = NULL;
+    ListIterator itr;
+
+    itr = list_iterator_create(act->exec);
+    while ((e = list_next(itr)))
+        outer = e;
+    list_iterator_destroy(itr);
+    return outer ? outer->plugs : NULL;
+}
+
+/* TRUE if a client action queued on dev targets any of the plugs */
+static bool _plugs_busy(Device *dev, List plugs)
+{
+    Action *act;
+    ListIterator itr;
+    Plug *plug;
+    List busy;
+    bool found = FALSE;
+
+    itr = list_iterator_create(dev->acts);
+    while (!found && (act = list_next(itr))) {
+        if (act->complete_fun == NULL)
+            continue;
+        busy = _action_plugs(act);
+        if (plugs == NULL || busy == NULL)
+            found = TRUE;
+        else {
+            ListIterator pitr = list_iterator_create(plugs);
+
+            while (!found && (plug = list_next(pitr)))
+                if (list_find_first(busy, (ListFindF) _same_plug, plug))
+                    found = TRUE;
+            list_iterator_destroy(pitr);
+        }
+    }
+    list_iterator_destroy(itr);
+    return found;
+}
+
+/*
+ * Choose the session of a device that should run a client action.  Plugs
+ * stay with the session that already has work queued for them, so actions
+ * on a plug are run in the order they were enqueued.  An action whose
+ * plugs are busy on more than one session goes to the first (primary)
+ * session, which holds it until the others are done with them (see
+ * _sessions_busy).  Otherwise pick the session with the shortest queue,
+ * preferring one that is logged in.
  */
+static Device *_pick_session(Device *dev, Action *act)
+{
+    List plugs = _action_plugs(act);
+    Device *s, *busy = NULL, *best = dev;
+    ListIterator itr;
+    int load, best_load;
+
+    if (_plugs_busy(dev, plugs))
+        return dev;
+    best_load = list_count(dev->acts) * 2 + (dev->logged_in ? 0 : 1);
+
+    itr = list_iterator_create(dev->sessions);
+    while ((s = list_next(itr))) {
+        if (_plugs_busy(s, plugs)) {
+            if (busy != NULL) {
+                busy = dev;
+                break;
+            }
+            busy = s;
+        }
+        load = list_count(s->acts) * 2 + (s->logged_in ? 0 : 1);
+        if (load < best_load) {
+            best = s;
+            best_load = load;
+        }
+    }
+    list_iterator_destroy(itr);
+    return busy ? busy : best;
+}
+
+/*
+ * TRUE if a client action on the primary session of a device must wait
+ * because other sessions still have earlier actions on its plugs.
+ */
+static bool _sessions_busy(Device *dev, Action *act)
+{
+    List plugs = _action_plugs(act);
+    Device *s;
+    ListIterator itr;
+    bool busy = FALSE;
+
+    itr = list_iterator_create(dev->sessions);
+    while (!busy && (s = list_next(itr)))
+        busy = _plugs_busy(s, plugs);
+    list_iterator_destroy(itr);
+    return busy;
+}
+
+/*
+ * Queue a client action on dev, or on one of its sessions.
+ */
+static void _dispatch_action(Device *dev, Action *act)
+{
+    if (dev->sessions)
+        dev = _pick_session(dev, act);
+    list_append(dev->acts, act);
+
+    if (dev->connect_state != DEV_CONNECTED && !_device_down(dev))
+        dev->retry_count = 0;   /* expedite retries on this device since */
+                                /*   the user is beating on us... */
+    if (gettimeofday(&dev->last_used, NULL) < 0)
+        err_exit(TRUE, "gettimeofday");
+}
+
 static void _enqueue_login(Device *dev)
 {
+    if (dev->scripts[PM_LOG_IN] == NULL) {  /* e.g. http devices */
+        dev->logged_in = TRUE;
+        return;
+    }
     _enqueue_actions(dev, PM_LOG_IN, NULL, NULL, NULL, 0, NULL);
 }
 
+/* Called upon success of connect or finish_connect device methods.
+ */
+static void _connected(Device *dev)
+{
+    if (dev_down_failures > 0 && dev->connect_failures >= dev_down_failures)
+        err(FALSE, "%s: device is up", dev->name);
+    dev->connect_failures = 0;
+    if (gettimeofday(&dev->last_used, NULL) < 0)
+        err_exit(TRUE, "gettimeofday");
+    if (!dev->logged_in)    /* may have joined a logged in shared session */
+        _enqueue_login(dev);
+}
+
+/*
+ * Close the connection to a device that is not needed right now: run the
+ * logout script first if there is one, else disconnect at once.  A shared
+ * connection is not logged out as other devices may still be using it.
+ * The closing flag tells the disconnect method this is not an error.
+ */
+static void _close(Device *dev)
+{
+    assert(dev->connect_state == DEV_CONNECTED);
+    assert(!dev->closing);
+
+    dev->closing = TRUE;
+    dev_nclosing++;
+    if (dev->logged_in && !dev->shared && dev->scripts[PM_LOG_OUT] != NULL) {
+        dbg(DBG_DEVICE, "%s: logging out to close connection", dev->name);
+        _enqueue_actions(dev, PM_LOG_OUT, NULL, NULL, NULL, 0, NULL);
+    } else {
+        dbg(DBG_DEVICE, "%s: closing connection", dev->name);
+        _disconnect(dev);
+    }
+}
+
+/*
+ * Free a slot in the connection budget by closing the connected device
+ * that has been idle the longest.  Return FALSE if there is none.
+ */
+static bool _evict_lru(void)
+{
+    Device *dev, *lru = NULL;
+    ListIterator itr;
+
+    itr = list_iterator_create(dev_sessions);
+    while ((dev = list_next(itr))) {
+        if (dev->connect_state != DEV_CONNECTED || dev->closing
+                                || !list_is_empty(dev->acts))
+            continue;
+        if (lru == NULL || timercmp(&dev->last_used, &lru->last_used, <))
+            lru = dev;
+    }
+    list_iterator_destroy(itr);
+    if (lru == NULL)
+        return FALSE;
+    err(FALSE, "%s: closing idle connection to stay within budget of %d",
+        lru->name, dev_max_open);
+    _close(lru);
+    return TRUE;
+}
+
+/*
+ * Return TRUE if dev may be (re)connected now.  Without a connection
+ * budget or idle timeout, devices are always connected.  Otherwise a
+ * device is only connected when it has actions queued, and only if that
+ * fits the budget, possibly after closing the least recently used idle
+ * connection.  If it doesn't fit yet, update timeout to check again soon.
+ * A spare connection is kept up whenever it fits the budget, and taking
+ * it over needs no room in the budget.  A device that is down has its
+ * actions failed at once, so it is probed (with the usual backoff) while
+ * there is room in the budget, to find out when it comes back up.
+ */
+static bool _want_connection(Device *dev, struct timeval *timeout)
+{
+    struct timeval wait;
+
+    if (!dev_lazy || dev->connect_state != DEV_NOT_CONNECTED)
+        return TRUE;
+    if (dev->standby)
+        return (dev_max_open == 0 || dev_nopen < dev_max_open);
+    if (_device_down(dev))          /* probe it, but evict no one for it */
+        return (dev_max_open == 0 || dev_nopen < dev_max_open);
+    if (list_is_empty(dev->acts))
+        return FALSE;
+    if (dev_max_open == 0 || dev_nopen < dev_max_open || _spare_ready(dev))
+        return TRUE;
+    if (dev_nopen - dev_nclosing >= dev_max_open && _evict_lru()
+                                && dev_nopen < dev_max_open)
+        return TRUE;
+    timerclear(&wait);
+    wait.tv_usec = DEV_WAIT_MS * 1000;
+    _update_timeout(timeout, &wait);
+    return FALSE;
+}
+
+
+/* Called when a connect attempt fails or times out.
+ */
+static void _connect_failed(Device *dev)
+{
+    if (++dev->connect_failures == dev_down_failures)
+        err(FALSE, "%s: device is down after %d failed connects", dev->name,
+            dev->connect_failures);
+}
+
+/* The connect timeout if one is configured, else the device timeout.
+ */
+static struct timeval *_connect_timeout(Device *dev)
+{
+    if (timerisset(&dev->connect_timeout))
+        return &dev->connect_timeout;
+    return &dev->timeout;
+}
+
+
+/* TRUE if dev or any of its sessions is connected */
+static bool _pool_connected(Device *dev)
+{
+    Device *s;
+    ListIterator itr;
+    bool connected = (dev->connect_state != DEV_NOT_CONNECTED);
+
+    if (dev->sessions && !connected) {
+        itr = list_iterator_create(dev->sessions);
+        while ((s = list_next(itr)))
+            if (s->connect_state != DEV_NOT_CONNECTED)
+                connected = TRUE;
+        list_iterator_destroy(itr);
+    }
+    return connected;
+}
 
 static void _disconnect(Device * dev)
 {
+    bool closing = dev->closing;
     Action *act;
 
     assert(dev->disconnect != NULL);
@@ -766,14 +1302,57 @@ static void _disconnect(Device * dev)
     cbuf_flush(dev->to);
 
     /* update state */
+    if (dev_nopen > 0)
+        dev_nopen--;
+    if (dev->closing) {
+        /* device may hang up before the logout action completes */
+        if (((act = list_peek(dev->acts)) != NULL) && act->com == PM_LOG_OUT
+                                            && act->complete_fun == NULL)
+            _destroy_action(list_dequeue(dev->acts));
+        dev->closing = FALSE;
+        dev_nclosing--;
+    }
     dev->connect_state = DEV_NOT_CONNECTED;
     dev->logged_in = FALSE;
+    dev->selected = FALSE;
+    dev->paused = FALSE;
+    /* An idle or eviction close leaves the plugs as they were; only when
+     * the connection is lost is their state no longer known.
+     */
+    if (!closing && !dev->standby
+                 && !_pool_connected(dev->pool ? dev->pool : dev))
+        _set_plugstate_all(dev, NULL, ST_UNKNOWN);
 
     /* delete PM_LOG_IN action queued for this device, if any */
     if (((act = list_peek(dev->acts)) != NULL) && act->com == PM_LOG_IN)
         _destroy_action(list_dequeue(dev->acts));
 }
 
+/*
+ * A power control action completed successfully - record the resulting
+ * state of its target plugs (NULL means all plugs, for _all scripts).
+ */
+static void _action_plugstate(Device *dev, Action *act, List plugs)
+{
+    switch (act->com) {
+    case PM_POWER_ON:
+    case PM_POWER_ON_RANGED:
+    case PM_POWER_ON_ALL:
+    case PM_POWER_CYCLE:
+    case PM_POWER_CYCLE_RANGED:
+    case PM_POWER_CYCLE_ALL:
+        _set_plugstate_all(dev, plugs, ST_ON);
+        break;
+    case PM_POWER_OFF:
+    case PM_POWER_OFF_RANGED:
+    case PM_POWER_OFF_ALL:
+        _set_plugstate_all(dev, plugs, ST_OFF);
+        break;
+    default:
+        break;
+    }
+}
+
 static void _act_completion(Action *act, Device *dev)
 {
     assert(act->complete_fun != NULL);
@@ -787,6 +1366,10 @@ static void _act_completion(Action *act, Device *dev)
         act->complete_fun(act->client_id, act->errnum,
                 "%s: login timeout", dev->name);
         break;
+    case ACT_EDEVDOWN:
+        act->complete_fun(act->client_id, act->errnum,
+                "%s: device is down", dev->name);
+        break;
     case ACT_EEXPFAIL:
         act->complete_fun(act->client_id, act->errnum,
                 "%s: action timed out waiting for expected response", dev->name);
@@ -801,6 +1384,57 @@ static void _act_completion(Action *act, Device *dev)
     }
 }
 
+/* Return TRUE if a statement talks to the device.
+ */
+static bool _uses_connection(Stmt *stmt)
+{
+    return (stmt->type == STMT_SEND || stmt->type == STMT_EXPECT
+            || stmt->type == STMT_REQUEST);
+}
+
+/*
+ * Devices sharing a connection take turns at statement boundaries (see
+ * dev_take_turn).  An action waits for its turn before it starts and
+ * before each statement that talks to the device, and its timeout starts
+ * over once it has the connection back.  On taking a turn, the select
+ * script, if any, runs first so the device can address its unit on the
+ * shared line (%s in it is the device's address).  Returns FALSE if the
+ * action must wait.
+ */
+static bool _wait_turn(Device *dev, Action *act, ExecCtx *e,
+        struct timeval *timeout)
+{
+    struct timeval timeleft;
+
+    if (!dev->may_run)
+        return TRUE;
+    if (dev->fd == NO_FD) {
+        if (timerisset(&act->time_stamp) && !_uses_connection(e->cur))
+            return TRUE;                /* e.g. a delay: carry on without */
+        if (!dev->may_run(dev)) {
+            timerclear(&timeleft);
+            timeleft.tv_usec = DEV_WAIT_MS * 1000;
+            _update_timeout(timeout, &timeleft);
+            return FALSE;
+        }
+        dev->selected = FALSE;
+        if (timerisset(&act->time_stamp))
+            if (gettimeofday(&act->time_stamp, NULL) < 0)
+                err_exit(TRUE, "gettimeofday");
+    }
+    if (dev->shared && !dev->selected) {
+        dev->selected = TRUE;
+        if (dev->scripts[PM_SELECT] != NULL) {
+            ExecCtx *new = _create_exec_ctx(dev, dev->scripts[PM_SELECT],
+                                            NULL);
+
+            new->arg = dev->addr;
+            list_push(act->exec, new);
+        }
+    }
+    return TRUE;
+}
+
 /*
  * Process the script for the current action for this device.
  * Update timeout and return if one of the script elements stalls.
@@ -820,13 +1454,41 @@ static void _process_action(Device * dev, struct timeval *timeout)
         dbg(DBG_ACTION, "_process_action: processing action %d", act->com);
         _dbg_actions(dev);
 
+        /* other sessions are not done with the action's plugs yet */
+        if (dev->sessions && act->complete_fun != NULL
+                && !timerisset(&act->time_stamp)
+                && _sessions_busy(dev, act)) {
+            timerclear(&timeleft);
+            timeleft.tv_usec = DEV_WAIT_MS * 1000;
+            _update_timeout(timeout, &timeleft);
+            break;
+        }
+
+        /* another device is using the shared connection - wait without
+         * running the action's timeout
+         */
+        if (dev->connect_state == DEV_CONNECTED
+                && !_wait_turn(dev, act, e, timeout))
+            break;
+        e = list_peek(act->exec);       /* may be the select script */
+
         /* initialize timeout (action is brand new) */
         if (!timerisset(&act->time_stamp))
             if (gettimeofday(&act->time_stamp, NULL) < 0)
                 err_exit(TRUE, "gettimeofday");
 
+        /* device known to be down - fail without waiting */
+        if (_device_down(dev)) {
+            act->errnum = ACT_EDEVDOWN;
+            if (act->vpf_fun)
+                act->vpf_fun(act->client_id, "connect(%s): device is down",
+                        dev->name);
+
         /* timeout exceeded? */
-        if (_timeout(&act->time_stamp, &dev->timeout, &timeleft)) {
+        } else if (_timeout(&act->time_stamp,
+                        dev->connect_state == DEV_CONNECTED ? &dev->timeout
+                                                    : _connect_timeout(dev),
+                        &timeleft)) {
             if (!(dev->connect_state == DEV_CONNECTED))
                 act->errnum = ACT_ECONNECTTIMEOUT;
             else if (!dev->logged_in) {
@@ -878,42 +1540,65 @@ static void _process_action(Device * dev, struct timeval *timeout)
                 ExecCtx *e2 = list_pop(act->exec);
 
                 assert(e2 == e);
+                if (list_is_empty(act->exec))   /* outer block is done */
+                    _action_plugstate(dev, act, e2->plugs);
                 _destroy_exec_ctx(e2);
                 e = list_peek(act->exec);
             }
 
             /* completed action successfully! */
             if (e == NULL) {
+                int com = act->com;
+
                 if (act->com == PM_LOG_IN)
                     dev->logged_in = TRUE;
-                if (act->complete_fun)
+                if (act->complete_fun) {
                     _act_completion(act, dev);
+                    if (gettimeofday(&dev->last_used, NULL) < 0)
+                        err_exit(TRUE, "gettimeofday");
+                }
                 _destroy_action(list_dequeue(dev->acts));
                 dev->stat_successful_actions++;
+
+                /* logged out to close the connection */
+                if (com == PM_LOG_OUT && dev->closing) {
+                    _disconnect(dev);
+                    break;
+                }
             }
 
         /* most recently attempted stmt completed with error */
         } else {
             ActError res = act->errnum; /* save for ref after _destroy_action */
-
-            if (act->complete_fun)
-                _act_completion(act, dev);
-            _destroy_action(list_dequeue(dev->acts));
+            bool reconnect = (dev->connect_state == DEV_CONNECTED);
+            List retry = list_create(NULL);
 
             /* if one action failed, abort the rest in the device queue
-             * in preparation for reconnect.
+             * in preparation for reconnect.  If the device is going to be
+             * reconnected, actions that may be retried stay queued.
              */
             while ((act = list_dequeue(dev->acts)) != NULL) {
-                act->errnum = (res == ACT_EEXPFAIL ? ACT_EABORT : res);
+                if (reconnect && dev->retries > 0 && _retry_action(dev, act)) {
+                    list_append(retry, act);
+                    continue;
+                }
+                if (act->errnum == ACT_ESUCCESS)
+                    act->errnum = (res == ACT_EEXPFAIL ? ACT_EABORT : res);
                 if (act->complete_fun)
                     _act_completion(act, dev);
                 _destroy_action(act);
             }
+            while ((act = list_dequeue(retry)) != NULL)
+                list_append(dev->acts, act);
+            list_destroy(retry);
 
             /* reconnect/login if expect timed out */
             if ((dev->connect_state == DEV_CONNECTED)) {
                 dbg(DBG_DEVICE, "_process_action: disconnecting due to error");
-                _reconnect(dev, timeout);
+                if (dev->closing || (dev_lazy && list_is_empty(dev->acts)))
+                    _disconnect(dev);
+                else
+                    _reconnect(dev, timeout);
                 break;
             }
         }
@@ -925,6 +1610,10 @@ bool _process_stmt(Device *dev, Action *act, ExecCtx *e,
 {
     bool finished = 0;
 
+    /* lost the shared connection - wait for the next turn */
+    if (dev->shared && dev->fd == NO_FD && _uses_connection(e->cur))
+        return FALSE;
+
     switch (e->cur->type)
     {
     case STMT_EXPECT:
@@ -933,6 +1622,9 @@ bool _process_stmt(Device *dev, Action *act, ExecCtx *e,
     case STMT_SEND:
         finished = _process_send(dev, act, e);
         break;
+    case STMT_REQUEST:
+        finished = _process_request(dev, act, e, timeout);
+        break;
     case STMT_SETPLUGSTATE:
         finished = _process_setplugstate(dev, act, e);
         break;
@@ -1061,6 +1753,48 @@ static bool _process_ifonoff(Device *dev, Action *act, ExecCtx *e)
     return finished;
 }
 
+/*
+ * Record the state (and the text it was interpreted from) of a plug in
+ * the action's result.
+ */
+static void _record_plugstate(Action *act, Plug *plug, InterpState state,
+                              const char *val)
+{
+    Arg *arg;
+
+    if ((arg = arglist_find(act->arglist, plug->node))) {
+        arg->state = state;
+        if (arg->val)
+            xfree(arg->val);
+        arg->val = val ? xstrdup(val) : NULL;
+    }
+    /* beacon and temp queries don't report power state */
+    if (!_is_query_action(act->com) || act->com == PM_STATUS_PLUGS
+                            || act->com == PM_STATUS_PLUGS_ALL)
+        _set_plugstate(plug->node, state);
+}
+
+/*
+ * Return the state the first matching interpretation gives str.
+ */
+static InterpState _interpret(List interps, const char *str)
+{
+    InterpState state = ST_UNKNOWN;
+    ListIterator itr;
+    Interp *i;
+
+    itr = list_iterator_create(interps);
+    while ((i = list_next(itr))) {
+        if (xregex_exec(i->re, str, NULL)) {
+            state = i->state;
+            break;
+        }
+    }
+    list_iterator_destroy(itr);
+
+    return state;
+}
+
 static bool _process_setplugstate(Device *dev, Action *act, ExecCtx *e)
 {
     bool finished = TRUE;
@@ -1088,28 +1822,9 @@ static bool _process_setplugstate(Device *dev, Action *act, ExecCtx *e)
                                             e->cur->u.setplugstate.stat_mp);
         Plug *plug = pluglist_find(dev->plugs, plug_name);
 
-        if (str && plug && plug->node) {
-            InterpState state = ST_UNKNOWN;
-            ListIterator itr;
-            Interp *i;
-            Arg *arg;
-
-            itr = list_iterator_create(e->cur->u.setplugstate.interps);
-            while ((i = list_next(itr))) {
-                if (xregex_exec(i->re, str, NULL)) {
-                    state = i->state;
-                    break;
-                }
-            }
-            list_iterator_destroy(itr);
-
-            if ((arg = arglist_find(act->arglist, plug->node))) {
-                arg->state = state;
-                if (arg->val)
-                    xfree(arg->val);
-                arg->val = xstrdup(str);
-            }
-        }
+        if (str && plug && plug->node)
+            _record_plugstate(act, plug,
+                    _interpret(e->cur->u.setplugstate.interps, str), str);
         if (str)
             xfree(str);
         /* if no match, do nothing */
@@ -1119,6 +1834,123 @@ static bool _process_setplugstate(Device *dev, Action *act, ExecCtx *e)
     return finished;
 }
 
+/* Get the IPv4 address of addr, which may be IPv4-mapped IPv6.
+ */
+static bool _in4_addr(const struct sockaddr *addr, struct in_addr *in)
+{
+    if (addr->sa_family == AF_INET) {
+        *in = ((const struct sockaddr_in *)addr)->sin_addr;
+        return TRUE;
+    }
+    if (addr->sa_family == AF_INET6) {
+        const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)addr;
+
+        if (IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr)) {
+            memcpy(&in->s_addr, &in6->sin6_addr.s6_addr[12], 4);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/*
+ * Apply the device's trap rules to a trap, given as text in the form
+ * snmpget responses take ("oid: value" lines).  Each rule whose regex
+ * matches sets the state of a plug as a setplugstate statement would.
+ * The matches are kept apart from dev->xmatch, which may hold those of
+ * an expect in a script that is still running.
+ */
+void dev_trap(Device *dev, const char *text)
+{
+    xregex_match_t xm = xregex_match_create(MAX_MATCH_POS);
+    ListIterator itr;
+    Script rule;
+
+    if (dev->traps == NULL)
+        return;
+    itr = list_iterator_create(dev->traps);
+    while ((rule = list_next(itr))) {
+        ListIterator stmts = list_iterator_create(rule);
+        Stmt *exp = list_next(stmts);
+        Stmt *set = list_next(stmts);
+        char *plug_name, *str;
+        Plug *plug;
+
+        list_iterator_destroy(stmts);
+        xregex_match_recycle(xm);
+        if (!xregex_exec(exp->u.expect.exp, text, xm))
+            continue;
+        if (set->u.setplugstate.plug_name)
+            plug_name = xstrdup(set->u.setplugstate.plug_name);
+        else
+            plug_name = xregex_match_sub_strdup(xm,
+                                                set->u.setplugstate.plug_mp);
+        str = xregex_match_sub_strdup(xm, set->u.setplugstate.stat_mp);
+        if (plug_name && str && (plug = pluglist_find(dev->plugs, plug_name))
+                          && plug->node) {
+            InterpState state = _interpret(set->u.setplugstate.interps, str);
+
+            dbg(DBG_DEVICE, "%s: trap: plug %s is %s", dev->name, plug_name,
+                _state_str(state));
+            _set_plugstate(plug->node, state);
+        }
+        if (plug_name)
+            xfree(plug_name);
+        if (str)
+            xfree(str);
+    }
+    list_iterator_destroy(itr);
+    xregex_match_destroy(xm);
+}
+
+/*
+ * Return TRUE if two socket addresses are of the same host (ports are
+ * not compared).  IPv4 addresses mapped into IPv6 compare equal to the
+ * plain IPv4 address, since a dual stack trap socket receives them so.
+ */
+bool dev_same_host(const struct sockaddr *a, const struct sockaddr *b)
+{
+    struct in_addr a4, b4;
+
+    if (a->sa_family == AF_INET6 && b->sa_family == AF_INET6) {
+        const struct sockaddr_in6 *x = (const struct sockaddr_in6 *)a;
+        const struct sockaddr_in6 *y = (const struct sockaddr_in6 *)b;
+
+        return memcmp(&x->sin6_addr, &y->sin6_addr,
+                      sizeof(x->sin6_addr)) == 0;
+    }
+    if (!_in4_addr(a, &a4) || !_in4_addr(b, &b4))
+        return FALSE;
+    return a4.s_addr == b4.s_addr;
+}
+
+/*
+ * Arbitrate a connection on fd that several devices share, *holder being
+ * the device using it.  Return TRUE if dev may use it now: it already
+ * does, or it takes it over because the holder has nothing left to send
+ * and is either idle or paused in a delay after logging in.  Turns thus
+ * change only between statements, never between a send and the expect
+ * for its answer.
+ */
+bool dev_take_turn(Device **holder, Device *dev, int fd)
+{
+    Device *h = *holder;
+
+    if (h == dev)
+        return TRUE;
+    if (h != NULL) {
+        if (!cbuf_is_empty(h->to) || (!list_is_empty(h->acts)
+                                      && !(h->paused && h->logged_in)))
+            return FALSE;
+        h->fd = NO_FD;
+    }
+    *holder = dev;
+    dev->fd = fd;
+    cbuf_flush(dev->from);              /* drop output meant for others */
+    dbg(DBG_DEVICE, "%s: using shared connection", dev->name);
+    return TRUE;
+}
+
 /* return TRUE if expect is finished */
 static bool _process_expect(Device *dev, Action *act, ExecCtx *e)
 {
@@ -1160,77 +1992,96 @@ static char *_xhostlist_ranged_string(hostlist_t hl)
     return str;
 }
 
-static bool _process_send(Device *dev, Action *act, ExecCtx *e)
+/*
+ * Format fmt with the name of the plug, or the ranged names of the plugs,
+ * the statement applies to.  Caller must xfree() the result.
+ */
+static char *_format_plugs(Device *dev, ExecCtx *e, const char *fmt)
 {
-    bool finished = FALSE;
+    char *str = NULL;
 
-    /* first time through? */
-    if (!e->processing) {
-        int dropped = 0;
-        int written;
-        char *str = NULL;
+    if (e->plugs && list_count(e->plugs) > 0) {
+        if (list_count(e->plugs) > 1) {
+            char *names;
+            ListIterator itr = NULL;
+            hostlist_t hl = NULL;
+            Plug *plug;
 
-        if (e->plugs && list_count(e->plugs) > 0) {
-            if (list_count(e->plugs) > 1) {
-                char *names;
-                ListIterator itr = NULL;
-                hostlist_t hl = NULL;
-                Plug *plug;
-
-                if (!(hl = hostlist_create(NULL))) {
-                    err(TRUE, "_process_send(%s): hostlist_create", dev->name);
-                    goto range_cleanup;
-                }
+            if (!(hl = hostlist_create(NULL))) {
+                err(TRUE, "_process_send(%s): hostlist_create", dev->name);
+                goto range_cleanup;
+            }
 
-                if (!(itr = list_iterator_create(e->plugs))) {
-                    err(TRUE, "_process_send(%s): list_iterator_create", dev->name);
-                    goto range_cleanup;
-                }
+            if (!(itr = list_iterator_create(e->plugs))) {
+                err(TRUE, "_process_send(%s): list_iterator_create", dev->name);
+                goto range_cleanup;
+            }
 
-                while ((plug = list_next(itr))) {
-                    if (!hostlist_push(hl, plug->name)) {
-                        err(TRUE, "_process_send(%s): hostlist_push", dev->name);
-                        goto range_cleanup;
-                    }
+            while ((plug = list_next(itr))) {
+                if (!hostlist_push(hl, plug->name)) {
+                    err(TRUE, "_process_send(%s): hostlist_push", dev->name);
+                    goto range_cleanup;
                 }
-
-                hostlist_sort(hl);
-                names = _xhostlist_ranged_string(hl);
-                str = hsprintf(e->cur->u.send.fmt, names);
-                xfree (names);
-            range_cleanup:
-                if (itr)
-                    list_iterator_destroy(itr);
-                if (hl)
-                    hostlist_destroy(hl);
-            }
-            else {
-                Plug *plug = list_peek(e->plugs);
-                str = hsprintf(e->cur->u.send.fmt, (plug->name ? plug->name : "[unresolved]"));
             }
+
+            hostlist_sort(hl);
+            names = _xhostlist_ranged_string(hl);
+            str = hsprintf(fmt, names);
+            xfree (names);
+        range_cleanup:
+            if (itr)
+                list_iterator_destroy(itr);
+            if (hl)
+                hostlist_destroy(hl);
         }
-        else
-            str = hsprintf(e->cur->u.send.fmt, NULL);
-
-        if (str) {
-            written = cbuf_write(dev->to, str, strlen(str), &dropped);
-
-            if (written < 0)
-                err(TRUE, "_process_send(%s): cbuf_write returned %d",
-                    dev->name, written);
-            else if (dropped > 0)
-                err(FALSE, "_process_send(%s): buffer overrun, %d dropped",
-                    dev->name, dropped);
-            else {
-                char *memstr = dbg_memstr(str, strlen(str));
-
-                if (act->vpf_fun)
-                    act->vpf_fun(act->client_id, "send(%s): '%s'",
-                                 dev->name, memstr);
-                xfree(memstr);
-            }
-            assert(written < 0 || (dropped == strlen(str) - written));
+        else {
+            Plug *plug = list_peek(e->plugs);
+            str = hsprintf(fmt, (plug->name ? plug->name : "[unresolved]"));
         }
+    }
+    else
+        str = hsprintf(fmt, e->arg);
+
+    return str;
+}
+
+/*
+ * Queue str to be written to the device.
+ */
+static void _write_str(Device *dev, Action *act, char *str)
+{
+    int dropped = 0;
+    int written;
+
+    written = cbuf_write(dev->to, str, strlen(str), &dropped);
+
+    if (written < 0)
+        err(TRUE, "_process_send(%s): cbuf_write returned %d",
+            dev->name, written);
+    else if (dropped > 0)
+        err(FALSE, "_process_send(%s): buffer overrun, %d dropped",
+            dev->name, dropped);
+    else {
+        char *memstr = dbg_memstr(str, strlen(str));
+
+        if (act->vpf_fun)
+            act->vpf_fun(act->client_id, "send(%s): '%s'",
+                         dev->name, memstr);
+        xfree(memstr);
+    }
+    assert(written < 0 || (dropped == strlen(str) - written));
+}
+
+static bool _process_send(Device *dev, Action *act, ExecCtx *e)
+{
+    bool finished = FALSE;
+
+    /* first time through? */
+    if (!e->processing) {
+        char *str = _format_plugs(dev, e, e->cur->u.send.fmt);
+
+        if (str)
+            _write_str(dev, act, str);
 
         e->processing = TRUE;
 
@@ -1245,6 +2096,85 @@ static bool _process_send(Device *dev, Action *act, ExecCtx *e)
     return finished;
 }
 
+static const char *_state_str(InterpState state)
+{
+    return state == ST_ON ? "on" : state == ST_OFF ? "off" : NULL;
+}
+
+/*
+ * A request completed - record the plug states the device learned from it,
+ * for devices that report them directly (no setplugstate is needed).  The
+ * targets are the action's plugs, or all plugs for _all scripts.
+ */
+static void _request_plugstate(Device *dev, Action *act, ExecCtx *e)
+{
+    InterpState state;
+    Plug *plug;
+
+    if (e->plugs) {
+        ListIterator itr = list_iterator_create(e->plugs);
+
+        while ((plug = list_next(itr)))
+            if (plug->node && dev->plugstate(dev, plug->name, &state))
+                _record_plugstate(act, plug, state, _state_str(state));
+        list_iterator_destroy(itr);
+    } else {
+        PlugListIterator itr = pluglist_iterator_create(dev->plugs);
+
+        while ((plug = pluglist_next(itr)))
+            if (plug->node && dev->plugstate(dev, plug->name, &state))
+                _record_plugstate(act, plug, state, _state_str(state));
+        pluglist_iterator_destroy(itr);
+    }
+}
+
+/*
+ * Send a request (e.g. HTTP GET) and wait for the complete response.  The
+ * device leaves only the response data (e.g. the HTTP body) in the input
+ * buffer, for the expects that follow.
+ */
+static bool _process_request(Device *dev, Action *act, ExecCtx *e,
+        struct timeval *timeout)
+{
+    bool finished = FALSE;
+
+    /* first time through? */
+    if (!e->processing) {
+        char *method = e->cur->u.request.method;
+        char *arg = _format_plugs(dev, e, e->cur->u.request.fmt);
+        char *body = NULL;
+
+        if (e->cur->u.request.body)
+            body = _format_plugs(dev, e, e->cur->u.request.body);
+
+        cbuf_flush(dev->from);      /* discard anything left unmatched */
+        if (arg && (body || !e->cur->u.request.body)) {
+            if (act->vpf_fun)
+                act->vpf_fun(act->client_id, "%s(%s): '%s%s%s'", method,
+                             dev->name, arg, body ? "' '" : "",
+                             body ? body : "");
+            if (!dev->request(dev, method, arg, body))
+                err(FALSE, "%s: %s request failed", dev->name, method);
+        }
+
+        e->processing = TRUE;
+
+        if (body)
+            xfree(body);
+        if (arg)
+            xfree(arg);
+    }
+
+    if (cbuf_is_empty(dev->to) && dev->response(dev, timeout)) {
+        e->processing = FALSE;
+        finished = TRUE;                                    /* finished! */
+        if (dev->plugstate)
+            _request_plugstate(dev, act, e);
+    }
+
+    return finished;
+}
+
 /* return TRUE if delay is finished */
 static bool _process_delay(Device *dev, Action *act, ExecCtx *e,
         struct timeval *timeout)
@@ -1260,6 +2190,7 @@ static bool _process_delay(Device *dev, Action *act, ExecCtx *e,
             act->vpf_fun(act->client_id, "delay(%s): %ld.%-6.6ld", dev->name,
                     delay.tv_sec, delay.tv_usec);
         e->processing = TRUE;
+        dev->paused = TRUE;             /* others may use a shared line */
         if (gettimeofday(&act->delay_start, NULL) < 0)
             err_exit(TRUE, "gettimeofday");
     }
@@ -1267,6 +2198,7 @@ static bool _process_delay(Device *dev, Action *act, ExecCtx *e,
     /* timeout expired? */
     if (short_circuit_delay || _timeout(&act->delay_start, &delay, &timeleft)) {
         e->processing = FALSE;
+        dev->paused = FALSE;
         finished = TRUE;
     } else
         _update_timeout(timeout, &timeleft);
@@ -1287,8 +2219,24 @@ Device *dev_create(const char *name)
     dev->acts = list_create((ListDelF) _destroy_action);
     dev->xmatch = xregex_match_create(MAX_MATCH_POS);
     dev->data = NULL;
+    dev->connect = NULL;
+    dev->finish_connect = NULL;
+    dev->connect_pre_poll = NULL;
+    dev->connect_post_poll = NULL;
+    dev->preprocess = NULL;
+    dev->may_run = NULL;
+    dev->alive = NULL;
+    dev->methods = NULL;
+    dev->request = NULL;
+    dev->response = NULL;
+    dev->plugstate = NULL;
+    dev->trapsource = NULL;
+    dev->read = NULL;
+    dev->disconnect = NULL;
+    dev->destroy = NULL;
 
     timerclear(&dev->timeout);
+    timerclear(&dev->connect_timeout);
     timerclear(&dev->last_retry);
     timerclear(&dev->last_ping);
     timerclear(&dev->ping_period);
@@ -1298,9 +2246,21 @@ Device *dev_create(const char *name)
 
     for (i = 0; i < NUM_SCRIPTS; i++)
         dev->scripts[i] = NULL;
+    dev->traps = NULL;
 
     dev->plugs = NULL;
+    dev->pool = NULL;
+    dev->sessions = NULL;
+    dev->spare = NULL;
+    dev->standby = FALSE;
     dev->retry_count = 0;
+    dev->retries = 0;
+    dev->connect_failures = 0;
+    dev->closing = FALSE;
+    dev->shared = FALSE;
+    dev->selected = FALSE;
+    dev->paused = FALSE;
+    timerclear(&dev->last_used);
     dev->stat_successful_connects = 0;
     dev->stat_successful_actions = 0;
     return dev;
@@ -1322,10 +2282,10 @@ void dev_destroy(Device * dev)
     int i;
 
     assert(dev->magic == DEV_MAGIC);
-    dev->magic = 0;
 
     if (dev->connect_state == DEV_CONNECTED)
         dev->disconnect(dev);
+    dev->magic = 0;
 
     xfree(dev->name);
     xfree(dev->specname);
@@ -1334,11 +2294,17 @@ void dev_destroy(Device * dev)
         dev->destroy(dev->data);
     }
     list_destroy(dev->acts);
-    if (dev->plugs)
+    if (dev->sessions)
+        list_destroy(dev->sessions);
+    if (dev->spare)
+        dev_destroy(dev->spare);
+    if (dev->plugs && dev->pool == NULL && !dev->standby)
         pluglist_destroy(dev->plugs);
     for (i = 0; i < NUM_SCRIPTS; i++)
         if (dev->scripts[i] != NULL)
             list_destroy(dev->scripts[i]);
+    if (dev->traps)
+        list_destroy(dev->traps);
 
     cbuf_destroy(dev->to);
     cbuf_destroy(dev->from);
@@ -1363,16 +2329,41 @@ static void _enqueue_ping(Device * dev, struct timeval *timeout)
 
 /*
  * Called prior to the select loop to initiate connects to all devices.
+ * If there is a connection budget or idle timeout, devices are instead
+ * connected when actions are enqueued for them.  If connects are rate
+ * limited, those that don't fit are started from dev_post_poll(), and
+ * timeout is updated so poll will unblock for them.
  */
-void dev_initial_connect(void)
+void dev_initial_connect(struct timeval *timeout)
 {
     Device *dev;
     ListIterator itr;
+    double rate;
+
+    dev_max_open = conf_get_max_connections();
+    conf_get_idle_timeout(&dev_idle);
+    dev_lazy = (dev_max_open > 0 || timerisset(&dev_idle));
+
+    dev_max_starting = conf_get_max_connecting();
+    dev_down_failures = conf_get_down_failures();
+    timerclear(&dev_connect_gap);
+    if ((rate = conf_get_connect_rate()) > 0) {
+        dev_connect_gap.tv_sec = (long)(1.0 / rate);
+        dev_connect_gap.tv_usec = (long)((1.0 / rate
+                                    - dev_connect_gap.tv_sec) * 1000000.0);
+        if (!timerisset(&dev_connect_gap))
+            dev_connect_gap.tv_usec = 1;
+    }
+    timerclear(&dev_next_connect);
+    srandom((unsigned int)(time(NULL) ^ getpid()));
 
-    itr = list_iterator_create(dev_devices);
+    itr = list_iterator_create(dev_sessions);
     while ((dev = list_next(itr))) {
         assert(dev->connect_state == DEV_NOT_CONNECTED);
-        _connect(dev);
+        if (dev_lazy && !dev->standby)
+            continue;                   /* connected when needed */
+        if (_connect_slot(dev, timeout))
+            _connect(dev);
     }
     list_iterator_destroy(itr);
 }
@@ -1386,6 +2377,8 @@ static bool _handle_read(Device * dev)
     int dropped;
 
     assert(dev->magic == DEV_MAGIC);
+    if (dev->read != NULL)                  /* e.g. datagrams */
+        return !dev->read(dev);
     n = cbuf_write_from_fd(dev->from, dev->fd, -1, &dropped);
     if (n < 0) {
         err(TRUE, "read error on %s", dev->name);
@@ -1451,7 +2444,7 @@ _handle_ready_device(Device *dev, short flags)
             if (!dev->finish_connect(dev))
                 goto ioerr;
             if (dev->connect_state == DEV_CONNECTED)
-                _enqueue_login(dev);    /* enqueue login if connected */
+                _connected(dev);        /* enqueue login if connected */
             goto success;           /* don't want to test read bit */
         } else {
             assert(dev->connect_state == DEV_CONNECTED);
@@ -1480,10 +2473,17 @@ void dev_pre_poll(xpollfd_t pfd)
     Device *dev;
     ListIterator itr;
 
-    itr = list_iterator_create(dev_devices);
+    pipe_pre_poll(pfd);
+    http_pre_poll(pfd);
+
+    itr = list_iterator_create(dev_sessions);
     while ((dev = list_next(itr))) {
         short flags = 0;
 
+        /* device may be polling descriptors of its own until connected */
+        if (dev->connect_state == DEV_CONNECTING && dev->connect_pre_poll)
+            dev->connect_pre_poll(dev, pfd);
+
         if (dev->fd < 0)
             continue;
 
@@ -1515,21 +2515,91 @@ void dev_post_poll(xpollfd_t pfd, struct timeval *timeout)
     Device *dev;
     ListIterator itr;
 
-    itr = list_iterator_create(dev_devices);
+    /* reap coprocesses of pipe devices that have exited */
+    pipe_post_poll(pfd, timeout);
+
+    /* let libcurl move http transfers along */
+    http_post_poll(pfd, timeout);
+
+    /* recount connections, as device methods may drop them on their own */
+    dev_nopen = dev_nclosing = dev_nstarting = dev_nurgent = 0;
+    itr = list_iterator_create(dev_sessions);
+    while ((dev = list_next(itr))) {
+        if (dev->connect_state != DEV_NOT_CONNECTED)
+            dev_nopen++;
+        if (dev->closing)
+            dev_nclosing++;
+        if (_starting(dev))
+            dev_nstarting++;
+        if (_urgent(dev))
+            dev_nurgent++;
+    }
+    list_iterator_reset(itr);
+
     while ((dev = list_next(itr))) {
         short flags = dev->fd != NO_FD ? xpollfd_revents(pfd, dev->fd) : 0;
+        bool connecting = (dev->connect_state == DEV_CONNECTING);
         bool ioerr = FALSE;
 
         /* A device is "ready", e.g. it can be read/written or has an error */
         if (flags)
             ioerr = _handle_ready_device(dev, flags);
 
+        /* ...or a connect it is managing itself may have completed */
+        if (!ioerr && dev->connect_state == DEV_CONNECTING
+                   && dev->connect_post_poll) {
+            if (!dev->connect_post_poll(dev, pfd, timeout))
+                ioerr = TRUE;
+            else if (dev->connect_state == DEV_CONNECTED)
+                _connected(dev);
+        }
+
+        /* ...or the connection it shares with other devices has gone away */
+        if (!ioerr && dev->connect_state == DEV_CONNECTED && dev->alive
+                   && !dev->alive(dev))
+            ioerr = TRUE;
+
+        /* Give up on a connect that is taking too long, even if no action
+         * is waiting for it, so the device is retried (and marked down if
+         * it keeps failing).
+         */
+        if (!ioerr && dev->connect_state == DEV_CONNECTING
+                   && timerisset(_connect_timeout(dev))) {
+            struct timeval timeleft;
+
+            if (_timeout(&dev->last_retry, _connect_timeout(dev), &timeleft)) {
+                err(FALSE, "%s: connect timeout", dev->name);
+                ioerr = TRUE;
+            } else
+                _update_timeout(timeout, &timeleft);
+        }
+        if (connecting && (ioerr || dev->connect_state == DEV_NOT_CONNECTED))
+            _connect_failed(dev);
+
         /* Either initiate reconnect or recalculate timeout (for backoff)
          * so poll will unblock then.  If successful, _reconnect()
          * will enqueue a login action which will need processing below.
+         * Devices that are not needed right now just stay disconnected.
+         */
+        if (ioerr || dev->connect_state == DEV_NOT_CONNECTED) {
+            if (_want_connection(dev, timeout) && !(ioerr && dev->closing))
+                _reconnect(dev, timeout); /* can update dev->connect_state */
+            else if (dev->connect_state != DEV_NOT_CONNECTED)
+                _disconnect(dev);
+        }
+
+        /* Close connections that have been idle for too long.
          */
-        if (ioerr || dev->connect_state == DEV_NOT_CONNECTED)
-            _reconnect(dev, timeout); /* can update dev->connect_state */
+        if (timerisset(&dev_idle) && dev->connect_state == DEV_CONNECTED
+                && !dev->closing && !dev->standby
+                && list_is_empty(dev->acts)) {
+            struct timeval timeleft;
+
+            if (_timeout(&dev->last_used, &dev_idle, &timeleft))
+                _close(dev);
+            else
+                _update_timeout(timeout, &timeleft);
+        }
 
         /* If we are periodically "pinging" this device, we may need to
          * enqueue a ping action, or update the timeout so poll will
@@ -0,0 +1,550 @@
+/*****************************************************************************
+ *  Copyright (C) 2026 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  UCRL-CODE-2002-008.
+ *
+ *  This file is part of PowerMan, a remote power management program.
+ *  For details, see http://code.google.com/p/powerman/
+ *
+ *  PowerMan is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PowerMan is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PowerMan; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/*
+ * Implement http devices on the libcurl multi interface.
+ *
+ * All http devices share one multi handle, so libcurl keeps a pool of
+ * keep-alive connections per host that requests from any device (or
+ * session) to that host reuse.  Its sockets and timer are polled along
+ * with everything else: libcurl tells us which sockets to watch in
+ * _socket_cb() and when to call it back in _timer_cb().
+ *
+ * A device is connected once the server has answered a HEAD request for
+ * the device URL, whatever the status.  Scripts then send requests with
+ * get/post statements.  The response body is passed on to the expects
+ * that follow once it is complete.  An HTTP error status is only logged;
+ * a request that fails outright makes the device reconnect.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdarg.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#if HAVE_LIBCURL_MULTI
+#include <curl/curl.h>
+#endif
+
+#include "xtypes.h"
+#include "list.h"
+#include "cbuf.h"
+#include "hostlist.h"
+#include "xpoll.h"
+#include "xmalloc.h"
+#include "xregex.h"
+#include "pluglist.h"
+#include "arglist.h"
+#include "device_private.h"
+#include "device_http.h"
+#include "hprintf.h"
+#include "error.h"
+#include "debug.h"
+
+#if HAVE_LIBCURL_MULTI
+
+typedef struct {
+    char *url;                  /* device URL without trailing slashes */
+    bool insecure;              /* don't verify the server's certificate */
+    CURL *easy;                 /* transfer handle, reused for each request */
+    bool pending;               /* request in progress */
+    bool failed;                /* last request failed - reconnect */
+    cbuf_t body;                /* response body so far */
+    char errbuf[CURL_ERROR_SIZE];
+    struct sockaddr_storage addr; /* server address last used */
+    bool have_addr;
+} HttpDev;
+
+typedef struct {
+    curl_socket_t fd;
+    int what;                   /* CURL_POLL_IN, CURL_POLL_OUT or both */
+} HttpSock;
+
+static CURLM *http_multi = NULL;
+static List http_socks = NULL;          /* sockets libcurl wants polled */
+static struct timeval http_due;         /* when libcurl wants to be called */
+
+static int _match_sock(HttpSock *hs, HttpSock *key)
+{
+    return (hs == key);
+}
+
+/* libcurl tells us to start, change or stop polling socket s.
+ */
+static int _socket_cb(CURL *easy, curl_socket_t s, int what, void *userp,
+                      void *socketp)
+{
+    HttpSock *hs = (HttpSock *)socketp;
+
+    if (what == CURL_POLL_REMOVE) {
+        if (hs != NULL) {
+            curl_multi_assign(http_multi, s, NULL);
+            list_delete_all(http_socks, (ListFindF) _match_sock, hs);
+        }
+        return 0;
+    }
+    if (hs == NULL) {
+        hs = (HttpSock *)xmalloc(sizeof(HttpSock));
+        hs->fd = s;
+        list_append(http_socks, hs);
+        curl_multi_assign(http_multi, s, hs);
+    }
+    hs->what = what;
+    return 0;
+}
+
+/* libcurl wants to be called back in ms milliseconds (-1 = never).
+ */
+static int _timer_cb(CURLM *multi, long ms, void *userp)
+{
+    struct timeval now, tv;
+
+    if (ms < 0) {
+        timerclear(&http_due);
+        return 0;
+    }
+    if (gettimeofday(&now, NULL) < 0)
+        err_exit(TRUE, "gettimeofday");
+    tv.tv_sec = ms / 1000;
+    tv.tv_usec = (ms % 1000) * 1000;
+    timeradd(&now, &tv, &http_due);
+    return 0;
+}
+
+/* Set up the multi handle the first time a device connects.
+ */
+static void _init_multi(void)
+{
+    if (http_multi != NULL)
+        return;
+    if (curl_global_init(CURL_GLOBAL_DEFAULT) != 0)
+        err_exit(FALSE, "curl_global_init failed");
+    if (!(http_multi = curl_multi_init()))
+        err_exit(FALSE, "curl_multi_init failed");
+    curl_multi_setopt(http_multi, CURLMOPT_SOCKETFUNCTION, _socket_cb);
+    curl_multi_setopt(http_multi, CURLMOPT_TIMERFUNCTION, _timer_cb);
+    http_socks = list_create((ListDelF) xfree);
+    timerclear(&http_due);
+}
+
+void http_fini(void)
+{
+    if (http_multi == NULL)
+        return;
+    curl_multi_cleanup(http_multi);
+    http_multi = NULL;
+    list_destroy(http_socks);
+    http_socks = NULL;
+    curl_global_cleanup();
+}
+
+static size_t _write_cb(char *ptr, size_t size, size_t nmemb, void *arg)
+{
+    Device *dev = (Device *)arg;
+    HttpDev *h = (HttpDev *)dev->data;
+    int dropped = 0;
+
+    cbuf_write(h->body, ptr, size * nmemb, &dropped);
+    if (dropped > 0)
+        err(FALSE, "%s lost %d chars due to buffer wrap", dev->name, dropped);
+    return size * nmemb;
+}
+
+/* Remember the server address, so traps from it can be recognized.
+ */
+static void _set_addr(HttpDev *h, const char *ip)
+{
+    struct addrinfo hints, *res;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_flags = AI_NUMERICHOST;
+    if (getaddrinfo(ip, NULL, &hints, &res) != 0)
+        return;
+    memcpy(&h->addr, res->ai_addr, res->ai_addrlen);
+    h->have_addr = TRUE;
+    freeaddrinfo(res);
+}
+
+/* A transfer has finished - pass the response body on to the script.
+ */
+static void _done(Device *dev, CURLcode result)
+{
+    HttpDev *h = (HttpDev *)dev->data;
+    long status = 0;
+    char *ip = NULL;
+    int dropped = 0;
+
+    curl_multi_remove_handle(http_multi, h->easy);
+    h->pending = FALSE;
+    if (curl_easy_getinfo(h->easy, CURLINFO_PRIMARY_IP, &ip) == CURLE_OK
+            && ip != NULL && *ip != '\0')
+        _set_addr(h, ip);
+    if (result != CURLE_OK) {
+        err(FALSE, "%s: %s", dev->name, h->errbuf[0] ? h->errbuf
+                                        : curl_easy_strerror(result));
+        h->failed = TRUE;
+        cbuf_flush(h->body);
+        return;
+    }
+    curl_easy_getinfo(h->easy, CURLINFO_RESPONSE_CODE, &status);
+    dbg(DBG_DEVICE, "%s: HTTP status %ld", dev->name, status);
+    if (dev->connect_state == DEV_CONNECTING)
+        return;                         /* any answer will do */
+    if (status < 200 || status > 299)
+        err(FALSE, "%s: HTTP status %ld", dev->name, status);
+    cbuf_move(h->body, dev->from, cbuf_used(h->body), &dropped);
+    if (dropped > 0)
+        err(FALSE, "%s lost %d chars due to buffer wrap", dev->name, dropped);
+}
+
+/* Put the time until libcurl wants to be called in timeout if sooner.
+ */
+static void _update_timeout(struct timeval *timeout)
+{
+    struct timeval now, left;
+
+    if (!timerisset(&http_due))
+        return;
+    if (gettimeofday(&now, NULL) < 0)
+        err_exit(TRUE, "gettimeofday");
+    if (timercmp(&http_due, &now, <))
+        timerclear(&left);
+    else
+        timersub(&http_due, &now, &left);
+    if (!timerisset(&left))
+        left.tv_usec = 1;               /* zero would mean no timeout */
+    if (!timerisset(timeout) || timercmp(&left, timeout, <))
+        *timeout = left;
+}
+
+/* Let libcurl run its timer if it is due, and pick up finished transfers.
+ */
+static void _run(void)
+{
+    struct timeval now;
+    CURLMsg *msg;
+    Device *dev;
+    int running, left;
+
+    if (timerisset(&http_due)) {
+        if (gettimeofday(&now, NULL) < 0)
+            err_exit(TRUE, "gettimeofday");
+        if (!timercmp(&now, &http_due, <)) {
+            timerclear(&http_due);
+            curl_multi_socket_action(http_multi, CURL_SOCKET_TIMEOUT, 0,
+                                     &running);
+        }
+    }
+    while ((msg = curl_multi_info_read(http_multi, &left))) {
+        if (msg->msg != CURLMSG_DONE)
+            continue;
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&dev);
+        _done(dev, msg->data.result);
+    }
+}
+
+void http_pre_poll(xpollfd_t pfd)
+{
+    ListIterator itr;
+    HttpSock *hs;
+
+    if (http_multi == NULL)
+        return;
+    itr = list_iterator_create(http_socks);
+    while ((hs = list_next(itr))) {
+        short flags = 0;
+
+        if (hs->what & CURL_POLL_IN)
+            flags |= XPOLLIN;
+        if (hs->what & CURL_POLL_OUT)
+            flags |= XPOLLOUT;
+        xpollfd_set(pfd, hs->fd, flags);
+    }
+    list_iterator_destroy(itr);
+}
+
+/*
+ * Hand libcurl the sockets that are ready and finish transfers that are
+ * done.
+ */
+void http_post_poll(xpollfd_t pfd, struct timeval *timeout)
+{
+    ListIterator itr;
+    HttpSock *hs;
+    int *fds, *evs;
+    int i, n = 0, running;
+
+    if (http_multi == NULL)
+        return;
+    /* libcurl may change the socket list while it runs */
+    fds = (int *)xmalloc(sizeof(int) * (list_count(http_socks) + 1));
+    evs = (int *)xmalloc(sizeof(int) * (list_count(http_socks) + 1));
+    itr = list_iterator_create(http_socks);
+    while ((hs = list_next(itr))) {
+        short flags = xpollfd_revents(pfd, hs->fd);
+
+        if (flags == 0)
+            continue;
+        fds[n] = hs->fd;
+        evs[n] = 0;
+        if (flags & XPOLLIN)
+            evs[n] |= CURL_CSELECT_IN;
+        if (flags & XPOLLOUT)
+            evs[n] |= CURL_CSELECT_OUT;
+        if (flags & (XPOLLERR | XPOLLHUP | XPOLLNVAL))
+            evs[n] |= CURL_CSELECT_ERR;
+        n++;
+    }
+    list_iterator_destroy(itr);
+    for (i = 0; i < n; i++)
+        curl_multi_socket_action(http_multi, fds[i], evs[i], &running);
+    xfree(fds);
+    xfree(evs);
+
+    _run();
+    _update_timeout(timeout);
+}
+
+static void _parse_options(HttpDev *h, char *flags)
+{
+    char *tmp = xstrdup(flags);
+    char *opt = strtok(tmp, ",");
+
+    while (opt) {
+        if (strcmp(opt, "insecure") == 0)
+            h->insecure = TRUE;
+        else
+            err_exit(FALSE, "bad device option: %s", opt);
+        opt = strtok(NULL, ",");
+    }
+    xfree(tmp);
+}
+
+/*
+ * Create an http device from an http:// or https:// URL,
+ * i.e. "scheme://[user:passwd@]host[:port][/path]", host possibly being
+ * a bracketed IPv6 address.  Returns NULL if the URL is bad.
+ */
+void *http_create(char *url, char *flags)
+{
+    HttpDev *h;
+    CURLU *u = curl_url();
+    char *host = NULL;
+    bool ok;
+
+    ok = (u != NULL && curl_url_set(u, CURLUPART_URL, url, 0) == CURLUE_OK
+                    && curl_url_get(u, CURLUPART_HOST, &host, 0) == CURLUE_OK
+                    && *host != '\0');
+    if (host)
+        curl_free(host);
+    if (u)
+        curl_url_cleanup(u);
+    if (!ok)
+        return NULL;
+
+    h = (HttpDev *)xmalloc(sizeof(HttpDev));
+    h->url = xstrdup(url);
+    while (strlen(h->url) > 0 && h->url[strlen(h->url) - 1] == '/')
+        h->url[strlen(h->url) - 1] = '\0';
+    h->insecure = FALSE;
+    h->easy = NULL;
+    h->pending = FALSE;
+    h->failed = FALSE;
+    h->body = cbuf_create(MIN_DEV_BUF, MAX_DEV_BUF);
+    h->errbuf[0] = '\0';
+    h->have_addr = FALSE;
+    if (flags)
+        _parse_options(h, flags);
+    return (void *)h;
+}
+
+void http_destroy(void *data)
+{
+    HttpDev *h = (HttpDev *)data;
+
+    if (h->pending)
+        curl_multi_remove_handle(http_multi, h->easy);
+    if (h->easy)
+        curl_easy_cleanup(h->easy);
+    cbuf_destroy(h->body);
+    xfree(h->url);
+    xfree(h);
+}
+
+/* Start a request for path (relative to the device URL) on dev's handle.
+ */
+static bool _start(Device *dev, const char *method, const char *path,
+                   const char *body)
+{
+    HttpDev *h = (HttpDev *)dev->data;
+    char *url = hsprintf("%s/%s", h->url, path);
+    CURLMcode mc;
+    int running;
+
+    if (h->easy == NULL) {
+        if (!(h->easy = curl_easy_init()))
+            err_exit(FALSE, "curl_easy_init failed");
+        curl_easy_setopt(h->easy, CURLOPT_PRIVATE, (char *)dev);
+        curl_easy_setopt(h->easy, CURLOPT_WRITEFUNCTION, _write_cb);
+        curl_easy_setopt(h->easy, CURLOPT_WRITEDATA, dev);
+        curl_easy_setopt(h->easy, CURLOPT_ERRORBUFFER, h->errbuf);
+        curl_easy_setopt(h->easy, CURLOPT_NOSIGNAL, 1L);
+        if (h->insecure) {
+            curl_easy_setopt(h->easy, CURLOPT_SSL_VERIFYPEER, 0L);
+            curl_easy_setopt(h->easy, CURLOPT_SSL_VERIFYHOST, 0L);
+        }
+    }
+    curl_easy_setopt(h->easy, CURLOPT_URL, url);
+    xfree(url);
+    if (strcmp(method, "HEAD") == 0)
+        curl_easy_setopt(h->easy, CURLOPT_NOBODY, 1L);
+    else if (body != NULL) {
+        curl_easy_setopt(h->easy, CURLOPT_NOBODY, 0L);
+        curl_easy_setopt(h->easy, CURLOPT_COPYPOSTFIELDS, body);
+    } else
+        curl_easy_setopt(h->easy, CURLOPT_HTTPGET, 1L);
+
+    h->errbuf[0] = '\0';
+    cbuf_flush(h->body);
+    if ((mc = curl_multi_add_handle(http_multi, h->easy)) != CURLM_OK) {
+        err(FALSE, "%s: %s", dev->name, curl_multi_strerror(mc));
+        return FALSE;
+    }
+    h->pending = TRUE;
+    curl_multi_socket_action(http_multi, CURL_SOCKET_TIMEOUT, 0, &running);
+    return TRUE;
+}
+
+/* The device is "connecting" until the server answers a HEAD request.
+ */
+bool http_connect(Device *dev)
+{
+    HttpDev *h = (HttpDev *)dev->data;
+
+    assert(dev->connect_state == DEV_NOT_CONNECTED);
+    assert(dev->fd == NO_FD);
+
+    _init_multi();
+    h->failed = FALSE;
+    dev->connect_state = DEV_CONNECTING;
+    if (!_start(dev, "HEAD", "", NULL))
+        dev->connect_state = DEV_NOT_CONNECTED;
+    return FALSE;
+}
+
+bool http_connect_post_poll(Device *dev, xpollfd_t pfd,
+                            struct timeval *timeout)
+{
+    HttpDev *h = (HttpDev *)dev->data;
+
+    if (h->failed)
+        return FALSE;
+    if (h->pending) {
+        _update_timeout(timeout);
+        return TRUE;
+    }
+    dev->connect_state = DEV_CONNECTED;
+    dev->stat_successful_connects++;
+    err(FALSE, "http_connect(%s): connected", dev->name);
+    return TRUE;
+}
+
+void http_disconnect(Device *dev)
+{
+    HttpDev *h = (HttpDev *)dev->data;
+
+    dbg(DBG_DEVICE, "http_disconnect: %s", dev->name);
+    if (h->pending) {
+        curl_multi_remove_handle(http_multi, h->easy);
+        h->pending = FALSE;
+    }
+    h->failed = FALSE;
+    cbuf_flush(h->body);
+}
+
+/*
+ * Send a GET, or a POST if there is a body, for path.
+ */
+bool http_request(Device *dev, const char *method, const char *path,
+                  const char *body)
+{
+    return _start(dev, method, path, body);
+}
+
+bool http_response(Device *dev, struct timeval *timeout)
+{
+    HttpDev *h = (HttpDev *)dev->data;
+
+    _run();
+    if (h->pending || h->failed) {
+        _update_timeout(timeout);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/*
+ * Return FALSE if the last request failed, so the device reconnects.
+ */
+bool http_alive(Device *dev)
+{
+    HttpDev *h = (HttpDev *)dev->data;
+
+    return !h->failed;
+}
+
+/*
+ * A trap is the device's if it comes from the address the last request
+ * went to.
+ */
+bool http_trapsource(Device *dev, const struct sockaddr *addr)
+{
+    HttpDev *h = (HttpDev *)dev->data;
+
+    return (h->have_addr && dev_same_host((struct sockaddr *)&h->addr, addr));
+}
+
+#else /* !HAVE_LIBCURL_MULTI */
+
+void http_pre_poll(xpollfd_t pfd)
+{
+}
+
+void http_post_poll(xpollfd_t pfd, struct timeval *timeout)
+{
+}
+
+void http_fini(void)
+{
+}
+
+#endif /* HAVE_LIBCURL_MULTI */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
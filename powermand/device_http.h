@@ -0,0 +1,28 @@
+#ifndef PM_DEVICE_HTTP_H
+#define PM_DEVICE_HTTP_H
+
+#define HTTP_METHODS    "GET POST"
+
+#if HAVE_LIBCURL_MULTI
+void *http_create(char *url, char *flags);
+void http_destroy(void *data);
+bool http_connect(Device *dev);
+bool http_connect_post_poll(Device *dev, xpollfd_t pfd,
+                            struct timeval *timeout);
+void http_disconnect(Device *dev);
+bool http_request(Device *dev, const char *method, const char *path,
+                  const char *body);
+bool http_response(Device *dev, struct timeval *timeout);
+bool http_alive(Device *dev);
+bool http_trapsource(Device *dev, const struct sockaddr *addr);
+#endif
+
+void http_pre_poll(xpollfd_t pfd);
+void http_post_poll(xpollfd_t pfd, struct timeval *timeout);
+void http_fini(void);
+
+#endif /* PM_DEVICE_HTTP_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,989 @@
+/*****************************************************************************
+ *  Copyright (C) 2026 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  UCRL-CODE-2002-008.
+ *
+ *  This file is part of PowerMan, a remote power management program.
+ *  For details, see http://code.google.com/p/powerman/
+ *
+ *  PowerMan is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PowerMan is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PowerMan; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/*
+ * Implement connect/disconnect/request methods for IPMI devices.
+ *
+ * Devices given as an ipmi:// URL power their plugs through the BMC of
+ * each node with IPMI v2.0 over LAN (RMCP+), without an ipmipower
+ * coprocess.  The URL holds a host pattern in which '*' stands for the
+ * plug name, so one device can stand for thousands of BMCs.  They are all
+ * spoken to over one UDP socket: an ipmi statement such as ipmi "on %s"
+ * runs its command on every target BMC at once (IPMI_WINDOW at a time),
+ * each BMC stepping through its own session setup and retransmitting on
+ * its own timer.  A session is kept after the command and reused for the
+ * next one while the BMC is still likely to hold it.
+ *
+ * The power and identify state returned by stat and identify-status is
+ * handed to the device layer directly (see ipmi_plugstate()), so scripts
+ * need no expect or setplugstate.  BMCs that fail are logged, and read as
+ * unknown in a status query.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+#include <errno.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <assert.h>
+#include <sys/time.h>
+
+#include "list.h"
+#include "hash.h"
+#include "hostlist.h"
+#include "cbuf.h"
+#include "xtypes.h"
+#include "parse_util.h"
+#include "xmalloc.h"
+#include "hprintf.h"
+#include "xpoll.h"
+#include "pluglist.h"
+#include "arglist.h"
+#include "xregex.h"
+#include "device_private.h"
+#include "error.h"
+#include "debug.h"
+#include "device_ipmi.h"
+#include "xpty.h"
+#include "xtime.h"
+#include "resolve.h"
+#include "rmcp.h"
+
+#define IPMI_WINDOW             512     /* BMCs with an exchange in flight */
+#define IPMI_RETRANSMIT_MS      500     /* resend a packet after this long */
+#define IPMI_MAX_TRIES          5       /* ...up to this many times */
+#define IPMI_SESSION_IDLE       30      /* secs an idle session is reused */
+#define IPMI_READ_BURST         64      /* datagrams read per poll */
+#define IPMI_SEQ_WINDOW         16      /* inbound sequence numbers accepted */
+#define IPMI_RCVBUF             (1024*1024)
+#define IPMI_PRIV               IPMI_PRIV_OPERATOR
+
+/* What a command finds out about the plug.
+ */
+typedef enum { IPMI_RESULT_NONE, IPMI_RESULT_POWER, IPMI_RESULT_IDENTIFY
+} IpmiResult;
+
+typedef struct {
+    const char *name;
+    int netfn;
+    int cmd;
+    unsigned char data[2];
+    int len;
+    IpmiResult result;
+} IpmiCmd;
+
+static IpmiCmd ipmi_cmds[] = {
+    { "stat", IPMI_NETFN_CHASSIS, IPMI_GET_CHASSIS_STATUS, { 0, 0 }, 0,
+      IPMI_RESULT_POWER },
+    { "identify-status", IPMI_NETFN_CHASSIS, IPMI_GET_CHASSIS_STATUS,
+      { 0, 0 }, 0, IPMI_RESULT_IDENTIFY },
+    { "on", IPMI_NETFN_CHASSIS, IPMI_CHASSIS_CONTROL,
+      { IPMI_CHASSIS_UP, 0 }, 1, IPMI_RESULT_NONE },
+    { "off", IPMI_NETFN_CHASSIS, IPMI_CHASSIS_CONTROL,
+      { IPMI_CHASSIS_DOWN, 0 }, 1, IPMI_RESULT_NONE },
+    { "cycle", IPMI_NETFN_CHASSIS, IPMI_CHASSIS_CONTROL,
+      { IPMI_CHASSIS_CYCLE, 0 }, 1, IPMI_RESULT_NONE },
+    { "reset", IPMI_NETFN_CHASSIS, IPMI_CHASSIS_CONTROL,
+      { IPMI_CHASSIS_RESET, 0 }, 1, IPMI_RESULT_NONE },
+    /* interval 0 with "force identify on" set, or not */
+    { "identify-on", IPMI_NETFN_CHASSIS, IPMI_CHASSIS_IDENTIFY, { 0, 1 }, 2,
+      IPMI_RESULT_NONE },
+    { "identify-off", IPMI_NETFN_CHASSIS, IPMI_CHASSIS_IDENTIFY, { 0, 0 }, 2,
+      IPMI_RESULT_NONE },
+    { NULL, 0, 0, { 0, 0 }, 0, IPMI_RESULT_NONE },
+};
+
+typedef enum {
+    BMC_IDLE,                   /* not part of the current request */
+    BMC_QUEUED,                 /* waiting for room in the window */
+    BMC_RESOLVING,              /* looking up the host */
+    BMC_OPEN,                   /* Open Session Request sent */
+    BMC_RAKP1,                  /* RAKP Message 1 sent */
+    BMC_RAKP3,                  /* RAKP Message 3 sent */
+    BMC_PRIV,                   /* Set Session Privilege Level sent */
+    BMC_COMMAND,                /* the command sent */
+} BmcState;
+
+typedef struct {
+    char *name;                 /* plug name */
+    char *host;
+    BmcState state;
+    bool resolved;              /* addr is valid */
+    struct sockaddr_in addr;
+    bool active;                /* session established */
+    bool reused;                /* command sent in a kept session */
+    RmcpAuth auth;
+    RmcpKeys keys;
+    unsigned long seq;          /* session sequence number last sent */
+    unsigned long rseq;         /* highest one received (0: none yet) */
+    unsigned long rseen;        /* bit i-1: rseq - i was received */
+    int tag;                    /* message tag (IPMI rqSeq) of the exchange */
+    int netfn;                  /* ...and the netfn and cmd of its request */
+    int cmd;
+    int tries;                  /* sends of the current packet */
+    struct timeval sent;        /* time of the last send */
+    struct timeval last_used;   /* time of the last response in session */
+    bool reported;              /* result is from the current request */
+    InterpState result;
+} Bmc;
+
+typedef struct {
+    char *user;
+    char *passwd;
+    char *host;                 /* host pattern, '*' is the plug name */
+    char *port;
+    int cipher;                 /* cipher suite ID */
+    int integrity;              /* ...and its algorithms */
+    int confidentiality;
+    int gen;                    /* bumped on each disconnect */
+    hash_t names;               /* plug name -> Bmc */
+    Bmc **bmcs;                 /* by remote console session ID - 1 */
+    int nbmcs;
+    int maxbmcs;
+    List queue;                 /* BMCs waiting to run the command */
+    List inflight;              /* BMCs running the command */
+    IpmiCmd *cmd;               /* command of the current request */
+    bool pending;               /* request sent, not complete */
+} IpmiDev;
+
+/* argument for _ipmi_resolved() */
+typedef struct {
+    Device *dev;
+    Bmc *b;
+    int gen;                    /* ipmi->gen when the lookup was started */
+} IpmiLookup;
+
+static void _bmc_begin(Device *dev, Bmc *b);
+
+static void _parse_options(IpmiDev *ipmi, char *flags)
+{
+    char *tmp = xstrdup(flags);
+    char *opt = strtok(tmp, ",");
+
+    while (opt) {
+        if (strncmp(opt, "cipher=", 7) == 0 && opt[7] >= '1'
+                                            && opt[7] <= '3' && !opt[8])
+            ipmi->cipher = opt[7] - '0';
+        else
+            err_exit(FALSE, "bad device option: %s", opt);
+        opt = strtok(NULL, ",");
+    }
+    xfree(tmp);
+}
+
+static void _destroy_bmc(Bmc *b)
+{
+    xfree(b->name);
+    xfree(b->host);
+    xfree(b);
+}
+
+/*
+ * Create an IPMI device from the part of an ipmi:// URL after the scheme,
+ * i.e. "[user[:password]@][host][:port]", where '*' in host (or an empty
+ * host) stands for the plug name.  Returns NULL if the URL is bad.
+ */
+void *ipmi_create(char *url, char *flags)
+{
+    char *tmp = xstrdup(url);
+    char *host = tmp;
+    char *user = "";
+    char *passwd = "";
+    char *port, *at;
+    IpmiDev *ipmi = NULL;
+
+    if ((at = strrchr(host, '@'))) {
+        *at++ = '\0';
+        user = tmp;
+        host = at;
+        if ((passwd = strchr(user, ':')))
+            *passwd++ = '\0';
+        else
+            passwd = "";
+    }
+    if ((port = strchr(host, ':')))
+        *port++ = '\0';
+    if (strchr(host, '/') || strlen(user) > RMCP_MAX_USER
+            || strlen(passwd) > RMCP_MAX_PASSWD
+            || (port && (*port == '\0'
+                         || strspn(port, "0123456789") != strlen(port)
+                         || atoi(port) < 1 || atoi(port) > 65535)))
+        goto done;
+
+    ipmi = (IpmiDev *)xmalloc(sizeof(IpmiDev));
+    ipmi->user = xstrdup(user);
+    ipmi->passwd = xstrdup(passwd);
+    ipmi->host = xstrdup(*host ? host : "*");
+    ipmi->port = xstrdup(port ? port : RMCP_PORT);
+    ipmi->cipher = 3;
+    ipmi->gen = 0;
+    ipmi->names = hash_create(0, (hash_key_f)hash_key_string,
+                              (hash_cmp_f)strcmp, (hash_del_f)_destroy_bmc);
+    ipmi->bmcs = NULL;
+    ipmi->nbmcs = ipmi->maxbmcs = 0;
+    ipmi->queue = list_create(NULL);
+    ipmi->inflight = list_create(NULL);
+    ipmi->cmd = NULL;
+    ipmi->pending = FALSE;
+    if (flags)
+        _parse_options(ipmi, flags);
+    ipmi->integrity = ipmi->cipher >= 2 ? RMCP_INTEG_HMAC_SHA1_96
+                                        : RMCP_INTEG_NONE;
+    ipmi->confidentiality = ipmi->cipher >= 3 ? RMCP_CONF_AES_CBC_128
+                                              : RMCP_CONF_NONE;
+done:
+    xfree(tmp);
+    return (void *)ipmi;
+}
+
+void ipmi_destroy(void *data)
+{
+    IpmiDev *ipmi = (IpmiDev *)data;
+
+    list_destroy(ipmi->queue);
+    list_destroy(ipmi->inflight);
+    hash_destroy(ipmi->names);
+    if (ipmi->bmcs)
+        xfree(ipmi->bmcs);
+    xfree(ipmi->user);
+    xfree(ipmi->passwd);
+    xfree(ipmi->host);
+    xfree(ipmi->port);
+    xfree(ipmi);
+}
+
+/* Get the BMC of a plug, creating it the first time.  Its index is its
+ * remote console session ID, so replies can be matched to it quickly.
+ */
+static Bmc *_bmc_get(IpmiDev *ipmi, const char *name)
+{
+    Bmc *b = hash_find(ipmi->names, name);
+    char *star;
+
+    if (b)
+        return b;
+    b = (Bmc *)xmalloc(sizeof(Bmc));
+    memset(b, 0, sizeof(Bmc));
+    b->name = xstrdup(name);
+    if ((star = strchr(ipmi->host, '*')))
+        b->host = hsprintf("%.*s%s%s", (int)(star - ipmi->host), ipmi->host,
+                           name, star + 1);
+    else
+        b->host = xstrdup(ipmi->host);
+    b->state = BMC_IDLE;
+    b->result = ST_UNKNOWN;
+    strcpy(b->auth.user, ipmi->user);
+    strcpy(b->auth.passwd, ipmi->passwd);
+
+    if (ipmi->bmcs == NULL) {
+        ipmi->maxbmcs = 64;
+        ipmi->bmcs = (Bmc **)xmalloc(ipmi->maxbmcs * sizeof(Bmc *));
+    } else if (ipmi->nbmcs == ipmi->maxbmcs) {
+        ipmi->maxbmcs *= 2;
+        ipmi->bmcs = (Bmc **)xrealloc((char *)ipmi->bmcs,
+                                      ipmi->maxbmcs * sizeof(Bmc *));
+    }
+    ipmi->bmcs[ipmi->nbmcs++] = b;
+    b->auth.sidm = ipmi->nbmcs;
+    hash_insert(ipmi->names, b->name, b);
+    return b;
+}
+
+/*
+ * There is nothing to connect to: BMCs are sent datagrams as needed from
+ * one unconnected UDP socket.
+ */
+bool ipmi_connect(Device *dev)
+{
+    int fd, size = IPMI_RCVBUF;
+
+    assert(dev->magic == DEV_MAGIC);
+    assert(dev->connect_state == DEV_NOT_CONNECTED);
+    assert(dev->fd == NO_FD);
+
+    if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        err(TRUE, "ipmi_connect(%s): socket", dev->name);
+        return FALSE;
+    }
+    /* many BMCs may answer at once */
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) < 0)
+        dbg(DBG_DEVICE, "ipmi_connect(%s): SO_RCVBUF: %s", dev->name,
+            strerror(errno));
+    nonblock_set(fd);
+    dev->fd = fd;
+    dev->connect_state = DEV_CONNECTED;
+    dev->stat_successful_connects++;
+    err(FALSE, "ipmi_connect(%s): ready", dev->name);
+    return TRUE;
+}
+
+/* Send one RMCP+ packet to a BMC, protected with the session keys if
+ * keys is not NULL.
+ */
+static void _bmc_xmit(Device *dev, Bmc *b, int type,
+                      const unsigned char *payload, int len,
+                      const RmcpKeys *keys)
+{
+    unsigned char msg[RMCP_MAX_MSG];
+    unsigned long sid = 0, seq = 0;
+    int n;
+
+    if (keys) {
+        sid = b->auth.sidc;
+        b->seq = (b->seq + 1) & 0xffffffffUL;
+        if (b->seq == 0)
+            b->seq = 1;
+        seq = b->seq;
+    }
+    n = rmcp_encode(msg, type, sid, seq, payload, len, keys);
+    /* a lost datagram is resent later, like one lost on the wire */
+    if (sendto(dev->fd, msg, n, 0, (struct sockaddr *)&b->addr,
+               sizeof(b->addr)) < 0 && errno != EAGAIN && errno != ENOBUFS)
+        err(TRUE, "%s: %s: sendto", dev->name, b->name);
+}
+
+/* Send an IPMI request in the session.
+ */
+static void _bmc_ipmi(Device *dev, Bmc *b, int netfn, int cmd,
+                      const unsigned char *data, int len)
+{
+    unsigned char p[RMCP_MAX_PAYLOAD];
+
+    b->netfn = netfn;
+    b->cmd = cmd;
+    len = ipmi_encode(p, IPMI_BMC_ADDR, netfn, IPMI_REMOTE_ADDR, b->tag,
+                      cmd, data, len);
+    _bmc_xmit(dev, b, RMCP_PAYLOAD_IPMI, p, len, &b->keys);
+}
+
+/* Send (or resend) the packet of the step the BMC is at.
+ */
+static void _bmc_send(Device *dev, Bmc *b)
+{
+    IpmiDev *ipmi = (IpmiDev *)dev->data;
+    unsigned char p[RMCP_MAX_PAYLOAD];
+    unsigned char priv = IPMI_PRIV;
+    int ulen = strlen(b->auth.user);
+
+    memset(p, 0, sizeof(p));
+    switch (b->state) {
+    case BMC_OPEN:
+        p[0] = b->tag;
+        p[1] = IPMI_PRIV;
+        rmcp_put32(p + 4, b->auth.sidm);
+        p[8] = 0x00;                        /* authentication payload */
+        p[11] = 8;
+        p[12] = RMCP_AUTH_HMAC_SHA1;
+        p[16] = 0x01;                       /* integrity payload */
+        p[19] = 8;
+        p[20] = ipmi->integrity;
+        p[24] = 0x02;                       /* confidentiality payload */
+        p[27] = 8;
+        p[28] = ipmi->confidentiality;
+        _bmc_xmit(dev, b, RMCP_PAYLOAD_OPEN_REQ, p, 32, NULL);
+        break;
+    case BMC_RAKP1:
+        p[0] = b->tag;
+        rmcp_put32(p + 4, b->auth.sidc);
+        memcpy(p + 8, b->auth.rm, RMCP_RAND_LEN);
+        p[24] = b->auth.rolem;
+        p[27] = ulen;
+        memcpy(p + 28, b->auth.user, ulen);
+        _bmc_xmit(dev, b, RMCP_PAYLOAD_RAKP1, p, 28 + ulen, NULL);
+        break;
+    case BMC_RAKP3:
+        p[0] = b->tag;
+        rmcp_put32(p + 4, b->auth.sidc);
+        rmcp_rakp3_hmac(&b->auth, p + 8);
+        _bmc_xmit(dev, b, RMCP_PAYLOAD_RAKP3, p, 8 + SHA1_LEN, NULL);
+        break;
+    case BMC_PRIV:
+        _bmc_ipmi(dev, b, IPMI_NETFN_APP, IPMI_SET_SESSION_PRIV, &priv, 1);
+        break;
+    case BMC_COMMAND:
+        _bmc_ipmi(dev, b, ipmi->cmd->netfn, ipmi->cmd->cmd, ipmi->cmd->data,
+                  ipmi->cmd->len);
+        break;
+    default:
+        return;
+    }
+    b->tries++;
+    if (gettimeofday(&b->sent, NULL) < 0)
+        err_exit(TRUE, "gettimeofday");
+}
+
+/* Move on to the next step of the exchange.
+ */
+static void _bmc_step(Device *dev, Bmc *b, BmcState state)
+{
+    b->state = state;
+    b->tag = (b->tag + 1) & 0x3f;
+    b->tries = 0;
+    _bmc_send(dev, b);
+}
+
+/* Close the BMC's session.  The reply is not waited for.
+ */
+static void _bmc_close(Device *dev, Bmc *b)
+{
+    unsigned char id[4];
+
+    if (!b->active)
+        return;
+    rmcp_put32(id, b->auth.sidc);
+    b->tag = (b->tag + 1) & 0x3f;
+    _bmc_ipmi(dev, b, IPMI_NETFN_APP, IPMI_CLOSE_SESSION, id, 4);
+    b->active = FALSE;
+}
+
+/* Start a new session with the BMC.
+ */
+static void _bmc_open(Device *dev, Bmc *b)
+{
+    _bmc_close(dev, b);
+    b->reused = FALSE;
+    b->auth.sidc = 0;
+    b->auth.rolem = IPMI_PRIV | IPMI_NAME_ONLY_LOOKUP;
+    rmcp_random(b->auth.rm, RMCP_RAND_LEN);
+    _bmc_step(dev, b, BMC_OPEN);
+}
+
+/* The BMC has finished the command, or failed it if error is not NULL.
+ * The caller has taken it out of the inflight list.
+ */
+static void _bmc_finish(Device *dev, Bmc *b, InterpState result,
+                        const char *error)
+{
+    IpmiDev *ipmi = (IpmiDev *)dev->data;
+
+    b->state = BMC_IDLE;
+    b->result = result;
+    b->reported = (ipmi->cmd->result != IPMI_RESULT_NONE);
+    if (error)
+        err(FALSE, "%s: %s: %s: %s", dev->name, b->name, ipmi->cmd->name,
+            error);
+    else
+        dbg(DBG_DEVICE, "%s: %s: %s: done", dev->name, b->name,
+            ipmi->cmd->name);
+}
+
+static int _same_bmc(void *x, void *key)
+{
+    return (x == key);
+}
+
+static void _bmc_fail(Device *dev, Bmc *b, const char *fmt, ...)
+{
+    IpmiDev *ipmi = (IpmiDev *)dev->data;
+    va_list ap;
+    char *msg;
+
+    va_start(ap, fmt);
+    msg = hvsprintf(fmt, ap);
+    va_end(ap);
+    list_delete_all(ipmi->inflight, (ListFindF)_same_bmc, b);
+    _bmc_finish(dev, b, ST_UNKNOWN, msg);
+    xfree(msg);
+}
+
+/*
+ * Resolver callback: remember the address of the BMC and get on with the
+ * command.  Addresses are kept until the device is disconnected.
+ */
+static void _ipmi_resolved(void *arg, struct addrinfo *res, int error)
+{
+    IpmiLookup *lookup = (IpmiLookup *)arg;
+    Device *dev = lookup->dev;
+    IpmiDev *ipmi = (IpmiDev *)dev->data;
+    Bmc *b = lookup->b;
+    int gen = lookup->gen;
+
+    xfree(lookup);
+
+    /* the device was disconnected while we were waiting */
+    if (gen != ipmi->gen || b->state != BMC_RESOLVING)
+        return;
+
+    if (error != 0) {
+        _bmc_fail(dev, b, "getaddrinfo %s: %s", b->host, gai_strerror(error));
+        return;
+    }
+    memcpy(&b->addr, res->ai_addr, sizeof(b->addr));
+    b->resolved = TRUE;
+    _bmc_begin(dev, b);
+}
+
+/* Run the command on a BMC whose address is known, in its session if it
+ * has one that has not been idle too long.
+ */
+static void _bmc_begin(Device *dev, Bmc *b)
+{
+    struct timeval now;
+
+    if (gettimeofday(&now, NULL) < 0)
+        err_exit(TRUE, "gettimeofday");
+    if (b->active && now.tv_sec - b->last_used.tv_sec < IPMI_SESSION_IDLE) {
+        b->reused = TRUE;
+        _bmc_step(dev, b, BMC_COMMAND);
+    } else
+        _bmc_open(dev, b);
+}
+
+/* Start queued BMCs while there is room in the window.
+ */
+static void _ipmi_run(Device *dev)
+{
+    IpmiDev *ipmi = (IpmiDev *)dev->data;
+    Bmc *b;
+
+    while (list_count(ipmi->inflight) < IPMI_WINDOW
+                && (b = list_dequeue(ipmi->queue))) {
+        list_append(ipmi->inflight, b);
+        if (!b->resolved) {
+            IpmiLookup *lookup = (IpmiLookup *)xmalloc(sizeof(IpmiLookup));
+            struct addrinfo hints;
+
+            memset(&hints, 0, sizeof(hints));
+            hints.ai_family = AF_INET;
+            hints.ai_socktype = SOCK_DGRAM;
+            lookup->dev = dev;
+            lookup->b = b;
+            lookup->gen = ipmi->gen;
+            b->state = BMC_RESOLVING;
+            resolve_addr(b->host, ipmi->port, &hints, _ipmi_resolved, lookup);
+        } else
+            _bmc_begin(dev, b);
+    }
+}
+
+void ipmi_disconnect(Device *dev)
+{
+    IpmiDev *ipmi;
+    int i;
+
+    assert(dev->magic == DEV_MAGIC);
+    assert(dev->connect_state == DEV_CONNECTING
+           || dev->connect_state == DEV_CONNECTED);
+    ipmi = (IpmiDev *)dev->data;
+
+    dbg(DBG_DEVICE, "ipmi_disconnect: %s on fd %d", dev->name, dev->fd);
+
+    ipmi->gen++;                /* forget any lookups in progress */
+    ipmi->pending = FALSE;
+    while (list_dequeue(ipmi->queue))
+        ;
+    while (list_dequeue(ipmi->inflight))
+        ;
+    for (i = 0; i < ipmi->nbmcs; i++) {
+        Bmc *b = ipmi->bmcs[i];
+
+        if (dev->fd >= 0)
+            _bmc_close(dev, b);
+        b->active = FALSE;
+        b->resolved = FALSE;
+        b->reported = FALSE;
+        b->state = BMC_IDLE;
+    }
+    if (dev->fd >= 0) {
+        if (close(dev->fd) < 0)
+            err(TRUE, "ipmi_disconnect: %s close fd %d", dev->name, dev->fd);
+        dev->fd = NO_FD;
+    }
+
+    err(FALSE, "ipmi_disconnect(%s): disconnected", dev->name);
+}
+
+/*
+ * Start an ipmi request.  arg is a command ("stat", "on", "off", "cycle",
+ * "reset", "identify-on", "identify-off" or "identify-status") optionally
+ * followed by the plugs to run it on as a host list; by default it is run
+ * on all plugs.
+ */
+bool ipmi_request(Device *dev, const char *method, const char *arg,
+                  const char *body)
+{
+    IpmiDev *ipmi = (IpmiDev *)dev->data;
+    char *tmp = xstrdup(arg);
+    char *cmd = strtok(tmp, " \t");
+    char *plugs = strtok(NULL, " \t");
+    hostlist_t hl = NULL;
+    bool res = FALSE;
+    char *name;
+    Bmc *b;
+    int i;
+
+    /* forget any request that was abandoned */
+    ipmi->pending = FALSE;
+    while ((b = list_dequeue(ipmi->queue)))
+        b->state = BMC_IDLE;
+    while ((b = list_dequeue(ipmi->inflight)))
+        b->state = BMC_IDLE;
+    for (i = 0; i < ipmi->nbmcs; i++)
+        ipmi->bmcs[i]->reported = FALSE;
+
+    for (ipmi->cmd = &ipmi_cmds[0]; ipmi->cmd->name; ipmi->cmd++)
+        if (cmd && strcmp(cmd, ipmi->cmd->name) == 0)
+            break;
+    if (ipmi->cmd->name == NULL || strtok(NULL, " \t") != NULL) {
+        err(FALSE, "%s: bad ipmi command '%s'", dev->name, arg);
+        goto done;
+    }
+
+    if (plugs) {
+        hostlist_iterator_t itr;
+
+        if (!(hl = hostlist_create(plugs))) {
+            err(FALSE, "%s: bad ipmi plug list '%s'", dev->name, plugs);
+            goto done;
+        }
+        itr = hostlist_iterator_create(hl);
+        while ((name = hostlist_next(itr))) {
+            if (pluglist_find(dev->plugs, name)) {
+                b = _bmc_get(ipmi, name);
+                if (b->state == BMC_IDLE) {
+                    b->state = BMC_QUEUED;
+                    list_append(ipmi->queue, b);
+                }
+            } else
+                err(FALSE, "%s: ipmi: no plug %s", dev->name, name);
+            free(name);
+        }
+        hostlist_iterator_destroy(itr);
+    } else if (dev->plugs) {
+        PlugListIterator itr = pluglist_iterator_create(dev->plugs);
+        Plug *plug;
+
+        while ((plug = pluglist_next(itr))) {
+            b = _bmc_get(ipmi, plug->name);
+            if (b->state == BMC_IDLE) {
+                b->state = BMC_QUEUED;
+                list_append(ipmi->queue, b);
+            }
+        }
+        pluglist_iterator_destroy(itr);
+    }
+    ipmi->pending = TRUE;
+    _ipmi_run(dev);
+    res = TRUE;
+done:
+    if (hl)
+        hostlist_destroy(hl);
+    xfree(tmp);
+    return res;
+}
+
+/*
+ * Resend packets that have not been answered in time, giving up on BMCs
+ * that do not answer at all, and return TRUE once every BMC is done.
+ */
+bool ipmi_response(Device *dev, struct timeval *timeout)
+{
+    IpmiDev *ipmi = (IpmiDev *)dev->data;
+    struct timeval now, limit, timeleft;
+    struct timeval retransmit = { 0, IPMI_RETRANSMIT_MS * 1000 };
+    ListIterator itr;
+    Bmc *b;
+
+    if (!ipmi->pending)
+        return TRUE;
+    if (gettimeofday(&now, NULL) < 0)
+        err_exit(TRUE, "gettimeofday");
+
+    itr = list_iterator_create(ipmi->inflight);
+    while ((b = list_next(itr))) {
+        if (b->state == BMC_RESOLVING)
+            continue;
+        timeradd(&b->sent, &retransmit, &limit);
+        if (timercmp(&now, &limit, <)) {
+            timersub(&limit, &now, &timeleft);
+            if (!timerisset(timeout) || timercmp(&timeleft, timeout, <))
+                *timeout = timeleft;
+        } else if (b->tries < IPMI_MAX_TRIES) {
+            dbg(DBG_DEVICE, "%s: %s: resend", dev->name, b->name);
+            _bmc_send(dev, b);
+            if (!timerisset(timeout) || timercmp(&retransmit, timeout, <))
+                *timeout = retransmit;
+        } else if (b->reused) {
+            /* the BMC may have dropped a session kept from before */
+            b->active = FALSE;
+            _bmc_open(dev, b);
+            if (!timerisset(timeout) || timercmp(&retransmit, timeout, <))
+                *timeout = retransmit;
+        } else {
+            list_remove(itr);
+            b->active = FALSE;
+            _bmc_finish(dev, b, ST_UNKNOWN, "timeout");
+        }
+    }
+    list_iterator_destroy(itr);
+
+    _ipmi_run(dev);
+    if (list_is_empty(ipmi->queue) && list_is_empty(ipmi->inflight))
+        ipmi->pending = FALSE;
+
+    return !ipmi->pending;
+}
+
+/*
+ * Report the state of a plug found by the last request, if it found one.
+ */
+bool ipmi_plugstate(Device *dev, const char *plug, InterpState *state)
+{
+    IpmiDev *ipmi = (IpmiDev *)dev->data;
+    Bmc *b = hash_find(ipmi->names, plug);
+
+    if (b == NULL || !b->reported)
+        return FALSE;
+    *state = b->result;
+    return TRUE;
+}
+
+/* Handle the reply to a command.
+ */
+static void _bmc_result(Device *dev, Bmc *b, const unsigned char *data,
+                        int len)
+{
+    IpmiDev *ipmi = (IpmiDev *)dev->data;
+
+    list_delete_all(ipmi->inflight, (ListFindF)_same_bmc, b);
+    switch (ipmi->cmd->result) {
+    case IPMI_RESULT_POWER:
+        if (len < 2)
+            _bmc_finish(dev, b, ST_UNKNOWN, "short chassis status");
+        else
+            _bmc_finish(dev, b, (data[1] & 0x01) ? ST_ON : ST_OFF, NULL);
+        break;
+    case IPMI_RESULT_IDENTIFY:
+        if (len < 4 || !(data[3] & 0x40))
+            _bmc_finish(dev, b, ST_UNKNOWN, "identify state not supported");
+        else
+            _bmc_finish(dev, b, (data[3] & 0x30) ? ST_ON : ST_OFF, NULL);
+        break;
+    case IPMI_RESULT_NONE:
+        _bmc_finish(dev, b, ST_UNKNOWN, NULL);
+        break;
+    }
+}
+
+/*
+ * Check the session sequence number of a packet from the BMC against a
+ * sliding window (IPMI 2.0 section 6.12.13), and record it.  Numbers up
+ * to IPMI_SEQ_WINDOW ahead of the highest one received are accepted, and
+ * as many behind it if they have not been received yet, so duplicated
+ * and replayed packets are dropped while reordered ones are not.
+ */
+static bool _seq_accept(Bmc *b, unsigned long seq)
+{
+    unsigned long d;
+
+    if (seq == 0)
+        return FALSE;
+    if (b->rseq == 0) {
+        b->rseq = seq;
+        return TRUE;
+    }
+    d = (seq - b->rseq) & 0xffffffffUL;
+    if (d > 0 && d <= IPMI_SEQ_WINDOW) {
+        b->rseen = ((b->rseen << d) | (1UL << (d - 1)))
+                 & ((1UL << IPMI_SEQ_WINDOW) - 1);
+        b->rseq = seq;
+        return TRUE;
+    }
+    d = (b->rseq - seq) & 0xffffffffUL;
+    if (d > 0 && d <= IPMI_SEQ_WINDOW && !(b->rseen & (1UL << (d - 1)))) {
+        b->rseen |= 1UL << (d - 1);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/*
+ * Handle one datagram.  Replies during session setup carry our session ID
+ * in the payload, the rest in the session header; either way it leads to
+ * the BMC.  Anything unexpected is dropped, and left to retransmission.
+ */
+static void _ipmi_recv(Device *dev, const unsigned char *buf, int len,
+                       struct sockaddr_in *from)
+{
+    IpmiDev *ipmi = (IpmiDev *)dev->data;
+    unsigned char p[RMCP_MAX_MSG], hmac[SHA1_LEN];
+    const unsigned char *data;
+    unsigned long sid, sidm, seq;
+    int type, n = 0, netfn, rqseq, cmd, dlen;
+    Bmc *b;
+
+    if (rmcp_header(buf, len, &type, &sid) < 0)
+        goto bad;
+    sidm = sid;
+    if (sid == 0) {
+        if ((n = rmcp_decode(buf, len, NULL, &seq, p, sizeof(p))) < 8)
+            goto bad;
+        sidm = rmcp_get32(p + 4);
+    }
+    if (sidm < 1 || sidm > ipmi->nbmcs)
+        goto bad;
+    b = ipmi->bmcs[sidm - 1];
+    if (!b->resolved || from->sin_addr.s_addr != b->addr.sin_addr.s_addr
+                     || from->sin_port != b->addr.sin_port)
+        goto stale;
+    if (sid != 0) {
+        if (!b->active)
+            goto stale;
+        if ((n = rmcp_decode(buf, len, &b->keys, &seq, p, sizeof(p))) < 0)
+            goto bad;
+        if (!_seq_accept(b, seq))
+            goto stale;
+    }
+
+    switch (b->state) {
+    case BMC_OPEN:
+        if (type != RMCP_PAYLOAD_OPEN_RSP || p[0] != b->tag)
+            goto stale;
+        if (p[1] != 0) {
+            _bmc_fail(dev, b, "open session: status 0x%02x", p[1]);
+            break;
+        }
+        if (n < 36)
+            goto bad;
+        if (p[16] != RMCP_AUTH_HMAC_SHA1 || p[24] != ipmi->integrity
+                                         || p[32] != ipmi->confidentiality) {
+            _bmc_fail(dev, b, "cipher suite %d refused", ipmi->cipher);
+            break;
+        }
+        b->auth.sidc = rmcp_get32(p + 8);
+        _bmc_step(dev, b, BMC_RAKP1);
+        break;
+    case BMC_RAKP1:
+        if (type != RMCP_PAYLOAD_RAKP2 || p[0] != b->tag)
+            goto stale;
+        if (p[1] != 0) {
+            _bmc_fail(dev, b, "RAKP 2: status 0x%02x", p[1]);
+            break;
+        }
+        if (n < 40 + SHA1_LEN)
+            goto bad;
+        memcpy(b->auth.rc, p + 8, RMCP_RAND_LEN);
+        memcpy(b->auth.guidc, p + 24, RMCP_GUID_LEN);
+        rmcp_rakp2_hmac(&b->auth, hmac);
+        if (!rmcp_equal(hmac, p + 40, SHA1_LEN)) {
+            _bmc_fail(dev, b, "authentication failed");
+            break;
+        }
+        rmcp_keys(&b->auth, ipmi->integrity, ipmi->confidentiality,
+                  &b->keys);
+        _bmc_step(dev, b, BMC_RAKP3);
+        break;
+    case BMC_RAKP3:
+        if (type != RMCP_PAYLOAD_RAKP4 || p[0] != b->tag)
+            goto stale;
+        if (p[1] != 0) {
+            _bmc_fail(dev, b, "RAKP 4: status 0x%02x", p[1]);
+            break;
+        }
+        if (n < 8 + RMCP_AUTHCODE_LEN)
+            goto bad;
+        rmcp_rakp4_icv(&b->auth, &b->keys, hmac);
+        if (!rmcp_equal(hmac, p + 8, RMCP_AUTHCODE_LEN)) {
+            _bmc_fail(dev, b, "RAKP 4: bad integrity check value");
+            break;
+        }
+        b->active = TRUE;
+        b->seq = 0;
+        b->rseq = 0;
+        b->rseen = 0;
+        if (gettimeofday(&b->last_used, NULL) < 0)
+            err_exit(TRUE, "gettimeofday");
+        _bmc_step(dev, b, BMC_PRIV);
+        break;
+    case BMC_PRIV:
+    case BMC_COMMAND:
+        if (type != RMCP_PAYLOAD_IPMI
+                || ipmi_decode(p, n, &netfn, &rqseq, &cmd, &data, &dlen) < 0)
+            goto bad;
+        /* a reply to an earlier request may carry the same 6-bit tag */
+        if (rqseq != b->tag || netfn != b->netfn + 1 || cmd != b->cmd
+                            || dlen < 1)
+            goto stale;
+        if (gettimeofday(&b->last_used, NULL) < 0)
+            err_exit(TRUE, "gettimeofday");
+        if (data[0] != 0) {
+            _bmc_fail(dev, b, "%s: completion code 0x%02x",
+                      b->state == BMC_PRIV ? "set privilege" : "command",
+                      data[0]);
+            break;
+        }
+        if (b->state == BMC_PRIV)
+            _bmc_step(dev, b, BMC_COMMAND);
+        else
+            _bmc_result(dev, b, data, dlen);
+        break;
+    default:
+        goto stale;
+    }
+    return;
+bad:
+    dbg(DBG_DEVICE, "%s: dropped malformed RMCP+ packet", dev->name);
+    return;
+stale:
+    dbg(DBG_DEVICE, "%s: dropped unexpected RMCP+ packet", dev->name);
+}
+
+/*
+ * Read the datagrams that have arrived.  Returns FALSE only if the socket
+ * itself has failed.
+ */
+bool ipmi_read(Device *dev)
+{
+    static unsigned char buf[RMCP_MAX_MSG];
+    struct sockaddr_in from;
+    socklen_t fromlen;
+    int i, n;
+
+    for (i = 0; i < IPMI_READ_BURST; i++) {
+        fromlen = sizeof(from);
+        n = recvfrom(dev->fd, buf, sizeof(buf), 0, (struct sockaddr *)&from,
+                     &fromlen);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                break;
+            if (errno == ECONNREFUSED)  /* ICMP from an earlier send */
+                continue;
+            err(TRUE, "read error on %s", dev->name);
+            return FALSE;
+        }
+        if (fromlen >= sizeof(from) && from.sin_family == AF_INET)
+            _ipmi_recv(dev, buf, n, &from);
+    }
+    return TRUE;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
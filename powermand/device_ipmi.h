@@ -0,0 +1,20 @@
+#ifndef PM_DEVICE_IPMI_H
+#define PM_DEVICE_IPMI_H
+
+#define IPMI_METHODS    "ipmi"
+
+void *ipmi_create(char *url, char *flags);
+void ipmi_destroy(void *data);
+bool ipmi_connect(Device *dev);
+void ipmi_disconnect(Device *dev);
+bool ipmi_request(Device *dev, const char *method, const char *arg,
+                  const char *body);
+bool ipmi_response(Device *dev, struct timeval *timeout);
+bool ipmi_plugstate(Device *dev, const char *plug, InterpState *state);
+bool ipmi_read(Device *dev);
+
+#endif /* PM_DEVICE_IPMI_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -25,6 +25,39 @@
 /*
  * Implement connect/disconnect device methods for pipes.
  * Well it started out as a pipe, now actually it's a "coprocess" on a pty.
+ *
+ * With the "nopty" flag, the coprocess is connected to a socketpair instead,
+ * which avoids pty line discipline processing and pty allocation limits.
+ *
+ * With the "spare" flag, the device gets a standby connection with a second
+ * coprocess, which is started and logged in ahead of time (see
+ * dev_add_spare).  Nothing here is specific to it.
+ *
+ * With the "shared" flag, devices with the same command line share one
+ * coprocess.  The first device to connect starts it and logs in; others
+ * join the running session.  The devices take turns: a device holds the
+ * coprocess from the start of an action until another device needs it
+ * and the holder is idle or pauses in a delay.  If the holder disconnects
+ * because of an error, the coprocess is restarted and the other devices
+ * reconnect to the new one.
+ *
+ * With the "mux=<option>" flag, devices whose command lines differ only in
+ * the value following <option>, e.g. "ipmipower -h bmc[0-3]" and
+ * "ipmipower -h bmc[4-7]", share one coprocess started with the union of
+ * those values, i.e. "ipmipower -h bmc[0-7]".  Each device talks to its
+ * own socketpair.  Its lines are queued there and sent one batch at a
+ * time: lines from several devices that begin with the same command word
+ * are merged into one command for all of their hosts.  Reply lines are
+ * routed by the host name before the first colon to the device that
+ * controls it, and the "prompt=<string>" flag marks the end of a reply,
+ * which is passed on to each device in the batch.  Devices connect and
+ * disconnect on their own; the coprocess runs while any are connected.
+ *
+ * A coprocess is not waited for when it is disconnected, since it may take
+ * a while to exit (or ignore SIGTERM).  It goes on a list of exiting
+ * children which are reaped from the poll loop when SIGCHLD arrives, and
+ * sent SIGKILL if they are still around after a grace period.  A new
+ * coprocess for the device can be started right away.
  */
 
 #if HAVE_CONFIG_H
@@ -32,16 +65,20 @@
 #endif
 #include <errno.h>
 #include <fcntl.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <ctype.h>
 #include <sys/types.h>
+#include <sys/socket.h>
 #include <sys/wait.h>
+#include <sys/time.h>
 #include <signal.h>
 
 #include "hostlist.h"
+#include "hash.h"
 #include "list.h"
 #include "cbuf.h"
 #include "xtypes.h"
@@ -57,12 +94,465 @@
 #include "debug.h"
 #include "argv.h"
 #include "xpty.h"
+#include "xsignal.h"
+#include "xtime.h"
+
+/* seconds an exiting coprocess gets after SIGTERM before SIGKILL */
+#define PIPE_KILL_DELAY     5
+
+/* socket buffer size for "nopty" coprocesses */
+#define PIPE_SOCKET_BUF     (256*1024)
+
+/* longest line passed through a muxed coprocess */
+#define PIPE_MUX_LINE       1024
+
+typedef struct {
+    char *cmdline;              /* command line (shared coprocess key) */
+    pid_t pid;                  /* coprocess pid (-1 = not running) */
+    int fd;                     /* coprocess pty or socket */
+    int gen;                    /* incremented each time it is started */
+    int users;                  /* devices connected to it */
+    Device *holder;             /* device currently using it */
+    int refs;                   /* devices configured to use it */
+} PipeShared;
+
+typedef struct pipe_mux PipeMux;
+
+typedef struct {
+    PipeMux *mux;
+    Device *dev;                /* device, once it has connected */
+    hostlist_t hosts;           /* hosts on the device's command line */
+    int fd;                     /* mux end of the device's socketpair */
+    cbuf_t in;                  /* lines from the device */
+    cbuf_t out;                 /* replies to the device */
+    bool batched;               /* its line is in the command being run */
+} PipeMember;
+
+struct pipe_mux {
+    char *key;                  /* command line without the host value */
+    char *flags;                /* device flags, which must all be the same */
+    char *prompt;               /* coprocess prompt */
+    bool nopty;
+    char **argv;                /* command line, host value set on start */
+    int hostarg;                /* index of the host value in argv */
+    pid_t pid;                  /* coprocess pid (-1 = not running) */
+    int fd;                     /* coprocess pty or socket */
+    cbuf_t in;                  /* output of the coprocess */
+    cbuf_t out;                 /* commands for the coprocess */
+    bool ready;                 /* the first prompt has arrived */
+    bool busy;                  /* a command is waiting for the prompt */
+    PipeMember **members;
+    int nmembers;
+    int next;                   /* member the next batch starts with */
+    hash_t hosts;               /* host name -> PipeMember */
+    List keys;                  /* host names used as hash keys */
+    int refs;                   /* devices configured to use it */
+};
 
 typedef struct {
     char **argv;
     pid_t cpid;
+    PipeShared *sh;             /* shared coprocess (NULL if not shared) */
+    int sh_gen;                 /* sh->gen when device connected */
+    PipeMember *mm;             /* muxed coprocess (NULL if not muxed) */
+    bool nopty;                 /* use a socketpair instead of a pty */
+    bool shared;                /* share coprocess with other devices */
+    bool spare;                 /* keep a spare coprocess logged in */
+    char *mux;                  /* option followed by the host value */
+    char *prompt;               /* prompt of a muxed coprocess */
 } PipeDev;
 
+typedef struct {
+    pid_t pid;
+    char *name;                 /* device name */
+    char *cmd;                  /* coprocess path */
+    struct timeval termed;      /* time SIGTERM was sent */
+    bool killed;                /* SIGKILL has been sent */
+} PipeChild;
+
+static List pipe_children = NULL;       /* coprocesses that are exiting */
+static List pipe_shared = NULL;         /* shared coprocesses */
+static List pipe_mux = NULL;            /* muxed coprocesses */
+static int pipe_sigpipe[2] = { -1, -1 }; /* SIGCHLD wakes up the poll loop */
+
+static void _mux_pre_poll(PipeMux *mux, xpollfd_t pfd);
+static void _mux_post_poll(PipeMux *mux, xpollfd_t pfd);
+
+static void _sigchld_handler(int signum)
+{
+    int saved_errno = errno;
+    ssize_t n;
+
+    n = write(pipe_sigpipe[1], "", 1); /* if full, poll will wake up anyway */
+    (void)n;
+    errno = saved_errno;
+}
+
+static void _destroy_child(PipeChild *c)
+{
+    xfree(c->name);
+    xfree(c->cmd);
+    xfree(c);
+}
+
+/* Set up SIGCHLD handling the first time a coprocess is started.
+ */
+static void _init_children(void)
+{
+    if (pipe_children != NULL)
+        return;
+    if (pipe(pipe_sigpipe) < 0)
+        err_exit(TRUE, "pipe");
+    nonblock_set(pipe_sigpipe[0]);
+    nonblock_set(pipe_sigpipe[1]);
+    if (fcntl(pipe_sigpipe[0], F_SETFD, FD_CLOEXEC) < 0
+            || fcntl(pipe_sigpipe[1], F_SETFD, FD_CLOEXEC) < 0)
+        err_exit(TRUE, "fcntl");
+    pipe_children = list_create((ListDelF) _destroy_child);
+    xsignal(SIGCHLD, _sigchld_handler);
+}
+
+/* Reap child if it has exited and log how.  Return TRUE if reaped.
+ */
+static bool _reap_child(PipeChild *c)
+{
+    int wstat;
+    pid_t pid = waitpid(c->pid, &wstat, WNOHANG);
+
+    if (pid == 0)
+        return FALSE;
+    if (pid < 0) {
+        err(TRUE, "_pipe_disconnect(%s): wait", c->name);
+    } else if (WIFEXITED(wstat)) {
+        err(FALSE, "_pipe_disconnect(%s): %s exited with status %d",
+                c->name, c->cmd, WEXITSTATUS(wstat));
+    } else if (WIFSIGNALED(wstat)) {
+        err(FALSE, "_pipe_disconnect(%s): %s terminated with signal %d",
+                c->name, c->cmd, WTERMSIG(wstat));
+    } else {
+        err(FALSE, "_pipe_disconnect(%s): %s terminated", c->name, c->cmd);
+    }
+    return TRUE;
+}
+
+/* Reap exited children and SIGKILL those that have had long enough.
+ * Put the time until the next SIGKILL is due in timeout if it is sooner.
+ */
+static void _reap_children(struct timeval *timeout)
+{
+    ListIterator itr;
+    PipeChild *c;
+    struct timeval now, due, left;
+
+    if (gettimeofday(&now, NULL) < 0)
+        err_exit(TRUE, "gettimeofday");
+    itr = list_iterator_create(pipe_children);
+    while ((c = list_next(itr))) {
+        if (_reap_child(c)) {
+            list_delete(itr);
+            continue;
+        }
+        if (c->killed)
+            continue;
+        due = c->termed;
+        due.tv_sec += PIPE_KILL_DELAY;
+        if (!timercmp(&now, &due, <)) {
+            err(FALSE, "_pipe_disconnect(%s): %s did not exit, killing it",
+                    c->name, c->cmd);
+            kill(c->pid, SIGKILL); /* ignore errors */
+            c->killed = TRUE;
+        } else {
+            timersub(&due, &now, &left);
+            if (!timerisset(timeout) || timercmp(&left, timeout, <))
+                *timeout = left;
+        }
+    }
+    list_iterator_destroy(itr);
+}
+
+void pipe_pre_poll(xpollfd_t pfd)
+{
+    ListIterator itr;
+    PipeMux *mux;
+
+    if (pipe_sigpipe[0] >= 0)
+        xpollfd_set(pfd, pipe_sigpipe[0], XPOLLIN);
+    if (pipe_mux != NULL) {
+        itr = list_iterator_create(pipe_mux);
+        while ((mux = list_next(itr)))
+            _mux_pre_poll(mux, pfd);
+        list_iterator_destroy(itr);
+    }
+}
+
+/*
+ * Move data through muxed coprocesses and reap coprocesses that have
+ * exited since the last call.
+ */
+void pipe_post_poll(xpollfd_t pfd, struct timeval *timeout)
+{
+    ListIterator itr;
+    PipeMux *mux;
+    char buf[64];
+
+    if (pipe_mux != NULL) {
+        itr = list_iterator_create(pipe_mux);
+        while ((mux = list_next(itr)))
+            _mux_post_poll(mux, pfd);
+        list_iterator_destroy(itr);
+    }
+    if (pipe_sigpipe[0] < 0)
+        return;
+    if (xpollfd_revents(pfd, pipe_sigpipe[0]) & XPOLLIN) {
+        while (read(pipe_sigpipe[0], buf, sizeof(buf)) > 0)
+            ;
+    }
+    if (!list_is_empty(pipe_children))
+        _reap_children(timeout);
+}
+
+static void _parse_options(PipeDev *pd, char *flags)
+{
+    char *tmp = xstrdup(flags);
+    char *opt = strtok(tmp, ",");
+
+    while (opt) {
+        if (strcmp(opt, "nopty") == 0)
+            pd->nopty = TRUE;
+        else if (strcmp(opt, "spare") == 0)
+            pd->spare = TRUE;
+        else if (strcmp(opt, "shared") == 0)
+            pd->shared = TRUE;
+        else if (strncmp(opt, "mux=", 4) == 0 && opt[4] != '\0')
+            pd->mux = xstrdup(opt + 4);
+        else if (strncmp(opt, "prompt=", 7) == 0 && opt[7] != '\0')
+            pd->prompt = xstrdup(opt + 7);
+        else
+            err_exit(FALSE, "bad device option: %s", opt);
+        opt = strtok(NULL, ",");
+    }
+    xfree(tmp);
+}
+
+static void _destroy_shared(PipeShared *sh)
+{
+    xfree(sh->cmdline);
+    xfree(sh);
+}
+
+static int _match_shared(PipeShared *sh, char *cmdline)
+{
+    return (strcmp(sh->cmdline, cmdline) == 0);
+}
+
+/* Find the shared coprocess for cmdline, creating it if needed.
+ */
+static PipeShared *_get_shared(char *cmdline)
+{
+    PipeShared *sh;
+
+    if (pipe_shared == NULL)
+        pipe_shared = list_create((ListDelF) _destroy_shared);
+    sh = list_find_first(pipe_shared, (ListFindF) _match_shared, cmdline);
+    if (sh == NULL) {
+        sh = (PipeShared *)xmalloc(sizeof(PipeShared));
+        sh->cmdline = xstrdup(cmdline);
+        sh->pid = -1;
+        sh->fd = NO_FD;
+        sh->gen = 0;
+        sh->users = 0;
+        sh->holder = NULL;
+        sh->refs = 0;
+        list_append(pipe_shared, sh);
+    }
+    sh->refs++;
+    return sh;
+}
+
+/* Drop a device's reference to its shared coprocess, freeing it with the
+ * last.
+ */
+static void _put_shared(PipeShared *sh)
+{
+    ListIterator itr;
+
+    if (--sh->refs > 0)
+        return;
+    itr = list_iterator_create(pipe_shared);
+    if (list_find(itr, (ListFindF) _match_shared, sh->cmdline))
+        list_delete(itr);
+    list_iterator_destroy(itr);
+    if (list_is_empty(pipe_shared)) {
+        list_destroy(pipe_shared);
+        pipe_shared = NULL;
+    }
+}
+
+static void _destroy_member(PipeMember *m)
+{
+    hostlist_destroy(m->hosts);
+    cbuf_destroy(m->in);
+    cbuf_destroy(m->out);
+    xfree(m);
+}
+
+static void _destroy_mux(PipeMux *mux)
+{
+    int i;
+
+    for (i = 0; i < mux->nmembers; i++)
+        _destroy_member(mux->members[i]);
+    xfree(mux->members);
+    hash_destroy(mux->hosts);
+    list_destroy(mux->keys);
+    cbuf_destroy(mux->in);
+    cbuf_destroy(mux->out);
+    argv_destroy(mux->argv);
+    xfree(mux->prompt);
+    xfree(mux->flags);
+    xfree(mux->key);
+    xfree(mux);
+}
+
+static int _match_mux(PipeMux *mux, char *key)
+{
+    return (strcmp(mux->key, key) == 0);
+}
+
+/* Return the command line with the host value left out, which is the same
+ * for all devices that can share a muxed coprocess.
+ */
+static char *_mux_key(char **argv, int hostarg)
+{
+    int i, len = 1;
+    char *key;
+
+    for (i = 0; argv[i] != NULL; i++)
+        len += strlen(argv[i]) + 1;
+    key = (char *)xmalloc(len);
+    key[0] = '\0';
+    for (i = 0; argv[i] != NULL; i++) {
+        if (i != hostarg)
+            strcat(key, argv[i]);
+        strcat(key, " ");
+    }
+    return key;
+}
+
+/* Add a device to the muxed coprocess for its command line, creating the
+ * coprocess if needed.  Each host may belong to only one device.
+ */
+static PipeMember *_get_mux(PipeDev *pd, char *flags)
+{
+    PipeMux *mux;
+    PipeMember *m;
+    hostlist_iterator_t itr;
+    char *key, *host;
+    int i, hostarg = -1;
+
+    for (i = 0; pd->argv[i] != NULL && pd->argv[i + 1] != NULL; i++) {
+        if (strcmp(pd->argv[i], pd->mux) == 0) {
+            hostarg = i + 1;
+            break;
+        }
+    }
+    if (hostarg < 0)
+        err_exit(FALSE, "%s: mux option %s is not on the command line",
+                 pd->argv[0], pd->mux);
+    if (pd->prompt == NULL)
+        err_exit(FALSE, "%s: mux needs a prompt", pd->argv[0]);
+    if (pd->shared || pd->spare)
+        err_exit(FALSE, "%s: mux cannot be combined with shared or spare",
+                 pd->argv[0]);
+
+    key = _mux_key(pd->argv, hostarg);
+    if (pipe_mux == NULL)
+        pipe_mux = list_create((ListDelF) _destroy_mux);
+    mux = list_find_first(pipe_mux, (ListFindF) _match_mux, key);
+    if (mux == NULL) {
+        mux = (PipeMux *)xmalloc(sizeof(PipeMux));
+        mux->key = key;
+        mux->flags = xstrdup(flags);
+        mux->prompt = xstrdup(pd->prompt);
+        mux->nopty = pd->nopty;
+        mux->argv = argv_create("", "");
+        for (i = 0; pd->argv[i] != NULL; i++)
+            mux->argv = argv_append(mux->argv, pd->argv[i]);
+        mux->hostarg = hostarg;
+        mux->pid = -1;
+        mux->fd = NO_FD;
+        mux->in = cbuf_create(MIN_DEV_BUF, MAX_DEV_BUF);
+        mux->out = cbuf_create(MIN_DEV_BUF, MAX_DEV_BUF);
+        mux->ready = FALSE;
+        mux->busy = FALSE;
+        mux->members = NULL;
+        mux->nmembers = 0;
+        mux->next = 0;
+        mux->hosts = hash_create(0, (hash_key_f)hash_key_string,
+                                 (hash_cmp_f)strcmp, NULL);
+        mux->keys = list_create((ListDelF) xfree);
+        mux->refs = 0;
+        list_append(pipe_mux, mux);
+    } else {
+        xfree(key);
+        if (strcmp(mux->flags, flags) != 0)
+            err_exit(FALSE, "%s: muxed devices have different flags "
+                     "\"%s\" and \"%s\"", pd->argv[0], mux->flags, flags);
+    }
+
+    m = (PipeMember *)xmalloc(sizeof(PipeMember));
+    m->mux = mux;
+    m->dev = NULL;
+    m->hosts = hostlist_create(pd->argv[hostarg]);
+    if (m->hosts == NULL)
+        err_exit(FALSE, "%s: bad host list %s", pd->argv[0],
+                 pd->argv[hostarg]);
+    m->fd = NO_FD;
+    m->in = cbuf_create(MIN_DEV_BUF, MAX_DEV_BUF);
+    m->out = cbuf_create(MIN_DEV_BUF, MAX_DEV_BUF);
+    m->batched = FALSE;
+    if (mux->members == NULL)
+        mux->members = (PipeMember **)xmalloc(sizeof(PipeMember *));
+    else
+        mux->members = (PipeMember **)xrealloc((char *)mux->members,
+                       sizeof(PipeMember *) * (mux->nmembers + 1));
+    mux->members[mux->nmembers++] = m;
+    mux->refs++;
+
+    itr = hostlist_iterator_create(m->hosts);
+    while ((host = hostlist_next(itr))) {
+        if (hash_find(mux->hosts, host))
+            err_exit(FALSE, "%s: host %s is on more than one muxed device",
+                     pd->argv[0], host);
+        key = xstrdup(host);
+        free(host);
+        list_append(mux->keys, key);
+        hash_insert(mux->hosts, key, m);
+    }
+    hostlist_iterator_destroy(itr);
+    return m;
+}
+
+/* Drop a device's reference to its muxed coprocess, freeing it with the
+ * last.
+ */
+static void _put_mux(PipeMember *m)
+{
+    PipeMux *mux = m->mux;
+    ListIterator itr;
+
+    if (--mux->refs > 0)
+        return;
+    itr = list_iterator_create(pipe_mux);
+    if (list_find(itr, (ListFindF) _match_mux, mux->key))
+        list_delete(itr);
+    list_iterator_destroy(itr);
+    if (list_is_empty(pipe_mux)) {
+        list_destroy(pipe_mux);
+        pipe_mux = NULL;
+    }
+}
+
 /* Create "pipe device" data struct.
  * cmdline would normally look something like "/usr/bin/conman -j -Q bay0 |&"
  * (Korn shell style "coprocess" syntax)
@@ -73,6 +563,20 @@ void *pipe_create(char *cmdline, char *flags)
 
     pd->argv = argv_create(cmdline, "|&");
     pd->cpid = -1;
+    pd->nopty = FALSE;
+    pd->shared = FALSE;
+    pd->sh = NULL;
+    pd->sh_gen = 0;
+    pd->mm = NULL;
+    pd->spare = FALSE;
+    pd->mux = NULL;
+    pd->prompt = NULL;
+    if (flags)
+        _parse_options(pd, flags);
+    if (pd->mux)
+        pd->mm = _get_mux(pd, flags);
+    else if (pd->shared)
+        pd->sh = _get_shared(cmdline);
 
     return (void *)pd;
 }
@@ -84,10 +588,206 @@ void pipe_destroy(void *data)
     PipeDev *pd = (PipeDev *)data;
 
     argv_destroy(pd->argv);
+    if (pd->sh)
+        _put_shared(pd->sh);
+    if (pd->mm)
+        _put_mux(pd->mm);
+    if (pd->mux)
+        xfree(pd->mux);
+    if (pd->prompt)
+        xfree(pd->prompt);
     xfree(pd);
 }
 
-/* Start the coprocess using forkpty(3).  */
+/* Start a coprocess on a pty or socketpair.  Return its pid or -1.
+ */
+static pid_t _spawn(char **argv, bool nopty, int *fd, char *name, int len)
+{
+    pid_t pid;
+
+    if (nopty) {
+        pid = xspawnsocketpair(argv, fd, PIPE_SOCKET_BUF);
+        snprintf(name, len, "socketpair");
+    } else
+        pid = xspawnpty(argv, fd, name, len);
+    if (pid > 0)
+        nonblock_set(*fd);
+    return pid;
+}
+
+/* Connect to the shared coprocess, starting it if it is not running.
+ */
+static bool _join_shared(Device *dev)
+{
+    PipeDev *pd = (PipeDev *)dev->data;
+    PipeShared *sh = pd->sh;
+    char ptyname[64];
+
+    dev->shared = TRUE;
+    if (sh->pid < 0) {
+        sh->pid = _spawn(pd->argv, pd->nopty, &sh->fd, ptyname,
+                         sizeof(ptyname));
+        if (sh->pid < 0) {
+            err(TRUE, "_pipe_connect(%s): could not start %s", dev->name,
+                pd->argv[0]);
+            return FALSE;
+        }
+        sh->gen++;
+        sh->holder = dev;               /* so it can log in first */
+        dev->fd = sh->fd;
+        err(FALSE, "_pipe_connect(%s): opened on %s (shared)", dev->name,
+            ptyname);
+    } else {
+        dev->logged_in = TRUE;          /* session is already logged in */
+        dbg(DBG_DEVICE, "_pipe_connect: %s joined shared coprocess",
+            dev->name);
+    }
+    sh->users++;
+    pd->sh_gen = sh->gen;
+    dev->connect_state = DEV_CONNECTED;
+    dev->stat_successful_connects++;
+    return TRUE;
+}
+
+/*
+ * Wrapped hostlist_ranged_string() with internal buffer allocation,
+ * which caller must xfree().
+ */
+#define CHUNKSIZE 80
+static char *_xhostlist_ranged_string(hostlist_t hl)
+{
+    int size = 0;
+    char *str = NULL;
+
+    do {
+        str = (size == 0) ? xmalloc(CHUNKSIZE) : xrealloc(str, size+CHUNKSIZE);
+        size += CHUNKSIZE;
+    } while (hostlist_ranged_string(hl, size, str) == -1);
+
+    return str;
+}
+
+/* Start a muxed coprocess for the hosts of all of its devices.
+ */
+static bool _mux_start(PipeMux *mux, Device *dev)
+{
+    hostlist_t hl = hostlist_create(NULL);
+    char ptyname[64];
+    int i;
+
+    for (i = 0; i < mux->nmembers; i++)
+        hostlist_push_list(hl, mux->members[i]->hosts);
+    hostlist_sort(hl);
+    xfree(mux->argv[mux->hostarg]);
+    mux->argv[mux->hostarg] = _xhostlist_ranged_string(hl);
+    hostlist_destroy(hl);
+
+    mux->pid = _spawn(mux->argv, mux->nopty, &mux->fd, ptyname,
+                      sizeof(ptyname));
+    if (mux->pid < 0) {
+        err(TRUE, "_pipe_connect(%s): could not start %s", dev->name,
+            mux->argv[0]);
+        return FALSE;
+    }
+    mux->ready = FALSE;
+    mux->busy = FALSE;
+    cbuf_flush(mux->in);
+    cbuf_flush(mux->out);
+    err(FALSE, "_pipe_connect(%s): opened on %s (mux %s %s)", dev->name,
+        ptyname, mux->argv[mux->hostarg - 1], mux->argv[mux->hostarg]);
+    return TRUE;
+}
+
+/* Connect to the muxed coprocess over a socketpair of the device's own,
+ * starting the coprocess if it is not running.  If the coprocess is at its
+ * prompt already, the device gets a prompt of its own to log in with.
+ */
+static bool _join_mux(Device *dev)
+{
+    PipeDev *pd = (PipeDev *)dev->data;
+    PipeMember *m = pd->mm;
+    PipeMux *mux = m->mux;
+    int sv[2];
+
+    if (mux->pid < 0 && !_mux_start(mux, dev))
+        return FALSE;
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        err(TRUE, "_pipe_connect(%s): socketpair", dev->name);
+        return FALSE;
+    }
+    nonblock_set(sv[0]);
+    nonblock_set(sv[1]);
+    if (fcntl(sv[0], F_SETFD, FD_CLOEXEC) < 0
+            || fcntl(sv[1], F_SETFD, FD_CLOEXEC) < 0)
+        err_exit(TRUE, "fcntl");
+    dev->fd = sv[0];
+    m->dev = dev;
+    m->fd = sv[1];
+    m->batched = FALSE;
+    cbuf_flush(m->in);
+    cbuf_flush(m->out);
+    if (mux->ready)
+        cbuf_write(m->out, mux->prompt, strlen(mux->prompt), NULL);
+    dbg(DBG_DEVICE, "_pipe_connect: %s joined muxed coprocess", dev->name);
+    dev->connect_state = DEV_CONNECTED;
+    dev->stat_successful_connects++;
+    return TRUE;
+}
+
+/*
+ * Return TRUE if dev may use its coprocess now.  A device that is not
+ * sharing its coprocess always may.  Otherwise it takes its turn as
+ * arbitrated by dev_take_turn().
+ */
+bool pipe_may_run(Device *dev)
+{
+    PipeDev *pd = (PipeDev *)dev->data;
+
+    if (pd->sh == NULL)
+        return TRUE;
+    return dev_take_turn(&pd->sh->holder, dev, pd->sh->fd);
+}
+
+/*
+ * Return TRUE if the device is served by a muxed coprocess.  It can have
+ * only one session, as each host may belong to only one device.
+ */
+bool pipe_muxed(Device *dev)
+{
+    PipeDev *pd = (PipeDev *)dev->data;
+
+    return (pd->mm != NULL);
+}
+
+/*
+ * Return TRUE if the device should have a spare coprocess.  It is ignored
+ * for shared coprocesses.
+ */
+bool pipe_want_spare(Device *dev)
+{
+    PipeDev *pd = (PipeDev *)dev->data;
+
+    return (pd->spare && pd->sh == NULL);
+}
+
+/*
+ * Return FALSE if the shared or muxed coprocess dev connected to has been
+ * stopped.
+ */
+bool pipe_alive(Device *dev)
+{
+    PipeDev *pd = (PipeDev *)dev->data;
+
+    if (pd->mm)
+        return (pd->mm->fd != NO_FD);
+    if (pd->sh == NULL)
+        return TRUE;
+    return (pd->sh->pid > 0 && pd->sh_gen == pd->sh->gen);
+}
+
+/* Start the coprocess on a pty, or on a socketpair if "nopty".  If it can't
+ * be started, the connect fails and is retried later.
+ */
 bool pipe_connect(Device * dev)
 {
     int fd;
@@ -98,16 +798,16 @@ bool pipe_connect(Device * dev)
     assert(dev->connect_state == DEV_NOT_CONNECTED);
     assert(dev->fd == NO_FD);
 
-    pid = xforkpty(&fd, ptyname, sizeof(ptyname));
+    _init_children();
+    if (pd->sh)
+        return _join_shared(dev);
+    if (pd->mm)
+        return _join_mux(dev);
+    pid = _spawn(pd->argv, pd->nopty, &fd, ptyname, sizeof(ptyname));
     if (pid < 0) {
-        err_exit(TRUE, "_pipe_connect(%s): forkpty error", dev->name);
-    } else if (pid == 0) {      /* child */
-        xcfmakeraw(STDIN_FILENO);
-        execv(pd->argv[0], pd->argv);
-        err_exit(TRUE, "exec %s", pd->argv[0]);
-    } else {                    /* parent */
-        nonblock_set(fd);
-
+        err(TRUE, "_pipe_connect(%s): could not start %s", dev->name,
+            pd->argv[0]);
+    } else {
         dev->fd = fd;
 
         dev->connect_state = DEV_CONNECTED;
@@ -121,6 +821,373 @@ bool pipe_connect(Device * dev)
     return (dev->connect_state == DEV_CONNECTED);
 }
 
+/* Send SIGTERM to a coprocess.  It is reaped from the poll loop.
+ */
+static void _terminate(char *name, char *cmd, pid_t pid)
+{
+    PipeChild *c = (PipeChild *)xmalloc(sizeof(PipeChild));
+
+    c->pid = pid;
+    c->name = xstrdup(name);
+    c->cmd = xstrdup(cmd);
+    c->killed = FALSE;
+    if (gettimeofday(&c->termed, NULL) < 0)
+        err_exit(TRUE, "gettimeofday");
+    kill(pid, SIGTERM); /* ignore errors */
+    if (_reap_child(c))
+        _destroy_child(c);
+    else
+        list_append(pipe_children, c);
+}
+
+/* Leave a shared coprocess.  It is stopped when the last device leaves, or
+ * if the device using it leaves because of an error, since the coprocess
+ * may be in the middle of a response.
+ */
+static void _leave_shared(Device *dev)
+{
+    PipeDev *pd = (PipeDev *)dev->data;
+    PipeShared *sh = pd->sh;
+    bool stop = FALSE;
+
+    if (sh->holder == dev) {
+        sh->holder = NULL;
+        if (!dev->closing)
+            stop = TRUE;
+    }
+    dev->fd = NO_FD;
+    if (sh->pid < 0 || pd->sh_gen != sh->gen)
+        return;                         /* already stopped */
+    if (--sh->users == 0)
+        stop = TRUE;
+    if (stop) {
+        dbg(DBG_DEVICE, "_pipe_disconnect: %s stopping shared coprocess",
+            dev->name);
+        if (close(sh->fd) < 0)
+            err(TRUE, "_pipe_disconnect: %s close fd %d", dev->name, sh->fd);
+        sh->fd = NO_FD;
+        _terminate(dev->name, pd->argv[0], sh->pid);
+        sh->pid = -1;
+        sh->users = 0;
+    }
+}
+
+/* Stop a muxed coprocess.  Its devices see their socketpairs close and
+ * reconnect, which starts a new one.
+ */
+static void _mux_stop(PipeMux *mux, char *name)
+{
+    PipeMember *m;
+    int i;
+
+    if (close(mux->fd) < 0)
+        err(TRUE, "_pipe_disconnect: %s close fd %d", name, mux->fd);
+    mux->fd = NO_FD;
+    _terminate(name, mux->argv[0], mux->pid);
+    mux->pid = -1;
+    mux->ready = FALSE;
+    mux->busy = FALSE;
+    for (i = 0; i < mux->nmembers; i++) {
+        m = mux->members[i];
+        if (m->fd != NO_FD) {
+            if (close(m->fd) < 0)
+                err(TRUE, "_pipe_disconnect: %s close fd %d", name, m->fd);
+            m->fd = NO_FD;
+        }
+        m->batched = FALSE;
+    }
+}
+
+/* Leave a muxed coprocess.  As with a shared one, it is stopped when the
+ * last device leaves, or if a device waiting for a reply leaves because
+ * of an error, since the coprocess may be hung.
+ */
+static void _leave_mux(Device *dev)
+{
+    PipeDev *pd = (PipeDev *)dev->data;
+    PipeMember *m = pd->mm;
+    PipeMux *mux = m->mux;
+    bool stop;
+    int i;
+
+    if (close(dev->fd) < 0)
+        err(TRUE, "_pipe_disconnect: %s close fd %d", dev->name, dev->fd);
+    dev->fd = NO_FD;
+    if (m->fd == NO_FD)
+        return;                         /* already stopped */
+    if (close(m->fd) < 0)
+        err(TRUE, "_pipe_disconnect: %s close fd %d", dev->name, m->fd);
+    m->fd = NO_FD;
+    stop = (m->batched && !dev->closing);
+    m->batched = FALSE;
+    for (i = 0; i < mux->nmembers; i++)
+        if (mux->members[i]->fd != NO_FD)
+            break;
+    if (i == mux->nmembers)
+        stop = TRUE;
+    if (stop) {
+        dbg(DBG_DEVICE, "_pipe_disconnect: %s stopping muxed coprocess",
+            dev->name);
+        _mux_stop(mux, dev->name);
+    }
+}
+
+/* Put the next line from a device, without trailing white space, in buf.
+ * Return FALSE if there is no complete line.  Lines from a device that is
+ * closing, e.g. the logout script's, are dropped, as other devices may
+ * still be using the coprocess.
+ */
+static bool _mux_peek(PipeMember *m, char *buf, int len)
+{
+    int n;
+
+    if (m->fd == NO_FD)
+        return FALSE;
+    if (m->dev->closing) {
+        cbuf_flush(m->in);
+        return FALSE;
+    }
+    n = cbuf_peek_line(m->in, buf, len, 1);
+    if (n <= 0)
+        return FALSE;
+    if (n >= len)
+        n = len - 1;
+    while (n > 0 && isspace((unsigned char)buf[n - 1]))
+        buf[--n] = '\0';
+    return TRUE;
+}
+
+/* Split a line into its first word and the rest.  Return the rest.
+ */
+static char *_mux_split(char *line)
+{
+    char *args = line + strcspn(line, " \t");
+
+    if (*args != '\0')
+        *args++ = '\0';
+    return args + strspn(args, " \t");
+}
+
+/* Add the hosts in args to hl, dropping any the device does not control,
+ * since the coprocess would act on them for it.
+ */
+static void _mux_own(PipeMember *m, char *args, hostlist_t hl)
+{
+    hostlist_t req = hostlist_create(args);
+    hostlist_iterator_t itr;
+    char *host;
+
+    if (req == NULL) {
+        err(FALSE, "%s: dropping bad host list %s", m->dev->name, args);
+        return;
+    }
+    itr = hostlist_iterator_create(req);
+    while ((host = hostlist_next(itr))) {
+        if (hostlist_find(m->hosts, host) != -1)
+            hostlist_push_host(hl, host);
+        else
+            err(FALSE, "%s: dropping host %s it does not control",
+                m->dev->name, host);
+        free(host);
+    }
+    hostlist_iterator_destroy(itr);
+    hostlist_destroy(req);
+}
+
+/* Send the next batch to the coprocess.  It is made of the lines waiting at
+ * the head of each device's queue that begin with the same word as the
+ * first of them, going round robin from device to device.  Their hosts,
+ * or if a line has none, the device's own, are merged into one host list.
+ * If no hosts are left, the devices in the batch get the prompt at once.
+ */
+static void _mux_batch(PipeMux *mux)
+{
+    char line[PIPE_MUX_LINE], verb[PIPE_MUX_LINE];
+    char *args, *hosts;
+    hostlist_t hl;
+    PipeMember *m;
+    int i, first = -1;
+
+    for (i = 0; i < mux->nmembers && first < 0; i++) {
+        first = (mux->next + i) % mux->nmembers;
+        if (!_mux_peek(mux->members[first], line, sizeof(line)))
+            first = -1;
+    }
+    if (first < 0)
+        return;
+    mux->next = (first + 1) % mux->nmembers;
+    _mux_split(line);
+    strcpy(verb, line);
+
+    hl = hostlist_create(NULL);
+    for (i = 0; i < mux->nmembers; i++) {
+        m = mux->members[(first + i) % mux->nmembers];
+        if (!_mux_peek(m, line, sizeof(line)))
+            continue;
+        args = _mux_split(line);
+        if (strcmp(line, verb) != 0)
+            continue;
+        cbuf_drop_line(m->in, sizeof(line), 1);
+        m->batched = TRUE;
+        if (verb[0] == '\0')
+            break;                      /* empty line: send it alone */
+        if (*args == '\0')
+            hostlist_push_list(hl, m->hosts);
+        else
+            _mux_own(m, args, hl);
+    }
+    if (verb[0] != '\0' && hostlist_count(hl) == 0) {
+        for (i = 0; i < mux->nmembers; i++) {
+            m = mux->members[i];
+            if (m->batched)
+                cbuf_write(m->out, mux->prompt, strlen(mux->prompt), NULL);
+            m->batched = FALSE;
+        }
+        hostlist_destroy(hl);
+        return;
+    }
+    if (verb[0] != '\0') {
+        hostlist_uniq(hl);
+        hosts = _xhostlist_ranged_string(hl);
+        cbuf_write(mux->out, verb, strlen(verb), NULL);
+        cbuf_write(mux->out, " ", 1, NULL);
+        cbuf_write(mux->out, hosts, strlen(hosts), NULL);
+        xfree(hosts);
+    }
+    cbuf_write(mux->out, "\n", 1, NULL);
+    hostlist_destroy(hl);
+    mux->busy = TRUE;
+}
+
+/* Pass a reply line to the device in the batch that controls the host named
+ * by the last word before the first colon.  Other lines, e.g. the echo of
+ * a command on a pty, are dropped.
+ */
+static void _mux_route(PipeMux *mux, char *line)
+{
+    char host[PIPE_MUX_LINE];
+    PipeMember *m;
+    char *p;
+    int n;
+
+    if ((p = strchr(line, ':')) == NULL)
+        return;
+    n = p - line;
+    while (n > 0 && isspace((unsigned char)line[n - 1]))
+        n--;
+    p = line + n;
+    while (p > line && !isspace((unsigned char)p[-1]))
+        p--;
+    n -= p - line;
+    if (n == 0)
+        return;
+    memcpy(host, p, n);
+    host[n] = '\0';
+    m = hash_find(mux->hosts, host);
+    if (m != NULL && m->batched && m->fd != NO_FD)
+        cbuf_write(m->out, line, strlen(line), NULL);
+}
+
+/* The coprocess is at its prompt: pass it on to the devices in the batch,
+ * or the first time, to all connected devices so they can log in.
+ */
+static void _mux_prompt(PipeMux *mux)
+{
+    PipeMember *m;
+    int i;
+
+    for (i = 0; i < mux->nmembers; i++) {
+        m = mux->members[i];
+        if (m->fd != NO_FD && (m->batched || !mux->ready))
+            cbuf_write(m->out, mux->prompt, strlen(mux->prompt), NULL);
+        m->batched = FALSE;
+    }
+    mux->ready = TRUE;
+    mux->busy = FALSE;
+}
+
+static void _mux_pre_poll(PipeMux *mux, xpollfd_t pfd)
+{
+    PipeMember *m;
+    int i;
+
+    if (mux->pid < 0)
+        return;
+    if (mux->ready && !mux->busy)
+        _mux_batch(mux);
+    xpollfd_set(pfd, mux->fd,
+                XPOLLIN | (cbuf_is_empty(mux->out) ? 0 : XPOLLOUT));
+    for (i = 0; i < mux->nmembers; i++) {
+        m = mux->members[i];
+        if (m->fd != NO_FD)
+            xpollfd_set(pfd, m->fd,
+                        XPOLLIN | (cbuf_is_empty(m->out) ? 0 : XPOLLOUT));
+    }
+}
+
+/* Move data between a muxed coprocess and its devices.  A device whose
+ * socketpair fails is dropped; pipe_alive() tells it so.
+ */
+static void _mux_post_poll(PipeMux *mux, xpollfd_t pfd)
+{
+    char line[PIPE_MUX_LINE];
+    int plen = strlen(mux->prompt);
+    PipeMember *m;
+    short flags;
+    int i, n;
+
+    if (mux->pid < 0)
+        return;
+    for (i = 0; i < mux->nmembers; i++) {
+        m = mux->members[i];
+        if (m->fd == NO_FD)
+            continue;
+        flags = xpollfd_revents(pfd, m->fd);
+        n = 1;
+        if (flags & XPOLLIN)
+            n = cbuf_write_from_fd(m->in, m->fd, -1, NULL);
+        if (n > 0 && (flags & XPOLLOUT))
+            n = cbuf_read_to_fd(m->out, m->fd, -1);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)
+                   || (flags & (XPOLLERR | XPOLLNVAL))) {
+            close(m->fd);
+            m->fd = NO_FD;
+            m->batched = FALSE;
+        }
+    }
+
+    flags = xpollfd_revents(pfd, mux->fd);
+    n = 1;
+    if (flags & XPOLLOUT)
+        n = cbuf_read_to_fd(mux->out, mux->fd, -1);
+    if (n > 0 && (flags & (XPOLLIN | XPOLLHUP)))
+        n = cbuf_write_from_fd(mux->in, mux->fd, -1, NULL);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)
+               || (flags & (XPOLLERR | XPOLLNVAL))) {
+        for (i = 0; i < mux->nmembers - 1; i++)
+            if (mux->members[i]->fd != NO_FD)
+                break;
+        m = mux->members[i];            /* a device to name in messages */
+        err(FALSE, "_pipe_disconnect(%s): muxed %s stopped",
+            m->dev ? m->dev->name : "mux", mux->argv[0]);
+        _mux_stop(mux, m->dev ? m->dev->name : "mux");
+        return;
+    }
+
+    while (cbuf_read_line(mux->in, line, sizeof(line), 1) > 0)
+        _mux_route(mux, line);
+    n = cbuf_used(mux->in);
+    if (n >= sizeof(line))
+        cbuf_drop(mux->in, n);          /* no newline in sight */
+    else if (n >= plen) {
+        cbuf_peek(mux->in, line, n);
+        if (memcmp(line + n - plen, mux->prompt, plen) == 0) {
+            cbuf_drop(mux->in, n);
+            _mux_prompt(mux);
+        }
+    }
+}
+
 /*
  * Close down the pipes/pty.
  */
@@ -132,29 +1199,24 @@ void pipe_disconnect(Device * dev)
 
     dbg(DBG_DEVICE, "_pipe_disconnect: %s on fd %d", dev->name, dev->fd);
 
+    if (pd->sh) {
+        _leave_shared(dev);
+        return;
+    }
+    if (pd->mm) {
+        _leave_mux(dev);
+        return;
+    }
+
     if (dev->fd >= 0) {
         if (close(dev->fd) < 0)
             err(TRUE, "_pipe_disconnect: %s close fd %d", dev->name, dev->fd);
         dev->fd = NO_FD;
     }
 
-    /* reap child */
+    /* terminate child - it is reaped from the poll loop */
     if (pd->cpid > 0) {
-        int wstat;
-
-        kill(pd->cpid, SIGTERM); /* ignore errors */
-        if (waitpid(pd->cpid, &wstat, 0) < 0)
-            err(TRUE, "_pipe_disconnect(%s): wait", dev->name);
-        if (WIFEXITED(wstat)) {
-            err(FALSE, "_pipe_disconnect(%s): %s exited with status %d",
-                    dev->name, pd->argv[0], WEXITSTATUS(wstat));
-        } else if (WIFSIGNALED(wstat)) {
-            err(FALSE, "_pipe_disconnect(%s): %s terminated with signal %d",
-                    dev->name, pd->argv[0], WTERMSIG(wstat));
-        } else {
-            err(FALSE, "_pipe_disconnect(%s): %s terminated",
-                    dev->name, pd->argv[0]);
-        }
+        _terminate(dev->name, pd->argv[0], pd->cpid);
         pd->cpid = -1;
     }
 }
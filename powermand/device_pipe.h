@@ -3,9 +3,16 @@
 
 bool pipe_connect(Device * dev);
 void pipe_disconnect(Device * dev);
+bool pipe_may_run(Device *dev);
+bool pipe_alive(Device *dev);
+bool pipe_muxed(Device *dev);
+bool pipe_want_spare(Device *dev);
 void *pipe_create(char *cmdline, char *flags);
 void pipe_destroy(void *data);
 
+void pipe_pre_poll(xpollfd_t pfd);
+void pipe_post_poll(xpollfd_t pfd, struct timeval *timeout);
+
 #endif /* PM_DEVICE_PIPE_H */
 
 /*
@@ -3,6 +3,8 @@
 
 #define NO_FD (-1)
 
+struct sockaddr;
+
 /* Indices into script array */
 #define PM_LOG_IN             0
 #define PM_LOG_OUT            1
@@ -32,7 +34,8 @@
 #define PM_BEACON_OFF         25
 #define PM_BEACON_OFF_RANGED  26
 #define PM_RESOLVE            27
-#define NUM_SCRIPTS           28 /* count of scripts above */
+#define PM_SELECT             28
+#define NUM_SCRIPTS           29 /* count of scripts above */
 
 #define MAX_MATCH_POS   20
 
@@ -56,6 +59,7 @@ typedef enum {
     STMT_FOREACHNODE,
     STMT_IFOFF,
     STMT_IFON,
+    STMT_REQUEST,
 } StmtType;
 
 typedef struct {
@@ -64,6 +68,11 @@ typedef struct {
         struct {                /* SEND */
             char *fmt;          /* printf(fmt, ...) style format string */
         } send;
+        struct {                /* REQUEST */
+            char *method;       /* e.g. "GET" or "snmpget" */
+            char *fmt;          /* printf(fmt, ...) style path or OIDs */
+            char *body;         /* printf(fmt, ...) style body, or NULL */
+        } request;
         struct {                /* EXPECT */
             xregex_t exp;        /* compiled regex */
         } expect;
@@ -108,15 +117,31 @@ typedef struct _device {
     List acts;                  /* queue of Actions */
 
     struct timeval timeout;     /* configurable device timeout */
+    struct timeval connect_timeout; /* configurable connect timeout */
 
     cbuf_t to;                  /* buffer -> device */
     cbuf_t from;                /* buffer <- device */
 
     PlugList plugs;             /* list of Plugs (node name <-> plug name) */
     Script scripts[NUM_SCRIPTS]; /* array of scripts */
+    List traps;                 /* trap rules (Scripts: expect+setplugstate) */
 
     struct timeval last_retry;  /* time of last reconnect retry */
     int retry_count;            /* number of retries attempted */
+    int connect_failures;       /* consecutive failed connects */
+    int retries;                /* configurable retries of failed actions */
+
+    struct timeval last_used;   /* time of last client action */
+    bool closing;               /* logging out to close the connection */
+    bool shared;                /* connection shared with other devices */
+    bool selected;              /* select script run since taking its turn */
+    char *addr;                 /* address on a shared line (select "%s") */
+    bool paused;                /* in a delay: others may use the connection */
+
+    struct _device *pool;       /* device this is an extra session of */
+    List sessions;              /* extra sessions (NULL if only one) */
+    struct _device *spare;      /* standby connection (NULL if none) */
+    bool standby;               /* this is another device's spare */
 
     struct timeval last_ping;   /* time of last ping (if any) */
     struct timeval ping_period; /* configurable ping period (0.0 = none) */
@@ -126,7 +151,26 @@ typedef struct _device {
                                 /* network (e.g. tcp/serial)-specific methods */
     bool (*connect)(struct _device *dev);
     bool (*finish_connect)(struct _device *dev);
+                                /* optional: poll own fds while connecting */
+    void (*connect_pre_poll)(struct _device *dev, xpollfd_t pfd);
+    bool (*connect_post_poll)(struct _device *dev, xpollfd_t pfd,
+                              struct timeval *timeout);
     void (*preprocess)(struct _device *dev);
+                                /* optional: connection shared with others */
+    bool (*may_run)(struct _device *dev);
+    bool (*alive)(struct _device *dev);
+                                /* optional: request statements */
+    const char *methods;        /* methods supported, e.g. "GET POST" */
+    bool (*request)(struct _device *dev, const char *method,
+                    const char *arg, const char *body);
+    bool (*response)(struct _device *dev, struct timeval *timeout);
+                                /* optional: plug states a request found */
+    bool (*plugstate)(struct _device *dev, const char *plug,
+                      InterpState *state);
+                                /* optional: is addr one of the device's? */
+    bool (*trapsource)(struct _device *dev, const struct sockaddr *addr);
+                                /* optional: read input itself */
+    bool (*read)(struct _device *dev);
     void (*disconnect)(struct _device *dev);
     void (*destroy)(void *data);
 
@@ -134,17 +178,25 @@ typedef struct _device {
 } Device;
 
 typedef enum { ACT_ESUCCESS, ACT_EEXPFAIL, ACT_EABORT, ACT_ECONNECTTIMEOUT,
-               ACT_ELOGINTIMEOUT } ActError;
+               ACT_ELOGINTIMEOUT, ACT_EDEVDOWN } ActError;
 typedef void (*ActionCB) (int client_id, ActError acterr, const char *fmt, ...);
 typedef void (*VerbosePrintf) (int client_id, const char *fmt, ...);
+typedef void (*PlugStateCB) (char *node, InterpState state);
 
 #define MIN_DEV_BUF     1024
 #define MAX_DEV_BUF     1024*64
 
 void dev_add(Device * dev);
+void dev_add_session(Device *dev, Device *session);
+void dev_add_spare(Device *dev, Device *spare);
 int dev_enqueue_actions(int com, hostlist_t hl, ActionCB complete_fun,
         VerbosePrintf vpf_fun, int client_id, ArgList arglist);
 bool dev_check_actions(int com, hostlist_t hl);
+void dev_set_plugstate_cb(PlugStateCB fun);
+InterpState dev_get_plugstate(char *node);
+void dev_trap(Device *dev, const char *text);
+bool dev_same_host(const struct sockaddr *a, const struct sockaddr *b);
+bool dev_take_turn(Device **holder, Device *dev, int fd);
 
 Device *dev_create(const char *name);
 void dev_destroy(Device * dev);
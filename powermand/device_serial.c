@@ -24,6 +24,14 @@
 
 /*
  * Implement connect/disconnect device methods for serial devices.
+ *
+ * With the "shared" flag, devices on the same special file share one open
+ * port, e.g. daisy-chained units on one serial line.  The first device to
+ * connect opens the port and logs in; others join the open session.  The
+ * devices take turns at statement boundaries (see dev_take_turn), and
+ * each device's select script, if any, runs whenever it takes the line
+ * so that it can address its own unit.  If the holder disconnects because
+ * of an error, the port is closed and reopened by all of them.
  */
 
 #if HAVE_CONFIG_H
@@ -54,9 +62,22 @@
 #include "debug.h"
 #include "xpty.h"
 
+typedef struct {
+    char *special;              /* special file (shared port key) */
+    char *line;                 /* baud and framing flags */
+    int refs;                   /* devices configured on it */
+    int fd;                     /* open port (NO_FD if closed) */
+    int gen;                    /* incremented each time it is opened */
+    int users;                  /* devices connected to it */
+    Device *holder;             /* device currently using it */
+} SerialShared;
+
 typedef struct {
     char *special;
     char *flags;
+    char *addr;                 /* unit address on the shared port */
+    SerialShared *sh;           /* shared port (NULL if not shared) */
+    int sh_gen;                 /* sh->gen when device connected */
 } SerialDev;
 
 typedef struct {
@@ -86,12 +107,108 @@ static baudmap_t baudmap[] = {
 #endif
 };
 
+static List serial_shared = NULL;       /* shared ports */
+
+static int _match_shared(SerialShared *sh, char *special)
+{
+    return (strcmp(sh->special, special) == 0);
+}
+
+static void _destroy_shared(SerialShared *sh)
+{
+    xfree(sh->special);
+    xfree(sh->line);
+    xfree(sh);
+}
+
+/* Find the shared port for special, creating it if needed.  The port is
+ * opened with the line settings of whichever device connects first, so
+ * they must be the same for all devices on it.
+ */
+static SerialShared *_get_shared(char *special, char *line)
+{
+    SerialShared *sh;
+
+    if (serial_shared == NULL)
+        serial_shared = list_create((ListDelF) _destroy_shared);
+    sh = list_find_first(serial_shared, (ListFindF) _match_shared, special);
+    if (sh == NULL) {
+        sh = (SerialShared *)xmalloc(sizeof(SerialShared));
+        sh->special = xstrdup(special);
+        sh->line = xstrdup(line);
+        sh->refs = 0;
+        sh->fd = NO_FD;
+        sh->gen = 0;
+        sh->users = 0;
+        sh->holder = NULL;
+        list_append(serial_shared, sh);
+    } else if (strcmp(sh->line, line) != 0)
+        err_exit(FALSE, "%s: shared devices have different flags "
+                 "\"%s\" and \"%s\"", special, sh->line, line);
+    sh->refs++;
+    return sh;
+}
+
+/* Drop a device's reference to its shared port, freeing it with the last.
+ */
+static void _put_shared(SerialShared *sh)
+{
+    ListIterator itr;
+
+    if (--sh->refs > 0)
+        return;
+    itr = list_iterator_create(serial_shared);
+    if (list_find(itr, (ListFindF) _match_shared, sh->special))
+        list_delete(itr);
+    list_iterator_destroy(itr);
+    if (list_is_empty(serial_shared)) {
+        list_destroy(serial_shared);
+        serial_shared = NULL;
+    }
+}
+
+/* Flags are "baud,<databits><parity><stopbits>" optionally followed by
+ * ",shared" and ",addr=<unit address>".  The latter are picked out here,
+ * the former are parsed by sscanf on connect.
+ */
+static void _parse_options(SerialDev *ser, char *flags)
+{
+    char *tmp = xstrdup(flags);
+    char *line = xmalloc(strlen(flags) + 1);
+    char *opt = strtok(tmp, ",");
+    bool shared = FALSE;
+
+    while (opt) {
+        if (strcmp(opt, "shared") == 0)
+            shared = TRUE;
+        else if (strncmp(opt, "addr=", 5) == 0) {
+            if (ser->addr)
+                xfree(ser->addr);
+            ser->addr = xstrdup(opt + 5);
+        } else {
+            if (*line)
+                strcat(line, ",");
+            strcat(line, opt);
+        }
+        opt = strtok(NULL, ",");
+    }
+    xfree(tmp);
+    if (shared)
+        ser->sh = _get_shared(ser->special, line);
+    xfree(line);
+}
+
 void *serial_create(char *special, char *flags)
 {
     SerialDev *ser = (SerialDev *)xmalloc(sizeof(SerialDev));
 
     ser->special = xstrdup(special);
     ser->flags = xstrdup(flags);
+    ser->addr = NULL;
+    ser->sh = NULL;
+    ser->sh_gen = 0;
+    if (flags)
+        _parse_options(ser, flags);
 
     return (void *)ser;
 }
@@ -104,6 +221,10 @@ void serial_destroy(void *data)
         xfree(ser->special);
     if (ser->flags)
         xfree(ser->flags);
+    if (ser->addr)
+        xfree(ser->addr);
+    if (ser->sh)
+        _put_shared(ser->sh);
     xfree(ser);
 }
 
@@ -190,29 +311,21 @@ static int _serial_setup(char *devname, int fd, int baud, int databits,
     return 0;
 }
 
-/*
- * Open the special file associated with this device.
+/* Open and set up the port, returning its fd, or NO_FD on error.
  */
-bool serial_connect(Device * dev)
+static int _serial_open(Device *dev, SerialDev *ser)
 {
-    SerialDev *ser;
     int baud = 9600, databits = 8, stopbits = 1;
     char parity = 'N';
-    int res;
+    int fd;
     int n;
 
-    assert(dev->magic == DEV_MAGIC);
-    assert(dev->connect_state == DEV_NOT_CONNECTED);
-    assert(dev->fd == NO_FD);
-
-    ser = (SerialDev *)dev->data;
-
-    dev->fd = open(ser->special, O_RDWR | O_NONBLOCK | O_NOCTTY);
-    if (dev->fd < 0) {
+    fd = open(ser->special, O_RDWR | O_NONBLOCK | O_NOCTTY);
+    if (fd < 0) {
         err(TRUE, "_serial_connect(%s): open %s", dev->name, ser->special);
         goto out;
     }
-    if (!isatty(dev->fd)) {
+    if (!isatty(fd)) {
         err(FALSE, "_serial_connect(%s): not a tty", dev->name);
         goto out;
     }
@@ -223,12 +336,12 @@ bool serial_connect(Device * dev)
      *    open on a tty will affect subsequent read()s.
      *    Play it safe and be explicit!
      */
-    nonblock_set(dev->fd);
+    nonblock_set(fd);
 
     /* Conman takes an fcntl F_WRLCK on serial devices.
      * Powerman should respect conman's locks and vice-versa.
      */
-    if (lockf(dev->fd, F_TLOCK, 0) < 0) {
+    if (lockf(fd, F_TLOCK, 0) < 0) {
         err(TRUE, "_serial_connect(%s): could not lock device\n", dev->name);
         goto out;
     }
@@ -236,26 +349,126 @@ bool serial_connect(Device * dev)
     /* parse the serial flags and set up port accordingly */
     n = sscanf(ser->flags, "%d,%d%c%d", &baud, &databits, &parity, &stopbits);
     assert(n >= 0 && n <= 4); /* 0-4 matches OK (defaults if no match) */
-    res = _serial_setup(dev->name, dev->fd, baud, databits, parity, stopbits);
-    if (res < 0)
+    if (_serial_setup(dev->name, fd, baud, databits, parity, stopbits) < 0)
         goto out;
+    return fd;
+
+out:
+    if (fd >= 0) {
+        if (close(fd) < 0)
+            err(TRUE, "_serial_connect(%s): close", dev->name);
+    }
+    return NO_FD;
+}
+
+/* Connect to the shared port, opening it if it is not open.
+ */
+static bool _join_shared(Device *dev)
+{
+    SerialDev *ser = (SerialDev *)dev->data;
+    SerialShared *sh = ser->sh;
+
+    dev->shared = TRUE;
+    dev->addr = ser->addr;
+    if (sh->fd == NO_FD) {
+        if ((sh->fd = _serial_open(dev, ser)) == NO_FD)
+            return FALSE;
+        sh->gen++;
+        sh->holder = dev;               /* so it can log in first */
+        dev->fd = sh->fd;
+        err(FALSE, "_serial_connect(%s): opened (shared)", dev->name);
+    } else {
+        dev->logged_in = TRUE;          /* session is already logged in */
+        dbg(DBG_DEVICE, "_serial_connect: %s joined shared port", dev->name);
+    }
+    sh->users++;
+    ser->sh_gen = sh->gen;
+    dev->connect_state = DEV_CONNECTED;
+    dev->stat_successful_connects++;
+    return TRUE;
+}
+
+/*
+ * Return TRUE if dev may use the port now.  A device that is not sharing
+ * its port always may.  Otherwise it takes its turn as arbitrated by
+ * dev_take_turn().
+ */
+bool serial_may_run(Device *dev)
+{
+    SerialDev *ser = (SerialDev *)dev->data;
+
+    if (ser->sh == NULL)
+        return TRUE;
+    return dev_take_turn(&ser->sh->holder, dev, ser->sh->fd);
+}
+
+/*
+ * Return FALSE if the shared port dev connected to has been closed.
+ */
+bool serial_alive(Device *dev)
+{
+    SerialDev *ser = (SerialDev *)dev->data;
+
+    if (ser->sh == NULL)
+        return TRUE;
+    return (ser->sh->fd != NO_FD && ser->sh_gen == ser->sh->gen);
+}
+
+/*
+ * Open the special file associated with this device.
+ */
+bool serial_connect(Device * dev)
+{
+    SerialDev *ser;
+
+    assert(dev->magic == DEV_MAGIC);
+    assert(dev->connect_state == DEV_NOT_CONNECTED);
+    assert(dev->fd == NO_FD);
+
+    ser = (SerialDev *)dev->data;
+    if (ser->sh)
+        return _join_shared(dev);
+
+    if ((dev->fd = _serial_open(dev, ser)) == NO_FD)
+        return FALSE;
 
     dev->connect_state = DEV_CONNECTED;
     dev->stat_successful_connects++;
 
     err(FALSE, "_serial_connect(%s): opened", dev->name);
     return TRUE;
+}
 
-out:
-    if (dev->fd >= 0) {
-        if (close(dev->fd) < 0)
-            err(TRUE, "_serial_connect(%s): close", dev->name);
-        dev->fd = NO_FD;
+/* Leave a shared port.  It is closed when the last device leaves, or if
+ * the device using it leaves because of an error, since a unit may be in
+ * the middle of a response.
+ */
+static void _leave_shared(Device *dev)
+{
+    SerialDev *ser = (SerialDev *)dev->data;
+    SerialShared *sh = ser->sh;
+    bool stop = FALSE;
+
+    if (sh->holder == dev) {
+        sh->holder = NULL;
+        if (!dev->closing)
+            stop = TRUE;
+    }
+    dev->fd = NO_FD;
+    if (sh->fd == NO_FD || ser->sh_gen != sh->gen)
+        return;                         /* already closed */
+    if (--sh->users == 0)
+        stop = TRUE;
+    if (stop) {
+        dbg(DBG_DEVICE, "_serial_disconnect: %s closing shared port",
+            dev->name);
+        if (close(sh->fd) < 0)
+            err(TRUE, "_serial_disconnect(%s): close", dev->name);
+        sh->fd = NO_FD;
+        sh->users = 0;
     }
-    return FALSE;
 }
 
-
 /*
  * Close the special file associated with this device.
  */
@@ -264,6 +477,11 @@ void serial_disconnect(Device * dev)
     assert(dev->connect_state == DEV_CONNECTED);
     dbg(DBG_DEVICE, "_serial_disconnect: %s on fd %d", dev->name, dev->fd);
 
+    if (((SerialDev *)dev->data)->sh) {
+        _leave_shared(dev);
+        return;
+    }
+
     /* close device if open */
     if (dev->fd >= 0) {
         if (close(dev->fd) < 0)
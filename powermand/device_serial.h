@@ -3,6 +3,8 @@
 
 bool serial_connect(Device * dev);
 void serial_disconnect(Device * dev);
+bool serial_may_run(Device *dev);
+bool serial_alive(Device *dev);
 void *serial_create(char *special, char *flags);
 void serial_destroy(void *data);
 
@@ -0,0 +1,560 @@
+/*****************************************************************************
+ *  Copyright (C) 2026 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  UCRL-CODE-2002-008.
+ *
+ *  This file is part of PowerMan, a remote power management program.
+ *  For details, see http://code.google.com/p/powerman/
+ *
+ *  PowerMan is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PowerMan is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PowerMan; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/*
+ * Implement connect/disconnect/request methods for SNMP devices.
+ *
+ * Devices given as an snmp:// URL are spoken to directly over UDP, without
+ * a snmppower coprocess.  Scripts send requests with snmpget, snmpbulk and
+ * snmpset statements.  Each is a single request datagram (or, for snmpbulk,
+ * a series of GETBULKs walking a subtree), and each varbind of the response
+ * is written into the input buffer as a line "oid: value" for the expects
+ * that follow.  A request that has not been answered is sent again, with
+ * the same request id, every third of the device timeout until the script
+ * times out.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+#include <errno.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netdb.h>
+#include <assert.h>
+#include <sys/time.h>
+
+#include "list.h"
+#include "hostlist.h"
+#include "cbuf.h"
+#include "xtypes.h"
+#include "parse_util.h"
+#include "xmalloc.h"
+#include "hprintf.h"
+#include "xpoll.h"
+#include "pluglist.h"
+#include "arglist.h"
+#include "xregex.h"
+#include "device_private.h"
+#include "error.h"
+#include "debug.h"
+#include "device_snmp.h"
+#include "xpty.h"
+#include "resolve.h"
+#include "ber.h"
+
+/* Varbinds asked for by each GETBULK of an snmpbulk walk.
+ */
+#define SNMP_MAX_REPETITIONS    32
+
+/* Largest datagram we will receive.
+ */
+#define SNMP_MAX_MSG            65536
+
+/* Resend interval for devices without a timeout.
+ */
+#define SNMP_RETRANSMIT_MS      1000
+
+typedef struct {
+    char *host;
+    char *port;
+    char *community;
+    int version;                /* SNMP_V1 or SNMP_V2C */
+    int gen;                    /* bumped on each connect and disconnect */
+    int fd;                     /* socket ready to be promoted, or NO_FD */
+    struct sockaddr_storage addr; /* address the socket is connected to */
+    socklen_t addrlen;          /* 0 until the first connect */
+    long reqid;                 /* request id of the last request sent */
+    BerBuf msg;                 /* last request sent, for resending */
+    struct timeval sent;        /* when it was last sent */
+    bool pending;               /* request sent, response not complete */
+    bool walking;               /* pending request is part of snmpbulk */
+    char root[BER_MAX_STR];     /* subtree being walked */
+    char last[BER_MAX_STR];     /* last OID returned by the walk */
+} SnmpDev;
+
+/* argument for _snmp_resolved() */
+typedef struct {
+    Device *dev;
+    int gen;                    /* sn->gen when the lookup was started */
+} SnmpLookup;
+
+static void _parse_options(SnmpDev *sn, char *flags)
+{
+    char *tmp = xstrdup(flags);
+    char *opt = strtok(tmp, ",");
+
+    while (opt) {
+        if (strcmp(opt, "v1") == 0)
+            sn->version = SNMP_V1;
+        else
+            err_exit(FALSE, "bad device option: %s", opt);
+        opt = strtok(NULL, ",");
+    }
+    xfree(tmp);
+}
+
+/*
+ * Create an SNMP device from the part of an snmp:// URL after the scheme,
+ * i.e. "[community@]host[:port]".  Returns NULL if the URL is bad.
+ */
+void *snmp_create(char *url, char *flags)
+{
+    char *tmp = xstrdup(url);
+    char *host = tmp;
+    char *port, *at;
+    SnmpDev *sn = NULL;
+
+    if ((at = strrchr(host, '@'))) {
+        *at++ = '\0';
+        host = at;
+    }
+    if ((port = strchr(host, ':')))
+        *port++ = '\0';
+    if (*host == '\0' || strchr(host, '/') || (at && *tmp == '\0')
+            || (port && (*port == '\0'
+                         || strspn(port, "0123456789") != strlen(port)
+                         || atoi(port) < 1 || atoi(port) > 65535)))
+        goto done;
+
+    sn = (SnmpDev *)xmalloc(sizeof(SnmpDev));
+    sn->host = xstrdup(host);
+    sn->port = xstrdup(port ? port : "161");
+    sn->community = xstrdup(at ? tmp : "public");
+    sn->version = SNMP_V2C;
+    sn->gen = 0;
+    sn->fd = NO_FD;
+    sn->addrlen = 0;
+    sn->reqid = 0;
+    ber_init(&sn->msg);
+    timerclear(&sn->sent);
+    sn->pending = FALSE;
+    sn->walking = FALSE;
+    sn->root[0] = sn->last[0] = '\0';
+    if (flags)
+        _parse_options(sn, flags);
+done:
+    xfree(tmp);
+    return (void *)sn;
+}
+
+void snmp_destroy(void *data)
+{
+    SnmpDev *sn = (SnmpDev *)data;
+
+    if (sn->fd != NO_FD)
+        close(sn->fd);
+    xfree(sn->host);
+    xfree(sn->port);
+    xfree(sn->community);
+    ber_free(&sn->msg);
+    xfree(sn);
+}
+
+/*
+ * Resolver callback: open a UDP socket to the first usable address.
+ * snmp_connect_post_poll() hands it to the device.
+ */
+static void _snmp_resolved(void *arg, struct addrinfo *res, int error)
+{
+    SnmpLookup *lookup = (SnmpLookup *)arg;
+    Device *dev = lookup->dev;
+    SnmpDev *sn = (SnmpDev *)dev->data;
+    int gen = lookup->gen;
+    struct addrinfo *ai;
+    int fd = NO_FD;
+
+    xfree(lookup);
+
+    /* the device was disconnected while we were waiting */
+    if (gen != sn->gen || dev->connect_state != DEV_CONNECTING)
+        return;
+
+    if (error != 0) {
+        err(FALSE, "snmp_connect(%s): getaddrinfo %s:%s: %s", dev->name,
+            sn->host, sn->port, gai_strerror(error));
+        dev->connect_state = DEV_NOT_CONNECTED;
+        return;
+    }
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0)
+            continue;
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = NO_FD;
+    }
+    if (fd == NO_FD) {
+        err(TRUE, "snmp_connect(%s): %s:%s", dev->name, sn->host, sn->port);
+        dev->connect_state = DEV_NOT_CONNECTED;
+        return;
+    }
+    nonblock_set(fd);
+    sn->fd = fd;
+    if (ai->ai_addrlen <= sizeof(sn->addr)) {
+        memcpy(&sn->addr, ai->ai_addr, ai->ai_addrlen);
+        sn->addrlen = ai->ai_addrlen;
+    }
+}
+
+/*
+ * There is no connection to make over UDP; "connecting" is just looking
+ * up the host and opening a socket.  The device stays in the connecting
+ * state until _snmp_resolved() has been called.
+ */
+bool snmp_connect(Device *dev)
+{
+    SnmpDev *sn;
+    SnmpLookup *lookup;
+    struct addrinfo hints;
+
+    assert(dev->magic == DEV_MAGIC);
+    assert(dev->connect_state == DEV_NOT_CONNECTED);
+    assert(dev->fd == NO_FD);
+
+    sn = (SnmpDev *)dev->data;
+
+    dev->connect_state = DEV_CONNECTING;
+    sn->gen++;
+
+    lookup = (SnmpLookup *)xmalloc(sizeof(SnmpLookup));
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = PF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    lookup->dev = dev;
+    lookup->gen = sn->gen;
+    dbg(DBG_DEVICE, "snmp_connect: %s resolving %s:%s", dev->name,
+        sn->host, sn->port);
+    resolve_addr(sn->host, sn->port, &hints, _snmp_resolved, lookup);
+
+    return FALSE;
+}
+
+bool snmp_connect_post_poll(Device *dev, xpollfd_t pfd,
+                            struct timeval *timeout)
+{
+    SnmpDev *sn = (SnmpDev *)dev->data;
+
+    if (dev->connect_state == DEV_NOT_CONNECTED)
+        return FALSE;
+    if (sn->fd == NO_FD)            /* still resolving */
+        return TRUE;
+
+    dev->fd = sn->fd;
+    sn->fd = NO_FD;
+    dev->connect_state = DEV_CONNECTED;
+    dev->stat_successful_connects++;
+    err(FALSE, "snmp_connect(%s): ready", dev->name);
+    return TRUE;
+}
+
+void snmp_disconnect(Device *dev)
+{
+    SnmpDev *sn;
+
+    assert(dev->magic == DEV_MAGIC);
+    assert(dev->connect_state == DEV_CONNECTING
+           || dev->connect_state == DEV_CONNECTED);
+    sn = (SnmpDev *)dev->data;
+
+    dbg(DBG_DEVICE, "snmp_disconnect: %s on fd %d", dev->name, dev->fd);
+
+    sn->gen++;                  /* forget any lookup in progress */
+    sn->pending = FALSE;
+    sn->walking = FALSE;
+    if (sn->fd != NO_FD) {
+        close(sn->fd);
+        sn->fd = NO_FD;
+    }
+    if (dev->fd >= 0) {
+        if (close(dev->fd) < 0)
+            err(TRUE, "snmp_disconnect: %s close fd %d", dev->name, dev->fd);
+        dev->fd = NO_FD;
+    }
+
+    err(FALSE, "snmp_disconnect(%s): disconnected", dev->name);
+}
+
+/*
+ * A trap is the device's if it comes from the address we last sent
+ * requests to.
+ */
+bool snmp_trapsource(Device *dev, const struct sockaddr *addr)
+{
+    SnmpDev *sn = (SnmpDev *)dev->data;
+
+    return sn->addrlen > 0
+        && dev_same_host((struct sockaddr *)&sn->addr, addr);
+}
+
+/* Send the datagram in sn->msg (again).
+ */
+static bool _snmp_xmit(Device *dev)
+{
+    SnmpDev *sn = (SnmpDev *)dev->data;
+    int n;
+
+    if (gettimeofday(&sn->sent, NULL) < 0)
+        err_exit(TRUE, "gettimeofday");
+    n = send(dev->fd, sn->msg.data, sn->msg.len, 0);
+    if (n < 0)
+        err(TRUE, "%s: send", dev->name);
+
+    return (n == sn->msg.len);
+}
+
+/* Send a request with varbind list vbl.  nonrep and maxrep are only
+ * used by GETBULK and are zero otherwise.
+ */
+static bool _snmp_send(Device *dev, int type, BerBuf *vbl, long nonrep,
+                       long maxrep)
+{
+    SnmpDev *sn = (SnmpDev *)dev->data;
+
+    ber_free(&sn->msg);
+    ber_init(&sn->msg);
+    snmp_encode(&sn->msg, sn->version, sn->community, type, ++sn->reqid,
+                nonrep, maxrep, vbl);
+    sn->pending = _snmp_xmit(dev);
+
+    return sn->pending;
+}
+
+/* Ask for the OIDs following the last one an snmpbulk walk returned.
+ */
+static bool _snmp_walk_next(Device *dev)
+{
+    SnmpDev *sn = (SnmpDev *)dev->data;
+    BerBuf vbl;
+    bool res;
+
+    ber_init(&vbl);
+    ber_put_varbind(&vbl, sn->last, 0, NULL);
+    if (sn->version == SNMP_V1)
+        res = _snmp_send(dev, SNMP_GETNEXT, &vbl, 0, 0);
+    else
+        res = _snmp_send(dev, SNMP_GETBULK, &vbl, 0, SNMP_MAX_REPETITIONS);
+    ber_free(&vbl);
+
+    return res;
+}
+
+/*
+ * Send an snmpget, snmpbulk, or snmpset request.  arg holds the OIDs
+ * (one subtree for snmpbulk); the body of snmpset is a net-snmp style
+ * type letter and value, e.g. "i 1", which is set on each of them.
+ */
+bool snmp_request(Device *dev, const char *method, const char *arg,
+                  const char *body)
+{
+    SnmpDev *sn = (SnmpDev *)dev->data;
+    char *tmp = xstrdup(arg);
+    char *oid = strtok(tmp, " \t");
+    bool res = FALSE;
+    BerBuf vbl;
+
+    sn->pending = FALSE;
+    sn->walking = FALSE;
+    ber_init(&vbl);
+
+    if (strcmp(method, "snmpbulk") == 0) {
+        if (oid == NULL || strtok(NULL, " \t") != NULL
+                || strlen(oid) >= BER_MAX_STR
+                || ber_put_varbind(&vbl, oid, 0, NULL) < 0) {
+            err(FALSE, "%s: bad snmpbulk OID '%s'", dev->name, arg);
+            goto done;
+        }
+        if (*oid == '.')
+            oid++;
+        strcpy(sn->root, oid);
+        strcpy(sn->last, oid);
+        sn->walking = TRUE;
+        res = _snmp_walk_next(dev);
+    } else {
+        bool set = (strcmp(method, "snmpset") == 0);
+        char type = 0;
+        const char *val = NULL;
+
+        if (set) {
+            if (body == NULL || body[0] == '\0' || body[1] != ' ') {
+                err(FALSE, "%s: bad snmpset value '%s'", dev->name,
+                    body ? body : "");
+                goto done;
+            }
+            type = body[0];
+            val = body + 2;
+        }
+        if (oid == NULL) {
+            err(FALSE, "%s: %s needs an OID", dev->name, method);
+            goto done;
+        }
+        for (; oid != NULL; oid = strtok(NULL, " \t")) {
+            if (ber_put_varbind(&vbl, oid, type, val) < 0) {
+                err(FALSE, "%s: bad %s varbind '%s'", dev->name, method, oid);
+                goto done;
+            }
+        }
+        res = _snmp_send(dev, set ? SNMP_SET : SNMP_GET, &vbl, 0, 0);
+    }
+done:
+    ber_free(&vbl);
+    xfree(tmp);
+    return res;
+}
+
+/*
+ * Resend the pending request if it has not been answered in a third of
+ * the device timeout, and return TRUE once it has been answered.  The
+ * script timeout ends the resending.
+ */
+bool snmp_response(Device *dev, struct timeval *timeout)
+{
+    SnmpDev *sn = (SnmpDev *)dev->data;
+    struct timeval now, limit, timeleft;
+    struct timeval retransmit = { SNMP_RETRANSMIT_MS / 1000,
+                                  SNMP_RETRANSMIT_MS % 1000 * 1000 };
+
+    if (!sn->pending)
+        return TRUE;
+    if (timerisset(&dev->timeout)) {
+        long usec = dev->timeout.tv_sec * 1000000L + dev->timeout.tv_usec;
+
+        retransmit.tv_sec = usec / 3 / 1000000;
+        retransmit.tv_usec = usec / 3 % 1000000;
+    }
+    if (gettimeofday(&now, NULL) < 0)
+        err_exit(TRUE, "gettimeofday");
+
+    timeradd(&sn->sent, &retransmit, &limit);
+    if (timercmp(&now, &limit, <))
+        timersub(&limit, &now, &timeleft);
+    else {
+        dbg(DBG_DEVICE, "%s: resend SNMP request %ld", dev->name, sn->reqid);
+        _snmp_xmit(dev);
+        timeleft = retransmit;
+    }
+    if (!timerisset(timeout) || timercmp(&timeleft, timeout, <))
+        *timeout = timeleft;
+
+    return FALSE;
+}
+
+/* Is oid inside the subtree rooted at root?
+ */
+static bool _in_subtree(const char *root, const char *oid)
+{
+    int len = strlen(root);
+
+    return (strncmp(root, oid, len) == 0 && oid[len] == '.');
+}
+
+static void _snmp_output(Device *dev, const char *oid, const char *val)
+{
+    char *line = hsprintf("%s: %s\n", oid, val);
+    int dropped;
+
+    cbuf_write(dev->from, line, strlen(line), &dropped);
+    if (dropped > 0)
+        err(FALSE, "%s lost %d chars due to buffer wrap", dev->name, dropped);
+    xfree(line);
+}
+
+/*
+ * Read one response datagram and put its varbinds in the input buffer.
+ * Stale and malformed datagrams are dropped.  Returns FALSE only if the
+ * socket itself has failed, e.g. the host reported the port unreachable.
+ */
+bool snmp_read(Device *dev)
+{
+    static unsigned char buf[SNMP_MAX_MSG];
+    SnmpDev *sn = (SnmpDev *)dev->data;
+    char community[BER_MAX_STR];
+    char oid[BER_MAX_STR], val[BER_MAX_STR];
+    const unsigned char *vbl;
+    int vblen, version, type, tag, rc;
+    long reqid, errstat, erridx;
+    bool more;
+    int count = 0;
+    int n;
+
+    n = recv(dev->fd, buf, sizeof(buf), 0);
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return TRUE;
+        err(TRUE, "read error on %s", dev->name);
+        return FALSE;
+    }
+
+    if (snmp_decode(buf, n, &version, community, sizeof(community), &type,
+                    &reqid, &errstat, &erridx, &vbl, &vblen) < 0
+            || type != SNMP_RESPONSE) {
+        err(FALSE, "%s: dropped malformed SNMP response", dev->name);
+        return TRUE;
+    }
+    if (!sn->pending || reqid != sn->reqid) {
+        dbg(DBG_DEVICE, "%s: dropped stale SNMP response %ld", dev->name,
+            reqid);
+        return TRUE;
+    }
+    sn->pending = FALSE;
+
+    if (errstat != 0) {
+        /* an SNMPv1 walk ends with noSuchName */
+        if (sn->walking && sn->version == SNMP_V1 && errstat == 2)
+            return TRUE;
+        err(FALSE, "%s: SNMP error %s (index %ld)", dev->name,
+            snmp_strerror(errstat), erridx);
+        _snmp_output(dev, "error", snmp_strerror(errstat));
+        return TRUE;
+    }
+
+    more = sn->walking;
+    while ((rc = snmp_next_varbind(&vbl, &vblen, oid, &tag, val)) > 0) {
+        if (sn->walking) {
+            if (tag == BER_ENDOFMIBVIEW || !_in_subtree(sn->root, oid)) {
+                more = FALSE;
+                break;
+            }
+            strcpy(sn->last, oid);
+            count++;
+        }
+        _snmp_output(dev, oid, val);
+    }
+    if (rc < 0) {
+        err(FALSE, "%s: malformed SNMP varbind list", dev->name);
+        more = FALSE;
+    }
+    if (more && count > 0)
+        _snmp_walk_next(dev);
+
+    return TRUE;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,22 @@
+#ifndef PM_DEVICE_SNMP_H
+#define PM_DEVICE_SNMP_H
+
+#define SNMP_METHODS    "snmpget snmpbulk snmpset"
+
+void *snmp_create(char *url, char *flags);
+void snmp_destroy(void *data);
+bool snmp_connect(Device *dev);
+bool snmp_connect_post_poll(Device *dev, xpollfd_t pfd,
+                            struct timeval *timeout);
+void snmp_disconnect(Device *dev);
+bool snmp_request(Device *dev, const char *method, const char *arg,
+                  const char *body);
+bool snmp_response(Device *dev, struct timeval *timeout);
+bool snmp_read(Device *dev);
+bool snmp_trapsource(Device *dev, const struct sockaddr *addr);
+
+#endif /* PM_DEVICE_SNMP_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
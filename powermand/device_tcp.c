@@ -64,22 +64,49 @@
 #include "debug.h"
 #include "device_tcp.h"
 #include "xpty.h"
+#include "resolve.h"
 
 #ifndef HAVE_SOCKLEN_T
 typedef int socklen_t;                  /* socklen_t is uint32_t in Posix.1g */
 #endif /* !HAVE_SOCKLEN_T */
 
+/* Delay before a connect to the next address is started while earlier
+ * ones are still in progress (RFC 8305 "Connection Attempt Delay").
+ */
+#define TCP_ATTEMPT_DELAY_MS    250
+
 typedef enum { TELNET_NONE, TELNET_CMD, TELNET_OPT } TelnetState;
+typedef struct {
+    int family;
+    int socktype;
+    int protocol;
+    socklen_t addrlen;
+    struct sockaddr_storage addr;
+    int fd;                     /* connect in progress, or NO_FD */
+    bool polled;                /* fd has been through poll() */
+} TcpAddr;
 typedef struct {
     char *host;
     char *port;
     TelnetState tstate;         /* state of telnet processing */
     unsigned char tcmd;         /* buffered telnet command */
     bool quiet;                 /* don't report idle timeout messages */
-    struct addrinfo *addrs;
-    struct addrinfo *cur;
+    bool reresolve;             /* look up host again on each reconnect */
+    bool resolving;             /* waiting for _tcp_resolved() */
+    TcpAddr *addrs;             /* addresses of host (NULL until resolved) */
+    int naddrs;
+    int next;                   /* index of next address to try */
+    struct timeval next_time;   /* when to try it if others are pending */
+    int family;                 /* family of last connected address, or 0 */
+    int gen;                    /* bumped on each connect and disconnect */
 } TcpDev;
 
+/* argument for _tcp_resolved() */
+typedef struct {
+    Device *dev;
+    int gen;                    /* tcp->gen when the lookup was started */
+} TcpLookup;
+
 static void _telnet_init(Device *dev);
 static void _telnet_preprocess(Device * dev);
 
@@ -91,6 +118,8 @@ static void _parse_options(TcpDev *tcp, char *flags)
     while (opt) {
         if (strcmp(opt, "quiet") == 0)
             tcp->quiet = TRUE;
+        else if (strcmp(opt, "reresolve") == 0)
+            tcp->reresolve = TRUE;
         else
             err_exit(FALSE, "bad device option: %s\n", opt);
         opt = strtok(NULL, ",");
@@ -98,36 +127,49 @@ static void _parse_options(TcpDev *tcp, char *flags)
     xfree(tmp);
 }
 
+/*
+ * Host names are not looked up here, while the config file is being
+ * parsed, but by the resolver when the device is first connected.
+ * That way all devices are resolved concurrently and a slow name
+ * server cannot hold up the daemon.
+ */
 void *tcp_create(char *host, char *port, char *flags)
 {
     TcpDev *tcp = (TcpDev *)xmalloc(sizeof(TcpDev));
-    struct addrinfo hints;
-    int error;
 
     tcp->host = xstrdup(host);
     tcp->port = xstrdup(port);
     tcp->tstate = TELNET_NONE;
     tcp->tcmd = 0;
     tcp->quiet = FALSE;
+    tcp->reresolve = FALSE;
+    tcp->resolving = FALSE;
+    tcp->addrs = NULL;
+    tcp->naddrs = 0;
+    tcp->next = 0;
+    timerclear(&tcp->next_time);
+    tcp->family = 0;
+    tcp->gen = 0;
     if (flags)
         _parse_options(tcp, flags);
 
-    /* Store a list of possible addresses/families to connect to
-     * in the tcp->addrs linked list.
-     */
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = PF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-    if ((error = getaddrinfo(tcp->host, tcp->port, &hints, &tcp->addrs)) != 0)
-        err_exit(FALSE, "getaddrinfo %s:%s: %s", tcp->host, tcp->port,
-                                                 gai_strerror(error));
-    if (tcp->addrs == NULL)
-        err_exit(FALSE, "no addresses for server %s:%s", tcp->host, tcp->port);
-    tcp->cur = tcp->addrs;
-
     return (void *)tcp;
 }
 
+/* Abandon all connects in progress.
+ */
+static void _tcp_close_attempts(TcpDev *tcp)
+{
+    int i;
+
+    for (i = 0; i < tcp->naddrs; i++) {
+        if (tcp->addrs[i].fd != NO_FD) {
+            close(tcp->addrs[i].fd);
+            tcp->addrs[i].fd = NO_FD;
+        }
+    }
+}
+
 void tcp_destroy(void *data)
 {
     TcpDev *tcp = (TcpDev *)data;
@@ -136,107 +178,207 @@ void tcp_destroy(void *data)
         xfree(tcp->host);
     if (tcp->port)
         xfree(tcp->port);
-    if (tcp->addrs)
-        freeaddrinfo(tcp->addrs);
+    if (tcp->addrs) {
+        _tcp_close_attempts(tcp);
+        xfree(tcp->addrs);
+    }
 
     xfree(tcp);
 }
 
-/* After a successful connect, perform some management on
- * the connection.  Returns TRUE on success, FALSE on error.
+/*
+ * Order the addresses for connecting: the address we last connected to
+ * first, then alternating between its family and the others, as
+ * suggested by RFC 8305.  Without a previous connection the first
+ * family returned by getaddrinfo() leads.  Order within each family
+ * is preserved.
  */
-static bool tcp_finish_connect_one(Device *dev)
+static void _tcp_order_addrs(TcpDev *tcp, int win)
 {
-    int rc;
-    int error = 0;
-    socklen_t len = sizeof(error);
-
-    rc = getsockopt(dev->fd, SOL_SOCKET, SO_ERROR, &error, &len);
-    /*
-     *  If an error occurred, Berkeley-derived implementations
-     *    return 0 with the pending error in 'error'.  But Solaris
-     *    returns -1 with the pending error in 'errno'.  -dun
-     */
-    if (rc < 0)
-        error = errno;
-    if (! error) {
-        dev->connect_state = DEV_CONNECTED;
-        dev->stat_successful_connects++;
-        _telnet_init(dev);
-        return TRUE;
+    TcpAddr *tmp = (TcpAddr *)xmalloc(tcp->naddrs * sizeof(TcpAddr));
+    int family, i, a, b, n = 0;
+
+    if (win > 0) {
+        TcpAddr w = tcp->addrs[win];
+
+        memmove(&tcp->addrs[1], &tcp->addrs[0], win * sizeof(TcpAddr));
+        tcp->addrs[0] = w;
     }
-    return FALSE;
+    family = tcp->family ? tcp->family : tcp->addrs[0].family;
+    a = b = 0;
+    while (n < tcp->naddrs) {
+        for (i = a; i < tcp->naddrs; i++) {
+            if (tcp->addrs[i].family == family) {
+                tmp[n++] = tcp->addrs[i];
+                break;
+            }
+        }
+        a = i + 1;
+        for (i = b; i < tcp->naddrs; i++) {
+            if (tcp->addrs[i].family != family) {
+                tmp[n++] = tcp->addrs[i];
+                break;
+            }
+        }
+        b = i + 1;
+    }
+    memcpy(tcp->addrs, tmp, tcp->naddrs * sizeof(TcpAddr));
+    xfree(tmp);
 }
 
-/* Obtain a socket for the specified address and attempt to connect it.
- * Return TRUE on completion or connection in progress, FALSE on error.
+/* Obtain a socket for the specified address and start connecting it.
+ * Return TRUE if the connect is in progress, FALSE on error.  A connect
+ * that completes immediately is finished by tcp_connect_post_poll()
+ * like any other once poll() reports the socket writable.
  */
-static bool tcp_connect_one(Device *dev, struct addrinfo *addr)
+static bool _tcp_connect_one(TcpAddr *addr)
 {
-    TcpDev *tcp = (TcpDev *)dev->data;
     int opt;
+    int fd;
 
-    assert(tcp->cur != NULL);
-
-    if ((dev->fd = socket(addr->ai_family, addr->ai_socktype, 0)) < 0)
+    if ((fd = socket(addr->family, addr->socktype, addr->protocol)) < 0)
         return FALSE;
     opt = 1;
-    if (setsockopt(dev->fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-        close(dev->fd);
-        return FALSE;
-    }
-    nonblock_set(dev->fd);
-
-    if (connect(dev->fd, addr->ai_addr, addr->ai_addrlen) >= 0)
-        return tcp_finish_connect_one(dev);
-    else if (errno == EINPROGRESS)
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
+        goto fail;
+    nonblock_set(fd);
+
+    if (connect(fd, (struct sockaddr *)&addr->addr, addr->addrlen) >= 0
+            || errno == EINPROGRESS) {
+        addr->fd = fd;
+        addr->polled = FALSE;
         return TRUE;
-
-    close(dev->fd);
+    }
+fail:
+    close(fd);
     return FALSE;
 }
 
-/*
- * Continue TCP connect when fd unblocks.
- * Return FALSE on error, which triggers timed retry of tcp_connect().
- * Return TRUE if connected or still connecting (on the next address).
+/* Start a connect to the next address that will take one, and schedule
+ * the one after it.  Return FALSE if there were no addresses left.
  */
-bool tcp_finish_connect(Device * dev)
+static bool _tcp_connect_next(Device *dev)
 {
-    TcpDev *tcp;
-
-    assert(dev->magic == DEV_MAGIC);
-    assert(dev->connect_state == DEV_CONNECTING);
+    TcpDev *tcp = (TcpDev *)dev->data;
+    struct timeval delay;
+
+    while (tcp->next < tcp->naddrs) {
+        if (_tcp_connect_one(&tcp->addrs[tcp->next++])) {
+            if (gettimeofday(&tcp->next_time, NULL) < 0)
+                err_exit(TRUE, "gettimeofday");
+            delay.tv_sec = 0;
+            delay.tv_usec = TCP_ATTEMPT_DELAY_MS * 1000;
+            timeradd(&tcp->next_time, &delay, &tcp->next_time);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
 
-    tcp = (TcpDev *)dev->data;
+static void _tcp_report(Device *dev, const char *fn)
+{
+    TcpDev *tcp = (TcpDev *)dev->data;
 
-    if (!tcp_finish_connect_one(dev)) {
-        tcp->cur = tcp->cur->ai_next;
-        while (tcp->cur && !tcp_connect_one(dev, tcp->cur))
-            tcp->cur = tcp->cur->ai_next;
-        if (tcp->cur == NULL)
-            dev->connect_state = DEV_NOT_CONNECTED;
-    }
     switch(dev->connect_state) {
         case DEV_NOT_CONNECTED:
-            err(FALSE, "tcp_finish_connect(%s): connection refused", dev->name);
+            err(FALSE, "%s(%s): connection refused", fn, dev->name);
             break;
         case DEV_CONNECTED:
             if (!tcp->quiet)
-                err(FALSE, "tcp_finish_connect(%s): connected", dev->name);
+                err(FALSE, "%s(%s): connected", fn, dev->name);
             break;
         case DEV_CONNECTING:
             if (!tcp->quiet)
-                err(FALSE, "tcp_finish_connect(%s): connecting", dev->name);
+                err(FALSE, "%s(%s): connecting", fn, dev->name);
             break;
     }
-    return (dev->connect_state != DEV_NOT_CONNECTED);
+}
+
+/* Begin connecting to the device's addresses from the top of the list.
+ */
+static void _tcp_start(Device *dev, const char *fn)
+{
+    TcpDev *tcp = (TcpDev *)dev->data;
+
+    tcp->next = 0;
+    if (!_tcp_connect_next(dev))
+        dev->connect_state = DEV_NOT_CONNECTED;
+    _tcp_report(dev, fn);
+}
+
+/* Replace the device's address list with a copy of res, which belongs
+ * to the resolver.
+ */
+static void _tcp_set_addrs(TcpDev *tcp, struct addrinfo *res)
+{
+    struct addrinfo *ai;
+    int n = 0;
+
+    for (ai = res; ai != NULL; ai = ai->ai_next)
+        n++;
+    if (tcp->addrs)
+        xfree(tcp->addrs);
+    tcp->addrs = (TcpAddr *)xmalloc(n * sizeof(TcpAddr));
+    tcp->naddrs = 0;
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        TcpAddr *a = &tcp->addrs[tcp->naddrs];
+
+        if (ai->ai_addrlen > sizeof(a->addr))
+            continue;
+        a->family = ai->ai_family;
+        a->socktype = ai->ai_socktype;
+        a->protocol = ai->ai_protocol;
+        a->addrlen = ai->ai_addrlen;
+        memcpy(&a->addr, ai->ai_addr, ai->ai_addrlen);
+        a->fd = NO_FD;
+        a->polled = FALSE;
+        tcp->naddrs++;
+    }
+    if (tcp->naddrs > 0)
+        _tcp_order_addrs(tcp, 0);
 }
 
 /*
- * Initiate a non-blocking TCP connect.  tcp_finish_connect() will try to
- * finish the job when the main poll() loop unblocks again, unless we
- * finish here.
+ * Resolver callback: start connecting to the addresses just looked up.
+ * If the lookup failed, fall back to any addresses we already had.
+ */
+static void _tcp_resolved(void *arg, struct addrinfo *res, int error)
+{
+    TcpLookup *lookup = (TcpLookup *)arg;
+    Device *dev = lookup->dev;
+    TcpDev *tcp = (TcpDev *)dev->data;
+    int gen = lookup->gen;
+
+    xfree(lookup);
+
+    /* the device was disconnected while we were waiting */
+    if (gen != tcp->gen || dev->connect_state != DEV_CONNECTING)
+        return;
+    tcp->resolving = FALSE;
+
+    if (error != 0)
+        err(FALSE, "tcp_connect(%s): getaddrinfo %s:%s: %s", dev->name,
+            tcp->host, tcp->port, gai_strerror(error));
+    else if (res == NULL)
+        err(FALSE, "tcp_connect(%s): no addresses for server %s:%s",
+            dev->name, tcp->host, tcp->port);
+    else
+        _tcp_set_addrs(tcp, res);
+
+    if (tcp->naddrs == 0) {
+        dev->connect_state = DEV_NOT_CONNECTED;
+        return;
+    }
+    _tcp_start(dev, "tcp_connect");
+}
+
+/*
+ * Initiate a non-blocking TCP connect.  The connect is finished by
+ * tcp_connect_post_poll() when the main poll() loop unblocks again.  If
+ * the host has not been looked up yet, or 'reresolve' is set, the lookup
+ * is handed to the resolver first and the device stays in the connecting
+ * state until _tcp_resolved() is called.  The resolver caches results, so
+ * reconnects only cause a new lookup when its entry has expired.
  */
 bool tcp_connect(Device * dev)
 {
@@ -249,26 +391,130 @@ bool tcp_connect(Device * dev)
     tcp = (TcpDev *)dev->data;
 
     dev->connect_state = DEV_CONNECTING;
-    while (tcp->cur && !tcp_connect_one(dev, tcp->cur))
-        tcp->cur = tcp->cur->ai_next;
-    if (tcp->cur == NULL)
-        dev->connect_state = DEV_NOT_CONNECTED;
+    tcp->gen++;
+
+    if (tcp->addrs == NULL || tcp->reresolve) {
+        TcpLookup *lookup = (TcpLookup *)xmalloc(sizeof(TcpLookup));
+        struct addrinfo hints;
+
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = PF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        lookup->dev = dev;
+        lookup->gen = tcp->gen;
+        tcp->resolving = TRUE;
+        dbg(DBG_DEVICE, "tcp_connect: %s resolving %s:%s", dev->name,
+            tcp->host, tcp->port);
+        resolve_addr(tcp->host, tcp->port, &hints, _tcp_resolved, lookup);
+        return FALSE;
+    }
 
-    switch(dev->connect_state) {
-        case DEV_NOT_CONNECTED:
-            err(FALSE, "tcp_connect(%s): connection refused", dev->name);
-            break;
-        case DEV_CONNECTED:
-            if (!tcp->quiet)
-                err(FALSE, "tcp_connect(%s): connected", dev->name);
-            break;
-        case DEV_CONNECTING:
-            if (!tcp->quiet)
-                err(FALSE, "tcp_connect(%s): connecting", dev->name);
-            break;
+    _tcp_start(dev, "tcp_connect");
+
+    return FALSE;
+}
+
+/*
+ * While connecting, poll the sockets of all connects in progress.
+ * dev->fd is not set until one of them has succeeded.
+ */
+void tcp_connect_pre_poll(Device *dev, xpollfd_t pfd)
+{
+    TcpDev *tcp = (TcpDev *)dev->data;
+    int i;
+
+    for (i = 0; i < tcp->next; i++) {
+        if (tcp->addrs[i].fd != NO_FD) {
+            xpollfd_set(pfd, tcp->addrs[i].fd, XPOLLOUT);
+            tcp->addrs[i].polled = TRUE;
+        }
+    }
+}
+
+/*
+ * Continue TCP connect after poll().  The first connect to complete wins
+ * and the others are abandoned.  A connect to the next address is started
+ * as soon as one fails, or after TCP_ATTEMPT_DELAY_MS if the ones in
+ * progress are slow, so an address that silently drops packets does not
+ * use up the whole device timeout.
+ * Return FALSE if all addresses failed, which triggers timed retry of
+ * tcp_connect().  Return TRUE if connected or still connecting.
+ */
+bool tcp_connect_post_poll(Device *dev, xpollfd_t pfd,
+                           struct timeval *timeout)
+{
+    TcpDev *tcp = (TcpDev *)dev->data;
+    struct timeval now, timeleft;
+    bool pending = FALSE;
+    bool failed = FALSE;
+    int i;
+
+    assert(dev->magic == DEV_MAGIC);
+    assert(dev->connect_state == DEV_CONNECTING);
+
+    if (tcp->resolving)
+        return TRUE;
+
+    for (i = 0; i < tcp->next; i++) {
+        TcpAddr *a = &tcp->addrs[i];
+        int error = 0;
+        socklen_t len = sizeof(error);
+
+        if (a->fd == NO_FD)
+            continue;
+        if (!a->polled || !xpollfd_revents(pfd, a->fd)) {
+            pending = TRUE;
+            continue;
+        }
+        /*
+         *  If an error occurred, Berkeley-derived implementations
+         *    return 0 with the pending error in 'error'.  But Solaris
+         *    returns -1 with the pending error in 'errno'.  -dun
+         */
+        if (getsockopt(a->fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0)
+            error = errno;
+        if (!error) {
+            dev->fd = a->fd;
+            a->fd = NO_FD;
+            _tcp_close_attempts(tcp);
+            dev->connect_state = DEV_CONNECTED;
+            dev->stat_successful_connects++;
+            _telnet_init(dev);
+            dbg(DBG_DEVICE, "tcp_connect_post_poll: %s address %d of %d",
+                dev->name, i + 1, tcp->naddrs);
+            tcp->family = a->family;
+            _tcp_order_addrs(tcp, i);
+            _tcp_report(dev, "tcp_finish_connect");
+            return TRUE;
+        }
+        close(a->fd);
+        a->fd = NO_FD;
+        failed = TRUE;
     }
 
-    return (dev->connect_state == DEV_CONNECTED);
+    if (gettimeofday(&now, NULL) < 0)
+        err_exit(TRUE, "gettimeofday");
+    if (tcp->next < tcp->naddrs && (failed || !pending
+                                    || timercmp(&now, &tcp->next_time, >=))) {
+        if (_tcp_connect_next(dev))
+            pending = TRUE;
+    }
+    if (!pending) {
+        dev->connect_state = DEV_NOT_CONNECTED;
+        _tcp_report(dev, "tcp_finish_connect");
+        return FALSE;
+    }
+
+    /* unblock poll when it is time to try the next address */
+    if (tcp->next < tcp->naddrs) {
+        if (timercmp(&now, &tcp->next_time, <))
+            timersub(&tcp->next_time, &now, &timeleft);
+        else
+            timerclear(&timeleft);
+        if (!timerisset(timeout) || timercmp(&timeleft, timeout, <))
+            *timeout = timeleft;
+    }
+    return TRUE;
 }
 
 /*
@@ -285,6 +531,10 @@ void tcp_disconnect(Device * dev)
 
     dbg(DBG_DEVICE, "tcp_disconnect: %s on fd %d", dev->name, dev->fd);
 
+    tcp->gen++;                 /* forget any lookup in progress */
+    tcp->resolving = FALSE;
+    _tcp_close_attempts(tcp);
+
     /* close socket if open */
     if (dev->fd >= 0) {
         if (close(dev->fd) < 0)
@@ -296,6 +546,21 @@ void tcp_disconnect(Device * dev)
         err(FALSE, "tcp_disconnect(%s): disconnected", dev->name);
 }
 
+/*
+ * A trap is the device's if it comes from any address its host name was
+ * last looked up to (so not before the first connect).
+ */
+bool tcp_trapsource(Device *dev, const struct sockaddr *addr)
+{
+    TcpDev *tcp = (TcpDev *)dev->data;
+    int i;
+
+    for (i = 0; i < tcp->naddrs; i++)
+        if (dev_same_host((struct sockaddr *)&tcp->addrs[i].addr, addr))
+            return TRUE;
+    return FALSE;
+}
+
 void tcp_preprocess(Device *dev)
 {
     _telnet_preprocess(dev);
@@ -1,9 +1,12 @@
 #ifndef PM_DEVICE_TCP_H
 #define PM_DEVICE_TCP_H
 
-bool tcp_finish_connect(Device * dev);
 bool tcp_connect(Device * dev);
 void tcp_disconnect(Device * dev);
+void tcp_connect_pre_poll(Device *dev, xpollfd_t pfd);
+bool tcp_connect_post_poll(Device *dev, xpollfd_t pfd,
+                           struct timeval *timeout);
+bool tcp_trapsource(Device *dev, const struct sockaddr *addr);
 void tcp_preprocess(Device * dev);
 void *tcp_create(char *host, char *port, char *flags);
 void tcp_destroy(void *data);
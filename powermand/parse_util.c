@@ -35,6 +35,9 @@
 #include <string.h>
 #include <assert.h>
 #include <stdio.h>
+#include <ctype.h>
+#include <pwd.h>
+#include <grp.h>
 
 #include "list.h"
 #include "hostlist.h"
@@ -54,11 +57,23 @@ typedef struct {
 
 static bool         conf_use_tcp_wrap = FALSE;
 static List         conf_listen = NULL;     /* list of host:port strings */
+static char *       conf_snapshot = NULL;   /* shared memory segment name */
+static List         conf_traplisten = NULL; /* list of TrapListen's */
+static int          conf_max_connections = 0; /* device connection budget */
+static double       conf_idle_timeout = 0.0;  /* idle device disconnect */
+static double       conf_connect_rate = 0.0;  /* device connects per second */
+static int          conf_max_connecting = 0;  /* concurrent device connects */
+static int          conf_down_failures = 3;   /* failed connects till down */
+static uid_t *      conf_allow_uids = NULL; /* unix socket users allowed */
+static int          conf_allow_uids_len = 0;
+static gid_t *      conf_allow_gids = NULL; /* unix socket groups allowed */
+static int          conf_allow_gids_len = 0;
 static hostlist_t   conf_nodes = NULL;
 static List         conf_aliases = NULL;    /* list of alias_t's */
 
 static bool _validate_config(void);
 static void _alias_destroy(alias_t *a);
+static void _traplisten_destroy(TrapListen *t);
 
 extern int parse_config_file(char *filename); /* yacc/lex parser */
 
@@ -72,6 +87,7 @@ void conf_init(char *filename)
     bool valid;
 
     conf_listen = list_create((ListDelF) xfree);
+    conf_traplisten = list_create((ListDelF) _traplisten_destroy);
 
     conf_nodes = hostlist_create(NULL);
 
@@ -102,6 +118,12 @@ void conf_fini(void)
 {
     if (conf_nodes != NULL)
         hostlist_destroy(conf_nodes);
+    if (conf_snapshot != NULL)
+        xfree(conf_snapshot);
+    if (conf_allow_uids != NULL)
+        xfree(conf_allow_uids);
+    if (conf_allow_gids != NULL)
+        xfree(conf_allow_gids);
 }
 
 /*
@@ -219,6 +241,214 @@ void conf_add_listen(char *hostport)
     list_append(conf_listen, xstrdup(hostport));
 }
 
+List conf_get_traplisten(void)
+{
+    return conf_traplisten;
+}
+
+void conf_add_traplisten(char *hostport, char *community)
+{
+    TrapListen *t;
+
+    if (strchr(hostport, ':') == NULL)
+        err_exit(FALSE, "traplisten address must be of the form [host]:port");
+    t = (TrapListen *)xmalloc(sizeof(TrapListen));
+    t->hostport = xstrdup(hostport);
+    t->community = community ? xstrdup(community) : NULL;
+    list_append(conf_traplisten, t);
+}
+
+static void _traplisten_destroy(TrapListen *t)
+{
+    xfree(t->hostport);
+    if (t->community)
+        xfree(t->community);
+    xfree(t);
+}
+
+char *conf_get_snapshot(void)
+{
+    return conf_snapshot;
+}
+
+void conf_set_snapshot(char *name)
+{
+    if (name[0] != '/' || strchr(name + 1, '/') != NULL)
+        err_exit(FALSE, "snapshot name must be of the form /name");
+    if (conf_snapshot != NULL)
+        xfree(conf_snapshot);
+    conf_snapshot = xstrdup(name);
+}
+
+int conf_get_max_connections(void)
+{
+    return conf_max_connections;
+}
+
+void conf_set_max_connections(int val)
+{
+    if (val < 0)
+        err_exit(FALSE, "maxconnections must be zero or more");
+    conf_max_connections = val;
+}
+
+void conf_get_idle_timeout(struct timeval *tv)
+{
+    tv->tv_sec = (long)conf_idle_timeout;
+    tv->tv_usec = (long)((conf_idle_timeout - tv->tv_sec) * 1000000.0);
+}
+
+void conf_set_idle_timeout(double val)
+{
+    if (val < 0)
+        err_exit(FALSE, "idletimeout must be zero or more");
+    conf_idle_timeout = val;
+}
+
+double conf_get_connect_rate(void)
+{
+    return conf_connect_rate;
+}
+
+void conf_set_connect_rate(double val)
+{
+    if (val < 0)
+        err_exit(FALSE, "connectrate must be zero or more");
+    conf_connect_rate = val;
+}
+
+int conf_get_max_connecting(void)
+{
+    return conf_max_connecting;
+}
+
+void conf_set_max_connecting(int val)
+{
+    if (val < 0)
+        err_exit(FALSE, "maxconnecting must be zero or more");
+    conf_max_connecting = val;
+}
+
+int conf_get_down_failures(void)
+{
+    return conf_down_failures;
+}
+
+void conf_set_down_failures(int val)
+{
+    if (val < 0)
+        err_exit(FALSE, "downfailures must be zero or more");
+    conf_down_failures = val;
+}
+
+/*
+ * Manage users and groups allowed to connect on unix domain sockets.
+ * Names are resolved when the config file is read so no lookups are needed
+ * when clients connect.  Members of an allowed group are added as allowed
+ * users, since the peer credentials only contain the primary group.
+ */
+
+static void _allow_uid(uid_t uid)
+{
+    if (conf_allow_uids == NULL)
+        conf_allow_uids = (uid_t *)xmalloc(sizeof(uid_t));
+    else
+        conf_allow_uids = (uid_t *)xrealloc((char *)conf_allow_uids,
+                            sizeof(uid_t) * (conf_allow_uids_len + 1));
+    conf_allow_uids[conf_allow_uids_len++] = uid;
+}
+
+static void _allow_gid(gid_t gid)
+{
+    if (conf_allow_gids == NULL)
+        conf_allow_gids = (gid_t *)xmalloc(sizeof(gid_t));
+    else
+        conf_allow_gids = (gid_t *)xrealloc((char *)conf_allow_gids,
+                            sizeof(gid_t) * (conf_allow_gids_len + 1));
+    conf_allow_gids[conf_allow_gids_len++] = gid;
+}
+
+static bool _isnumeric(char *s)
+{
+    if (*s == '\0')
+        return FALSE;
+    while (*s)
+        if (!isdigit(*s++))
+            return FALSE;
+    return TRUE;
+}
+
+/* users is a comma separated list of user names or uids */
+void conf_add_allow_users(char *users)
+{
+    char *cpy = xstrdup(users);
+    char *tok, *saveptr = NULL;
+    struct passwd *pw;
+
+    for (tok = strtok_r(cpy, ",", &saveptr); tok != NULL;
+                                    tok = strtok_r(NULL, ",", &saveptr)) {
+        if (_isnumeric(tok))
+            _allow_uid(strtoul(tok, NULL, 10));
+        else if ((pw = getpwnam(tok)))
+            _allow_uid(pw->pw_uid);
+        else
+            err_exit(FALSE, "allowuser: unknown user %s", tok);
+    }
+    xfree(cpy);
+}
+
+/* groups is a comma separated list of group names or gids */
+void conf_add_allow_groups(char *groups)
+{
+    char *cpy = xstrdup(groups);
+    char *tok, *saveptr = NULL;
+    struct group *gr;
+    struct passwd *pw;
+    char **mem;
+
+    for (tok = strtok_r(cpy, ",", &saveptr); tok != NULL;
+                                    tok = strtok_r(NULL, ",", &saveptr)) {
+        if (_isnumeric(tok))
+            gr = getgrgid(strtoul(tok, NULL, 10));
+        else
+            gr = getgrnam(tok);
+        if (gr == NULL) {
+            if (!_isnumeric(tok))
+                err_exit(FALSE, "allowgroup: unknown group %s", tok);
+            _allow_gid(strtoul(tok, NULL, 10));
+            continue;
+        }
+        _allow_gid(gr->gr_gid);
+        for (mem = gr->gr_mem; *mem != NULL; mem++) {
+            if ((pw = getpwnam(*mem)))
+                _allow_uid(pw->pw_uid);
+        }
+    }
+    xfree(cpy);
+}
+
+/*
+ * Return TRUE if a unix domain socket peer with the given credentials may
+ * connect.  Without allowuser/allowgroup lines, anyone may connect.
+ * Root and the user powermand runs as are always allowed.
+ */
+bool conf_unix_peer_allowed(uid_t uid, gid_t gid)
+{
+    int i;
+
+    if (conf_allow_uids_len == 0 && conf_allow_gids_len == 0)
+        return TRUE;
+    if (uid == 0 || uid == geteuid())
+        return TRUE;
+    for (i = 0; i < conf_allow_uids_len; i++)
+        if (conf_allow_uids[i] == uid)
+            return TRUE;
+    for (i = 0; i < conf_allow_gids_len; i++)
+        if (conf_allow_gids[i] == gid)
+            return TRUE;
+    return FALSE;
+}
+
 /*
  * Manage a list of nodename aliases.
  */
@@ -13,6 +13,32 @@ void conf_set_use_tcp_wrappers(bool val);
 
 List conf_get_listen(void);
 void conf_add_listen(char *hostport);
+/* a traplisten line: community is NULL if any is accepted */
+typedef struct {
+    char *hostport;
+    char *community;
+} TrapListen;
+
+List conf_get_traplisten(void);
+void conf_add_traplisten(char *hostport, char *community);
+
+char *conf_get_snapshot(void);
+void conf_set_snapshot(char *name);
+
+int conf_get_max_connections(void);
+void conf_set_max_connections(int val);
+void conf_get_idle_timeout(struct timeval *tv);
+void conf_set_idle_timeout(double val);
+double conf_get_connect_rate(void);
+void conf_set_connect_rate(double val);
+int conf_get_max_connecting(void);
+void conf_set_max_connecting(int val);
+int conf_get_down_failures(void);
+void conf_set_down_failures(int val);
+
+void conf_add_allow_users(char *users);
+void conf_add_allow_groups(char *groups);
+bool conf_unix_peer_allowed(uid_t uid, gid_t gid);
 
 void conf_exp_aliases(hostlist_t hl);
 bool conf_add_alias(char *name, char *hosts);
@@ -52,6 +52,10 @@
 #include "device.h"
 #include "daemon.h"
 #include "client.h"
+#include "arglist.h"
+#include "snapshot.h"
+#include "resolve.h"
+#include "trap.h"
 #include "error.h"
 #include "debug.h"
 #include "hprintf.h"
@@ -167,9 +171,17 @@ int main(int argc, char **argv)
         dbg_notty();
     }
 
+    /* publish plug state for local readers (after daemonizing) */
+    snap_init(conf_get_snapshot());
+    resolve_init();
+    trap_init(conf_get_traplisten());
+
     /* We now have a socket at listener fd running in listen mode */
     /* and a file descriptor for communicating with each device */
     _select_loop();
+    trap_fini();
+    snap_fini();
+    cli_fini();
     return 0;
 }
 
@@ -199,9 +211,9 @@ static void _select_loop(void)
     timerclear(&tmout);
 
     /* start non-blocking connections to all the devices - finish them inside
-     * the poll loop.
+     * the poll loop (along with any the connect scheduler holds back).
      */
-    dev_initial_connect();
+    dev_initial_connect(&tmout);
 
     while (1) {
         int n;
@@ -210,6 +222,8 @@ static void _select_loop(void)
 
         cli_pre_poll(pfd);
         dev_pre_poll(pfd);
+        resolve_pre_poll(pfd);
+        trap_pre_poll(pfd);
 
         n = xpoll(pfd, timerisset(&tmout) ? &tmout : NULL);
         timerclear(&tmout);
@@ -220,6 +234,8 @@ static void _select_loop(void)
          * to process a scripted delay, tmout is updated.
          */
         cli_post_poll(pfd);
+        resolve_post_poll(pfd);
+        trap_post_poll(pfd);
         dev_post_poll(pfd, &tmout);
 
         if (cli_server_done())
@@ -235,6 +251,8 @@ static void _noop_handler(int signum)
 
 static void _exit_handler(int signum)
 {
+    trap_fini();
+    snap_fini();
     cli_fini();
     dev_fini();
     conf_fini();
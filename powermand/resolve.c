@@ -0,0 +1,360 @@
+/*****************************************************************************
+ *  Copyright (C) 2026 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  UCRL-CODE-2002-008.
+ *
+ *  This file is part of PowerMan, a remote power management program.
+ *  For details, see http://code.google.com/p/powerman/
+ *
+ *  PowerMan is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PowerMan is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PowerMan; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/*
+ * Asynchronous host name and address lookups.  getnameinfo() and
+ * getaddrinfo() may block for the resolver timeout, so they are run by a
+ * small pool of helper threads and their results are handed back to the
+ * poll loop through a pipe.  Results are cached for a while so repeated
+ * lookups (e.g. a client that reconnects often) cost nothing.
+ *
+ * Helper threads only perform the lookups; requests are created, cached,
+ * and completed (callbacks run) in the main thread.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+
+#include "xtypes.h"
+#include "xmalloc.h"
+#include "xpoll.h"
+#include "xpty.h"
+#include "hash.h"
+#include "hprintf.h"
+#include "error.h"
+#include "debug.h"
+#include "resolve.h"
+
+#define RESOLVE_THREADS     16      /* max concurrent lookups */
+#define RESOLVE_TTL         300     /* secs to cache a successful lookup */
+#define RESOLVE_NEG_TTL     30      /* secs to cache a failed lookup */
+#define RESOLVE_CACHE_SIZE  256
+
+typedef enum { RES_NAME, RES_ADDR } ResType;
+
+typedef struct resreq {
+    ResType type;
+    char *key;                      /* cache key */
+    struct sockaddr_storage addr;   /* RES_NAME: address to look up */
+    socklen_t addrlen;
+    char *host;                     /* RES_ADDR: host and port to look up */
+    char *port;
+    struct addrinfo hints;
+    ResolveNameCB namefun;
+    ResolveAddrCB addrfun;
+    void *arg;
+    struct rescache *cached;        /* cache entry result came from */
+    char name[NI_MAXHOST];          /* RES_NAME result */
+    bool found;                     /* RES_NAME result is valid */
+    struct addrinfo *res;           /* RES_ADDR result */
+    int error;                      /* RES_ADDR getaddrinfo error */
+    struct resreq *next;
+} ResReq;
+
+typedef struct rescache {
+    char *key;
+    time_t expires;
+    char *name;                     /* RES_NAME result (NULL if none) */
+    struct addrinfo *res;           /* RES_ADDR result (NULL if error) */
+    int error;                      /* RES_ADDR getaddrinfo error */
+    int refs;                       /* requests using this entry */
+    bool orphan;                    /* removed from cache while in use */
+} ResCache;
+
+static pthread_mutex_t res_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t res_cond = PTHREAD_COND_INITIALIZER;
+static ResReq *res_todo = NULL;     /* requests waiting for a thread */
+static ResReq *res_done = NULL;     /* requests waiting for completion */
+static int res_nthreads = 0;        /* helper threads started */
+static int res_idle = 0;            /* helper threads waiting for work */
+static int res_pipe[2] = { -1, -1 };  /* wakes up the poll loop */
+static hash_t res_cache = NULL;     /* key -> ResCache */
+
+/* append r to the list at *head (caller holds res_lock) */
+static void _append(ResReq **head, ResReq *r)
+{
+    r->next = NULL;
+    while (*head != NULL)
+        head = &(*head)->next;
+    *head = r;
+}
+
+/* signal the poll loop (caller holds res_lock) */
+static void _notify(void)
+{
+    if (write(res_pipe[1], "", 1) < 0 && errno != EAGAIN)
+        err(TRUE, "resolve: write");
+}
+
+static void *_resolve_thread(void *arg)
+{
+    ResReq *r;
+
+    pthread_mutex_lock(&res_lock);
+    for (;;) {
+        while (res_todo == NULL) {
+            res_idle++;
+            pthread_cond_wait(&res_cond, &res_lock);
+            res_idle--;
+        }
+        r = res_todo;
+        res_todo = r->next;
+        pthread_mutex_unlock(&res_lock);
+
+        if (r->type == RES_NAME) {
+            r->found = (getnameinfo((struct sockaddr *)&r->addr, r->addrlen,
+                                    r->name, sizeof(r->name), NULL, 0,
+                                    NI_NAMEREQD) == 0);
+        } else {
+            r->error = getaddrinfo(r->host, r->port, &r->hints, &r->res);
+            if (r->error == 0 && r->res == NULL)
+                r->error = EAI_NONAME;
+        }
+
+        pthread_mutex_lock(&res_lock);
+        _append(&res_done, r);
+        _notify();
+    }
+    /*NOTREACHED*/
+    return NULL;
+}
+
+static void _cache_destroy(ResCache *e)
+{
+    xfree(e->key);
+    if (e->name)
+        xfree(e->name);
+    if (e->res)
+        freeaddrinfo(e->res);
+    xfree(e);
+}
+
+/* destroy an entry removed from the cache, unless still in use */
+static void _cache_drop(ResCache *e)
+{
+    if (e->refs > 0)
+        e->orphan = TRUE;
+    else
+        _cache_destroy(e);
+}
+
+static void _cache_release(ResCache *e)
+{
+    if (--e->refs == 0 && e->orphan)
+        _cache_destroy(e);
+}
+
+static int _cache_expired(ResCache *e, time_t *now)
+{
+    return (e->expires <= *now);
+}
+
+/*
+ * Complete request r from the cache if there is a fresh entry for it,
+ * otherwise hand it to a helper thread, starting one if none are idle.
+ */
+static void _submit(ResReq *r)
+{
+    ResCache *e;
+    time_t now = time(NULL);
+
+    if ((e = hash_find(res_cache, r->key))) {
+        if (!_cache_expired(e, &now)) {
+            r->cached = e;
+            e->refs++;
+            if (e->name) {
+                snprintf(r->name, sizeof(r->name), "%s", e->name);
+                r->found = TRUE;
+            }
+            r->res = e->res;
+            r->error = e->error;
+        } else
+            _cache_drop(hash_remove(res_cache, r->key));
+    }
+
+    pthread_mutex_lock(&res_lock);
+    if (r->cached) {
+        _append(&res_done, r);
+        _notify();
+    } else {
+        _append(&res_todo, r);
+        if (res_idle == 0 && res_nthreads < RESOLVE_THREADS) {
+            pthread_t tid;
+            pthread_attr_t attr;
+
+            pthread_attr_init(&attr);
+            pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+            if (pthread_create(&tid, &attr, _resolve_thread, NULL) != 0)
+                err_exit(FALSE, "resolve: pthread_create failed");
+            pthread_attr_destroy(&attr);
+            res_nthreads++;
+        }
+        pthread_cond_signal(&res_cond);
+    }
+    pthread_mutex_unlock(&res_lock);
+}
+
+/*
+ * Cache the result of a completed lookup.  The cache takes ownership of
+ * any addrinfo list, and r holds a reference until its callback is done.
+ */
+static void _cache_result(ResReq *r)
+{
+    ResCache *e = (ResCache *)xmalloc(sizeof(ResCache));
+    bool ok = (r->type == RES_NAME) ? r->found : (r->error == 0);
+
+    e->key = xstrdup(r->key);
+    e->expires = time(NULL) + (ok ? RESOLVE_TTL : RESOLVE_NEG_TTL);
+    e->name = (r->type == RES_NAME && r->found) ? xstrdup(r->name) : NULL;
+    e->res = r->res;
+    e->error = r->error;
+    e->refs = 1;
+    e->orphan = FALSE;
+    r->cached = e;
+
+    /* replace the result of any concurrent lookup of the same key */
+    if (hash_find(res_cache, e->key))
+        _cache_drop(hash_remove(res_cache, e->key));
+    if (!hash_insert(res_cache, e->key, e))
+        err_exit(TRUE, "resolve: hash_insert");
+}
+
+void resolve_init(void)
+{
+    if (pipe(res_pipe) < 0)
+        err_exit(TRUE, "resolve: pipe");
+    nonblock_set(res_pipe[0]);
+    nonblock_set(res_pipe[1]);
+    res_cache = hash_create(RESOLVE_CACHE_SIZE, (hash_key_f)hash_key_string,
+                            (hash_cmp_f)strcmp, (hash_del_f)_cache_drop);
+}
+
+/*
+ * Look up the host name for addr.  fun(arg, name) is called later from
+ * resolve_post_poll(), never from within this function.
+ */
+void resolve_name(struct sockaddr *addr, socklen_t addrlen,
+                  ResolveNameCB fun, void *arg)
+{
+    ResReq *r = (ResReq *)xmalloc(sizeof(ResReq));
+    char hbuf[NI_MAXHOST];
+
+    memset(r, 0, sizeof(ResReq));
+    r->type = RES_NAME;
+    if (addrlen > sizeof(r->addr))
+        addrlen = sizeof(r->addr);
+    memcpy(&r->addr, addr, addrlen);
+    r->addrlen = addrlen;
+    r->namefun = fun;
+    r->arg = arg;
+    if (getnameinfo(addr, addrlen, hbuf, sizeof(hbuf), NULL, 0,
+                    NI_NUMERICHOST) != 0)
+        hbuf[0] = '\0';
+    r->key = hsprintf("name:%s", hbuf);
+    _submit(r);
+}
+
+/*
+ * Look up the addresses of host:port.  fun(arg, res, error) is called
+ * later from resolve_post_poll(), never from within this function.
+ */
+void resolve_addr(char *host, char *port, struct addrinfo *hints,
+                  ResolveAddrCB fun, void *arg)
+{
+    ResReq *r = (ResReq *)xmalloc(sizeof(ResReq));
+
+    memset(r, 0, sizeof(ResReq));
+    r->type = RES_ADDR;
+    r->host = xstrdup(host);
+    r->port = xstrdup(port);
+    r->hints = *hints;
+    r->addrfun = fun;
+    r->arg = arg;
+    r->key = hsprintf("addr:%s:%s:%d:%d:%d", host, port, hints->ai_family,
+                      hints->ai_socktype, hints->ai_flags);
+    _submit(r);
+}
+
+void resolve_pre_poll(xpollfd_t pfd)
+{
+    if (res_pipe[0] >= 0)
+        xpollfd_set(pfd, res_pipe[0], XPOLLIN);
+}
+
+/*
+ * Run callbacks for completed lookups.
+ */
+void resolve_post_poll(xpollfd_t pfd)
+{
+    ResReq *r, *done;
+    char buf[64];
+    time_t now;
+
+    if (res_pipe[0] < 0 || !(xpollfd_revents(pfd, res_pipe[0]) & XPOLLIN))
+        return;
+    while (read(res_pipe[0], buf, sizeof(buf)) > 0)
+        ;
+
+    pthread_mutex_lock(&res_lock);
+    done = res_done;
+    res_done = NULL;
+    pthread_mutex_unlock(&res_lock);
+
+    now = time(NULL);
+    hash_delete_if(res_cache, (hash_arg_f)_cache_expired, &now);
+
+    while ((r = done)) {
+        done = r->next;
+        dbg(DBG_CLIENT, "resolve: %s%s", r->key, r->cached ? " (cached)" : "");
+        if (!r->cached)
+            _cache_result(r);
+        if (r->type == RES_NAME)
+            r->namefun(r->arg, r->found ? r->name : NULL);
+        else
+            r->addrfun(r->arg, r->res, r->error);
+        if (r->cached)
+            _cache_release(r->cached);
+        xfree(r->key);
+        if (r->host)
+            xfree(r->host);
+        if (r->port)
+            xfree(r->port);
+        xfree(r);
+    }
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
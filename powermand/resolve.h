@@ -0,0 +1,31 @@
+#ifndef PM_RESOLVE_H
+#define PM_RESOLVE_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+
+/* Called with the host name for an address, or NULL if it has none.
+ */
+typedef void (*ResolveNameCB) (void *arg, char *name);
+
+/* Called with the addresses for a host:port (owned by the resolver and
+ * only valid during the call), or NULL and a getaddrinfo error code.
+ */
+typedef void (*ResolveAddrCB) (void *arg, struct addrinfo *res, int error);
+
+void resolve_init(void);
+
+void resolve_name(struct sockaddr *addr, socklen_t addrlen,
+                  ResolveNameCB fun, void *arg);
+void resolve_addr(char *host, char *port, struct addrinfo *hints,
+                  ResolveAddrCB fun, void *arg);
+
+void resolve_pre_poll(xpollfd_t pfd);
+void resolve_post_poll(xpollfd_t pfd);
+
+#endif /* PM_RESOLVE_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
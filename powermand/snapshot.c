@@ -0,0 +1,213 @@
+/*****************************************************************************
+ *  Copyright (C) 2026 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  UCRL-CODE-2002-008.
+ *
+ *  This file is part of PowerMan, a remote power management program.
+ *  For details, see http://code.google.com/p/powerman/
+ *
+ *  PowerMan is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PowerMan is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PowerMan; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/*
+ * Publish the last known plug state of each node in a POSIX shared memory
+ * segment so that local tools can read it without contacting powermand.
+ * See snapshot_proto.h for the segment layout and locking protocol.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "xtypes.h"
+#include "xmalloc.h"
+#include "list.h"
+#include "hostlist.h"
+#include "hash.h"
+#include "error.h"
+#include "debug.h"
+#include "parse_util.h"
+#include "arglist.h"
+#include "snapshot_proto.h"
+#include "snapshot.h"
+
+static struct pm_snap_hdr *snap = NULL;
+static char *snap_name = NULL;
+static int snap_fd = -1;            /* segment, locked while we own it */
+static hash_t snap_nodes = NULL;    /* node name -> struct pm_snap_node */
+
+/*
+ * Create the shared memory segment 'name' and lock it for as long as we
+ * own it.  A segment that already exists belongs to a running instance if
+ * it is still locked; otherwise it was left behind by one that died, and
+ * is replaced.  Return the descriptor of the new segment.
+ */
+static int _snap_create(char *name)
+{
+    int fd;
+
+    for (;;) {
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, PM_SNAP_MODE);
+        if (fd >= 0) {
+            if (lockf(fd, F_TLOCK, 0) < 0)
+                err_exit(TRUE, "lock %s", name);
+            return fd;
+        }
+        if (errno != EEXIST)
+            err_exit(TRUE, "shm_open %s", name);
+        if ((fd = shm_open(name, O_RDWR, 0)) < 0) {
+            if (errno == ENOENT)
+                continue;               /* removed in the meantime */
+            err_exit(TRUE, "shm_open %s", name);
+        }
+        if (lockf(fd, F_TLOCK, 0) < 0) {
+            if (errno == EACCES || errno == EAGAIN)
+                err_exit(FALSE, "%s: snapshot is in use by another process",
+                         name);
+            err_exit(TRUE, "lock %s", name);
+        }
+        /* stale: remove it while holding its lock, then start over */
+        (void)shm_unlink(name);
+        (void)close(fd);
+    }
+}
+
+/*
+ * Create the shared memory segment 'name' (if non-NULL) with an entry for
+ * every configured node, all in unknown state.
+ */
+void snap_init(char *name)
+{
+    hostlist_t hl;
+    hostlist_iterator_t itr;
+    struct pm_snap_node *nodes;
+    char *node, *names;
+    size_t size, nameslen = 0;
+    int count, i, fd;
+
+    if (name == NULL)
+        return;
+
+    hl = hostlist_copy(conf_getnodes());
+    hostlist_sort(hl);
+    count = hostlist_count(hl);
+
+    if ((itr = hostlist_iterator_create(hl)) == NULL)
+        err_exit(FALSE, "hostlist_iterator_create failed");
+    while ((node = hostlist_next(itr))) {
+        nameslen += strlen(node) + 1;
+        free(node);
+    }
+    size = sizeof(struct pm_snap_hdr) + count * sizeof(struct pm_snap_node)
+         + nameslen;
+
+    /* replace any segment left behind by a previous instance */
+    fd = _snap_create(name);
+    if (fchmod(fd, PM_SNAP_MODE) < 0)
+        err_exit(TRUE, "fchmod %s", name);
+    if (ftruncate(fd, size) < 0)
+        err_exit(TRUE, "ftruncate %s", name);
+    snap = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (snap == MAP_FAILED)
+        err_exit(TRUE, "mmap %s", name);
+    snap_fd = fd;                       /* keep it open to hold the lock */
+    snap_name = xstrdup(name);
+
+    /* the segment starts zeroed, so all states are unknown */
+    snap->size = size;
+    snap->count = count;
+    snap->names = size - nameslen;
+    snap->seq = 0;
+    snap->pid = getpid();
+    snap->updated = time(NULL);
+
+    snap_nodes = hash_create(count, (hash_key_f)hash_key_string,
+                             (hash_cmp_f)strcmp, NULL);
+    nodes = PM_SNAP_NODES(snap);
+    names = (char *)snap + snap->names;
+    hostlist_iterator_reset(itr);
+    for (i = 0; (node = hostlist_next(itr)); i++) {
+        nodes[i].name = names - (char *)snap;
+        strcpy(names, node);
+        if (!hash_insert(snap_nodes, names, &nodes[i]))
+            err_exit(TRUE, "hash_insert");
+        names += strlen(node) + 1;
+        free(node);
+    }
+    hostlist_iterator_destroy(itr);
+    hostlist_destroy(hl);
+
+    /* readers check the magic last */
+    PM_SNAP_BARRIER();
+    snap->version = PM_SNAP_VERSION;
+    snap->magic = PM_SNAP_MAGIC;
+
+    dbg(DBG_CLIENT, "snapshot %s: %d nodes, %lu bytes", name, count,
+        (unsigned long)size);
+}
+
+/*
+ * Mark the segment as abandoned and remove it.
+ */
+void snap_fini(void)
+{
+    if (snap == NULL)
+        return;
+    snap->pid = 0;
+    (void)shm_unlink(snap_name);
+    (void)munmap(snap, snap->size);
+    snap = NULL;
+    (void)close(snap_fd);
+    snap_fd = -1;
+    xfree(snap_name);
+    snap_name = NULL;
+    hash_destroy(snap_nodes);
+    snap_nodes = NULL;
+}
+
+/*
+ * Publish a new state for node.
+ */
+void snap_set_state(char *node, InterpState state)
+{
+    struct pm_snap_node *n;
+    time_t now;
+
+    if (snap == NULL || !(n = hash_find(snap_nodes, node)))
+        return;
+    now = time(NULL);
+
+    snap->seq++;
+    PM_SNAP_BARRIER();
+    n->state = state == ST_ON ? PM_SNAP_ON
+             : state == ST_OFF ? PM_SNAP_OFF : PM_SNAP_UNKNOWN;
+    n->changed = now;
+    snap->updated = now;
+    PM_SNAP_BARRIER();
+    snap->seq++;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
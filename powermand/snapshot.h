@@ -0,0 +1,12 @@
+#ifndef PM_SNAPSHOT_H
+#define PM_SNAPSHOT_H
+
+void snap_init(char *name);
+void snap_fini(void);
+void snap_set_state(char *node, InterpState state);
+
+#endif /* PM_SNAPSHOT_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
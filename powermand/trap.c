@@ -0,0 +1,333 @@
+/*****************************************************************************
+ *  Copyright (C) 2026 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  UCRL-CODE-2002-008.
+ *
+ *  This file is part of PowerMan, a remote power management program.
+ *  For details, see http://code.google.com/p/powerman/
+ *
+ *  PowerMan is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PowerMan is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PowerMan; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/*
+ * Listen for SNMP traps (v1 and v2c) and informs on the UDP addresses
+ * given by traplisten lines, so that devices which report outlet changes
+ * on their own update plug state without being polled.
+ *
+ * A trap is handed to the device it came from, as decided by the device's
+ * trapsource method (the source address is compared with those the device
+ * was looked up to).  It is rendered as the text an snmpget of its
+ * varbinds would produce ("oid: value" lines, led by sysUpTime.0 and
+ * snmpTrapOID.0, which v1 traps are given as in RFC 3584), and the trap
+ * rules of the device's specification are matched against it.  Traps
+ * from anywhere else are dropped, and informs are only acknowledged for
+ * known devices.  A traplisten line may name a community, in which case
+ * traps received on its sockets with any other community are dropped.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netdb.h>
+
+#include "xtypes.h"
+#include "xmalloc.h"
+#include "list.h"
+#include "hostlist.h"
+#include "cbuf.h"
+#include "xpoll.h"
+#include "xregex.h"
+#include "xpty.h"
+#include "pluglist.h"
+#include "arglist.h"
+#include "device_private.h"
+#include "parse_util.h"
+#include "error.h"
+#include "debug.h"
+#include "ber.h"
+#include "trap.h"
+
+/* Largest datagram we will receive.
+ */
+#define TRAP_MAX_MSG        65536
+
+/* Datagrams read from a socket each time through the poll loop, so a
+ * storm of traps cannot starve clients and devices.
+ */
+#define TRAP_READ_BURST     64
+
+static int *trap_fds = NULL;        /* sockets we receive traps on */
+static char **trap_communities = NULL;  /* community per socket, or NULL */
+static int trap_fds_len = 0;
+
+/* Bind a socket for each address of "[host]:port".  An empty host means
+ * any interface.  Returns the number of sockets bound.
+ */
+static int _trap_listen(char *hostport, char *community)
+{
+    char *host = xstrdup(hostport);
+    char *port = strrchr(host, ':');
+    struct addrinfo hints, *res, *r;
+    int fd, error, opt, count = 0;
+
+    *port++ = '\0';
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = PF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_PASSIVE;
+    if ((error = getaddrinfo(*host ? host : NULL, port, &hints, &res)))
+        err_exit(FALSE, "traplisten %s: %s", hostport, gai_strerror(error));
+
+    for (r = res; r != NULL; r = r->ai_next) {
+        if ((fd = socket(r->ai_family, r->ai_socktype, r->ai_protocol)) < 0) {
+            err(TRUE, "traplisten %s: socket", hostport);
+            continue;
+        }
+        /* keep IPv6 sockets from claiming the IPv4 port as well */
+        opt = 1;
+        if (r->ai_family == AF_INET6)
+            (void)setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &opt, sizeof(opt));
+        if (bind(fd, r->ai_addr, r->ai_addrlen) < 0) {
+            err(TRUE, "traplisten %s: bind", hostport);
+            close(fd);
+            continue;
+        }
+        nonblock_set(fd);
+        trap_fds = trap_fds ? (int *)xrealloc((char *)trap_fds,
+                                              sizeof(int) * (trap_fds_len + 1))
+                            : (int *)xmalloc(sizeof(int));
+        trap_communities = trap_communities
+                ? (char **)xrealloc((char *)trap_communities,
+                                    sizeof(char *) * (trap_fds_len + 1))
+                : (char **)xmalloc(sizeof(char *));
+        trap_communities[trap_fds_len] = community ? xstrdup(community)
+                                                   : NULL;
+        trap_fds[trap_fds_len++] = fd;
+        count++;
+    }
+    freeaddrinfo(res);
+    xfree(host);
+    return count;
+}
+
+/*
+ * Begin listening for traps on each of the addresses in the list
+ * of TrapListen's.
+ */
+void trap_init(List addrs)
+{
+    ListIterator itr;
+    TrapListen *t;
+
+    itr = list_iterator_create(addrs);
+    while ((t = list_next(itr))) {
+        if (_trap_listen(t->hostport, t->community) == 0)
+            err_exit(FALSE, "traplisten %s: no usable address", t->hostport);
+    }
+    list_iterator_destroy(itr);
+    if (trap_fds_len > 0)
+        dbg(DBG_DEVICE, "listening for traps on %d sockets", trap_fds_len);
+}
+
+void trap_fini(void)
+{
+    int i;
+
+    for (i = 0; i < trap_fds_len; i++) {
+        close(trap_fds[i]);
+        if (trap_communities[i])
+            xfree(trap_communities[i]);
+    }
+    if (trap_fds)
+        xfree(trap_fds);
+    trap_fds = NULL;
+    if (trap_communities)
+        xfree(trap_communities);
+    trap_communities = NULL;
+    trap_fds_len = 0;
+}
+
+/* Append a line "oid: value" to the trap text.
+ */
+static void _trap_line(char **text, int *len, const char *oid,
+                       const char *val)
+{
+    int n = strlen(oid) + strlen(val) + 3;
+
+    *text = *text ? xrealloc(*text, *len + n + 1) : xmalloc(n + 1);
+    sprintf(*text + *len, "%s: %s\n", oid, val);
+    *len += n;
+}
+
+/* Render a trap's varbinds as text.  Returns NULL if they are malformed.
+ * The caller must xfree() the result.
+ */
+static char *_trap_text(const unsigned char *vbl, int vblen, char *text,
+                        int len)
+{
+    char oid[BER_MAX_STR], val[BER_MAX_STR];
+    int tag, rc;
+
+    while ((rc = snmp_next_varbind(&vbl, &vblen, oid, &tag, val)) > 0)
+        _trap_line(&text, &len, oid, val);
+    if (rc < 0) {
+        if (text)
+            xfree(text);
+        return NULL;
+    }
+    if (text == NULL)
+        text = xstrdup("");
+    return text;
+}
+
+/* Return the device a trap from addr belongs to, or NULL.
+ */
+static Device *_trap_device(const struct sockaddr *addr)
+{
+    ListIterator itr;
+    Device *dev;
+
+    itr = list_iterator_create(dev_getdevices());
+    while ((dev = list_next(itr))) {
+        if (dev->traps && dev->trapsource && dev->trapsource(dev, addr))
+            break;
+    }
+    list_iterator_destroy(itr);
+    return dev;
+}
+
+/* Acknowledge an inform by echoing its varbinds in a response.
+ */
+static void _trap_ack(int fd, int version, const char *community, long reqid,
+                      const unsigned char *vbl, int vblen,
+                      struct sockaddr *addr, socklen_t addrlen)
+{
+    BerBuf echo, msg;
+
+    echo.data = (unsigned char *)vbl;
+    echo.len = echo.size = vblen;
+    ber_init(&msg);
+    snmp_encode(&msg, version, community, SNMP_RESPONSE, reqid, 0, 0, &echo);
+    if (sendto(fd, msg.data, msg.len, 0, addr, addrlen) < 0)
+        dbg(DBG_DEVICE, "trap: inform response: %s", strerror(errno));
+    ber_free(&msg);
+}
+
+/* Decode one datagram received on a socket that only accepts community
+ * want (any if NULL) and apply it to the device that sent it.
+ */
+static void _trap_recv(int fd, char *want, const unsigned char *buf, int len,
+                       struct sockaddr *addr, socklen_t addrlen)
+{
+    char community[BER_MAX_STR];
+    const unsigned char *vbl;
+    int vblen, version, type;
+    long reqid, err, idx;
+    char *text = NULL;
+    Device *dev;
+
+    if (snmp_decode(buf, len, &version, community, sizeof(community), &type,
+                    &reqid, &err, &idx, &vbl, &vblen) == 0) {
+        if (type != SNMP_TRAP2 && type != SNMP_INFORM)
+            return;
+        if (want && strcmp(community, want) != 0)
+            goto badcommunity;
+        if (!(dev = _trap_device(addr)))
+            goto unknown;
+        text = _trap_text(vbl, vblen, NULL, 0);
+        if (type == SNMP_INFORM)
+            _trap_ack(fd, version, community, reqid, vbl, vblen, addr,
+                      addrlen);
+    } else {
+        char trapoid[BER_MAX_STR], uptime[32];
+        unsigned long ticks;
+        int n = 0;
+
+        if (snmp_decode_trap1(buf, len, community, sizeof(community),
+                              trapoid, &ticks, &vbl, &vblen) < 0) {
+            dbg(DBG_DEVICE, "trap: malformed message");
+            return;
+        }
+        if (want && strcmp(community, want) != 0)
+            goto badcommunity;
+        if (!(dev = _trap_device(addr)))
+            goto unknown;
+        sprintf(uptime, "%lu", ticks);
+        _trap_line(&text, &n, "1.3.6.1.2.1.1.3.0", uptime);
+        _trap_line(&text, &n, "1.3.6.1.6.3.1.1.4.1.0", trapoid);
+        text = _trap_text(vbl, vblen, text, n);
+    }
+    if (text == NULL) {
+        dbg(DBG_DEVICE, "trap: %s: malformed varbinds", dev->name);
+        return;
+    }
+    dbg(DBG_DEVICE, "trap: %s: %s", dev->name, text);
+    dev_trap(dev, text);
+    xfree(text);
+    return;
+unknown:
+    dbg(DBG_DEVICE, "trap: not from a device with trap rules");
+    return;
+badcommunity:
+    dbg(DBG_DEVICE, "trap: wrong community");
+}
+
+void trap_pre_poll(xpollfd_t pfd)
+{
+    int i;
+
+    for (i = 0; i < trap_fds_len; i++)
+        xpollfd_set(pfd, trap_fds[i], XPOLLIN);
+}
+
+void trap_post_poll(xpollfd_t pfd)
+{
+    static unsigned char *buf = NULL;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    int i, j, n;
+
+    for (i = 0; i < trap_fds_len; i++) {
+        if (!(xpollfd_revents(pfd, trap_fds[i]) & XPOLLIN))
+            continue;
+        if (buf == NULL)
+            buf = (unsigned char *)xmalloc(TRAP_MAX_MSG);
+        for (j = 0; j < TRAP_READ_BURST; j++) {
+            addrlen = sizeof(addr);
+            n = recvfrom(trap_fds[i], buf, TRAP_MAX_MSG, 0,
+                         (struct sockaddr *)&addr, &addrlen);
+            if (n < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                    err(TRUE, "trap: recvfrom");
+                break;
+            }
+            _trap_recv(trap_fds[i], trap_communities[i], buf, n,
+                       (struct sockaddr *)&addr, addrlen);
+        }
+    }
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,14 @@
+#ifndef PM_TRAP_H
+#define PM_TRAP_H
+
+void trap_init(List addrs);
+void trap_fini(void);
+
+void trap_pre_poll(xpollfd_t pfd);
+void trap_post_poll(xpollfd_t pfd);
+
+#endif /* PM_TRAP_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
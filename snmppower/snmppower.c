@@ -46,15 +46,184 @@ static struct option longopts[] = {
     {0,0,0,0},
 };
 
+/* Variables asked for by each GETBULK of a walk, and the default for
+ * the getbulk command.
+ */
+#define MAX_REPETITIONS 64
+
+/* Most OIDs a range like "[1-24]" may expand to.
+ */
+#define MAX_RANGE       256
+
+static void
+print_var (const char *name, struct variable_list *vars)
+{
+    switch (vars->type) {
+        case ASN_OCTET_STR:
+            printf("%s: %.*s\n", name, (int)vars->val_len, vars->val.string);
+            break;
+        case ASN_INTEGER:
+            printf("%s: %ld\n", name, *vars->val.integer);
+            break;
+        default:
+            print_variable (vars->name, vars->name_length, vars);
+            break;
+    }
+}
+
+/* Print a variable found under the OID named root, which has rootlen
+ * sub-identifiers, naming it after root, e.g. "enterprises.318.1.2".
+ */
+static void
+print_subvar (const char *root, size_t rootlen, struct variable_list *vars)
+{
+    char name[1024];
+    size_t n, i;
+
+    n = snprintf (name, sizeof (name), "%s", root);
+    for (i = rootlen; i < vars->name_length && n < sizeof (name); i++)
+        n += snprintf (name + n, sizeof (name) - n, ".%lu",
+                       (unsigned long)vars->name[i]);
+    print_var (name, vars);
+}
+
+/* Expand an OID ending in a range of sub-identifiers, such as
+ * "enterprises.318.1.1.4.4.2.1.3.[1-3,5]" (the form powermand gives
+ * ranged scripts), into one OID per sub-identifier.  Any other OID is
+ * returned as is.  Returns NULL if the range is malformed.
+ */
+static char **
+expand_oid (char *str)
+{
+    char **oids = argv_create ("", "");
+    char *open = strrchr (str, '[');
+    char *prefix, *p, *end;
+    unsigned long lo, hi;
+    int count = 0;
+    char buf[1024];
+
+    if (open == NULL)
+        return argv_append (oids, str);
+    prefix = xstrdup (str);
+    prefix[open - str] = '\0';
+    p = open + 1;
+    for (;;) {
+        lo = hi = strtoul (p, &end, 10);
+        if (end == p)
+            goto bad;
+        if (*end == '-') {
+            p = end + 1;
+            hi = strtoul (p, &end, 10);
+            if (end == p || hi < lo)
+                goto bad;
+        }
+        for (; lo <= hi; lo++) {
+            if (++count > MAX_RANGE)
+                goto bad;
+            snprintf (buf, sizeof (buf), "%s%lu", prefix, lo);
+            oids = argv_append (oids, buf);
+        }
+        if (*end == ']' && end[1] == '\0')
+            break;
+        if (*end != ',')
+            goto bad;
+        p = end + 1;
+    }
+    xfree (prefix);
+    return oids;
+bad:
+    xfree (prefix);
+    argv_destroy (oids);
+    return NULL;
+}
+
+/* Add the OIDs named by str (see expand_oid) to pdu, set to val of the
+ * given type, or with a NULL value if type is 0.  Their names are added
+ * to *names.  Returns -1 if they could not be parsed.
+ */
+static int
+add_vars (struct snmp_pdu *pdu, char *str, char type, char *val,
+          char ***names)
+{
+    char **oids = expand_oid (str);
+    oid anOID[MAX_OID_LEN];
+    size_t anOID_len;
+    int i;
+    int rc = 0;
+
+    if (oids == NULL) {
+        printf ("error parsing oid\n");
+        return -1;
+    }
+    for (i = 0; oids[i] != NULL && rc == 0; i++) {
+        anOID_len = MAX_OID_LEN;
+        if (!get_node (oids[i], anOID, &anOID_len)) {
+            printf ("error parsing oid\n");
+            rc = -1;
+        } else if (type == 0)
+            snmp_add_null_var (pdu, anOID, anOID_len);
+        else if (snmp_add_var (pdu, anOID, anOID_len, type, val) != 0) {
+            printf ("error parsing value\n");
+            rc = -1;
+        }
+        if (rc == 0)
+            *names = argv_append (*names, oids[i]);
+    }
+    argv_destroy (oids);
+    return rc;
+}
+
+/* Send pdu and wait for the response.  Returns NULL if there is none,
+ * or if a GETNEXT ran off the end of the MIB (SNMPv1 noSuchName).
+ */
+static struct snmp_pdu *
+request (struct snmp_session *ss, struct snmp_pdu *pdu, char *cmd)
+{
+    struct snmp_pdu *response = NULL;
+    int command = pdu->command;
+    int status;
+
+    status = snmp_synch_response (ss, pdu, &response);
+    if (status == STAT_SUCCESS && response->errstat == SNMP_ERR_NOERROR)
+        return response;
+    if (status == STAT_SUCCESS) {
+        if (command != SNMP_MSG_GETNEXT
+                || response->errstat != SNMP_ERR_NOSUCHNAME)
+            err_exit (FALSE, "error in packet: %s",
+                      snmp_errstring (response->errstat));
+    } else
+        snmp_sess_perror (cmd, ss);
+    if (response)
+        snmp_free_pdu (response);
+    return NULL;
+}
+
+/* Print the variables named in the response in the order of names.
+ */
+static void
+print_response (struct snmp_pdu *response, char **names)
+{
+    struct variable_list *vars;
+    int i = 0;
+
+    for (vars = response->variables; vars; vars = vars->next_variable) {
+        if (names[i] != NULL)
+            print_var (names[i++], vars);
+        else
+            print_variable (vars->name, vars->name_length, vars);
+    }
+}
+
+/* get oid [oid ...]
+ * Get all the OIDs in one request.
+ */
 static void
 get (char **av, struct snmp_session **ssp)
 {
     struct snmp_pdu *pdu;
     struct snmp_pdu *response;
-    oid anOID[MAX_OID_LEN];
-    size_t anOID_len = MAX_OID_LEN;
-    struct variable_list *vars;
-    int status;
+    char **names;
+    int i;
 
     if (av[1] == NULL) {
         err (FALSE, "missing oid");
@@ -65,97 +234,136 @@ get (char **av, struct snmp_session **ssp)
         return;
     }
     pdu = snmp_pdu_create (SNMP_MSG_GET);
-    if (!get_node (av[1], anOID, &anOID_len)) {
-        snmp_free_pdu (pdu);
-        printf ("error parsing oid\n");
-        return;
-    }
-    snmp_add_null_var (pdu, anOID, anOID_len);
-    status = snmp_synch_response (*ssp, pdu, &response);
-    if (status == STAT_SUCCESS && response->errstat == SNMP_ERR_NOERROR) {
-        for (vars = response->variables; vars; vars = vars->next_variable) {
-            switch (vars->type) {
-                case ASN_OCTET_STR:
-                    printf("%s: %*s\n", av[1],
-                           (int)vars->val_len, vars->val.string);
-                    break;
-                case ASN_INTEGER:
-                    printf("%s: %ld\n", av[1], *vars->val.integer);
-                    break;
-                default:
-                    print_variable (vars->name, vars->name_length, vars);
-                    break;
-            }
+    names = argv_create ("", "");
+    for (i = 1; av[i] != NULL; i++) {
+        if (add_vars (pdu, av[i], 0, NULL, &names) < 0) {
+            snmp_free_pdu (pdu);
+            argv_destroy (names);
+            return;
         }
-    } else {
-        if (status == STAT_SUCCESS)
-            err_exit (FALSE, "error in packet: %s",
-                      snmp_errstring (response->errstat));
-        else
-            snmp_sess_perror ("snmpget", *ssp);
     }
-    if (response)
+    if ((response = request (*ssp, pdu, "snmpget"))) {
+        print_response (response, names);
         snmp_free_pdu (response);
+    }
+    argv_destroy (names);
 }
 
+/* set oid type value [oid type value ...]
+ * Set all the OIDs in one request.
+ */
 static void
 set (char **av, struct snmp_session **ssp)
 {
     struct snmp_pdu *pdu;
     struct snmp_pdu *response;
-    oid anOID[MAX_OID_LEN];
-    size_t anOID_len = MAX_OID_LEN;
-    struct variable_list *vars;
-    int status;
+    char **names;
+    int i;
 
     if (av[1] == NULL) {
         err (FALSE, "missing oid");
         return;
     }
-    if (av[2] == NULL) {
-        err (FALSE, "missing type");
+    for (i = 1; av[i] != NULL; i += 3) {
+        if (av[i + 1] == NULL) {
+            err (FALSE, "missing type");
+            return;
+        }
+        if (av[i + 2] == NULL) {
+            err (FALSE, "missing value");
+            return;
+        }
+    }
+    if (*ssp == NULL) {
+        err (FALSE, "start session first");
         return;
     }
-    if (av[3] == NULL) {
-        err (FALSE, "missing value");
+    pdu = snmp_pdu_create (SNMP_MSG_SET);
+    names = argv_create ("", "");
+    for (i = 1; av[i] != NULL; i += 3) {
+        if (add_vars (pdu, av[i], *(av[i + 1]), av[i + 2], &names) < 0) {
+            snmp_free_pdu (pdu);
+            argv_destroy (names);
+            return;
+        }
+    }
+    if ((response = request (*ssp, pdu, "snmpset"))) {
+        print_response (response, names);
+        snmp_free_pdu (response);
+    }
+    argv_destroy (names);
+}
+
+/* walk oid
+ * getbulk oid [count]
+ * Print the variables in the subtree under oid, asking for many at a time
+ * with GETBULK (one at a time with GETNEXT for SNMPv1), so a whole table
+ * usually takes one request.  getbulk stops after count variables.
+ */
+static void
+walk (char **av, struct snmp_session **ssp, int bulk)
+{
+    struct snmp_pdu *pdu;
+    struct snmp_pdu *response;
+    oid root[MAX_OID_LEN], next[MAX_OID_LEN];
+    size_t rootlen = MAX_OID_LEN, nextlen;
+    struct variable_list *vars;
+    int maxrep = MAX_REPETITIONS;
+    int count = 0;
+    int done = 0;
+
+    if (av[1] == NULL) {
+        err (FALSE, "missing oid");
+        return;
+    }
+    if (bulk && av[2] != NULL && (maxrep = strtol (av[2], NULL, 10)) < 1) {
+        err (FALSE, "bad count");
         return;
     }
     if (*ssp == NULL) {
         err (FALSE, "start session first");
         return;
     }
-    pdu = snmp_pdu_create (SNMP_MSG_SET);
-    if (!get_node (av[1], anOID, &anOID_len)) {
-        snmp_free_pdu (pdu);
+    if (!get_node (av[1], root, &rootlen)) {
         printf ("error parsing oid\n");
         return;
     }
-    snmp_add_var (pdu, anOID, anOID_len, *(av[2]), av[3]);
-    status = snmp_synch_response (*ssp, pdu, &response);
-    if (status == STAT_SUCCESS && response->errstat == SNMP_ERR_NOERROR) {
-        for (vars = response->variables; vars; vars = vars->next_variable) {
-            switch (vars->type) {
-                case ASN_OCTET_STR:
-                    printf("%s: %*s\n", av[1],
-                           (int)vars->val_len, vars->val.string);
-                    break;
-                case ASN_INTEGER:
-                    printf("%s: %ld\n", av[1], *vars->val.integer);
-                    break;
-                default:
-                    print_variable (vars->name, vars->name_length, vars);
-                    break;
+    memcpy (next, root, rootlen * sizeof (oid));
+    nextlen = rootlen;
+    while (!done) {
+        if ((*ssp)->version == SNMP_VERSION_1)
+            pdu = snmp_pdu_create (SNMP_MSG_GETNEXT);
+        else {
+            pdu = snmp_pdu_create (SNMP_MSG_GETBULK);
+            pdu->non_repeaters = 0;
+            pdu->max_repetitions = bulk ? maxrep - count : MAX_REPETITIONS;
+        }
+        snmp_add_null_var (pdu, next, nextlen);
+        if (!(response = request (*ssp, pdu, bulk ? "snmpbulkget"
+                                                  : "snmpwalk")))
+            break;
+        if (response->variables == NULL)
+            done = 1;
+        for (vars = response->variables; vars && !done;
+                vars = vars->next_variable) {
+            if (vars->type == SNMP_ENDOFMIBVIEW
+                    || vars->type == SNMP_NOSUCHOBJECT
+                    || vars->type == SNMP_NOSUCHINSTANCE
+                    || snmp_oidtree_compare (root, rootlen, vars->name,
+                                             vars->name_length) != 0
+                    || snmp_oid_compare (vars->name, vars->name_length,
+                                         next, nextlen) <= 0) {
+                done = 1;
+                break;
             }
+            print_subvar (av[1], rootlen, vars);
+            memcpy (next, vars->name, vars->name_length * sizeof (oid));
+            nextlen = vars->name_length;
+            if (bulk && ++count >= maxrep)
+                done = 1;
         }
-    } else {
-        if (status == STAT_SUCCESS)
-            err_exit (FALSE, "error in packet: %s",
-                      snmp_errstring (response->errstat));
-        else
-            snmp_sess_perror ("snmpset", *ssp);
-    }
-    if (response)
         snmp_free_pdu (response);
+    }
 }
 
 static void
@@ -256,8 +464,11 @@ help (void)
     printf ("  start_v3 name passphrase\n");
     printf ("  mib name\n");
     printf ("  finish\n");
-    printf ("  get oid\n");
-    printf ("  set oid type value\n");
+    printf ("  get oid [oid ...]\n");
+    printf ("  getbulk oid [count]\n");
+    printf ("  walk oid\n");
+    printf ("  set oid type value [oid type value ...]\n");
+    printf ("An oid may end in a range, e.g. enterprises.318.1.[1-3,5]\n");
 }
 
 static int
@@ -270,6 +481,10 @@ docmd (char **av, char *hostname, struct snmp_session **ssp)
             help ();
         else if (strcmp (av[0], "get") == 0)
             get (av, ssp);
+        else if (strcmp (av[0], "getbulk") == 0)
+            walk (av, ssp, 1);
+        else if (strcmp (av[0], "walk") == 0)
+            walk (av, ssp, 0);
         else if (strcmp (av[0], "set") == 0)
             set (av, ssp);
         else if (strcmp (av[0], "start_v1") == 0)
@@ -291,7 +506,7 @@ docmd (char **av, char *hostname, struct snmp_session **ssp)
 static void
 shell (char *hostname)
 {
-    char buf[128];
+    char buf[1024];
     char **av;
     int rc = 0;
     struct snmp_session *ss = NULL;
@@ -0,0 +1,376 @@
+/*****************************************************************************
+ *  Copyright (C) 2026 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  UCRL-CODE-2002-008.
+ *
+ *  This file is part of PowerMan, a remote power management program.
+ *  For details, see http://code.google.com/p/powerman/
+ *
+ *  PowerMan is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PowerMan is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PowerMan; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/* bmcd.c - mimic the IPMI v2.0 LAN interface of a rack of BMCs */
+
+/* BMC i (1..count) listens on 127.0.0.i.  Sessions are set up with
+ * RAKP-HMAC-SHA1 for the user admin, password secret, with whatever
+ * integrity and confidentiality algorithms (none, HMAC-SHA1-96,
+ * AES-CBC-128) the client proposes.  Chassis status, control and identify
+ * are supported.  Each session set up and each chassis command is
+ * reported on stderr.  With -d, each chassis status reply is preceded by
+ * a decoy with the power state inverted that reuses the last session
+ * sequence number sent, as a replayed packet would.  With -D, the decoy
+ * has a new sequence number but is a chassis control reply, as a late
+ * reply to an earlier request with the same tag would be.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "xtypes.h"
+#include "error.h"
+#include "rmcp.h"
+
+#define MAX_BMCS        64
+#define MAX_SESSIONS    8
+#define USER            "admin"
+#define PASSWD          "secret"
+
+typedef struct {
+    int used;
+    int active;
+    int integrity;
+    int confidentiality;
+    unsigned long seq;
+    RmcpAuth auth;
+    RmcpKeys keys;
+} Session;
+
+typedef struct {
+    int fd;
+    int power;
+    int identify;               /* 0 off, 1 timed, 2 forced on */
+    int next;                   /* session slot to recycle when full */
+    Session s[MAX_SESSIONS];
+} Bmc;
+
+static Bmc bmc[MAX_BMCS];
+static int decoy = 0;
+
+static void reply(Bmc *b, struct sockaddr_in *to, int type, unsigned long sid,
+                  const unsigned char *payload, int len, Session *s)
+{
+    unsigned char msg[RMCP_MAX_MSG];
+    int n;
+
+    n = rmcp_encode(msg, type, sid, s ? ++s->seq : 0, payload, len,
+                    s ? &s->keys : NULL);
+    sendto(b->fd, msg, n, 0, (struct sockaddr *)to, sizeof(*to));
+}
+
+/* Session IDs are slot + 1 in the low byte, BMC number above it.
+ */
+static Session *find_session(Bmc *b, unsigned long sid)
+{
+    int slot = (sid & 0xff) - 1;
+
+    if (slot < 0 || slot >= MAX_SESSIONS || (sid >> 8) != b - bmc + 1
+                                         || !b->s[slot].used)
+        return NULL;
+    return &b->s[slot];
+}
+
+static void open_session(Bmc *b, struct sockaddr_in *from,
+                         const unsigned char *p, int len)
+{
+    unsigned char r[36];
+    Session *s;
+    int slot;
+
+    if (len < 32)
+        return;
+    memset(r, 0, sizeof(r));
+    r[0] = p[0];
+    memcpy(r + 4, p + 4, 4);
+    if (p[12] != RMCP_AUTH_HMAC_SHA1 || p[20] > RMCP_INTEG_HMAC_SHA1_96
+                                     || p[28] > RMCP_CONF_AES_CBC_128) {
+        r[1] = 0x11;                        /* no matching cipher suite */
+        reply(b, from, RMCP_PAYLOAD_OPEN_RSP, 0, r, 8, NULL);
+        return;
+    }
+    slot = b->next;
+    b->next = (b->next + 1) % MAX_SESSIONS;
+    s = &b->s[slot];
+    memset(s, 0, sizeof(*s));
+    s->used = 1;
+    s->integrity = p[20];
+    s->confidentiality = p[28];
+    s->auth.sidm = rmcp_get32(p + 4);
+    s->auth.sidc = ((b - bmc + 1) << 8) | (slot + 1);
+
+    r[2] = IPMI_PRIV_ADMIN;
+    rmcp_put32(r + 8, s->auth.sidc);
+    memcpy(r + 12, p + 8, 24);              /* algorithms accepted */
+    reply(b, from, RMCP_PAYLOAD_OPEN_RSP, 0, r, 36, NULL);
+}
+
+static void rakp1(Bmc *b, struct sockaddr_in *from, const unsigned char *p,
+                  int len)
+{
+    unsigned char r[60];
+    Session *s;
+    int ulen;
+
+    if (len < 28 || !(s = find_session(b, rmcp_get32(p + 4))))
+        return;
+    ulen = p[27];
+    if (ulen > RMCP_MAX_USER || len < 28 + ulen)
+        return;
+    memset(r, 0, sizeof(r));
+    r[0] = p[0];
+    rmcp_put32(r + 4, s->auth.sidm);
+    if (ulen != strlen(USER) || memcmp(p + 28, USER, ulen) != 0) {
+        r[1] = 0x0d;                        /* unauthorized name */
+        reply(b, from, RMCP_PAYLOAD_RAKP2, 0, r, 8, NULL);
+        return;
+    }
+    memcpy(s->auth.rm, p + 8, RMCP_RAND_LEN);
+    s->auth.rolem = p[24];
+    memcpy(s->auth.user, p + 28, ulen);
+    s->auth.user[ulen] = '\0';
+    strcpy(s->auth.passwd, PASSWD);
+    rmcp_random(s->auth.rc, RMCP_RAND_LEN);
+    memset(s->auth.guidc, b - bmc + 1, RMCP_GUID_LEN);
+
+    memcpy(r + 8, s->auth.rc, RMCP_RAND_LEN);
+    memcpy(r + 24, s->auth.guidc, RMCP_GUID_LEN);
+    rmcp_rakp2_hmac(&s->auth, r + 40);
+    reply(b, from, RMCP_PAYLOAD_RAKP2, 0, r, 60, NULL);
+}
+
+static void rakp3(Bmc *b, struct sockaddr_in *from, const unsigned char *p,
+                  int len)
+{
+    unsigned char r[20], hmac[SHA1_LEN];
+    Session *s;
+
+    if (len < 8 + SHA1_LEN || !(s = find_session(b, rmcp_get32(p + 4))))
+        return;
+    memset(r, 0, sizeof(r));
+    r[0] = p[0];
+    rmcp_put32(r + 4, s->auth.sidm);
+    rmcp_rakp3_hmac(&s->auth, hmac);
+    if (p[1] != 0 || !rmcp_equal(hmac, p + 8, SHA1_LEN)) {
+        r[1] = 0x0f;                        /* invalid integrity check */
+        reply(b, from, RMCP_PAYLOAD_RAKP4, 0, r, 8, NULL);
+        s->used = 0;
+        return;
+    }
+    rmcp_keys(&s->auth, s->integrity, s->confidentiality, &s->keys);
+    rmcp_rakp4_icv(&s->auth, &s->keys, r + 8);
+    reply(b, from, RMCP_PAYLOAD_RAKP4, 0, r, 8 + RMCP_AUTHCODE_LEN, NULL);
+    s->active = 1;
+    fprintf(stderr, "bmcd: session\n");
+}
+
+static void command(Bmc *b, struct sockaddr_in *from, Session *s,
+                    const unsigned char *p, int len)
+{
+    unsigned char r[16], msg[RMCP_MAX_PAYLOAD];
+    const unsigned char *data;
+    int netfn, seq, cmd, dlen, rlen = 1;
+
+    if (ipmi_decode(p, len, &netfn, &seq, &cmd, &data, &dlen) < 0)
+        return;
+    r[0] = 0;                               /* completion code */
+    if (netfn == IPMI_NETFN_APP && cmd == IPMI_SET_SESSION_PRIV
+                                && dlen >= 1) {
+        r[1] = data[0];
+        rlen = 2;
+    } else if (netfn == IPMI_NETFN_APP && cmd == IPMI_CLOSE_SESSION) {
+        s->active = 0;
+    } else if (netfn == IPMI_NETFN_CHASSIS && cmd == IPMI_GET_CHASSIS_STATUS) {
+        r[1] = b->power;
+        r[2] = 0;
+        r[3] = 0x40 | (b->identify << 4);
+        r[4] = 0;
+        rlen = 5;
+        fprintf(stderr, "bmcd: chassis status\n");
+    } else if (netfn == IPMI_NETFN_CHASSIS && cmd == IPMI_CHASSIS_CONTROL
+                                           && dlen >= 1) {
+        switch (data[0]) {
+        case IPMI_CHASSIS_DOWN:
+            b->power = 0;
+            break;
+        case IPMI_CHASSIS_UP:
+        case IPMI_CHASSIS_CYCLE:
+        case IPMI_CHASSIS_RESET:
+            b->power = 1;
+            break;
+        default:
+            r[0] = 0xcc;                    /* invalid data field */
+            break;
+        }
+        fprintf(stderr, "bmcd: chassis control %d\n", data[0]);
+    } else if (netfn == IPMI_NETFN_CHASSIS && cmd == IPMI_CHASSIS_IDENTIFY) {
+        if (dlen >= 2 && (data[1] & 1))
+            b->identify = 2;
+        else
+            b->identify = (dlen >= 1 && data[0] > 0) ? 1 : 0;
+        fprintf(stderr, "bmcd: chassis identify\n");
+    } else
+        r[0] = 0xc1;                        /* invalid command */
+
+    if (decoy && s->seq > 0 && netfn == IPMI_NETFN_CHASSIS
+                          && cmd == IPMI_GET_CHASSIS_STATUS) {
+        unsigned char out[RMCP_MAX_MSG];
+        int n;
+
+        r[1] ^= 1;
+        if (decoy == 2) {
+            len = ipmi_encode(msg, IPMI_REMOTE_ADDR, netfn + 1,
+                              IPMI_BMC_ADDR, seq, IPMI_CHASSIS_CONTROL, r,
+                              rlen);
+            reply(b, from, RMCP_PAYLOAD_IPMI, s->auth.sidm, msg, len, s);
+        } else {
+            len = ipmi_encode(msg, IPMI_REMOTE_ADDR, netfn + 1,
+                              IPMI_BMC_ADDR, seq, cmd, r, rlen);
+            n = rmcp_encode(out, RMCP_PAYLOAD_IPMI, s->auth.sidm, s->seq,
+                            msg, len, &s->keys);
+            sendto(b->fd, out, n, 0, (struct sockaddr *)from, sizeof(*from));
+        }
+        r[1] ^= 1;
+    }
+    len = ipmi_encode(msg, IPMI_REMOTE_ADDR, netfn + 1, IPMI_BMC_ADDR, seq,
+                      cmd, r, rlen);
+    reply(b, from, RMCP_PAYLOAD_IPMI, s->auth.sidm, msg, len, s);
+    if (!s->active)
+        s->used = 0;
+}
+
+static void handle(Bmc *b)
+{
+    unsigned char buf[RMCP_MAX_MSG], p[RMCP_MAX_MSG];
+    struct sockaddr_in from;
+    socklen_t fromlen = sizeof(from);
+    unsigned long sid, seq;
+    Session *s = NULL;
+    int n, type;
+
+    n = recvfrom(b->fd, buf, sizeof(buf), 0, (struct sockaddr *)&from,
+                 &fromlen);
+    if (n < 0 || rmcp_header(buf, n, &type, &sid) < 0)
+        return;
+    if (sid != 0 && (!(s = find_session(b, sid)) || !s->active))
+        return;
+    if ((n = rmcp_decode(buf, n, s ? &s->keys : NULL, &seq, p,
+                         sizeof(p))) < 0)
+        return;
+    switch (type) {
+    case RMCP_PAYLOAD_OPEN_REQ:
+        open_session(b, &from, p, n);
+        break;
+    case RMCP_PAYLOAD_RAKP1:
+        rakp1(b, &from, p, n);
+        break;
+    case RMCP_PAYLOAD_RAKP3:
+        rakp3(b, &from, p, n);
+        break;
+    case RMCP_PAYLOAD_IPMI:
+        if (s)
+            command(b, &from, s, p, n);
+        break;
+    }
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: bmcd -p port -n count [-d|-D]\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    struct pollfd pfd[MAX_BMCS];
+    struct sockaddr_in addr;
+    int port = 0, count = 0;
+    int c, i;
+
+    err_init(argv[0]);
+    while ((c = getopt(argc, argv, "p:n:dD")) != -1) {
+        switch (c) {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'n':
+            count = atoi(optarg);
+            break;
+        case 'd':
+            decoy = 1;
+            break;
+        case 'D':
+            decoy = 2;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (port < 1 || port > 65535 || count < 1 || count > MAX_BMCS)
+        usage();
+
+    for (i = 0; i < count; i++) {
+        char ip[32];
+
+        if ((bmc[i].fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+            perror("socket");
+            exit(1);
+        }
+        sprintf(ip, "127.0.0.%d", i + 1);
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = inet_addr(ip);
+        if (bind(bmc[i].fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            perror(ip);
+            exit(1);
+        }
+        pfd[i].fd = bmc[i].fd;
+        pfd[i].events = POLLIN;
+    }
+    for (;;) {
+        if (poll(pfd, count, -1) < 0) {
+            perror("poll");
+            exit(1);
+        }
+        for (i = 0; i < count; i++)
+            if (pfd[i].revents & POLLIN)
+                handle(&bmc[i]);
+    }
+    /*NOTREACHED*/
+    return 0;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
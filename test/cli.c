@@ -26,10 +26,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "libpowerman.h"
 
 static pm_err_t list_nodes(pm_handle_t pm);
+static pm_err_t query_ids(pm_handle_t pm, char *ids);
+static pm_err_t query_snapshot(char *name, char *node);
 static void usage(void);
 
 #define statstr(s) ((s) == PM_ON ? "on" : (s) == PM_OFF ? "off" : "unknown")
@@ -42,20 +45,37 @@ main(int argc, char *argv[])
     pm_handle_t pm;
     char ebuf[64];
     char *server, *node = NULL;
+    int flags = 0;
     char cmd;
 
+    if (argc > 1 && !strcmp(argv[1], "-s")) {
+        if (argc < 3 || argc > 4)
+            usage();
+        if ((err = query_snapshot(argv[2], argv[3])) != PM_ESUCCESS) {
+            fprintf(stderr, "Error: %s\n",
+                    pm_strerror(err, ebuf, sizeof(ebuf)));
+            exit(1);
+        }
+        exit(0);
+    }
+    if (argc > 1 && !strcmp(argv[1], "-b")) {
+        flags |= PM_CONN_BINARY;
+        argc--;
+        argv++;
+    }
     if (argc < 3 || argc > 4)
         usage();
     server = argv[1];
     cmd = argv[2][0];
     if (argc == 3 && cmd != 'l')
         usage();
-    if (argc == 4 && cmd != '1' && cmd != '0' && cmd != 'c' && cmd != 'q')
+    if (argc == 4 && cmd != '1' && cmd != '0' && cmd != 'c' && cmd != 'q'
+                  && cmd != 'i')
         usage();
     if (argc == 4)
         node = argv[3];
 
-    if ((err = pm_connect(server, NULL, &pm, 0)) != PM_ESUCCESS) {
+    if ((err = pm_connect(server, NULL, &pm, flags)) != PM_ESUCCESS) {
         fprintf(stderr, "%s: %s\n", server,
                 pm_strerror(err, ebuf, sizeof(ebuf)));
         exit(1);
@@ -79,6 +99,9 @@ main(int argc, char *argv[])
             if ((err = pm_node_status(pm, node, &ns)) == PM_ESUCCESS)
                 printf("%s: %s\n", node, statstr(ns));
             break;
+        case 'i':
+            err = query_ids(pm, node);
+            break;
     }
 
     if (err != PM_ESUCCESS) {
@@ -107,11 +130,64 @@ list_nodes(pm_handle_t pm)
     return err;
 }
 
+static pm_err_t
+query_ids(pm_handle_t pm, char *ids)
+{
+    pm_node_state_t states[64];
+    int id[64];
+    char *p;
+    int i, n = 0;
+    pm_err_t err;
+
+    for (p = strtok(ids, ","); p != NULL && n < 64; p = strtok(NULL, ","))
+        id[n++] = strtoul(p, NULL, 10);
+    if ((err = pm_node_status_ids(pm, id, n, states)) != PM_ESUCCESS)
+        return err;
+    for (i = 0; i < n; i++)
+        printf("%d: %s\n", id[i], statstr(states[i]));
+    return err;
+}
+
+static pm_err_t
+query_snapshot(char *name, char *node)
+{
+    pm_snapshot_t snap;
+    pm_node_state_t *states;
+    time_t *changed;
+    int i, count;
+    pm_err_t err;
+
+    if ((err = pm_snapshot_open(name, &snap)) != PM_ESUCCESS)
+        return err;
+    if (node) {
+        states = malloc(sizeof(pm_node_state_t));
+        changed = malloc(sizeof(time_t));
+        count = 1;
+        err = pm_snapshot_status(snap, node, states, changed);
+    } else {
+        count = pm_snapshot_count(snap);
+        states = malloc(count * sizeof(pm_node_state_t));
+        changed = malloc(count * sizeof(time_t));
+        err = pm_snapshot_read(snap, states, changed, NULL);
+    }
+    if (err == PM_ESUCCESS) {
+        for (i = 0; i < count; i++)
+            printf("%s: %s%s\n", node ? node : pm_snapshot_node(snap, i),
+                   statstr(states[i]), changed[i] ? " (changed)" : "");
+    }
+    free(states);
+    free(changed);
+    pm_snapshot_close(snap);
+    return err;
+}
+
 static void
 usage(void)
 {
-    fprintf(stderr, "Usage: cli host:port 0|1|q node\n");
-    fprintf(stderr, "       cli host:port l\n");
+    fprintf(stderr, "Usage: cli [-b] host:port 0|1|q node\n");
+    fprintf(stderr, "       cli [-b] host:port l\n");
+    fprintf(stderr, "       cli -b host:port i id[,id...]\n");
+    fprintf(stderr, "       cli -s /snapshot [node]\n");
     exit(1);
 }
 
@@ -238,10 +238,42 @@
 </body>\n\
 </html>\n"
 
+/* Parse "N" or a range like "[1-3,5]" into set[], returning the count.
+ */
+static int
+parse_range(char *str, int *set, int max)
+{
+    char *p = str, *end;
+    int lo, hi, n = 0;
+
+    if (*p == '[')
+        p++;
+    while (*p && *p != ']') {
+        lo = hi = strtol(p, &end, 10);
+        if (end == p)
+            return -1;
+        if (*end == '-') {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+            if (end == p)
+                return -1;
+        }
+        for (; lo <= hi; lo++) {
+            if (n == max)
+                return -1;
+            set[n++] = lo;
+        }
+        p = *end == ',' ? end + 1 : end;
+    }
+    return n;
+}
+
 static void
 prompt_loop(void)
 {
-    char buf[128], tmp[32];
+    char buf[128], tmp[32], range[32];
+    int set[8];
+    int n;
     char plug[8][4];
     int num_plugs = 8;
     int plug_origin = 1;
@@ -259,6 +291,7 @@ prompt_loop(void)
             printf(" auth admin:admin\n");
             printf(" get\n");
             printf(" post outlet [1-8]=ON|OFF\n");
+            printf(" multipost outlet [1-8]=ON|OFF\n");
         } else if (!strcmp(buf, "auth admin:admin")) {
             authenticated = 1;
         } else if (!strcmp(buf, "get")) {
@@ -278,6 +311,24 @@ prompt_loop(void)
             else
                 goto err;
             printf(DLI_POST);
+        } else if (sscanf(buf, "multipost outlet %31[^=]=%31s", range,
+                          tmp) == 2) {
+            if (!authenticated)
+                goto err;
+            if ((n = parse_range(range, set, num_plugs)) < 1)
+                goto err;
+            if (strcmp(tmp, "ON") != 0 && strcmp(tmp, "OFF") != 0)
+                goto err;
+            for (i = 0; i < n; i++) {
+                if (set[i] < plug_origin || set[i] >= num_plugs + plug_origin)
+                    goto err;
+            }
+            for (i = 0; i < n; i++) {
+                strcpy(plug[set[i] - plug_origin], tmp);
+                printf("begin %d outlet\n", i + 1);
+                printf(DLI_POST);
+                printf("end %d OK\n", i + 1);
+            }
         } else
             goto err;
 
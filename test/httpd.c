@@ -0,0 +1,206 @@
+/*****************************************************************************
+ *  Copyright (C) 2026 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  UCRL-CODE-2002-008.
+ *
+ *  This file is part of PowerMan, a remote power management program.
+ *  For details, see http://code.google.com/p/powerman/
+ *
+ *  PowerMan is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PowerMan is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PowerMan; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/* httpd.c - mimic the web server of a Digital Loggers Inc LPC */
+
+/* Serves keep-alive connections on 127.0.0.1, each in its own process
+ * so clients may open several at once.  GET / returns the outlet states
+ * with chunked encoding, POST /outlet with "N=ON" or "N=OFF" switches an
+ * outlet, and HEAD answers with headers only.  Basic authentication as
+ * admin:admin is required.  Each accepted connection is reported on
+ * stderr.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define NUM_PLUGS   8
+#define AUTH        "Basic YWRtaW46YWRtaW4="    /* admin:admin */
+
+static char (*plug)[4];           /* shared by all connections */
+
+static void reply(FILE *out, int status, char *msg, char *body, int head)
+{
+    fprintf(out, "HTTP/1.1 %d %s\r\n", status, msg);
+    fprintf(out, "Content-Type: text/html\r\n");
+    fprintf(out, "Content-Length: %d\r\n\r\n", (int)strlen(body));
+    if (!head)
+        fprintf(out, "%s", body);
+}
+
+static void chunk(FILE *out, char *str)
+{
+    fprintf(out, "%x\r\n%s\r\n", (int)strlen(str), str);
+}
+
+static void status(FILE *out)
+{
+    char buf[128];
+    int i;
+
+    fprintf(out, "HTTP/1.1 200 OK\r\n");
+    fprintf(out, "Content-Type: text/html\r\n");
+    fprintf(out, "Transfer-Encoding: chunked\r\n\r\n");
+    chunk(out, "<html><body>\nController: Lite Power Controller\n<table>\n");
+    for (i = 0; i < NUM_PLUGS; i++) {
+        snprintf(buf, sizeof(buf), "<tr><td>%d</td><td>Outlet %d</td>"
+                 "<td><font color=red>%s</font></td></tr>\n",
+                 i + 1, i + 1, plug[i]);
+        chunk(out, buf);
+    }
+    chunk(out, "</table></body></html>\n");
+    fprintf(out, "0\r\n\r\n");
+}
+
+static void serve(int fd)
+{
+    FILE *in = fdopen(fd, "r");
+    FILE *out = fdopen(dup(fd), "w");
+    char line[256], method[16], path[128], body[128], tmp[16];
+    int len, i;
+    int authorized;
+
+    if (!in || !out) {
+        perror("fdopen");
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), in)) {
+        if (sscanf(line, "%15s %127s", method, path) != 2)
+            break;
+        len = 0;
+        authorized = 0;
+        while (fgets(line, sizeof(line), in) && strcmp(line, "\r\n") != 0) {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (!strncasecmp(line, "Content-Length: ", 16))
+                len = atoi(line + 16);
+            else if (!strncasecmp(line, "Authorization: ", 15))
+                authorized = !strcmp(line + 15, AUTH);
+        }
+        if (len >= sizeof(body) || fread(body, 1, len, in) != len)
+            break;
+        body[len] = '\0';
+
+        if (!authorized)
+            reply(out, 401, "Unauthorized", "Unauthorized\n",
+                  !strcmp(method, "HEAD"));
+        else if (!strcmp(method, "HEAD"))
+            reply(out, 200, "OK", "", 1);
+        else if (!strcmp(method, "GET") && !strcmp(path, "/"))
+            status(out);
+        else if (!strcmp(method, "POST") && !strcmp(path, "/outlet")
+                && sscanf(body, "%d=%3s", &i, tmp) == 2
+                && i >= 1 && i <= NUM_PLUGS
+                && (!strcmp(tmp, "ON") || !strcmp(tmp, "OFF"))) {
+            strcpy(plug[i - 1], tmp);
+            reply(out, 200, "OK", "<html><body>OK</body></html>\n", 0);
+        } else
+            reply(out, 404, "Not Found", "Not Found\n", 0);
+        fflush(out);
+    }
+    fclose(in);
+    fclose(out);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: httpd -p port\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    struct sockaddr_in addr;
+    int port = 0;
+    int fd, cfd, c;
+    int opt = 1;
+    int connections = 0;
+
+    while ((c = getopt(argc, argv, "p:")) != -1) {
+        switch (c) {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        default:
+            usage();
+        }
+    }
+    if (port < 1 || port > 65535)
+        usage();
+    plug = mmap(NULL, NUM_PLUGS * sizeof(*plug), PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (plug == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    for (c = 0; c < NUM_PLUGS; c++)
+        strcpy(plug[c], "OFF");
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGCHLD, SIG_IGN);
+
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        perror("socket");
+        exit(1);
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        exit(1);
+    }
+    if (listen(fd, 5) < 0) {
+        perror("listen");
+        exit(1);
+    }
+    while ((cfd = accept(fd, NULL, NULL)) >= 0) {
+        fprintf(stderr, "httpd: connection %d\n", ++connections);
+        switch (fork()) {
+        case -1:
+            perror("fork");
+            exit(1);
+        case 0:
+            close(fd);
+            serve(cfd);
+            exit(0);
+        default:
+            close(cfd);
+        }
+    }
+    perror("accept");
+    exit(1);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,182 @@
+/*****************************************************************************
+ *  Copyright (C) 2026 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  UCRL-CODE-2002-008.
+ *
+ *  This file is part of PowerMan, a remote power management program.
+ *  For details, see http://code.google.com/p/powerman/
+ *
+ *  PowerMan is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PowerMan is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PowerMan; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/* serialbus.c - daisy-chained power controllers on a serial line */
+
+/* Usage: serialbus -t ttylink -l logfile [-n units]
+ * Creates a pty and makes ttylink a symlink to it, then plays a chain of
+ * units (default 2) of 8 plugs each on the master side.  Commands are
+ * lines: "unit N" addresses unit N, after which "on P", "off P" and
+ * "stat" apply to it.  Each reply, also to an empty line, ends with the
+ * prompt "N> " of the addressed unit.  Commands are logged as
+ * "N: command" to logfile, N being the unit addressed when it arrived.
+ * Runs until killed.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+#define _GNU_SOURCE             /* posix_openpt, cfmakeraw */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <termios.h>
+
+#define MAX_UNITS   8
+#define NUM_PLUGS   8
+
+static int plugs[MAX_UNITS + 1][NUM_PLUGS];
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: serialbus -t ttylink -l logfile [-n units]\n");
+    exit(1);
+}
+
+/* Write a string to the bus.
+ */
+static void reply(int fd, const char *s)
+{
+    int n, len = strlen(s);
+
+    while (len > 0) {
+        if ((n = write(fd, s, len)) < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            perror("write");
+            exit(1);
+        }
+        s += n;
+        len -= n;
+    }
+}
+
+/* Execute one command line for the addressed unit.
+ */
+static void command(int fd, FILE *log, int *unit, int units, char *cmd)
+{
+    char buf[64];
+    int n, i;
+
+    if (*cmd == '\0')
+        goto prompt;
+    fprintf(log, "%d: %s\n", *unit, cmd);
+    fflush(log);
+    if (sscanf(cmd, "unit %d", &n) == 1 && n >= 1 && n <= units)
+        *unit = n;
+    else if (*unit == 0)
+        reply(fd, "no unit\r\n");
+    else if (sscanf(cmd, "on %d", &n) == 1 && n >= 1 && n <= NUM_PLUGS)
+        plugs[*unit][n - 1] = 1;
+    else if (sscanf(cmd, "off %d", &n) == 1 && n >= 1 && n <= NUM_PLUGS)
+        plugs[*unit][n - 1] = 0;
+    else if (strcmp(cmd, "stat") == 0) {
+        for (i = 0; i < NUM_PLUGS; i++) {
+            sprintf(buf, "%d: %s\r\n", i + 1, plugs[*unit][i] ? "on" : "off");
+            reply(fd, buf);
+        }
+    } else
+        reply(fd, "error\r\n");
+prompt:
+    sprintf(buf, "%d> ", *unit);
+    reply(fd, buf);
+}
+
+int main(int argc, char *argv[])
+{
+    char *link = NULL, *logname = NULL;
+    char line[256], *slave;
+    int units = 2, unit = 0, len = 0;
+    int master, sfd, c, n;
+    struct termios tio;
+    FILE *log;
+
+    while ((c = getopt(argc, argv, "t:l:n:")) != -1) {
+        switch (c) {
+        case 't':
+            link = optarg;
+            break;
+        case 'l':
+            logname = optarg;
+            break;
+        case 'n':
+            units = atoi(optarg);
+            break;
+        default:
+            usage();
+        }
+    }
+    if (!link || !logname || units < 1 || units > MAX_UNITS)
+        usage();
+    if (!(log = fopen(logname, "w"))) {
+        perror(logname);
+        exit(1);
+    }
+    if ((master = posix_openpt(O_RDWR | O_NOCTTY)) < 0
+            || grantpt(master) < 0 || unlockpt(master) < 0
+            || !(slave = ptsname(master))) {
+        perror("pty");
+        exit(1);
+    }
+    /* hold the slave open so the master does not see a hangup when
+     * powermand closes it, and start it out raw (no echo)
+     */
+    if ((sfd = open(slave, O_RDWR | O_NOCTTY)) < 0) {
+        perror(slave);
+        exit(1);
+    }
+    if (tcgetattr(sfd, &tio) == 0) {
+        cfmakeraw(&tio);
+        (void)tcsetattr(sfd, TCSANOW, &tio);
+    }
+    (void)unlink(link);
+    if (symlink(slave, link) < 0) {
+        perror(link);
+        exit(1);
+    }
+
+    while ((n = read(master, line + len, 1)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            perror("read");
+            exit(1);
+        }
+        if (line[len] == '\r' || line[len] == '\n') {
+            line[len] = '\0';
+            command(master, log, &unit, units, line);
+            len = 0;
+        } else if (len < sizeof(line) - 1)
+            len++;
+    }
+    close(sfd);
+    fclose(log);
+    return 0;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,307 @@
+/*****************************************************************************
+ *  Copyright (C) 2026 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  UCRL-CODE-2002-008.
+ *
+ *  This file is part of PowerMan, a remote power management program.
+ *  For details, see http://code.google.com/p/powerman/
+ *
+ *  PowerMan is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PowerMan is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PowerMan; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/* snmpd.c - mimic the SNMP agent of an APC MasterSwitch */
+
+/* Answers GET, GETNEXT, GETBULK and SET on 127.0.0.1 for the community
+ * "private".  The MIB holds the sPDUOutletCtl column (1=on, 2=off),
+ * which can be set, followed by the sPDUOutletCtlName column.  Each
+ * request is reported on stderr.  With -d, every other request, starting
+ * with the first, is dropped unanswered.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ber.h"
+
+#define NUM_PLUGS   8
+#define COMMUNITY   "private"
+#define CTL_OID     "1.3.6.1.4.1.318.1.1.4.4.2.1.3"
+#define NAME_OID    "1.3.6.1.4.1.318.1.1.4.4.2.1.4"
+#define NUM_OIDS    (2 * NUM_PLUGS)
+
+static int plug[NUM_PLUGS];
+
+/* Compare two dotted decimal OIDs numerically.
+ */
+static int oidcmp(const char *a, const char *b)
+{
+    char *end;
+
+    while (*a && *b) {
+        unsigned long x = strtoul(a, &end, 10);
+        unsigned long y;
+
+        a = end;
+        y = strtoul(b, &end, 10);
+        b = end;
+        if (x != y)
+            return x < y ? -1 : 1;
+        if (*a == '.')
+            a++;
+        if (*b == '.')
+            b++;
+    }
+    return *a ? 1 : *b ? -1 : 0;
+}
+
+/* Return the OID of MIB object i (in lexicographic order).
+ */
+static void mib_oid(int i, char *oid)
+{
+    sprintf(oid, "%s.%d", i < NUM_PLUGS ? CTL_OID : NAME_OID,
+            i % NUM_PLUGS + 1);
+}
+
+/* Return the index of oid in the MIB, or -1.
+ */
+static int mib_find(const char *oid)
+{
+    char tmp[BER_MAX_STR];
+    int i;
+
+    for (i = 0; i < NUM_OIDS; i++) {
+        mib_oid(i, tmp);
+        if (oidcmp(tmp, oid) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/* Return the index of the first MIB object after oid, or -1.
+ */
+static int mib_next(const char *oid)
+{
+    char tmp[BER_MAX_STR];
+    int i;
+
+    for (i = 0; i < NUM_OIDS; i++) {
+        mib_oid(i, tmp);
+        if (oidcmp(tmp, oid) > 0)
+            return i;
+    }
+    return -1;
+}
+
+static void put_object(BerBuf *vbl, int i)
+{
+    char oid[BER_MAX_STR], val[32];
+
+    mib_oid(i, oid);
+    if (i < NUM_PLUGS) {
+        sprintf(val, "%d", plug[i]);
+        ber_put_varbind(vbl, oid, 'i', val);
+    } else {
+        sprintf(val, "Outlet %d", i % NUM_PLUGS + 1);
+        ber_put_varbind(vbl, oid, 's', val);
+    }
+}
+
+static void put_exception(BerBuf *vbl, const char *oid, int tag)
+{
+    int start = vbl->len;
+
+    ber_put_oid(vbl, oid);
+    ber_put_str(vbl, tag, "", 0);
+    ber_wrap(vbl, BER_SEQUENCE, start);
+}
+
+/* Build the response to one request in rsp.  Returns the error status.
+ */
+static long respond(int version, int type, long nonrep, long maxrep,
+                    const unsigned char *p, int len, BerBuf *rsp, long *idx)
+{
+    char oid[BER_MAX_STR], val[BER_MAX_STR];
+    int tag, i, n = 0, rc;
+
+    while ((rc = snmp_next_varbind(&p, &len, oid, &tag, val)) > 0) {
+        n++;
+        switch (type) {
+        case SNMP_GET:
+            if ((i = mib_find(oid)) >= 0)
+                put_object(rsp, i);
+            else if (version == SNMP_V1)
+                goto nosuchname;
+            else
+                put_exception(rsp, oid, BER_NOSUCHINSTANCE);
+            break;
+        case SNMP_GETNEXT:
+            if ((i = mib_next(oid)) >= 0)
+                put_object(rsp, i);
+            else if (version == SNMP_V1)
+                goto nosuchname;
+            else
+                put_exception(rsp, oid, BER_ENDOFMIBVIEW);
+            break;
+        case SNMP_GETBULK:
+            if (n <= nonrep)
+                maxrep = 1;
+            for (i = mib_next(oid); maxrep > 0; maxrep--) {
+                if (i < 0 || i >= NUM_OIDS) {
+                    put_exception(rsp, oid, BER_ENDOFMIBVIEW);
+                    break;
+                }
+                put_object(rsp, i++);
+            }
+            break;
+        case SNMP_SET:
+            if ((i = mib_find(oid)) < 0 || i >= NUM_PLUGS) {
+                *idx = n;
+                return version == SNMP_V1 ? 2 : 17; /* notWritable */
+            }
+            if (tag != BER_INTEGER || (atoi(val) != 1 && atoi(val) != 2)) {
+                *idx = n;
+                return 3;                           /* badValue */
+            }
+            plug[i] = atoi(val);
+            put_object(rsp, i);
+            break;
+        }
+    }
+    if (rc < 0) {
+        *idx = 0;
+        return 5;                                   /* genErr */
+    }
+    return 0;
+nosuchname:
+    *idx = n;
+    return 2;
+}
+
+static const char *type_name(int type)
+{
+    switch (type) {
+    case SNMP_GET:
+        return "get";
+    case SNMP_GETNEXT:
+        return "getnext";
+    case SNMP_GETBULK:
+        return "getbulk";
+    case SNMP_SET:
+        return "set";
+    }
+    return "unknown";
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: snmpd -p port [-d]\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    static unsigned char buf[65536];
+    struct sockaddr_in addr, from;
+    socklen_t fromlen;
+    int port = 0;
+    int drop = 0, count = 0;
+    int fd, c, n;
+
+    while ((c = getopt(argc, argv, "p:d")) != -1) {
+        switch (c) {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'd':
+            drop = 1;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (port < 1 || port > 65535)
+        usage();
+    for (c = 0; c < NUM_PLUGS; c++)
+        plug[c] = 2;
+
+    if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        perror("socket");
+        exit(1);
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        exit(1);
+    }
+    for (;;) {
+        char community[BER_MAX_STR];
+        const unsigned char *vbl;
+        int vblen, version, type;
+        long reqid, nonrep, maxrep, err, idx = 0;
+        BerBuf rsp, msg;
+
+        fromlen = sizeof(from);
+        n = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr *)&from,
+                     &fromlen);
+        if (n < 0) {
+            perror("recvfrom");
+            exit(1);
+        }
+        if (snmp_decode(buf, n, &version, community, sizeof(community),
+                        &type, &reqid, &nonrep, &maxrep, &vbl, &vblen) < 0
+                || strcmp(community, COMMUNITY) != 0)
+            continue;
+        if (drop && count++ % 2 == 0) {
+            fprintf(stderr, "snmpd: dropped %s\n", type_name(type));
+            continue;
+        }
+        fprintf(stderr, "snmpd: %s\n", type_name(type));
+
+        ber_init(&rsp);
+        err = respond(version, type, nonrep, maxrep, vbl, vblen, &rsp, &idx);
+        ber_init(&msg);
+        if (err != 0) {             /* error responses echo the request */
+            BerBuf echo;
+
+            echo.data = (unsigned char *)vbl;
+            echo.len = echo.size = vblen;
+            snmp_encode(&msg, version, community, SNMP_RESPONSE, reqid, err,
+                        idx, &echo);
+        } else
+            snmp_encode(&msg, version, community, SNMP_RESPONSE, reqid, 0, 0,
+                        &rsp);
+        sendto(fd, msg.data, msg.len, 0, (struct sockaddr *)&from, fromlen);
+        ber_free(&msg);
+        ber_free(&rsp);
+    }
+    /*NOTREACHED*/
+    return 0;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
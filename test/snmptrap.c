@@ -0,0 +1,204 @@
+/*****************************************************************************
+ *  Copyright (C) 2026 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  UCRL-CODE-2002-008.
+ *
+ *  This file is part of PowerMan, a remote power management program.
+ *  For details, see http://code.google.com/p/powerman/
+ *
+ *  PowerMan is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  PowerMan is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with PowerMan; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/* snmptrap.c - send an SNMP trap to 127.0.0.1 */
+
+/* Usage: snmptrap -p port [-1|-i] [-s addr] [-c community] trapoid
+ *                 [oid type value]...
+ * Sends a v2c trap (or with -1 a v1 trap, or with -i an inform, which is
+ * waited for and reported on stderr) from addr, default 127.0.0.1, with
+ * community, default "public".  For
+ * v1, trapoid must be of the form enterprise.0.specific, or one of the
+ * generic traps 1.3.6.1.6.3.1.1.5.<1-6>.  Types are as in snmpset(1).
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ber.h"
+
+#define COMMUNITY   "public"
+#define UPTIME      4242
+#define GENERIC_OID "1.3.6.1.6.3.1.1.5."
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: snmptrap -p port [-1|-i] [-s addr] "
+                    "[-c community] trapoid [oid type value]...\n");
+    exit(1);
+}
+
+/* Encode a v1 Trap-PDU message for trapoid with varbind list vbl.
+ */
+static int encode_trap1(BerBuf *msg, const char *community,
+                        const char *trapoid, BerBuf *vbl)
+{
+    char enterprise[BER_MAX_STR];
+    unsigned char ip[4] = { 127, 0, 0, 1 };
+    long generic, specific = 0;
+    char *p;
+    int pdu;
+
+    if (strncmp(trapoid, GENERIC_OID, strlen(GENERIC_OID)) == 0) {
+        strcpy(enterprise, "1.3.6.1.4.1.318");
+        generic = atoi(trapoid + strlen(GENERIC_OID)) - 1;
+    } else {
+        if (strlen(trapoid) >= sizeof(enterprise)
+                || !(p = strstr(trapoid, ".0.")))
+            return -1;
+        memcpy(enterprise, trapoid, p - trapoid);
+        enterprise[p - trapoid] = '\0';
+        generic = 6;
+        specific = atol(p + 3);
+    }
+    ber_put_int(msg, BER_INTEGER, SNMP_V1);
+    ber_put_str(msg, BER_OCTET_STRING, community, strlen(community));
+    pdu = msg->len;
+    if (ber_put_oid(msg, enterprise) < 0)
+        return -1;
+    ber_put_str(msg, BER_IPADDRESS, ip, 4);
+    ber_put_int(msg, BER_INTEGER, generic);
+    ber_put_int(msg, BER_INTEGER, specific);
+    ber_put_uint(msg, BER_TIMETICKS, UPTIME);
+    ber_put_str(msg, BER_SEQUENCE, vbl->data, vbl->len);
+    ber_wrap(msg, SNMP_TRAP, pdu);
+    ber_wrap(msg, BER_SEQUENCE, 0);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static unsigned char buf[65536];
+    struct sockaddr_in addr;
+    char *src = "127.0.0.1";
+    char *community = COMMUNITY;
+    int port = 0, version = SNMP_V2C, type = SNMP_TRAP2;
+    int fd, c, i;
+    BerBuf vbl, msg;
+
+    while ((c = getopt(argc, argv, "p:1is:c:")) != -1) {
+        switch (c) {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case '1':
+            version = SNMP_V1;
+            type = SNMP_TRAP;
+            break;
+        case 'i':
+            type = SNMP_INFORM;
+            break;
+        case 's':
+            src = optarg;
+            break;
+        case 'c':
+            community = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (port < 1 || port > 65535 || optind >= argc
+            || (argc - optind - 1) % 3 != 0)
+        usage();
+
+    ber_init(&vbl);
+    if (version == SNMP_V2C) {
+        char uptime[16];
+
+        sprintf(uptime, "%d", UPTIME);
+        ber_put_varbind(&vbl, "1.3.6.1.2.1.1.3.0", 't', uptime);
+        if (ber_put_varbind(&vbl, "1.3.6.1.6.3.1.1.4.1.0", 'o',
+                            argv[optind]) < 0)
+            usage();
+    }
+    for (i = optind + 1; i < argc; i += 3) {
+        if (strlen(argv[i + 1]) != 1
+                || ber_put_varbind(&vbl, argv[i], argv[i + 1][0],
+                                   argv[i + 2]) < 0)
+            usage();
+    }
+    ber_init(&msg);
+    if (version == SNMP_V1) {
+        if (encode_trap1(&msg, community, argv[optind], &vbl) < 0)
+            usage();
+    } else
+        snmp_encode(&msg, version, community, type, 1, 0, 0, &vbl);
+
+    if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        perror("socket");
+        exit(1);
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr(src);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        exit(1);
+    }
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if (sendto(fd, msg.data, msg.len, 0, (struct sockaddr *)&addr,
+               sizeof(addr)) < 0) {
+        perror("sendto");
+        exit(1);
+    }
+    if (type == SNMP_INFORM) {
+        struct pollfd pfd;
+        char rcommunity[BER_MAX_STR];
+        const unsigned char *rvbl;
+        int n, rvblen, rversion, rtype;
+        long reqid, err, idx;
+
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 5000) <= 0
+                || (n = recv(fd, buf, sizeof(buf), 0)) < 0
+                || snmp_decode(buf, n, &rversion, rcommunity,
+                               sizeof(rcommunity), &rtype, &reqid, &err,
+                               &idx, &rvbl, &rvblen) < 0
+                || rtype != SNMP_RESPONSE || reqid != 1) {
+            fprintf(stderr, "snmptrap: no response to inform\n");
+            exit(1);
+        }
+        fprintf(stderr, "snmptrap: inform acknowledged\n");
+    }
+    ber_free(&msg);
+    ber_free(&vbl);
+    close(fd);
+    return 0;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -38,7 +38,9 @@
 #include <stdarg.h>
 #include <libgen.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
 #include <netdb.h>
+#include <fcntl.h>
 
 #include "xmalloc.h"
 #include "xread.h"
@@ -50,20 +52,28 @@ static void _spew_one(int linenum);
 static void _spew(int lines);
 static void _prompt_loop(void);
 static void _setup_socket(char *port);
+static int _get_plug(int i);
+static void _set_plug(int i, int val);
 
 #define NUM_PLUGS   16
 static int plug[NUM_PLUGS];
 static int beacon[NUM_PLUGS];
 static int temp[NUM_PLUGS];
 static int logged_in = 0;
+static int drop_one = 0;    /* ignore the first command after login */
+static int linger = 0;      /* seconds to ignore SIGTERM before exiting */
+static int state_fd = -1;   /* plug state shared with other vpcds */
 
 static char *prog;
 
-#define OPTIONS "p:"
+#define OPTIONS "p:o:l:s:"
 #if HAVE_GETOPT_LONG
 #define GETOPT(ac,av,opt,lopt) getopt_long(ac,av,opt,lopt,NULL)
 static const struct option longopts[] = {
     {"port", required_argument, 0, 'p'},
+    {"drop-once", required_argument, 0, 'o'},
+    {"linger", required_argument, 0, 'l'},
+    {"state", required_argument, 0, 's'},
     {0, 0, 0, 0},
 };
 #else
@@ -83,6 +93,19 @@ main(int argc, char *argv[])
             case 'p':   /* --port n */
                 port = xstrdup(optarg);
                 break;
+            case 'o':   /* --drop-once file */
+                if (unlink(optarg) == 0)
+                    drop_one = 1;
+                break;
+            case 'l':   /* --linger secs */
+                linger = strtoul(optarg, NULL, 10);
+                break;
+            case 's':   /* --state file */
+                if ((state_fd = open(optarg, O_RDWR | O_CREAT, 0644)) < 0) {
+                    perror(optarg);
+                    exit(1);
+                }
+                break;
             default:
                 usage();
         }
@@ -95,6 +118,12 @@ main(int argc, char *argv[])
         exit(1);
     }
 
+    if (linger > 0 && (signal(SIGTERM, SIG_IGN) == SIG_ERR
+                    || signal(SIGHUP, SIG_IGN) == SIG_ERR)) {
+        perror("signal");
+        exit(1);
+    }
+
     if (port)
         _setup_socket(port);
 
@@ -105,6 +134,8 @@ main(int argc, char *argv[])
     }
     _prompt_loop();
 
+    if (linger > 0)
+        sleep(linger);
     exit(0);
 }
 
@@ -121,6 +152,39 @@ _noop_handler(int signum)
     fprintf(stderr, "%s: received signal %d\n", prog, signum);
 }
 
+/* Plug state is kept in the state file if there is one, one byte per
+ * plug, so that several vpcds can play sessions to the same device.
+ * Missing bytes read as off.
+ */
+static int
+_get_plug(int i)
+{
+    char c = 0;
+
+    if (state_fd < 0)
+        return plug[i];
+    if (pread(state_fd, &c, 1, i) < 0) {
+        perror("pread");
+        exit(1);
+    }
+    return c;
+}
+
+static void
+_set_plug(int i, int val)
+{
+    char c = val;
+
+    if (state_fd < 0) {
+        plug[i] = val;
+        return;
+    }
+    if (pwrite(state_fd, &c, 1, i) < 0) {
+        perror("pwrite");
+        exit(1);
+    }
+}
+
 /* Return with stdin/stdout reopened as a connected socket.
  */
 #define LISTEN_BACKLOG 5
@@ -135,9 +199,11 @@ _setup_socket(char *serv)
     socklen_t addr_size;
     short flags;
 
-    /* get addresses to listen on for this port */
+    /* get addresses to listen on for this port (port 0: one IPv4 port
+     * chosen by the system, so tests need not pick one)
+     */
     memset(&hints, 0, sizeof(hints));
-    hints.ai_family = PF_UNSPEC;
+    hints.ai_family = strcmp(serv, "0") == 0 ? PF_INET : PF_UNSPEC;
     hints.ai_socktype = SOCK_STREAM;
     hints.ai_flags = AI_PASSIVE;
     if ((error = getaddrinfo(NULL, serv, &hints, &res))) {
@@ -192,6 +258,19 @@ _setup_socket(char *serv)
         fprintf(stderr, "%s: %s\n", what, strerror(saved_errno));
         exit(1);
     }
+    if (strcmp(serv, "0") == 0) {
+        struct sockaddr_in sin;
+        socklen_t sin_size = sizeof(sin);
+
+        for (i = 0; fds[i] == -1; i++)
+            ;
+        if (getsockname(fds[i], (struct sockaddr *)&sin, &sin_size) < 0) {
+            fprintf(stderr, "getsockname: %s\n", strerror(errno));
+            exit(1);
+        }
+        printf("%d\n", ntohs(sin.sin_port));
+        fflush(stdout);
+    }
 
     /* accept a connection on 'fd' */
     pfd = xpollfd_create();
@@ -294,17 +373,21 @@ _prompt_loop(void)
             printf("%d Please login\n", seq);
             continue;
         }
+        if (drop_one) {                                 /* no response */
+            drop_one = 0;
+            continue;
+        }
         if (sscanf(buf, "stat %d", &i) == 1) {         /* stat <plugnum> */
             if (i < 0 || i >= NUM_PLUGS) {
                 printf("%d BADVAL: %d\n", seq, i);
                 continue;
             }
-            printf("plug %d: %s\n", i, plug[i] ? "ON" : "OFF");
+            printf("plug %d: %s\n", i, _get_plug(i) ? "ON" : "OFF");
             goto ok;
         }
         if (strcmp(buf, "stat *") == 0) {               /* stat * */
             for (i = 0; i < NUM_PLUGS; i++)
-                printf("plug %d: %s\n", i, plug[i] ? "ON" : "OFF");
+                printf("plug %d: %s\n", i, _get_plug(i) ? "ON" : "OFF");
             goto ok;
         }
         if (sscanf(buf, "beacon %d", &i) == 1) {       /* beacon <plugnum> */
@@ -345,7 +428,7 @@ _prompt_loop(void)
                 printf("%d BADVAL: %d\n", seq, i);
                 continue;
             }
-            plug[i] = 1;
+            _set_plug(i, 1);
             goto ok;
         }
         if (sscanf(buf, "off %d", &i) == 1) {          /* off <plugnum> */
@@ -353,7 +436,7 @@ _prompt_loop(void)
                 printf("%d BADVAL: %d\n", seq, i);
                 continue;
             }
-            plug[i] = 0;
+            _set_plug(i, 0);
             goto ok;
         }
         if (sscanf(buf, "flash %d", &i) == 1) {        /* flash <plugnum> */
@@ -374,12 +457,12 @@ _prompt_loop(void)
         }
         if (strcmp(buf, "on *") == 0) {                 /* on * */
             for (i = 0; i < NUM_PLUGS; i++)
-                plug[i] = 1;
+                _set_plug(i, 1);
             goto ok;
         }
         if (strcmp(buf, "off *") == 0) {                /* off * */
             for (i = 0; i < NUM_PLUGS; i++)
-                plug[i] = 0;
+                _set_plug(i, 0);
             goto ok;
         }
         if (sscanf(buf, "reset %d", &i) == 1) {         /* reset <plugnum> */